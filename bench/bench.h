@@ -0,0 +1,280 @@
+#ifndef MAOWN_BENCH_H
+#define MAOWN_BENCH_H
+/*
+  Common helpers for the benchmarks.
+
+  Results are printed to stdout as one tab-separated record per line with the
+  fields named by `BENCH_HEADER`. Lines starting with '#' are comments. Fields
+  that do not apply to a record are printed as '-'.
+
+  For multi-threaded benchmarks, each thread performs `n` operations and the
+  time per operation is the elapsed wall-clock time divided by `n`, so it stays
+  constant if the benchmark scales perfectly.
+*/
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*!
+  @brief
+  The header line of the results.
+*/
+#define BENCH_HEADER \
+  "# benchmark\timplementation\toperation\tdistribution\tn\tthreads\tns_per_op\tbytes_per_entry\n"
+
+
+
+/*!
+  @brief
+  Get the current time from the monotonic clock.
+
+  @return
+  The time in nanoseconds.
+*/
+static inline uint64_t
+bench_now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+
+
+/*!
+  @brief
+  Get the number of bytes currently allocated on the heap.
+
+  @return
+  The number of bytes.
+*/
+static inline size_t
+bench_heap_bytes(void)
+{
+  struct mallinfo2 mi;
+  mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+
+
+/*!
+  @brief
+  Print the header line.
+*/
+static inline void
+bench_print_header(void)
+{
+  fputs(BENCH_HEADER, stdout);
+}
+
+
+
+/*!
+  @brief
+  Print a result of a multi-threaded benchmark.
+
+  @param
+  benchmark The name of the benchmark.
+
+  @param
+  implementation The implementation that was measured.
+
+  @param
+  operation The operation that was measured.
+
+  @param
+  distribution The distribution of the keys, or NULL.
+
+  @param
+  n The number of entries, or operations per thread.
+
+  @param
+  threads The number of threads.
+
+  @param
+  ns The elapsed time in nanoseconds, for `n` operations per thread.
+
+  @param
+  bytes The number of bytes used by all entries, or a negative number if it was
+  not measured.
+*/
+static inline void
+bench_report_threads(
+  const char * benchmark,
+  const char * implementation,
+  const char * operation,
+  const char * distribution,
+  unsigned long n,
+  unsigned int threads,
+  uint64_t ns,
+  double bytes
+)
+{
+  printf(
+    "%s\t%s\t%s\t%s\t%lu\t%u\t%.2f\t",
+    benchmark, implementation, operation,
+    (distribution == NULL) ? "-" : distribution,
+    n, threads, (double) ns / n
+  );
+  if (bytes < 0)
+  {
+    puts("-");
+  }
+  else
+  {
+    printf("%.2f\n", bytes / n);
+  }
+  fflush(stdout);
+}
+
+
+
+/*!
+  @brief
+  Print a result of a single-threaded benchmark.
+
+  @param
+  benchmark The name of the benchmark.
+
+  @param
+  implementation The implementation that was measured.
+
+  @param
+  operation The operation that was measured.
+
+  @param
+  distribution The distribution of the keys, or NULL.
+
+  @param
+  n The number of entries.
+
+  @param
+  ns The total time in nanoseconds, for `n` operations.
+
+  @param
+  bytes The number of bytes used by all entries, or a negative number if it was
+  not measured.
+*/
+static inline void
+bench_report(
+  const char * benchmark,
+  const char * implementation,
+  const char * operation,
+  const char * distribution,
+  unsigned long n,
+  uint64_t ns,
+  double bytes
+)
+{
+  bench_report_threads(benchmark, implementation, operation, distribution, n, 1, ns, bytes);
+}
+
+
+
+/*!
+  @brief
+  Generate a pseudo-random number (xorshift64*).
+
+  @param
+  state The non-zero generator state.
+
+  @return
+  The number.
+*/
+static inline uint64_t
+bench_rand(uint64_t * state)
+{
+  * state ^= * state >> 12;
+  * state ^= * state << 25;
+  * state ^= * state >> 27;
+  return * state * 0x2545F4914F6CDD1DULL;
+}
+
+
+
+/*!
+  @brief
+  Shuffle an array of integers.
+
+  @param
+  a The array.
+
+  @param
+  n The number of elements.
+
+  @param
+  state The generator state.
+*/
+static inline void
+bench_shuffle(int * a, size_t n, uint64_t * state)
+{
+  size_t i, j;
+  int tmp;
+  for (i=n; i>1; i--)
+  {
+    j = bench_rand(state) % i;
+    tmp = a[i-1];
+    a[i-1] = a[j];
+    a[j] = tmp;
+  }
+}
+
+
+
+/*!
+  @brief
+  Parse the sizes to benchmark from the command line.
+
+  @param
+  argc The number of arguments.
+
+  @param
+  argv The arguments. Each one is a size.
+
+  @param
+  defaults The sizes to use if none are given, terminated by 0.
+
+  @return
+  The sizes, terminated by 0. The array should be freed.
+*/
+static inline unsigned long *
+bench_sizes(int argc, char * * argv, const unsigned long * defaults)
+{
+  unsigned long * sizes;
+  int i;
+
+  if (argc > 1)
+  {
+    sizes = calloc(argc, sizeof(unsigned long));
+    if (sizes == NULL)
+    {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    for (i=1; i<argc; i++)
+    {
+      sizes[i-1] = strtoul(argv[i], NULL, 0);
+    }
+  }
+  else
+  {
+    for (i=0; defaults[i]; i++);
+    sizes = calloc(i + 1, sizeof(unsigned long));
+    if (sizes == NULL)
+    {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; defaults[i]; i++)
+    {
+      sizes[i] = defaults[i];
+    }
+  }
+  return sizes;
+}
+
+#endif //MAOWN_BENCH_H
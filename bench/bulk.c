@@ -0,0 +1,162 @@
+/*
+  Compare building watch descriptor trees from sorted arrays with the bulk
+  functions of rbt/node.h and with individual insertions.
+
+  The "merge" operation inserts the even watch descriptors into a tree that
+  already holds the odd ones. All trees are checked after they are built and
+  the program exits with an error if a check fails.
+
+  usage: bench_bulk [<n> ...]
+*/
+
+#include "watchlist.h"
+
+#include "bench.h"
+
+/*!
+  @brief
+  Check that a tree holds exactly the watch descriptors from 1 to n.
+
+  @param
+  operation The operation that built the tree.
+
+  @param
+  dict The tree.
+
+  @param
+  n The number of watch descriptors.
+*/
+void
+bench_bulk_check(const char * operation, wd_node_t * dict, unsigned long n)
+{
+  wd_node_iterator_t iterator;
+  wd_key_data_t * key_data;
+  unsigned long i, count;
+
+  count = 0;
+  for (
+    key_data = wd_node_iterator_begin(&iterator, dict, 0);
+    key_data != NULL;
+    key_data = wd_node_iterator_next(&iterator)
+  )
+  {
+    count ++;
+  }
+  wd_node_iterator_end(&iterator);
+  for (i=1; i<=n; i++)
+  {
+    if (wd_retrieve(dict, i).target == NULL)
+    {
+      break;
+    }
+  }
+  if (count != n || i <= n)
+  {
+    fprintf(stderr, "%s: found %lu entries, expected %lu\n", operation, count, n);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+
+/*!
+  @brief
+  Benchmark building a tree with n watch descriptors.
+
+  @param
+  n The number of watch descriptors.
+*/
+void
+bench_bulk(unsigned long n)
+{
+  wd_node_t * dict;
+  watchlist_data_t * values;
+  target_t target;
+  int * keys;
+  unsigned long i, half;
+  uint64_t t;
+  size_t heap;
+
+  keys = malloc(n * sizeof(int));
+  values = malloc(n * sizeof(watchlist_data_t));
+  if (keys == NULL || values == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<n; i++)
+  {
+    keys[i] = i + 1;
+    values[i].target = &target;
+    values[i].path = NULL;
+    values[i].dev = 0;
+  }
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  dict = wd_node_new();
+  for (i=0; i<n; i++)
+  {
+    wd_insert(dict, keys[i], values[i]);
+  }
+  t = bench_now_ns() - t;
+  bench_report("bulk", "rbt", "insert", "sequential", n, t, bench_heap_bytes() - heap);
+  bench_bulk_check("insert", dict, n);
+  wd_node_free(dict);
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  dict = wd_bulk_build(keys, values, n);
+  t = bench_now_ns() - t;
+  if (dict == NULL)
+  {
+    perror("wd_bulk_build");
+    exit(EXIT_FAILURE);
+  }
+  bench_report("bulk", "rbt", "build", "sequential", n, t, bench_heap_bytes() - heap);
+  bench_bulk_check("build", dict, n);
+  wd_node_free(dict);
+
+  /*
+    Split the keys into odd and even ones, each sorted.
+  */
+  half = n / 2;
+  for (i=0; i<n; i++)
+  {
+    keys[(i % 2) ? i / 2 : half + i / 2] = i + 1;
+  }
+  dict = wd_bulk_build(keys + half, values, n - half);
+  t = bench_now_ns();
+  wd_bulk_merge(dict, keys, values, half);
+  t = bench_now_ns() - t;
+  if (errno)
+  {
+    perror("wd_bulk_merge");
+    exit(EXIT_FAILURE);
+  }
+  bench_report("bulk", "rbt", "merge", "sequential", half, t, -1);
+  bench_bulk_check("merge", dict, n);
+  wd_node_free(dict);
+
+  free(values);
+  free(keys);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10000, 1000000, 10000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_bulk(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
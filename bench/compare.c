@@ -0,0 +1,388 @@
+/*
+  Compare the pin-by-pin key comparison with the word-wide comparison kernels
+  of rbt/key.h.
+
+  The common bit prefix of pairs of keys is measured for random integers and
+  for directory paths. The paths form a tree below a common root in which each
+  directory has up to 8 subdirectories. Sibling paths only differ in their last
+  component, random pairs usually differ earlier. Paths are compared in byte
+  pins, as in the target and watch indices, and in unsigned int pins, as in the
+  watch descriptor tree. The paths are also inserted into trees with byte pins
+  and retrieved to measure the effect on whole descents.
+
+  The results of both comparisons are checked against each other and the
+  program exits with an error if they differ.
+
+  usage: bench_compare [<n> ...]
+*/
+
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+#define RBT_KEY_SIZE_T unsigned int
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%lu", val)
+#define RBT_NODE_KEY_INLINE_PINS 4
+
+/*
+  Byte pins.
+*/
+#define RBT_PIN_T unsigned char
+#define RBT_KEY_PIN_COMPARISON
+#define RBT_KEY_H_PREFIX_ byte_pin_
+#include <rbt/key.h>
+#define RBT_NODE_H_PREFIX_ byte_pin_
+#define RBT_VALUE_T unsigned long
+#include <rbt/node.h>
+
+#undef RBT_KEY_PIN_COMPARISON
+#undef RBT_KEY_H_PREFIX_
+#undef RBT_NODE_H_PREFIX_
+#undef RBT_VALUE_T
+#define RBT_KEY_H_PREFIX_ byte_word_
+#include <rbt/key.h>
+#define RBT_NODE_H_PREFIX_ byte_word_
+#define RBT_VALUE_T unsigned long
+#include <rbt/node.h>
+
+/*
+  Unsigned int pins.
+*/
+#undef RBT_PIN_T
+#undef RBT_KEY_H_PREFIX_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_PIN_COMPARISON
+#define RBT_KEY_H_PREFIX_ int_pin_
+#include <rbt/key.h>
+
+#undef RBT_KEY_PIN_COMPARISON
+#undef RBT_KEY_H_PREFIX_
+#define RBT_KEY_H_PREFIX_ int_word_
+#include <rbt/key.h>
+
+/*!
+  @brief
+  The minimum number of comparisons per measurement.
+*/
+#define BENCH_COMPARE_MIN_OPS 1000000UL
+
+/*!
+  @brief
+  The size of the key buffers, in bytes.
+*/
+#define BENCH_COMPARE_KEY_SIZE 160
+
+/*!
+  @brief
+  The number of subdirectories of each directory.
+*/
+#define BENCH_COMPARE_FANOUT 8
+
+/*!
+  @brief
+  The common root of the paths.
+*/
+#define BENCH_COMPARE_ROOT "/home/user/projects/"
+
+/*!
+  @brief
+  Keys in both pin types.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The key in byte pins.
+  */
+  unsigned char bytes[BENCH_COMPARE_KEY_SIZE];
+
+  /*!
+    @brief
+    The key in unsigned int pins.
+  */
+  unsigned int ints[BENCH_COMPARE_KEY_SIZE / sizeof(unsigned int)];
+
+  /*!
+    @brief
+    The number of bits in the key.
+  */
+  unsigned int bits;
+}
+bench_key_t;
+
+
+
+/*!
+  @brief
+  Set a key from a byte string. The unsigned int pins hold the bytes in order
+  from the most significant one.
+*/
+void
+bench_compare_set(bench_key_t * key, const unsigned char * bytes, size_t length)
+{
+  size_t i;
+
+  memset(key, 0, sizeof(* key));
+  memcpy(key->bytes, bytes, length);
+  for (i=0; i<length; i++)
+  {
+    key->ints[i / sizeof(unsigned int)] |=
+      (unsigned int) bytes[i] << ((sizeof(unsigned int) - 1 - i % sizeof(unsigned int)) * BITS_PER_BYTE);
+  }
+  key->bits = length * BITS_PER_BYTE;
+}
+
+
+
+/*!
+  @brief
+  Measure m comparisons of n pairs of keys with one kernel. The sum of the
+  common prefix lengths is stored in `sum` for checking and the time in `ns`.
+*/
+#define BENCH_COMPARE_MEASURE(function, field, pairs, n, m, ns) \
+do \
+{ \
+  unsigned long _i, _j; \
+  uint64_t _t; \
+  sum = 0; \
+  _t = bench_now_ns(); \
+  for (_i=0, _j=0; _i<(m); _i++, _j = (_j + 1 == (n)) ? 0 : _j + 1) \
+  { \
+    sum += function( \
+      (pairs)[2 * _j]->field, \
+      (pairs)[2 * _j + 1]->field, \
+      MIN((pairs)[2 * _j]->bits, (pairs)[2 * _j + 1]->bits) \
+    ); \
+  } \
+  ns = bench_now_ns() - _t; \
+} while (0)
+
+
+
+/*!
+  @brief
+  Benchmark the comparison of n pairs of keys.
+
+  @param
+  pairs The pairs of keys, consecutively.
+
+  @param
+  n The number of pairs.
+
+  @param
+  distribution The name of the key distribution.
+*/
+void
+bench_compare_pairs(bench_key_t * * pairs, unsigned long n, const char * distribution)
+{
+  unsigned long m;
+  uint64_t ns, sum, expected;
+
+  m = (n < BENCH_COMPARE_MIN_OPS) ? BENCH_COMPARE_MIN_OPS : n;
+
+  BENCH_COMPARE_MEASURE(byte_pin_common_bit_prefix_len, bytes, pairs, n, m, ns);
+  bench_report("compare", "byte-pin", "prefix", distribution, m, ns, -1);
+  expected = sum;
+
+  BENCH_COMPARE_MEASURE(byte_word_common_bit_prefix_len, bytes, pairs, n, m, ns);
+  bench_report("compare", "byte-word", "prefix", distribution, m, ns, -1);
+  if (sum != expected)
+  {
+    fprintf(stderr, "byte pin and word comparisons differ (%s)\n", distribution);
+    exit(EXIT_FAILURE);
+  }
+
+  BENCH_COMPARE_MEASURE(int_pin_common_bit_prefix_len, ints, pairs, n, m, ns);
+  bench_report("compare", "int-pin", "prefix", distribution, m, ns, -1);
+  if (sum != expected)
+  {
+    fprintf(stderr, "byte and int pin comparisons differ (%s)\n", distribution);
+    exit(EXIT_FAILURE);
+  }
+
+  BENCH_COMPARE_MEASURE(int_word_common_bit_prefix_len, ints, pairs, n, m, ns);
+  bench_report("compare", "int-word", "prefix", distribution, m, ns, -1);
+  if (sum != expected)
+  {
+    fprintf(stderr, "int pin and word comparisons differ (%s)\n", distribution);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+
+/*!
+  @brief
+  Insert n paths into a tree. Both trees are built before either is measured
+  so that neither is allocated from the freed nodes of the other.
+*/
+#define BENCH_COMPARE_TREE_BUILD(prefix, tree, paths, n) \
+do \
+{ \
+  unsigned long _i; \
+  tree = prefix ## node_new(); \
+  for (_i=0; _i<(n); _i++) \
+  { \
+    prefix ## node_query(tree, (paths)[_i].bytes, (paths)[_i].bits, RBT_QUERY_ACTION_INSERT, _i + 1); \
+  } \
+} while (0)
+
+
+
+/*!
+  @brief
+  Benchmark retrieving n paths from a tree in the given order, then free the
+  tree.
+*/
+#define BENCH_COMPARE_TREE_RETRIEVE(prefix, name, tree, paths, n, order) \
+do \
+{ \
+  unsigned long _i, _errors; \
+  uint64_t _t; \
+  _errors = 0; \
+  _t = bench_now_ns(); \
+  for (_i=0; _i<(n); _i++) \
+  { \
+    _errors += prefix ## node_query( \
+      tree, (paths)[(order)[_i]].bytes, (paths)[(order)[_i]].bits, RBT_QUERY_ACTION_RETRIEVE, 0 \
+    ) != (unsigned long) (order)[_i] + 1; \
+  } \
+  _t = bench_now_ns() - _t; \
+  bench_report("compare", name, "retrieve", "paths", n, _t, -1); \
+  prefix ## node_free(tree); \
+  if (_errors) \
+  { \
+    fprintf(stderr, "%lu paths were not retrieved (%s)\n", _errors, name); \
+    exit(EXIT_FAILURE); \
+  } \
+} while (0)
+
+
+
+/*!
+  @brief
+  Benchmark n keys of each distribution.
+
+  @param
+  n The number of keys.
+*/
+void
+bench_compare(unsigned long n)
+{
+  unsigned char bytes[BENCH_COMPARE_KEY_SIZE];
+  bench_key_t * keys, * * pairs;
+  byte_pin_node_t * pin_tree;
+  byte_word_node_t * word_tree;
+  unsigned long i, j, parent;
+  uint32_t x, y;
+  uint64_t state;
+  int * order;
+  size_t length;
+
+  keys = malloc(2 * n * sizeof(bench_key_t));
+  pairs = malloc(2 * n * sizeof(bench_key_t *));
+  order = malloc(n * sizeof(int));
+  if (keys == NULL || pairs == NULL || order == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+
+  /*
+    Random integers, stored most significant byte first.
+  */
+  for (i=0; i<n; i++)
+  {
+    x = bench_rand(&state);
+    y = x ^ (0x80000000U >> (bench_rand(&state) % 32));
+    for (j=0; j<sizeof(x); j++)
+    {
+      bytes[j] = x >> ((sizeof(x) - 1 - j) * BITS_PER_BYTE);
+      bytes[sizeof(x) + j] = y >> ((sizeof(y) - 1 - j) * BITS_PER_BYTE);
+    }
+    bench_compare_set(keys + 2 * i, bytes, sizeof(x));
+    bench_compare_set(keys + 2 * i + 1, bytes + sizeof(x), sizeof(y));
+    pairs[2 * i] = keys + 2 * i;
+    pairs[2 * i + 1] = keys + 2 * i + 1;
+  }
+  bench_compare_pairs(pairs, n, "ints");
+
+  /*
+    The path tree, which reuses the keys.
+  */
+  for (i=0; i<n; i++)
+  {
+    if (i == 0)
+    {
+      length = snprintf((char *) bytes, sizeof(bytes), "%s", BENCH_COMPARE_ROOT);
+    }
+    else
+    {
+      parent = (i - 1) / BENCH_COMPARE_FANOUT;
+      length = snprintf(
+        (char *) bytes, sizeof(bytes), "%ssubdirectory-%lu/",
+        (char *) keys[parent].bytes, (i - 1) % BENCH_COMPARE_FANOUT
+      );
+    }
+    if (length >= BENCH_COMPARE_KEY_SIZE)
+    {
+      fprintf(stderr, "path %lu is too long\n", i);
+      exit(EXIT_FAILURE);
+    }
+    bench_compare_set(keys + i, bytes, length);
+    order[i] = i;
+  }
+
+  for (i=0; i<n; i++)
+  {
+    j = (i == 0) ? 0 : ((i - 1) ^ 1) + 1;
+    pairs[2 * i] = keys + i;
+    pairs[2 * i + 1] = keys + ((j < n) ? j : i);
+  }
+  bench_compare_pairs(pairs, n, "sibling-paths");
+
+  for (i=0; i<n; i++)
+  {
+    pairs[2 * i] = keys + i;
+    pairs[2 * i + 1] = keys + bench_rand(&state) % n;
+  }
+  bench_compare_pairs(pairs, n, "random-paths");
+
+  bench_shuffle(order, n, &state);
+  BENCH_COMPARE_TREE_BUILD(byte_pin_, pin_tree, keys, n);
+  BENCH_COMPARE_TREE_BUILD(byte_word_, word_tree, keys, n);
+  BENCH_COMPARE_TREE_RETRIEVE(byte_pin_, "byte-pin", pin_tree, keys, n, order);
+  BENCH_COMPARE_TREE_RETRIEVE(byte_word_, "byte-word", word_tree, keys, n, order);
+
+  free(order);
+  free(pairs);
+  free(keys);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1000, 100000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_compare(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/*
+  Compare rebuilding a tree key by key with loading a flat image of it from a
+  file with rbt/flat.h, and compare retrievals from the tree and from the
+  mapped image.
+
+  The "load" operation maps the image and checks it. Retrieved values are
+  compared and the program exits with an error if any differ.
+
+  usage: bench_flat [<n> ...]
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+#define RBT_KEY_H_PREFIX_ bench_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_NODE_H_PREFIX_ bench_
+#define RBT_VALUE_T unsigned long
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%lu", val)
+#define RBT_KEY_SIZE_FIXED sizeof(unsigned int)
+#define RBT_NODE_KEY_INLINE_PINS 1
+#define RBT_NODE_ARENA 0x10000
+#include <rbt/node.h>
+#include <rbt/flat.h>
+
+/*!
+  @brief
+  Benchmark a tree with n random keys.
+
+  @param
+  n The number of keys.
+*/
+void
+bench_flat(unsigned long n)
+{
+  bench_node_t * tree;
+  unsigned int * keys;
+  const unsigned long * value;
+  void * image;
+  char path[] = "/tmp/bench_flat.XXXXXX";
+  unsigned long i, sum, flat_sum;
+  uint64_t t, state;
+  size_t size, heap;
+  int fd;
+
+  keys = malloc(n * sizeof(unsigned int));
+  if (keys == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<n; i++)
+  {
+    keys[i] = i + 1;
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  bench_shuffle((int *) keys, n, &state);
+  for (i=0; i<n; i++)
+  {
+    keys[i] *= 0x9E3779B1U;
+  }
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  tree = bench_node_new();
+  for (i=0; i<n; i++)
+  {
+    bench_node_query(
+      tree, keys + i, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_INSERT, i + 1
+    );
+  }
+  t = bench_now_ns() - t;
+  bench_report("flat", "rbt", "insert", "random", n, t, bench_heap_bytes() - heap);
+
+  t = bench_now_ns();
+  image = bench_flat_serialize(tree, &size);
+  t = bench_now_ns() - t;
+  if (image == NULL)
+  {
+    perror("bench_flat_serialize");
+    exit(EXIT_FAILURE);
+  }
+  bench_report("flat", "image", "serialize", "random", n, t, size);
+
+  fd = mkstemp(path);
+  if (fd < 0 || write(fd, image, size) != (ssize_t) size)
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  free(image);
+  close(fd);
+
+  /*
+    The file is still in the page cache, as it would be after a restart.
+  */
+  t = bench_now_ns();
+  fd = open(path, O_RDONLY);
+  image = (fd < 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED || bench_flat_check(image, size))
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  t = bench_now_ns() - t;
+  bench_report("flat", "image", "load", "random", n, t, -1);
+  close(fd);
+  unlink(path);
+
+  sum = 0;
+  t = bench_now_ns();
+  for (i=n; i>0; i--)
+  {
+    sum += bench_node_query(
+      tree, keys + i - 1, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_RETRIEVE, 0
+    );
+  }
+  t = bench_now_ns() - t;
+  bench_report("flat", "rbt", "retrieve", "random", n, t, -1);
+
+  flat_sum = 0;
+  t = bench_now_ns();
+  for (i=n; i>0; i--)
+  {
+    value = bench_flat_retrieve(image, keys + i - 1, sizeof(unsigned int) * BITS_PER_BYTE, NULL);
+    if (value != NULL)
+    {
+      flat_sum += * value;
+    }
+  }
+  t = bench_now_ns() - t;
+  bench_report("flat", "image", "retrieve", "random", n, t, -1);
+
+  if (sum != flat_sum || sum != n * (n + 1) / 2)
+  {
+    fprintf(stderr, "sums differ: %lu (tree) %lu (image)\n", sum, flat_sum);
+    exit(EXIT_FAILURE);
+  }
+
+  munmap(image, size);
+  bench_node_free(tree);
+  free(keys);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10000, 1000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_flat(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/*
+  Compare full iteration over the watch descriptor tree with the traversal
+  callbacks of rbt/traverse_with_key.h, the iterators of the same header, and
+  `wd_foreach()`, which is built on the iterators.
+
+  Each pass sums the watch descriptors. The program exits with an error if the
+  sums differ from the expected value.
+
+  usage: bench_iterator [<n> ...]
+*/
+
+#include "watchlist.h"
+
+#include "bench.h"
+
+/*!
+  @brief
+  The minimum number of entries visited for each measurement. Small tables are
+  iterated repeatedly.
+*/
+#define BENCH_ITERATOR_VISITS 10000000UL
+
+/*!
+  @brief
+  `wd_node_traverse_with_key()` function to sum the watch descriptors.
+
+  The sum must be passed as the argument.
+*/
+int
+bench_iterator_callback(wd_key_data_t * key_data, wd_key_size_t height, va_list args)
+{
+  unsigned long * sum;
+  if (key_data->node->value.target == NULL)
+  {
+    return 0;
+  }
+  sum = va_arg(args, unsigned long *);
+  * sum += (unsigned int) (* key_data->key);
+  return 0;
+}
+
+/*!
+  @brief
+  `wd_foreach()` function to sum the watch descriptors.
+
+  The sum must be passed as the argument.
+*/
+static inline int
+bench_iterator_foreach(int wd, watchlist_data_t * data, void * sum)
+{
+  * (unsigned long *) sum += wd;
+  return 0;
+}
+
+/*!
+  @brief
+  Check a sum and exit on failure.
+*/
+static inline void
+bench_iterator_check(const char * operation, unsigned long sum, unsigned long expected)
+{
+  if (sum != expected)
+  {
+    fprintf(stderr, "%s: sum is %lu instead of %lu\n", operation, sum, expected);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*!
+  @brief
+  Benchmark iteration over a full table.
+
+  @param
+  n The number of watch descriptors.
+*/
+void
+bench_iterator(unsigned long n)
+{
+  wd_node_t * dict;
+  wd_node_iterator_t iterator;
+  wd_key_data_t * key_data;
+  watchlist_data_t data;
+  target_t target;
+  int * order;
+  unsigned long i, j, passes, sum, expected;
+  uint64_t t, state;
+
+  order = malloc(n * sizeof(int));
+  if (order == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<n; i++)
+  {
+    order[i] = i + 1;
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  bench_shuffle(order, n, &state);
+
+  data.target = &target;
+  data.path = NULL;
+  data.dev = 0;
+
+  dict = wd_node_new();
+  for (i=0; i<n; i++)
+  {
+    wd_insert(dict, order[i], data);
+  }
+  free(order);
+
+  passes = (BENCH_ITERATOR_VISITS + n - 1) / n;
+  expected = passes * (n * (n + 1) / 2);
+
+  sum = 0;
+  t = bench_now_ns();
+  for (j=0; j<passes; j++)
+  {
+    wd_node_traverse_with_key(dict, bench_iterator_callback, &sum);
+  }
+  t = bench_now_ns() - t;
+  bench_iterator_check("callback", sum, expected);
+  bench_report("iterator", "rbt", "callback", "random", n, t / passes, -1);
+
+  sum = 0;
+  t = bench_now_ns();
+  for (j=0; j<passes; j++)
+  {
+    for (
+      key_data = wd_node_iterator_begin(&iterator, dict, 0);
+      key_data != NULL;
+      key_data = wd_node_iterator_next(&iterator)
+    )
+    {
+      sum += (unsigned int) (* key_data->key);
+    }
+    wd_node_iterator_end(&iterator);
+  }
+  t = bench_now_ns() - t;
+  bench_iterator_check("iterator", sum, expected);
+  bench_report("iterator", "rbt", "iterator", "random", n, t / passes, -1);
+
+  sum = 0;
+  t = bench_now_ns();
+  for (j=0; j<passes; j++)
+  {
+    wd_foreach(dict, bench_iterator_foreach, &sum);
+  }
+  t = bench_now_ns() - t;
+  bench_iterator_check("foreach", sum, expected);
+  bench_report("iterator", "rbt", "foreach", "random", n, t / passes, -1);
+
+  wd_node_free(dict);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1000, 100000, 1000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_iterator(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
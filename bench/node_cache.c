@@ -0,0 +1,67 @@
+/*
+  Compare allocation without a node cache, with the global node cache and with
+  thread-local node caches while several threads insert and delete nodes in
+  trees of their own.
+
+  usage: bench_node_cache [<threads> ...]
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+/*!
+  @brief
+  The number of keys inserted and deleted by each thread per round.
+*/
+#define BENCH_CACHE_KEYS 0x1000
+
+/*!
+  @brief
+  The number of rounds per thread.
+*/
+#define BENCH_CACHE_ROUNDS 0x40
+
+pthread_mutex_t bench_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define RBT_NODE_CACHE_LOCK pthread_mutex_lock(&bench_cache_mutex);
+#define RBT_NODE_CACHE_UNLOCK pthread_mutex_unlock(&bench_cache_mutex);
+
+#define BENCH_CACHE_PREFIX_ malloc_
+#define BENCH_CACHE_IMPL "malloc"
+#define BENCH_CACHE_FUNCTION bench_node_cache_malloc
+#include "node_cache_template.h"
+
+#define RBT_NODE_CACHE_SIZE 0
+#define BENCH_CACHE_PREFIX_ global_
+#define BENCH_CACHE_IMPL "global"
+#define BENCH_CACHE_FUNCTION bench_node_cache_global
+#include "node_cache_template.h"
+
+#define RBT_NODE_CACHE_SIZE 0
+#define RBT_NODE_CACHE_BATCH 0x40
+#define BENCH_CACHE_PREFIX_ local_
+#define BENCH_CACHE_IMPL "thread-local"
+#define BENCH_CACHE_FUNCTION bench_node_cache_local
+#include "node_cache_template.h"
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1, 2, 4, 8, 16, 32, 0};
+  unsigned long * threads;
+  int i;
+
+  threads = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; threads[i]; i++)
+  {
+    bench_node_cache_malloc(threads[i]);
+    bench_node_cache_global(threads[i]);
+    bench_node_cache_local(threads[i]);
+  }
+  free(threads);
+  return EXIT_SUCCESS;
+}
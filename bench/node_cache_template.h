@@ -0,0 +1,134 @@
+/*
+  Contention benchmark of a rabbit tree node cache configuration. This is
+  included once for each configuration with the following macros defined:
+
+  - BENCH_CACHE_PREFIX_: the prefix of the rabbit tree instantiation
+  - BENCH_CACHE_IMPL: the name of the configuration, as a string
+  - BENCH_CACHE_FUNCTION: the name of the benchmark function
+
+  The cache itself is configured with `RBT_NODE_CACHE_SIZE` and
+  `RBT_NODE_CACHE_BATCH`, which are undefined again afterwards.
+*/
+
+#undef RBT_KEY_H_PREFIX_
+#undef RBT_PIN_T
+#undef RBT_KEY_SIZE_T
+#undef RBT_KEY_SIZE_T_FORMAT
+#define RBT_KEY_H_PREFIX_ BENCH_CACHE_PREFIX_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#undef RBT_NODE_H_PREFIX_
+#undef RBT_VALUE_T
+#undef RBT_VALUE_NULL
+#undef RBT_VALUE_IS_EQUAL
+#undef RBT_VALUE_COPY
+#undef RBT_VALUE_FREE
+#undef RBT_VALUE_FPRINT
+#define RBT_NODE_H_PREFIX_ BENCH_CACHE_PREFIX_
+#define RBT_VALUE_T int
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%d", val)
+#include <rbt/node.h>
+
+
+
+/*!
+  @brief
+  Repeatedly fill and empty a tree of the thread's own.
+
+  @param
+  arg The seed of the thread's keys.
+*/
+void *
+RBT_TOKEN_2_W(BENCH_CACHE_PREFIX_, bench_thread)(void * arg)
+{
+  RBT_NODE_T * root;
+  unsigned int keys[BENCH_CACHE_KEYS];
+  uint64_t state;
+  int i, round;
+
+  state = * (uint64_t *) arg;
+  for (i=0; i<BENCH_CACHE_KEYS; i++)
+  {
+    keys[i] = bench_rand(&state);
+  }
+  root = RBT_NODE_NEW();
+  for (round=0; round<BENCH_CACHE_ROUNDS; round++)
+  {
+    for (i=0; i<BENCH_CACHE_KEYS; i++)
+    {
+      RBT_NODE_QUERY(root, keys + i, sizeof(unsigned int) * BITS_PER_BYTE, RBT_QUERY_ACTION_INSERT, 1);
+    }
+    for (i=0; i<BENCH_CACHE_KEYS; i++)
+    {
+      RBT_NODE_QUERY(root, keys + i, sizeof(unsigned int) * BITS_PER_BYTE, RBT_QUERY_ACTION_DELETE, 0);
+    }
+  }
+  RBT_NODE_FREE(root);
+#ifdef RBT_NODE_CACHE_BATCH
+  RBT_NODE_CACHE_FLUSH();
+#endif //RBT_NODE_CACHE_BATCH
+  return NULL;
+}
+
+
+
+/*!
+  @brief
+  Run the benchmark with the given number of threads.
+
+  @param
+  threads The number of threads.
+*/
+void
+BENCH_CACHE_FUNCTION(unsigned int threads)
+{
+  pthread_t * thread_ids;
+  uint64_t * seeds;
+  uint64_t t;
+  unsigned int i;
+
+  thread_ids = malloc(threads * sizeof(pthread_t));
+  seeds = malloc(threads * sizeof(uint64_t));
+  if (thread_ids == NULL || seeds == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  t = bench_now_ns();
+  for (i=0; i<threads; i++)
+  {
+    seeds[i] = 0x9E3779B97F4A7C15ULL * (i + 1);
+    if (pthread_create(thread_ids + i, NULL, RBT_TOKEN_2_W(BENCH_CACHE_PREFIX_, bench_thread), seeds + i))
+    {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i=0; i<threads; i++)
+  {
+    pthread_join(thread_ids[i], NULL);
+  }
+  t = bench_now_ns() - t;
+  bench_report_threads(
+    "node_cache", BENCH_CACHE_IMPL, "insert+delete", "random",
+    2UL * BENCH_CACHE_KEYS * BENCH_CACHE_ROUNDS, threads, t, -1
+  );
+#ifdef RBT_NODE_CACHE_SIZE
+  RBT_NODE_CACHE_FREE();
+#endif //RBT_NODE_CACHE_SIZE
+  free(seeds);
+  free(thread_ids);
+}
+
+#undef RBT_NODE_CACHE_SIZE
+#undef RBT_NODE_CACHE_BATCH
+#undef BENCH_CACHE_PREFIX_
+#undef BENCH_CACHE_IMPL
+#undef BENCH_CACHE_FUNCTION
@@ -0,0 +1,370 @@
+/*
+  Compare readers of a persistent rabbit tree with readers of a tree guarded by
+  the reader-writer lock of rbt/concurrency/node_pthread.h while a single writer
+  modifies the tree.
+
+  The writer toggles random keys and the readers retrieve random keys until the
+  writer is done. The writer's time per update shows how long it is held up by
+  readers; the readers' time per lookup shows how long they are held up by the
+  writer. Retrieved values are checked against their keys and the program exits
+  with an error if any check fails.
+
+  usage: bench_node_persistent [<readers> ...]
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+/*!
+  @brief
+  The number of keys.
+*/
+#define BENCH_PERSISTENT_KEYS 0x10000
+
+/*!
+  @brief
+  The number of updates by the writer.
+*/
+#define BENCH_PERSISTENT_UPDATES 0x20000
+
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%u", val)
+
+#define RBT_KEY_H_PREFIX_ locked_
+#include <rbt/key.h>
+#define RBT_CONCURRENCY_PTHREAD
+#define RBT_NODE_H_PREFIX_ locked_
+#define RBT_VALUE_T unsigned int
+#include <rbt/node.h>
+#undef RBT_CONCURRENCY_PTHREAD
+
+#undef RBT_KEY_H_PREFIX_
+#define RBT_KEY_H_PREFIX_ persistent_
+#include <rbt/key.h>
+#define RBT_CONCURRENCY_PERSISTENT
+#undef RBT_NODE_H_PREFIX_
+#undef RBT_VALUE_T
+#define RBT_NODE_H_PREFIX_ persistent_
+#define RBT_VALUE_T unsigned int
+#include <rbt/node.h>
+
+/*!
+  @brief
+  The shared state of a benchmark run.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The locked tree, or NULL.
+  */
+  locked_node_root_t * locked;
+
+  /*!
+    @brief
+    The persistent tree, or NULL.
+  */
+  persistent_node_persistent_t * persistent;
+
+  /*!
+    @brief
+    Set when the writer is done.
+  */
+  int done;
+
+  /*!
+    @brief
+    The number of failed checks.
+  */
+  unsigned long errors;
+
+  /*!
+    @brief
+    The number of lookups by all readers.
+  */
+  unsigned long reads;
+}
+bench_persistent_t;
+
+
+
+/*!
+  @brief
+  Map a key index to a key.
+*/
+static inline unsigned int
+bench_persistent_key(unsigned int i)
+{
+  return (i + 1) * 0x9E3779B1U;
+}
+
+
+
+/*!
+  @brief
+  Retrieve random keys until the writer is done.
+
+  @param
+  arg The shared state.
+*/
+void *
+bench_persistent_reader(void * arg)
+{
+  bench_persistent_t * b;
+  persistent_node_persistent_reader_t * reader;
+  persistent_node_t * snapshot;
+  unsigned long n, errors;
+  unsigned int i, key, value;
+  uint64_t state;
+
+  b = arg;
+  reader = NULL;
+  if (b->persistent != NULL)
+  {
+    reader = persistent_node_persistent_reader_new(b->persistent);
+    if (reader == NULL)
+    {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  state = (uintptr_t) &state | 1;
+  n = errors = 0;
+  while (! __atomic_load_n(&b->done, __ATOMIC_RELAXED))
+  {
+    i = bench_rand(&state) % BENCH_PERSISTENT_KEYS;
+    key = bench_persistent_key(i);
+    if (reader != NULL)
+    {
+      snapshot = persistent_node_persistent_read_begin(b->persistent, reader);
+      value = persistent_node_query(
+        snapshot, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+      persistent_node_persistent_read_end(reader);
+    }
+    else
+    {
+      locked_node_root_read_lock(b->locked);
+      value = locked_node_query(
+        b->locked->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+      locked_node_root_read_unlock(b->locked);
+    }
+    if (value != 0 && value != i + 1)
+    {
+      errors ++;
+    }
+    n ++;
+  }
+  if (reader != NULL)
+  {
+    persistent_node_persistent_reader_free(b->persistent, reader);
+  }
+  __atomic_add_fetch(&b->reads, n, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&b->errors, errors, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+
+
+/*!
+  @brief
+  Insert or delete a key.
+
+  @param
+  b The shared state.
+
+  @param
+  i The index of the key.
+
+  @param
+  insert Non-zero to insert the key, otherwise delete it.
+*/
+static inline void
+bench_persistent_update(bench_persistent_t * b, unsigned int i, int insert)
+{
+  unsigned int key;
+
+  key = bench_persistent_key(i);
+  if (b->persistent != NULL)
+  {
+    persistent_node_persistent_query(
+      b->persistent, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_INSERT, insert ? i + 1 : 0
+    );
+  }
+  else
+  {
+    locked_node_root_write_lock(b->locked);
+    locked_node_query(
+      b->locked->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_INSERT, insert ? i + 1 : 0
+    );
+    locked_node_root_write_unlock(b->locked);
+  }
+}
+
+
+
+/*!
+  @brief
+  Run the benchmark.
+
+  @param
+  readers The number of reader threads.
+
+  @param
+  persistent Non-zero to use the persistent tree, otherwise the locked tree.
+
+  @return
+  The number of failed checks.
+*/
+unsigned long
+bench_persistent(unsigned int readers, int persistent)
+{
+  bench_persistent_t b;
+  pthread_t * thread_ids;
+  unsigned char * present;
+  uint64_t state, t;
+  unsigned int i, n, key, value;
+  const char * impl;
+
+  b.locked = NULL;
+  b.persistent = NULL;
+  if (persistent)
+  {
+    b.persistent = persistent_node_persistent_new();
+    impl = "persistent";
+  }
+  else
+  {
+    b.locked = locked_node_root_new();
+    impl = "rwlock";
+  }
+  b.done = 0;
+  b.errors = 0;
+  b.reads = 0;
+  thread_ids = malloc(readers * sizeof(pthread_t));
+  present = calloc(BENCH_PERSISTENT_KEYS, 1);
+  if ((b.locked == NULL && b.persistent == NULL) || thread_ids == NULL || present == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i=0; i<BENCH_PERSISTENT_KEYS; i+=2)
+  {
+    bench_persistent_update(&b, i, 1);
+    present[i] = 1;
+  }
+
+  for (i=0; i<readers; i++)
+  {
+    if (pthread_create(thread_ids + i, NULL, bench_persistent_reader, &b))
+    {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  t = bench_now_ns();
+  for (n=0; n<BENCH_PERSISTENT_UPDATES; n++)
+  {
+    i = bench_rand(&state) % BENCH_PERSISTENT_KEYS;
+    present[i] = ! present[i];
+    bench_persistent_update(&b, i, present[i]);
+  }
+  t = bench_now_ns() - t;
+  __atomic_store_n(&b.done, 1, __ATOMIC_RELAXED);
+  for (i=0; i<readers; i++)
+  {
+    pthread_join(thread_ids[i], NULL);
+  }
+
+  bench_report_threads(
+    "node_persistent", impl, "write", "random",
+    BENCH_PERSISTENT_UPDATES, readers + 1, t, -1
+  );
+  if (readers)
+  {
+    bench_report_threads(
+      "node_persistent", impl, "read", "random",
+      b.reads / readers, readers + 1, t, -1
+    );
+  }
+
+  for (i=0; i<BENCH_PERSISTENT_KEYS; i++)
+  {
+    key = bench_persistent_key(i);
+    if (persistent)
+    {
+      value = persistent_node_query(
+        b.persistent->root, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+    }
+    else
+    {
+      value = locked_node_query(
+        b.locked->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+    }
+    if (value != (present[i] ? i + 1 : 0))
+    {
+      b.errors ++;
+    }
+  }
+
+  if (persistent)
+  {
+    persistent_node_persistent_free(b.persistent);
+  }
+  else
+  {
+    locked_node_root_free(b.locked);
+  }
+  free(present);
+  free(thread_ids);
+  return b.errors;
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1, 2, 4, 8, 0};
+  unsigned long * readers;
+  unsigned long errors;
+  int i;
+
+  readers = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  errors = 0;
+  for (i=0; readers[i]; i++)
+  {
+    errors += bench_persistent(readers[i], 0);
+    errors += bench_persistent(readers[i], 1);
+  }
+  free(readers);
+  if (errors)
+  {
+    fprintf(stderr, "error: %lu failed consistency checks\n", errors);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,347 @@
+/*
+  Stress and throughput benchmark of rabbit trees shared between threads with
+  the reader-writer-locked root of rbt/concurrency/node_pthread.h.
+
+  Each thread retrieves random keys from the whole tree and toggles random keys
+  of its own range, so the expected content of the tree is known at all times.
+  Retrieved values are checked against their keys while the threads run and the
+  entire tree is checked against the threads' records afterwards. The program
+  exits with an error if any check fails.
+
+  The same workload is also run with every operation serialized by a single
+  mutex for comparison.
+
+  usage: bench_node_pthread [<threads> ...]
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+/*!
+  @brief
+  The number of keys owned by each thread.
+*/
+#define BENCH_SHARED_KEYS 0x1000
+
+/*!
+  @brief
+  The number of operations per thread.
+*/
+#define BENCH_SHARED_OPS 0x40000
+
+#define RBT_CONCURRENCY_PTHREAD
+
+#define RBT_KEY_H_PREFIX_ shared_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_NODE_H_PREFIX_ shared_
+#define RBT_VALUE_T unsigned int
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%u", val)
+#include <rbt/node.h>
+
+/*!
+  @brief
+  The state of a benchmark thread.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The shared tree.
+  */
+  shared_node_root_t * root;
+
+  /*!
+    @brief
+    If not NULL, serialize all operations with this mutex instead of using the
+    reader-writer lock of the root.
+  */
+  pthread_mutex_t * mutex;
+
+  /*!
+    @brief
+    The index of the thread. It determines the range of owned keys.
+  */
+  unsigned int index;
+
+  /*!
+    @brief
+    The number of threads.
+  */
+  unsigned int threads;
+
+  /*!
+    @brief
+    The percentage of write operations.
+  */
+  unsigned int write_percent;
+
+  /*!
+    @brief
+    The generator state.
+  */
+  uint64_t state;
+
+  /*!
+    @brief
+    The presence of each owned key in the tree.
+  */
+  unsigned char present[BENCH_SHARED_KEYS];
+
+  /*!
+    @brief
+    The number of failed checks.
+  */
+  unsigned long errors;
+}
+bench_shared_thread_t;
+
+
+
+/*!
+  @brief
+  Map a key index to a key. The multiplier is odd so the mapping is a
+  bijection that scatters consecutive indices across the key space.
+*/
+static inline unsigned int
+bench_shared_key(unsigned int i)
+{
+  return (i + 1) * 0x9E3779B1U;
+}
+
+
+
+/*!
+  @brief
+  Run the operations of a thread.
+
+  @param
+  arg The thread state.
+*/
+void *
+bench_shared_thread(void * arg)
+{
+  bench_shared_thread_t * t;
+  unsigned int i, n, key, value, expected;
+  uint64_t r;
+
+  t = arg;
+  for (n=0; n<BENCH_SHARED_OPS; n++)
+  {
+    r = bench_rand(&t->state);
+    if ((r >> 32) % 100 < t->write_percent)
+    {
+      i = (r & 0xFFFFFFFF) % BENCH_SHARED_KEYS;
+      key = bench_shared_key(t->index * BENCH_SHARED_KEYS + i);
+      expected = t->present[i] ? t->index * BENCH_SHARED_KEYS + i + 1 : 0;
+      if (t->mutex != NULL)
+      {
+        pthread_mutex_lock(t->mutex);
+      }
+      else
+      {
+        shared_node_root_write_lock(t->root);
+      }
+      value = shared_node_query(
+        t->root->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+      shared_node_query(
+        t->root->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_INSERT,
+        t->present[i] ? 0 : t->index * BENCH_SHARED_KEYS + i + 1
+      );
+      if (t->mutex != NULL)
+      {
+        pthread_mutex_unlock(t->mutex);
+      }
+      else
+      {
+        shared_node_root_write_unlock(t->root);
+      }
+      if (value != expected)
+      {
+        t->errors ++;
+      }
+      t->present[i] = ! t->present[i];
+    }
+    else
+    {
+      i = (r & 0xFFFFFFFF) % (t->threads * BENCH_SHARED_KEYS);
+      key = bench_shared_key(i);
+      if (t->mutex != NULL)
+      {
+        pthread_mutex_lock(t->mutex);
+      }
+      else
+      {
+        shared_node_root_read_lock(t->root);
+      }
+      value = shared_node_query(
+        t->root->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+      if (t->mutex != NULL)
+      {
+        pthread_mutex_unlock(t->mutex);
+      }
+      else
+      {
+        shared_node_root_read_unlock(t->root);
+      }
+      if (value != 0 && value != i + 1)
+      {
+        t->errors ++;
+      }
+    }
+  }
+  return NULL;
+}
+
+
+
+/*!
+  @brief
+  Run the benchmark.
+
+  @param
+  threads The number of threads.
+
+  @param
+  write_percent The percentage of write operations.
+
+  @param
+  serialize If non-zero, serialize all operations with a mutex.
+
+  @return
+  The number of failed checks.
+*/
+unsigned long
+bench_shared(unsigned int threads, unsigned int write_percent, int serialize)
+{
+  shared_node_root_t * root;
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_t * thread_ids;
+  bench_shared_thread_t * states;
+  unsigned long errors;
+  uint64_t t;
+  unsigned int i, j, key, value;
+  char op[0x20];
+
+  root = shared_node_root_new();
+  thread_ids = malloc(threads * sizeof(pthread_t));
+  states = calloc(threads, sizeof(bench_shared_thread_t));
+  if (root == NULL || thread_ids == NULL || states == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+    Start with half of the keys in the tree.
+  */
+  for (i=0; i<threads; i++)
+  {
+    states[i].root = root;
+    states[i].mutex = serialize ? &mutex : NULL;
+    states[i].index = i;
+    states[i].threads = threads;
+    states[i].write_percent = write_percent;
+    states[i].state = 0x9E3779B97F4A7C15ULL * (i + 1);
+    for (j=0; j<BENCH_SHARED_KEYS; j+=2)
+    {
+      key = bench_shared_key(i * BENCH_SHARED_KEYS + j);
+      shared_node_query(
+        root->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_INSERT, i * BENCH_SHARED_KEYS + j + 1
+      );
+      states[i].present[j] = 1;
+    }
+  }
+
+  t = bench_now_ns();
+  for (i=0; i<threads; i++)
+  {
+    if (pthread_create(thread_ids + i, NULL, bench_shared_thread, states + i))
+    {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i=0; i<threads; i++)
+  {
+    pthread_join(thread_ids[i], NULL);
+  }
+  t = bench_now_ns() - t;
+  snprintf(op, sizeof(op), "query-w%u", write_percent);
+  bench_report_threads(
+    "node_pthread", serialize ? "mutex" : "rwlock", op, "random",
+    BENCH_SHARED_OPS, threads, t, -1
+  );
+
+  errors = 0;
+  for (i=0; i<threads; i++)
+  {
+    errors += states[i].errors;
+    for (j=0; j<BENCH_SHARED_KEYS; j++)
+    {
+      key = bench_shared_key(i * BENCH_SHARED_KEYS + j);
+      value = shared_node_query(
+        root->node, &key, sizeof(unsigned int) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_RETRIEVE, 0
+      );
+      if (value != (states[i].present[j] ? i * BENCH_SHARED_KEYS + j + 1 : 0))
+      {
+        errors ++;
+      }
+    }
+  }
+
+  shared_node_root_free(root);
+  free(states);
+  free(thread_ids);
+  return errors;
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1, 2, 4, 8, 16, 0};
+  const unsigned int write_percents[] = {1, 10, 50};
+  unsigned long * threads;
+  unsigned long errors;
+  int i, j;
+
+  threads = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  errors = 0;
+  for (i=0; threads[i]; i++)
+  {
+    for (j=0; j<(int) (sizeof(write_percents) / sizeof(write_percents[0])); j++)
+    {
+      errors += bench_shared(threads[i], write_percents[j], 1);
+      errors += bench_shared(threads[i], write_percents[j], 0);
+    }
+  }
+  free(threads);
+  if (errors)
+  {
+    fprintf(stderr, "error: %lu failed consistency checks\n", errors);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/*
+  Compare the memory used by the paths of the watch descriptor map with full
+  path strings and with the parent-linked entries of path_entry.h.
+
+  The n directories form a tree below a common root in which each directory
+  has up to 8 subdirectories, as in a deep source or home directory hierarchy.
+  The full paths are copied as the map's values did before the entries were
+  introduced. The entries are inserted into a map to measure the whole watch
+  table. Both representations are also timed when the full paths are needed,
+  i.e. copied or assembled into a buffer, and the assembled paths are checked.
+
+  usage: bench_path [<n> ...]
+*/
+
+#include "watchlist.h"
+
+#include "bench.h"
+
+/*!
+  @brief
+  The number of subdirectories of each directory.
+*/
+#define BENCH_PATH_FANOUT 8
+
+/*!
+  @brief
+  The common root of the directories.
+*/
+#define BENCH_PATH_ROOT "/home/user/projects"
+
+/*!
+  @brief
+  Benchmark the paths of n directories.
+
+  @param
+  n The number of directories.
+*/
+void
+bench_path(unsigned long n)
+{
+  char buffer[PATH_MAX + 1];
+  char name[32];
+  char * * paths, * * copies;
+  path_entry_t * * entries;
+  wd_node_t * dict;
+  watchlist_data_t data;
+  wd_memory_t memory;
+  target_t target;
+  unsigned long i, parent;
+  size_t heap, length, full_bytes;
+  uint64_t t;
+
+  paths = malloc(n * sizeof(char *));
+  copies = malloc(n * sizeof(char *));
+  entries = malloc(n * sizeof(path_entry_t *));
+  if (paths == NULL || copies == NULL || entries == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+    Generate the full paths, with trailing slashes, and the entries.
+  */
+  full_bytes = 0;
+  for (i=0; i<n; i++)
+  {
+    if (i == 0)
+    {
+      snprintf(buffer, sizeof(buffer), "%s/", BENCH_PATH_ROOT);
+      entries[i] = path_entry_new(NULL, BENCH_PATH_ROOT, strlen(BENCH_PATH_ROOT));
+    }
+    else
+    {
+      parent = (i - 1) / BENCH_PATH_FANOUT;
+      snprintf(name, sizeof(name), "subdirectory-%lu", (i - 1) % BENCH_PATH_FANOUT);
+      snprintf(buffer, sizeof(buffer), "%s%s/", paths[parent], name);
+      entries[i] = path_entry_new(entries[parent], name, strlen(name));
+    }
+    paths[i] = strdup(buffer);
+    if (paths[i] == NULL || entries[i] == NULL)
+    {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    full_bytes += strlen(buffer) + 1;
+  }
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    copies[i] = strdup(paths[i]);
+    if (copies[i] == NULL)
+    {
+      perror("strdup");
+      exit(EXIT_FAILURE);
+    }
+  }
+  t = bench_now_ns() - t;
+  bench_report("path", "full", "copy", "tree", n, t, bench_heap_bytes() - heap);
+  for (i=0; i<n; i++)
+  {
+    free(copies[i]);
+  }
+
+  /*
+    The entries were allocated along with the full paths, so measure them by
+    freeing and recreating them.
+  */
+  for (i=n; i>0; i--)
+  {
+    path_entry_unref(entries[i - 1]);
+  }
+  heap = bench_heap_bytes();
+  for (i=0; i<n; i++)
+  {
+    if (i == 0)
+    {
+      entries[i] = path_entry_new(NULL, BENCH_PATH_ROOT, strlen(BENCH_PATH_ROOT));
+    }
+    else
+    {
+      snprintf(name, sizeof(name), "subdirectory-%lu", (i - 1) % BENCH_PATH_FANOUT);
+      entries[i] = path_entry_new(entries[(i - 1) / BENCH_PATH_FANOUT], name, strlen(name));
+    }
+    if (entries[i] == NULL)
+    {
+      perror("path_entry_new");
+      exit(EXIT_FAILURE);
+    }
+  }
+  bench_report("path", "parent-linked", "create", "tree", n, 0, bench_heap_bytes() - heap);
+
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    length = path_entry_format(entries[i], buffer);
+    if (length == 0 || strcmp(buffer, paths[i]))
+    {
+      fprintf(stderr, "assembled path %s differs from %s\n", buffer, paths[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  t = bench_now_ns() - t;
+  bench_report("path", "parent-linked", "format", "tree", n, t, -1);
+
+  /*
+    The whole watch table, which takes references to the entries.
+  */
+  data.target = &target;
+  data.dev = 0;
+  heap = bench_heap_bytes();
+  dict = wd_node_new();
+  for (i=0; i<n; i++)
+  {
+    data.path = entries[i];
+    wd_insert(dict, i + 1, data);
+  }
+  bench_report("path", "parent-linked", "map", "tree", n, 0, bench_heap_bytes() - heap);
+  wd_memory(dict, &memory);
+  printf(
+    "# watch table: %zu watches, %zu map bytes, %zu path bytes (%zu with full paths)\n",
+    memory.entries, memory.map_bytes, memory.path_bytes, full_bytes
+  );
+
+  for (i=0; i<n; i++)
+  {
+    path_entry_unref(entries[i]);
+    free(paths[i]);
+  }
+  wd_node_free(dict);
+  free(entries);
+  free(copies);
+  free(paths);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10000, 1000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_path(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
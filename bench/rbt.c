@@ -0,0 +1,270 @@
+/*
+  Benchmark the basic operations of rabbit trees: insertion, retrieval,
+  traversal, copying, the set operations of rbt/set.h and deletion.
+
+  Integer keys use unsigned int pins and the arena, as the watch descriptor
+  tree does, with two distributions: sequential keys, as allocated for watch
+  descriptors, and random keys scattered over the 32-bit range. Path keys use
+  byte pins, as the target and watch indices do. The paths form a tree below a
+  common root in which each directory has up to 8 subdirectories and they are
+  inserted parents first, as found by a scan.
+
+  The first set holds n keys and the second set shares half of them. The times
+  of the set operations are per key of the first set. Results are checked and
+  the program exits with an error if a check fails.
+
+  The results are tab-separated with a header line. Comment lines start with
+  "#" and describe the build so that results of different builds can be
+  compared.
+
+  usage: bench_rbt [<n> ...]
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+/*
+  Integer keys, configured as the watch descriptor tree.
+*/
+#define RBT_KEY_H_PREFIX_ int_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_SET_H_PREFIX_ int_
+#define RBT_KEY_T unsigned int
+#define RBT_KEY_SIZE_FIXED sizeof(RBT_KEY_T)
+#define RBT_KEY_COUNT_BITS(key) (sizeof(RBT_KEY_T) * BITS_PER_BYTE)
+#define RBT_KEY_PTR(key) (&key)
+#define RBT_KEY_FPRINT(fd, key) fprintf(fd, "%u", key)
+#define RBT_NODE_KEY_INLINE_PINS 1
+#define RBT_NODE_ARENA 0x10000
+#include <rbt/set.h>
+
+/*
+  Path keys, configured as the target and watch indices.
+*/
+#undef RBT_KEY_H_PREFIX_
+#undef RBT_PIN_T
+#undef RBT_KEY_SIZE_T
+#undef RBT_KEY_SIZE_T_FORMAT
+#define RBT_KEY_H_PREFIX_ path_
+#define RBT_PIN_T unsigned char
+#define RBT_KEY_SIZE_T unsigned int
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#undef RBT_SET_H_PREFIX_
+#undef RBT_KEY_T
+#undef RBT_KEY_SIZE_FIXED
+#undef RBT_KEY_COUNT_BITS
+#undef RBT_KEY_PTR
+#undef RBT_KEY_FPRINT
+#undef RBT_NODE_KEY_INLINE_PINS
+#undef RBT_NODE_ARENA
+#define RBT_SET_H_PREFIX_ path_
+#define RBT_KEY_T char *
+#define RBT_KEY_COUNT_BITS(key) (strlen(key) * BITS_PER_BYTE)
+#define RBT_KEY_PTR(key) (key)
+#define RBT_KEY_FPRINT(fd, key) fprintf(fd, "%s", key)
+#define RBT_NODE_KEY_INLINE_PINS 4
+#include <rbt/set.h>
+
+/*!
+  @brief
+  The minimum number of entries visited by each traversal measurement. Small
+  trees are traversed repeatedly.
+*/
+#define BENCH_RBT_VISITS 10000000UL
+
+/*!
+  @brief
+  The number of subdirectories of each directory.
+*/
+#define BENCH_RBT_FANOUT 8
+
+/*!
+  @brief
+  The common root of the paths.
+*/
+#define BENCH_RBT_ROOT "/home/user/projects/"
+
+#define BENCH_RBT(name) int_ ## name
+#define BENCH_RBT_KEY_T unsigned int
+#define BENCH_RBT_IMPL "int"
+#define BENCH_RBT_FUNCTION bench_rbt_int
+#include "rbt_template.h"
+
+#define BENCH_RBT(name) path_ ## name
+#define BENCH_RBT_KEY_T char *
+#define BENCH_RBT_IMPL "path"
+#define BENCH_RBT_FUNCTION bench_rbt_path
+#include "rbt_template.h"
+
+
+
+/*!
+  @brief
+  Generate paths below a common root. The paths are stored consecutively in a
+  single buffer.
+
+  @param
+  n The number of paths.
+
+  @param
+  buffer The buffer, which must be freed along with the paths.
+
+  @return
+  The paths.
+*/
+char * *
+bench_rbt_paths(unsigned long n, char * * buffer)
+{
+  char * * paths;
+  size_t * offsets, size, used, length, prefix;
+  unsigned long i, parent;
+
+  paths = malloc(n * sizeof(char *));
+  offsets = malloc(n * sizeof(size_t));
+  size = 0x10000;
+  * buffer = malloc(size);
+  if (paths == NULL || offsets == NULL || * buffer == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+    The buffer may move while it grows, so the paths are located by their
+    offsets until it is complete.
+  */
+  used = 0;
+  for (i=0; i<n; i++)
+  {
+    parent = (i == 0) ? 0 : (i - 1) / BENCH_RBT_FANOUT;
+    prefix = (i == 0) ? 0 : strlen(* buffer + offsets[parent]);
+    length = (i == 0) ? strlen(BENCH_RBT_ROOT) : prefix + 3;
+    if (used + length + 1 > size)
+    {
+      size *= 2;
+      * buffer = realloc(* buffer, size);
+      if (* buffer == NULL)
+      {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (i == 0)
+    {
+      strcpy(* buffer, BENCH_RBT_ROOT);
+    }
+    else
+    {
+      memcpy(* buffer + used, * buffer + offsets[parent], prefix);
+      sprintf(* buffer + used + prefix, "d%lu/", (i - 1) % BENCH_RBT_FANOUT);
+    }
+    offsets[i] = used;
+    used += length + 1;
+  }
+  for (i=0; i<n; i++)
+  {
+    paths[i] = * buffer + offsets[i];
+  }
+  free(offsets);
+  return paths;
+}
+
+
+
+/*!
+  @brief
+  Benchmark n keys of each distribution.
+
+  @param
+  n The number of keys in each set.
+*/
+void
+bench_rbt(unsigned long n)
+{
+  unsigned int * keys;
+  char * * paths, * buffer;
+  int * order;
+  unsigned long i, total;
+  uint64_t state;
+
+  total = n + n / 2;
+  keys = malloc(total * sizeof(unsigned int));
+  order = malloc(n * sizeof(int));
+  if (keys == NULL || order == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  for (i=0; i<n; i++)
+  {
+    order[i] = i;
+  }
+  bench_shuffle(order, n, &state);
+
+  for (i=0; i<total; i++)
+  {
+    keys[i] = i + 1;
+  }
+  bench_rbt_int(keys, n, order, "sequential");
+
+  /*
+    The multiplier is odd, so the random keys are distinct.
+  */
+  for (i=0; i<total; i++)
+  {
+    keys[i] *= 0x9E3779B1U;
+  }
+  bench_rbt_int(keys, n, order, "random");
+  free(keys);
+
+  paths = bench_rbt_paths(total, &buffer);
+  bench_rbt_path(paths, n, order, "paths");
+  free(paths);
+  free(buffer);
+  free(order);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {1000, 10000, 100000, 1000000, 10000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  printf("# compiler: %s\n", __VERSION__);
+#if defined(BENCH_OPTIMIZATION)
+  printf("# optimization: %s\n", BENCH_OPTIMIZATION);
+#elif defined(__OPTIMIZE__)
+  printf("# optimization: on\n");
+#else
+  printf("# optimization: off\n");
+#endif // BENCH_OPTIMIZATION
+  printf(
+    "# traverse rows are averaged over repeated traversals of at least %lu "
+    "nodes in total; all other rows are single runs\n",
+    BENCH_RBT_VISITS
+  );
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_rbt(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
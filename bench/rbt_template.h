@@ -0,0 +1,169 @@
+/*
+  Benchmark of the operations of a rabbit tree set instantiation of rbt/set.h.
+  This is included once for each key type with the following macros defined:
+
+  - BENCH_RBT(name): the name with the prefix of the instantiation
+  - BENCH_RBT_KEY_T: the key type
+  - BENCH_RBT_IMPL: the name of the implementation, as a string
+  - BENCH_RBT_FUNCTION: the name of the benchmark function
+
+  The macros are undefined again afterwards.
+*/
+
+/*!
+  @brief
+  `BENCH_RBT(node_traverse)()` function to count the values.
+
+  The count must be passed as the argument.
+*/
+static int
+BENCH_RBT(bench_count)(BENCH_RBT(node_t) * node, BENCH_RBT(key_size_t) height, va_list args)
+{
+  if (node->value)
+  {
+    (* va_arg(args, unsigned long *)) ++;
+  }
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Benchmark insertion, retrieval, traversal, copying, set operations and
+  deletion of keys.
+
+  @param
+  keys The keys. The first set holds the first n keys in the order of
+  insertion, the second set holds the n keys from `n / 2`, so `n + n / 2` keys
+  are required.
+
+  @param
+  n The number of keys in each set.
+
+  @param
+  order The order of retrievals, a permutation of the first n indices.
+
+  @param
+  distribution The name of the key distribution.
+*/
+void
+BENCH_RBT_FUNCTION(
+  BENCH_RBT_KEY_T * keys,
+  unsigned long n,
+  int * order,
+  const char * distribution
+)
+{
+  BENCH_RBT(node_t) * a, * b, * c;
+  unsigned long i, m, count, errors;
+  uint64_t t;
+  size_t heap;
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  a = BENCH_RBT(node_new)();
+  for (i=0; i<n; i++)
+  {
+    BENCH_RBT(insert)(a, keys[i], (int) (i % INT_MAX) + 1);
+  }
+  t = bench_now_ns() - t;
+  if (a == NULL || errno)
+  {
+    perror(BENCH_RBT_IMPL);
+    exit(EXIT_FAILURE);
+  }
+  bench_report("rbt", BENCH_RBT_IMPL, "insert", distribution, n, t, bench_heap_bytes() - heap);
+
+  errors = 0;
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    errors += BENCH_RBT(retrieve)(a, keys[order[i]]) != (int) (order[i] % INT_MAX) + 1;
+  }
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "retrieve", distribution, n, t, -1);
+
+  /*
+    Small trees are traversed repeatedly. The time is reported per traversal
+    so that the row covers n nodes like the others. Unlike the other rows it
+    is thus an average over warm runs, which the output header notes.
+  */
+  m = (BENCH_RBT_VISITS + n - 1) / n;
+  count = 0;
+  t = bench_now_ns();
+  for (i=0; i<m; i++)
+  {
+    BENCH_RBT(node_traverse)(a, BENCH_RBT(bench_count), &count);
+  }
+  t = bench_now_ns() - t;
+  errors += count != m * n;
+  bench_report("rbt", BENCH_RBT_IMPL, "traverse", distribution, n, t / m, -1);
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  c = BENCH_RBT(node_copy)(a);
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "copy", distribution, n, t, bench_heap_bytes() - heap);
+  errors += BENCH_RBT(node_count)(c) != n;
+  BENCH_RBT(node_free)(c);
+
+  /*
+    The sets share half of their keys.
+  */
+  b = BENCH_RBT(node_new)();
+  for (i=n/2; i<n+n/2; i++)
+  {
+    BENCH_RBT(set_add)(b, keys[i]);
+  }
+
+  t = bench_now_ns();
+  c = BENCH_RBT(set_union)(a, b);
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "union", distribution, n, t, -1);
+  errors += BENCH_RBT(node_count)(c) != n + n / 2;
+  BENCH_RBT(node_free)(c);
+
+  t = bench_now_ns();
+  c = BENCH_RBT(set_intersection)(a, b);
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "intersection", distribution, n, t, -1);
+  errors += BENCH_RBT(node_count)(c) != n - n / 2;
+  BENCH_RBT(node_free)(c);
+
+  t = bench_now_ns();
+  c = BENCH_RBT(set_difference)(a, b);
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "difference", distribution, n, t, -1);
+  errors += BENCH_RBT(node_count)(c) != n / 2;
+  BENCH_RBT(node_free)(c);
+
+  t = bench_now_ns();
+  c = BENCH_RBT(set_exclusive_disjunction)(a, b);
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "xor", distribution, n, t, -1);
+  errors += BENCH_RBT(node_count)(c) != 2 * (n / 2);
+  BENCH_RBT(node_free)(c);
+  BENCH_RBT(node_free)(b);
+
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    BENCH_RBT(delete)(a, keys[i]);
+  }
+  t = bench_now_ns() - t;
+  bench_report("rbt", BENCH_RBT_IMPL, "delete", distribution, n, t, -1);
+  errors += BENCH_RBT(node_count)(a) != 0;
+  BENCH_RBT(node_free)(a);
+
+  if (errors)
+  {
+    fprintf(stderr, "%s: %lu failed checks (%s, %lu keys)\n", BENCH_RBT_IMPL, errors, distribution, n);
+    exit(EXIT_FAILURE);
+  }
+}
+
+#undef BENCH_RBT
+#undef BENCH_RBT_KEY_T
+#undef BENCH_RBT_IMPL
+#undef BENCH_RBT_FUNCTION
@@ -0,0 +1,282 @@
+/*
+  Compare the set operations of rbt/set.h with their parallel counterparts.
+
+  Both sets hold n random keys and share half of them. Each operation is
+  performed by the sequential function, which looks up the keys of one set in
+  the other, and by the parallel function with an increasing number of threads.
+  The modifying operations work on copies of the first set, which are made
+  before the timing starts. All results are compared with the sequential result
+  and the program exits with an error if they differ.
+
+  usage: bench_set [<n> ...]
+*/
+
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+#define RBT_KEY_H_PREFIX_ bench_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_SET_H_PREFIX_ bench_
+#define RBT_SET_PARALLEL
+#define RBT_KEY_T unsigned int
+#define RBT_KEY_SIZE_FIXED sizeof(RBT_KEY_T)
+#define RBT_KEY_COUNT_BITS(key) (sizeof(RBT_KEY_T) * BITS_PER_BYTE)
+#define RBT_KEY_PTR(key) (&key)
+#define RBT_KEY_FPRINT(fd, key) fprintf(fd, "%u", key)
+#define RBT_NODE_KEY_INLINE_PINS 1
+#include <rbt/set.h>
+
+/*!
+  @brief
+  The numbers of threads for the parallel operations.
+*/
+static const unsigned int bench_set_threads[] = {1, 2, 4, 0};
+
+/*!
+  @brief
+  The set operations.
+*/
+enum
+{
+  BENCH_SET_UNION,
+  BENCH_SET_INTERSECTION,
+  BENCH_SET_DIFFERENCE,
+  BENCH_SET_EXCLUSIVE_DISJUNCTION,
+  BENCH_SET_MODIFY_UNION,
+  BENCH_SET_MODIFY_DIFFERENCE,
+  BENCH_SET_OPERATIONS
+};
+
+/*!
+  @brief
+  The names of the set operations.
+*/
+static const char * bench_set_names[] = {
+  "union",
+  "intersection",
+  "difference",
+  "xor",
+  "modify-union",
+  "modify-difference"
+};
+
+
+
+/*!
+  @brief
+  Perform a set operation.
+
+  @param
+  operation The operation.
+
+  @param
+  a The first set. It is modified by the modifying operations.
+
+  @param
+  b The second set.
+
+  @param
+  threads The number of threads, or 0 for the sequential function.
+
+  @return
+  The resulting set, which is `a` for the modifying operations.
+*/
+bench_node_t *
+bench_set_run(int operation, bench_node_t * a, bench_node_t * b, unsigned int threads)
+{
+  switch (operation)
+  {
+    case BENCH_SET_UNION:
+      return threads ? bench_set_parallel_union(a, b, threads) : bench_set_union(a, b);
+
+    case BENCH_SET_INTERSECTION:
+      return threads ? bench_set_parallel_intersection(a, b, threads) : bench_set_intersection(a, b);
+
+    case BENCH_SET_DIFFERENCE:
+      return threads ? bench_set_parallel_difference(a, b, threads) : bench_set_difference(a, b);
+
+    case BENCH_SET_EXCLUSIVE_DISJUNCTION:
+      return threads ? bench_set_parallel_exclusive_disjunction(a, b, threads) : bench_set_exclusive_disjunction(a, b);
+
+    case BENCH_SET_MODIFY_UNION:
+      if (threads)
+      {
+        bench_set_parallel_modify_union(a, b, threads);
+      }
+      else
+      {
+        bench_set_modify_union(a, b);
+      }
+      return a;
+
+    default:
+      if (threads)
+      {
+        bench_set_parallel_modify_difference(a, b, threads);
+      }
+      else
+      {
+        bench_set_modify_difference(a, b);
+      }
+      return a;
+  }
+}
+
+
+
+/*!
+  @brief
+  Check that two sets hold the same keys.
+
+  @return
+  Non-zero if they do.
+*/
+int
+bench_set_is_equal(bench_node_t * a, bench_node_t * b)
+{
+  bench_node_iterator_t iterators[2];
+  bench_key_data_t * key_data[2];
+  int equal;
+
+  key_data[0] = bench_node_iterator_begin(iterators, a, 0);
+  key_data[1] = bench_node_iterator_begin(iterators + 1, b, 0);
+  while (key_data[0] != NULL && key_data[1] != NULL)
+  {
+    if (* key_data[0]->key != * key_data[1]->key)
+    {
+      break;
+    }
+    key_data[0] = bench_node_iterator_next(iterators);
+    key_data[1] = bench_node_iterator_next(iterators + 1);
+  }
+  equal = (key_data[0] == NULL && key_data[1] == NULL);
+  bench_node_iterator_end(iterators);
+  bench_node_iterator_end(iterators + 1);
+  return equal;
+}
+
+
+
+/*!
+  @brief
+  Benchmark the set operations on sets of n keys.
+
+  @param
+  n The number of keys in each set.
+
+  @return
+  The number of failed checks.
+*/
+unsigned long
+bench_set(unsigned long n)
+{
+  bench_node_t * a, * b, * expected, * result, * copy;
+  unsigned long i, errors;
+  unsigned int key;
+  uint64_t state, t;
+  int operation, j, modify;
+
+  a = bench_node_new();
+  b = bench_node_new();
+  if (a == NULL || b == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  for (i=0; i<n; i++)
+  {
+    key = bench_rand(&state);
+    bench_set_add(a, key);
+    if (i % 2)
+    {
+      bench_set_add(b, key);
+    }
+    else
+    {
+      bench_set_add(b, (unsigned int) bench_rand(&state));
+    }
+  }
+
+  errors = 0;
+  for (operation=0; operation<BENCH_SET_OPERATIONS; operation++)
+  {
+    modify = (operation >= BENCH_SET_MODIFY_UNION);
+    expected = NULL;
+    for (j=-1; j<0 || bench_set_threads[j]; j++)
+    {
+      copy = modify ? bench_node_copy(a) : a;
+      if (copy == NULL)
+      {
+        perror("bench_node_copy");
+        exit(EXIT_FAILURE);
+      }
+      errno = 0;
+      t = bench_now_ns();
+      result = bench_set_run(operation, copy, b, (j < 0) ? 0 : bench_set_threads[j]);
+      t = bench_now_ns() - t;
+      if (result == NULL || errno)
+      {
+        perror(bench_set_names[operation]);
+        exit(EXIT_FAILURE);
+      }
+      if (j < 0)
+      {
+        bench_report("set", "rbt", bench_set_names[operation], "random", n, t, -1);
+        expected = result;
+        continue;
+      }
+      bench_report_threads(
+        "set", "rbt-parallel", bench_set_names[operation], "random",
+        n, bench_set_threads[j], t, -1
+      );
+      if (! bench_set_is_equal(result, expected))
+      {
+        fprintf(
+          stderr, "%s: parallel result with %u threads differs\n",
+          bench_set_names[operation], bench_set_threads[j]
+        );
+        errors ++;
+      }
+      bench_node_free(result);
+    }
+    bench_node_free(expected);
+  }
+
+  bench_node_free(a);
+  bench_node_free(b);
+  return errors;
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {100000, 1000000, 0};
+  unsigned long * sizes;
+  unsigned long errors;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  errors = 0;
+  for (i=0; sizes[i]; i++)
+  {
+    errors += bench_set(sizes[i]);
+  }
+  free(sizes);
+  if (errors)
+  {
+    fprintf(stderr, "error: %lu failed consistency checks\n", errors);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
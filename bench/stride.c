@@ -0,0 +1,131 @@
+/*
+  Compare rabbit trees with the 4-bit and 8-bit stride tries of rbt/stride.h
+  on dense keys (consecutive integers) and sparse keys (integers scattered over
+  the 32-bit range). The rabbit trees are configured as for watch descriptors.
+
+  Keys are inserted in random order, retrieved in the reverse order and then
+  deleted in the order of insertion. Retrieved values are checked and the
+  program exits with an error if a check fails.
+
+  usage: bench_stride [<n> ...]
+*/
+
+#include <stdint.h>
+
+#include "bench.h"
+
+#include <rbt/common.h>
+
+#define RBT_KEY_H_PREFIX_ bench_
+#define RBT_PIN_T unsigned int
+#define RBT_KEY_SIZE_T uint_fast8_t
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_NODE_H_PREFIX_ bench_
+#define RBT_VALUE_T unsigned long
+#define RBT_VALUE_NULL 0
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) a = b
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%lu", val)
+#define RBT_KEY_SIZE_FIXED sizeof(unsigned int)
+#define RBT_NODE_KEY_INLINE_PINS 1
+#define RBT_NODE_ARENA 0x10000
+#include <rbt/node.h>
+
+#define RBT_STRIDE_H_PREFIX_ bench4_
+#define RBT_STRIDE_BITS 4
+#include <rbt/stride.h>
+
+#undef RBT_STRIDE_H_PREFIX_
+#undef RBT_STRIDE_BITS
+#define RBT_STRIDE_H_PREFIX_ bench8_
+#define RBT_STRIDE_BITS 8
+#include <rbt/stride.h>
+
+#define BENCH_STRIDE_T bench_node_t
+#define BENCH_STRIDE_NEW bench_node_new
+#define BENCH_STRIDE_QUERY bench_node_query
+#define BENCH_STRIDE_FREE bench_node_free
+#define BENCH_STRIDE_IMPL "rbt"
+#define BENCH_STRIDE_FUNCTION bench_stride_rbt
+#include "stride_template.h"
+
+#define BENCH_STRIDE_T bench4_stride_t
+#define BENCH_STRIDE_NEW bench4_stride_new
+#define BENCH_STRIDE_QUERY bench4_stride_query
+#define BENCH_STRIDE_FREE bench4_stride_free
+#define BENCH_STRIDE_IMPL "stride4"
+#define BENCH_STRIDE_FUNCTION bench_stride_4
+#include "stride_template.h"
+
+#define BENCH_STRIDE_T bench8_stride_t
+#define BENCH_STRIDE_NEW bench8_stride_new
+#define BENCH_STRIDE_QUERY bench8_stride_query
+#define BENCH_STRIDE_FREE bench8_stride_free
+#define BENCH_STRIDE_IMPL "stride8"
+#define BENCH_STRIDE_FUNCTION bench_stride_8
+#include "stride_template.h"
+
+/*!
+  @brief
+  Benchmark all implementations with n dense and n sparse keys.
+
+  @param
+  n The number of keys.
+*/
+void
+bench_stride(unsigned long n)
+{
+  unsigned int * keys;
+  unsigned long i;
+  uint64_t state;
+
+  keys = malloc(n * sizeof(unsigned int));
+  if (keys == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<n; i++)
+  {
+    keys[i] = i + 1;
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  bench_shuffle((int *) keys, n, &state);
+  bench_stride_rbt(keys, n, "dense");
+  bench_stride_4(keys, n, "dense");
+  bench_stride_8(keys, n, "dense");
+
+  /*
+    The multiplier is odd, so the sparse keys are distinct.
+  */
+  for (i=0; i<n; i++)
+  {
+    keys[i] *= 0x9E3779B1U;
+  }
+  bench_stride_rbt(keys, n, "sparse");
+  bench_stride_4(keys, n, "sparse");
+  bench_stride_8(keys, n, "sparse");
+  free(keys);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10000, 1000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_stride(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+  Benchmark of a trie with a query interface like `RBT_NODE_QUERY()`. This is
+  included once for each implementation with the following macros defined:
+
+  - BENCH_STRIDE_T: the tree type
+  - BENCH_STRIDE_NEW: the function to create a tree
+  - BENCH_STRIDE_QUERY: the query function
+  - BENCH_STRIDE_FREE: the function to free a tree
+  - BENCH_STRIDE_IMPL: the name of the implementation, as a string
+  - BENCH_STRIDE_FUNCTION: the name of the benchmark function
+
+  The macros are undefined again afterwards.
+*/
+
+/*!
+  @brief
+  Benchmark insertion, retrieval and deletion of keys.
+
+  @param
+  keys The keys, in the order of insertion.
+
+  @param
+  n The number of keys.
+
+  @param
+  distribution The name of the key distribution.
+*/
+void
+BENCH_STRIDE_FUNCTION(unsigned int * keys, unsigned long n, const char * distribution)
+{
+  BENCH_STRIDE_T * tree;
+  unsigned long i, errors;
+  uint64_t t;
+  size_t heap;
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  tree = BENCH_STRIDE_NEW();
+  for (i=0; i<n; i++)
+  {
+    BENCH_STRIDE_QUERY(
+      tree, keys + i, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_INSERT, i + 1
+    );
+  }
+  t = bench_now_ns() - t;
+  if (tree == NULL || errno)
+  {
+    perror(BENCH_STRIDE_IMPL);
+    exit(EXIT_FAILURE);
+  }
+  bench_report("stride", BENCH_STRIDE_IMPL, "insert", distribution, n, t, bench_heap_bytes() - heap);
+
+  errors = 0;
+  t = bench_now_ns();
+  for (i=n; i>0; i--)
+  {
+    errors += BENCH_STRIDE_QUERY(
+      tree, keys + i - 1, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_RETRIEVE, 0
+    ) != i;
+  }
+  t = bench_now_ns() - t;
+  bench_report("stride", BENCH_STRIDE_IMPL, "retrieve", distribution, n, t, -1);
+
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    BENCH_STRIDE_QUERY(
+      tree, keys + i, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_DELETE, 0
+    );
+  }
+  t = bench_now_ns() - t;
+  bench_report("stride", BENCH_STRIDE_IMPL, "delete", distribution, n, t, -1);
+
+  for (i=0; i<n; i++)
+  {
+    errors += BENCH_STRIDE_QUERY(
+      tree, keys + i, sizeof(unsigned int) * BITS_PER_BYTE,
+      RBT_QUERY_ACTION_RETRIEVE, 0
+    ) != 0;
+  }
+  BENCH_STRIDE_FREE(tree);
+  if (errors)
+  {
+    fprintf(stderr, "%s: %lu failed checks\n", BENCH_STRIDE_IMPL, errors);
+    exit(EXIT_FAILURE);
+  }
+}
+
+#undef BENCH_STRIDE_T
+#undef BENCH_STRIDE_NEW
+#undef BENCH_STRIDE_QUERY
+#undef BENCH_STRIDE_FREE
+#undef BENCH_STRIDE_IMPL
+#undef BENCH_STRIDE_FUNCTION
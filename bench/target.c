@@ -0,0 +1,206 @@
+/*
+  Compare finding the most specific target of a path with the index of
+  target_index.h and with a linear scan of all targets.
+
+  The n target directories are nested randomly below a common root. Each
+  lookup is for a file in a random target directory, so the expected target is
+  known. The linear scan performs fewer lookups for large n to bound its run
+  time. The program exits with an error if a lookup returns the wrong target.
+
+  usage: bench_target [<n> ...]
+*/
+
+#include "target_index.h"
+
+#include "bench.h"
+
+/*!
+  @brief
+  The number of lookups with the index.
+*/
+#define BENCH_TARGET_LOOKUPS 1000000UL
+
+/*!
+  @brief
+  The approximate number of path comparisons by the linear scan.
+*/
+#define BENCH_TARGET_COMPARISONS 100000000UL
+
+/*!
+  @brief
+  Find the most specific target of a path by comparing it with each target.
+
+  @param
+  targets The targets.
+
+  @param
+  keys The index keys of the target directories.
+
+  @param
+  lengths The lengths of the keys.
+
+  @param
+  n The number of targets.
+
+  @param
+  path The path.
+
+  @return
+  The target, or NULL if no target contains the path.
+*/
+target_t *
+bench_target_scan(target_t * targets, char * * keys, size_t * lengths, size_t n, const char * path)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t i, l, best_length;
+  target_t * best;
+
+  l = target_index_key(path, key);
+  best = NULL;
+  best_length = 0;
+  for (i=0; i<n; i++)
+  {
+    if (
+      lengths[i] <= l &&
+      lengths[i] > best_length &&
+      ! memcmp(keys[i], key, lengths[i])
+    )
+    {
+      best = targets + i;
+      best_length = lengths[i];
+    }
+  }
+  return best;
+}
+
+
+
+/*!
+  @brief
+  Benchmark lookups with n targets.
+
+  @param
+  n The number of targets.
+*/
+void
+bench_target(unsigned long n)
+{
+  char path[TARGET_INDEX_KEY_SIZE];
+  char * * keys;
+  size_t * lengths, * queries;
+  target_t * targets;
+  path_node_t * index;
+  unsigned long i, m, errors;
+  uint64_t t, state;
+  size_t heap, parent;
+
+  targets = calloc(n, sizeof(target_t));
+  keys = calloc(n, sizeof(char *));
+  lengths = calloc(n, sizeof(size_t));
+  queries = calloc(BENCH_TARGET_LOOKUPS, sizeof(size_t));
+  if (targets == NULL || keys == NULL || lengths == NULL || queries == NULL)
+  {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+    Each target is a subdirectory of the root or of an earlier target.
+  */
+  state = 0x9E3779B97F4A7C15ULL;
+  for (i=0; i<n; i++)
+  {
+    parent = bench_rand(&state) % (i + 1);
+    if (parent == i)
+    {
+      snprintf(path, sizeof(path), "/srv/d%lu", i);
+    }
+    else
+    {
+      snprintf(path, sizeof(path), "%sd%lu", keys[parent], i);
+    }
+    targets[i].target = strdup(path);
+    keys[i] = malloc(TARGET_INDEX_KEY_SIZE);
+    if (targets[i].target == NULL || keys[i] == NULL)
+    {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    lengths[i] = target_index_key(path, keys[i]);
+  }
+  for (i=0; i<BENCH_TARGET_LOOKUPS; i++)
+  {
+    queries[i] = bench_rand(&state) % n;
+  }
+
+  heap = bench_heap_bytes();
+  t = bench_now_ns();
+  index = path_node_new();
+  for (i=0; i<n; i++)
+  {
+    if (index == NULL || target_index_add(index, targets[i].target, targets + i))
+    {
+      perror("target_index_add");
+      exit(EXIT_FAILURE);
+    }
+  }
+  t = bench_now_ns() - t;
+  bench_report("target", "rbt", "build", "nested", n, t, bench_heap_bytes() - heap);
+
+  errors = 0;
+  t = bench_now_ns();
+  for (i=0; i<BENCH_TARGET_LOOKUPS; i++)
+  {
+    snprintf(path, sizeof(path), "%sf%lu", keys[queries[i]], i);
+    errors += (target_index_lookup(index, path) != targets + queries[i]);
+  }
+  t = bench_now_ns() - t;
+  bench_report("target", "rbt", "lookup", "nested", BENCH_TARGET_LOOKUPS, t, -1);
+
+  m = BENCH_TARGET_COMPARISONS / n;
+  m = (m < 1000) ? 1000 : (m > BENCH_TARGET_LOOKUPS) ? BENCH_TARGET_LOOKUPS : m;
+  t = bench_now_ns();
+  for (i=0; i<m; i++)
+  {
+    snprintf(path, sizeof(path), "%sf%lu", keys[queries[i]], i);
+    errors += (bench_target_scan(targets, keys, lengths, n, path) != targets + queries[i]);
+  }
+  t = bench_now_ns() - t;
+  bench_report("target", "linear", "lookup", "nested", m, t, -1);
+
+  if (errors)
+  {
+    fprintf(stderr, "%lu lookups with %lu targets returned the wrong target\n", errors, n);
+    exit(EXIT_FAILURE);
+  }
+
+  path_node_free(index);
+  for (i=0; i<n; i++)
+  {
+    free(targets[i].target);
+    free(keys[i]);
+  }
+  free(queries);
+  free(lengths);
+  free(keys);
+  free(targets);
+}
+
+
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10, 100, 1000, 10000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_target(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
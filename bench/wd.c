@@ -0,0 +1,32 @@
+/*
+  Compare the rabbit tree and the dense table for mapping watch descriptors to
+  watchlist data.
+
+  usage: bench_wd [<n> ...]
+*/
+
+#include "bench.h"
+
+void
+bench_wd_rbt(unsigned long n);
+
+void
+bench_wd_dense(unsigned long n);
+
+int
+main(int argc, char * * argv)
+{
+  const unsigned long defaults[] = {10000, 1000000, 10000000, 0};
+  unsigned long * sizes;
+  int i;
+
+  sizes = bench_sizes(argc, argv, defaults);
+  bench_print_header();
+  for (i=0; sizes[i]; i++)
+  {
+    bench_wd_rbt(sizes[i]);
+    bench_wd_dense(sizes[i]);
+  }
+  free(sizes);
+  return EXIT_SUCCESS;
+}
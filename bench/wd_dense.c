@@ -0,0 +1,6 @@
+#define WD_TABLE_DENSE
+#include "watchlist.h"
+
+#define BENCH_WD_IMPL "dense"
+#define BENCH_WD_FUNCTION bench_wd_dense
+#include "wd_template.h"
@@ -0,0 +1,11 @@
+#include "watchlist.h"
+
+#if ! RBT_NODE_KEY_INLINE_PINS
+#define BENCH_WD_IMPL "rbt-heap-key"
+#elif ! RBT_NODE_ARENA
+#define BENCH_WD_IMPL "rbt-malloc"
+#else
+#define BENCH_WD_IMPL "rbt"
+#endif //RBT_NODE_KEY_INLINE_PINS
+#define BENCH_WD_FUNCTION bench_wd_rbt
+#include "wd_template.h"
@@ -0,0 +1,127 @@
+/*
+  Benchmark of a watch descriptor map. This is included once for each
+  implementation after `watchlist.h`, with the following macros defined:
+
+  - BENCH_WD_IMPL: the name of the implementation, as a string
+  - BENCH_WD_FUNCTION: the name of the benchmark function
+*/
+
+#include "bench.h"
+
+/*!
+  @brief
+  The number of watch descriptors retrieved per call to `wd_retrieve_batch()`.
+  This is the number of events that fit in the daemon's read buffer.
+*/
+#ifndef BENCH_WD_BATCH
+#define BENCH_WD_BATCH 0x800
+#endif // BENCH_WD_BATCH
+
+/*!
+  @brief
+  Benchmark insertion, retrieval, deletion and freeing of watch descriptors.
+
+  @param
+  n The number of watch descriptors.
+*/
+void
+BENCH_WD_FUNCTION(unsigned long n)
+{
+  wd_node_t * dict;
+  watchlist_data_t data, values[BENCH_WD_BATCH];
+  target_t target;
+  int * order;
+  unsigned long i, j, m, found;
+  uint64_t t, state;
+  size_t heap;
+
+  order = malloc(n * sizeof(int));
+  if (order == NULL)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<n; i++)
+  {
+    order[i] = i + 1;
+  }
+  state = 0x9E3779B97F4A7C15ULL;
+  bench_shuffle(order, n, &state);
+
+  /*
+    Paths are left NULL so that only the map itself is measured.
+  */
+  data.target = &target;
+  data.path = NULL;
+  data.dev = 0;
+
+  heap = bench_heap_bytes();
+  dict = wd_node_new();
+  t = bench_now_ns();
+  for (i=1; i<=n; i++)
+  {
+    wd_insert(dict, i, data);
+  }
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "insert", "sequential", n, t, bench_heap_bytes() - heap);
+
+  found = 0;
+  t = bench_now_ns();
+  for (i=1; i<=n; i++)
+  {
+    found += (wd_retrieve(dict, i).target != NULL);
+  }
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "retrieve", "sequential", n, t, -1);
+
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    found += (wd_retrieve(dict, order[i]).target != NULL);
+  }
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "retrieve", "random", n, t, -1);
+
+  t = bench_now_ns();
+  for (i=0; i<n; i+=m)
+  {
+    m = (n - i < BENCH_WD_BATCH) ? n - i : BENCH_WD_BATCH;
+    wd_retrieve_batch(dict, order + i, values, m);
+    for (j=0; j<m; j++)
+    {
+      found += (values[j].target != NULL);
+    }
+  }
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "retrieve-batch", "random", n, t, -1);
+
+  if (found != 3 * n)
+  {
+    fprintf(stderr, "%s: found %lu of %lu entries\n", BENCH_WD_IMPL, found, 3 * n);
+    exit(EXIT_FAILURE);
+  }
+
+  t = bench_now_ns();
+  for (i=0; i<n; i++)
+  {
+    wd_delete(dict, order[i]);
+  }
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "delete", "random", n, t, -1);
+  wd_node_free(dict);
+
+  /*
+    Rebuild the table in random order to measure freeing a full table, as after
+    a queue overflow.
+  */
+  dict = wd_node_new();
+  for (i=0; i<n; i++)
+  {
+    wd_insert(dict, order[i], data);
+  }
+  t = bench_now_ns();
+  wd_node_free(dict);
+  t = bench_now_ns() - t;
+  bench_report("wd", BENCH_WD_IMPL, "free", "random", n, t, -1);
+  free(order);
+}
@@ -0,0 +1,98 @@
+#ifndef MAOWN_EVENT_SOURCE_H
+#define MAOWN_EVENT_SOURCE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*!
+  @brief
+  A source of file events.
+
+  Events are delivered in the same format as inotify events so that the event
+  handling code does not depend on the source. This makes it possible to drive
+  the event loop without the kernel, e.g. for benchmarking.
+*/
+typedef
+struct event_source
+{
+  /*!
+    @brief
+    Watch a path.
+
+    @return
+    The watch descriptor, or -1 on error (check errno).
+  */
+  int
+  (* add_watch)(struct event_source * source, const char * path, uint32_t mask);
+
+  /*!
+    @brief
+    Remove a watch.
+
+    @return
+    0 on success, -1 on error (check errno).
+  */
+  int
+  (* rm_watch)(struct event_source * source, int wd);
+
+  /*!
+    @brief
+    Read events into a buffer as `struct inotify_event` records.
+
+    @return
+    The number of bytes read, 0 if the source is exhausted or -1 on error
+    (check errno).
+  */
+  ssize_t
+  (* read)(struct event_source * source, char * buffer, size_t len);
+
+  /*!
+    @brief
+    Check if events can be read without blocking.
+
+    @return
+    True if events are pending.
+  */
+  int
+  (* pending)(struct event_source * source);
+
+  /*!
+    @brief
+    Release all resources held by the source, including the source itself.
+  */
+  void
+  (* close)(struct event_source * source);
+
+  /*!
+    @brief
+    Optional. Notify the source that all events of the last read have been
+    handled.
+  */
+  void
+  (* handled)(struct event_source * source);
+
+  /*!
+    @brief
+    Optional. Log statistics collected by the source.
+  */
+  void
+  (* report)(struct event_source * source);
+
+  /*!
+    @brief
+    Optional. Make the current or next blocking read return 0 so that the
+    event loop ends. This must be async-signal-safe as it is called from signal
+    handlers.
+  */
+  void
+  (* interrupt)(struct event_source * source);
+
+  /*!
+    @brief
+    Implementation-specific data.
+  */
+  void * data;
+}
+event_source_t;
+
+#endif //MAOWN_EVENT_SOURCE_H
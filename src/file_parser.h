@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include "common.h"
+#include "path_entry.h"
 
 #define BUFSIZE 0x1000
 
@@ -240,9 +241,16 @@ struct
 
   /*!
     @brief
-    The full path of the current target.
+    The path of the watched directory.
   */
-  char * path;
+  path_entry_t * path;
+
+  /*!
+    @brief
+    The device of the watched directory. Event-triggered scans below it will
+    not cross onto other devices if `no_device_crossing` is set.
+  */
+  dev_t dev;
 }
 watchlist_data_t;
 
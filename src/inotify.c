@@ -1,3 +1,8 @@
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include "inotify.h"
 
 int
@@ -14,3 +19,149 @@ read_int(char * path)
   fclose(f);
   return i;
 }
+
+
+
+/*!
+  @brief
+  The state of an inotify event source.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The inotify instance.
+  */
+  int fd;
+
+  /*!
+    @brief
+    An eventfd that becomes readable when the source is interrupted.
+  */
+  int stop_fd;
+}
+inotify_data_t;
+
+/*!
+  @brief
+  The inotify instance of an inotify event source.
+*/
+#define INOTIFY_INSTANCE(source) (((inotify_data_t *) (source)->data)->fd)
+
+/*!
+  @brief
+  The interruption eventfd of an inotify event source.
+*/
+#define INOTIFY_STOP(source) (((inotify_data_t *) (source)->data)->stop_fd)
+
+
+
+int
+inotify_source_add_watch(event_source_t * source, const char * path, uint32_t mask)
+{
+  return inotify_add_watch(INOTIFY_INSTANCE(source), path, mask);
+}
+
+
+
+int
+inotify_source_rm_watch(event_source_t * source, int wd)
+{
+  return inotify_rm_watch(INOTIFY_INSTANCE(source), wd);
+}
+
+
+
+ssize_t
+inotify_source_read(event_source_t * source, char * buffer, size_t len)
+{
+  struct pollfd pfd[2];
+  pfd[0].fd = INOTIFY_INSTANCE(source);
+  pfd[0].events = POLLIN;
+  pfd[1].fd = INOTIFY_STOP(source);
+  pfd[1].events = POLLIN;
+  if (poll(pfd, 2, -1) == -1)
+  {
+    return -1;
+  }
+  if (pfd[1].revents & POLLIN)
+  {
+    return 0;
+  }
+  return read(INOTIFY_INSTANCE(source), buffer, len);
+}
+
+
+
+int
+inotify_source_pending(event_source_t * source)
+{
+  struct pollfd pfd;
+  pfd.fd = INOTIFY_INSTANCE(source);
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) > 0;
+}
+
+
+
+void
+inotify_source_interrupt(event_source_t * source)
+{
+  uint64_t one = 1;
+  ssize_t l;
+  /*
+    Nothing can be done about a failure in a signal handler.
+  */
+  l = write(INOTIFY_STOP(source), &one, sizeof(one));
+  (void) l;
+}
+
+
+
+void
+inotify_source_close(event_source_t * source)
+{
+  close(INOTIFY_INSTANCE(source));
+  close(INOTIFY_STOP(source));
+  free(source->data);
+  free(source);
+}
+
+
+
+event_source_t *
+inotify_source_new(void)
+{
+  event_source_t * source;
+
+  source = malloc(sizeof(event_source_t));
+  if (source == NULL)
+  {
+    die("error: failed to allocate memory for event source");
+  }
+  source->data = malloc(sizeof(inotify_data_t));
+  if (source->data == NULL)
+  {
+    die("error: failed to allocate memory for event source");
+  }
+  INOTIFY_INSTANCE(source) = inotify_init();
+  if (INOTIFY_INSTANCE(source) == -1)
+  {
+    die("error: failed to initialize inotify");
+  }
+  INOTIFY_STOP(source) = eventfd(0, 0);
+  if (INOTIFY_STOP(source) == -1)
+  {
+    die("error: failed to create eventfd");
+  }
+  source->add_watch = inotify_source_add_watch;
+  source->rm_watch = inotify_source_rm_watch;
+  source->read = inotify_source_read;
+  source->pending = inotify_source_pending;
+  source->close = inotify_source_close;
+  source->handled = NULL;
+  source->report = NULL;
+  source->interrupt = inotify_source_interrupt;
+  return source;
+}
@@ -1,12 +1,7 @@
 #include <sys/inotify.h>
 
 #include "common.h"
-
-/*!
-  @brief
-  The inotify instance.
-*/
-int INOTIFY_INSTANCE;
+#include "event_source.h"
 
 /*!
   @brief
@@ -29,6 +24,7 @@ int INOTIFY_INSTANCE;
   IN_ATTRIB | \
   IN_DELETE | \
   IN_DELETE_SELF | \
+  IN_MOVED_FROM | \
   IN_MOVED_TO | \
   IN_MOVE_SELF | \
   IN_Q_OVERFLOW | \
@@ -48,3 +44,13 @@ int INOTIFY_INSTANCE;
 */
 int
 read_int(char * path);
+
+/*!
+  @brief
+  Create an event source backed by a new inotify instance.
+
+  @return
+  The event source.
+*/
+event_source_t *
+inotify_source_new(void);
@@ -1,5 +1,6 @@
 #include <dirent.h>
 #include <glob.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -10,7 +11,12 @@
 
 #include "file_parser.h"
 #include "inotify.h"
-#include "rbt.h"
+#include "mountinfo.h"
+#include "synthetic.h"
+#include "trace.h"
+#include "watchlist.h"
+#include "target_index.h"
+#include "watch_index.h"
 
 
 #define NAME "autochown"
@@ -43,6 +49,133 @@ int enable_killmask = 0;
 */
 int no_device_crossing = 0;
 
+/*!
+  @brief
+  The index of mount points, loaded if `no_device_crossing` is set. Mount points
+  below the targets are never entered, which also stops bind mounts of the same
+  device.
+*/
+mountinfo_t mount_index = {
+  .mount_points = NULL,
+  .n = 0,
+  .fd = -1,
+  .lock = PTHREAD_RWLOCK_INITIALIZER
+};
+
+/*!
+  @brief
+  A target directory whose path is not canonical, e.g. because it is relative
+  or one of its parents is a symbolic link. Paths below it are translated
+  before they are looked up in the mount index.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The path of the directory as it is scanned, without trailing slashes.
+  */
+  char * path;
+
+  /*!
+    @brief
+    The length of the path.
+  */
+  size_t len;
+
+  /*!
+    @brief
+    The canonical path of the directory, or NULL if it could not be resolved.
+  */
+  char * real_path;
+}
+root_alias_t;
+
+/*!
+  @brief
+  The target directories with non-canonical paths, collected if
+  `no_device_crossing` is set.
+*/
+root_alias_t * root_aliases = NULL;
+
+/*!
+  @brief
+  The number of root aliases.
+*/
+size_t n_root_aliases = 0;
+
+/*!
+  @brief
+  Register watches before adjusting attributes and sweep in the background.
+*/
+int watch_first = 0;
+
+/*!
+  @brief
+  Give each target its own event source, watchlist and thread.
+*/
+int independent_targets = 0;
+
+/*!
+  @brief
+  Set by the signal handler to stop the workers.
+*/
+volatile sig_atomic_t stopping = 0;
+
+/*!
+  @brief
+  The index of the directories matched by the targets at startup. Directories
+  within several targets belong to the most specific one.
+*/
+path_node_t * target_index = NULL;
+
+/*!
+  @brief
+  The number of directories to sweep between checks for pending events.
+*/
+#define SWEEP_BATCH 0x40
+
+/*!
+  @brief
+  The maximum number of events in a read buffer.
+*/
+#define EVENT_BATCH (BUF_LEN / EVENT_SIZE)
+
+/*!
+  @brief
+  An event source together with the watches registered with it.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The source of file events.
+  */
+  event_source_t * source;
+
+  /*!
+    @brief
+    The dictionary mapping watch descriptors to watchlist data.
+  */
+  wd_node_t * wd_dict;
+
+  /*!
+    @brief
+    The index mapping the paths of watched directories to their watch
+    descriptors. It contains the same watches as the dictionary.
+  */
+  watch_path_node_t * path_index;
+
+  /*!
+    @brief
+    The number of modifications of the dictionary. Retrieved watchlist data is
+    only valid until the next modification.
+  */
+  unsigned long changes;
+}
+watcher_t;
+
 /*!
   @brief
   Convert a Unix timestamp to a version string.
@@ -82,6 +215,68 @@ maybe_append_slash(char * path)
 
 
 
+/*!
+  @brief
+  Get the name of a user. Unlike `getpwuid`, this is safe to call from several
+  threads.
+
+  @param
+  uid The user ID.
+
+  @param
+  name The output buffer of size `MAX_PW_NAME + 1`.
+
+  @return
+  0 on success, -1 if the name could not be determined.
+*/
+int
+user_name(uid_t uid, char * name)
+{
+  char buffer[BUFSIZE];
+  struct passwd pw, * result;
+
+  if (getpwuid_r(uid, &pw, buffer, sizeof(buffer), &result) || result == NULL)
+  {
+    return -1;
+  }
+  strncpy(name, pw.pw_name, MAX_PW_NAME);
+  name[MAX_PW_NAME] = '\0';
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Get the name of a group. Unlike `getgrgid`, this is safe to call from several
+  threads.
+
+  @param
+  gid The group ID.
+
+  @param
+  name The output buffer of size `MAX_GR_NAME + 1`.
+
+  @return
+  0 on success, -1 if the name could not be determined.
+*/
+int
+group_name(gid_t gid, char * name)
+{
+  char buffer[BUFSIZE];
+  struct group gr, * result;
+
+  if (getgrgid_r(gid, &gr, buffer, sizeof(buffer), &result) || result == NULL)
+  {
+    return -1;
+  }
+  strncpy(name, gr.gr_name, MAX_GR_NAME);
+  name[MAX_GR_NAME] = '\0';
+  return 0;
+}
+
+
+
 /*
   @brief
   Chown and chmod a file as necessary.
@@ -106,18 +301,14 @@ adjust_attrib(
 )
 {
   const char * filetype;
-  char pw_name[MAX_PW_NAME+1];
-  char gr_name[MAX_GR_NAME+1];
-  int check_mode;
+  char pw_name[MAX_PW_NAME+1], new_pw_name[MAX_PW_NAME+1];
+  char gr_name[MAX_GR_NAME+1], new_gr_name[MAX_GR_NAME+1];
+  int check_mode, error;
   mode_t mode, mask;
   uid_t uid;
   gid_t gid;
-  struct passwd * pw;
-  struct group * gr;
   struct stat internal_st;
 
-  pw = NULL;
-  gr = NULL;
   check_mode = 0;
 
   if (st == NULL)
@@ -158,26 +349,14 @@ adjust_attrib(
     {
       if (verbose_mode)
       {
-
-        pw = getpwuid(st->st_uid);
-        if (pw != NULL)
-        {
-          strncpy(pw_name, pw->pw_name, MAX_PW_NAME);
-          pw_name[MAX_PW_NAME] = '\0';
-          pw = getpwuid(uid);
-        }
-
-        gr = getgrgid(st->st_gid);
-        if (gr != NULL)
-        {
-          strncpy(gr_name, gr->gr_name, MAX_GR_NAME);
-          gr_name[MAX_GR_NAME] = '\0';
-          gr = getgrgid(gid);
-        }
-
-        if (pw != NULL && gr != NULL)
+        if (
+          ! user_name(uid, new_pw_name) &&
+          ! group_name(gid, new_gr_name) &&
+          ! user_name(st->st_uid, pw_name) &&
+          ! group_name(st->st_gid, gr_name)
+        )
         {
-          msg_log("lchown %s:%s %s [%s:%s]", pw->pw_name, gr->gr_name, path, pw_name, gr_name);
+          msg_log("lchown %s:%s %s [%s:%s]", new_pw_name, new_gr_name, path, pw_name, gr_name);
         }
         else
         {
@@ -192,20 +371,15 @@ adjust_attrib(
           {
             return 1;
           }
-          if (pw == NULL)
-          {
-            pw = getpwuid(uid);
-          }
-          if (gr == NULL)
-          {
-            gr = getgrgid(gid);
-          }
-          if (pw != NULL && gr != NULL)
+          error = errno;
+          if (! user_name(uid, new_pw_name) && ! group_name(gid, new_gr_name))
           {
-            die("error: failed to change ownership of \"%s\" to %s:%s", path, pw->pw_name, gr->gr_name);
+            errno = error;
+            die("error: failed to change ownership of \"%s\" to %s:%s", path, new_pw_name, new_gr_name);
           }
           else
           {
+            errno = error;
             die("error: failed to change ownership of \"%s\" to %lu:%lu", path, uid, gid);
           }
         }
@@ -406,197 +580,1597 @@ glob_errfunc(const char * filename, int error)
 
 /*!
   @brief
-  Recursively scan a directory, modifying attributes and building the watchlist.
+  Resolve a target directory and record it as a root alias if its path is not
+  canonical.
 
   @param
-  path The path.
-
-  @param
-  target The target struct.
-
-  @param
-  wd_dict The dictionary to populate with the watch descriptors.
-
-  @param
-  watch If "true" then found files and directories will be watched.
-
-  @param
-  dev The parent device. This is used to determine device crossing during
-  recursion.
+  path The path of the directory.
 */
 void
-scan(
-  char * path,
-  target_t * target,
-  wd_node_t * wd_dict,
-  int watch,
-  dev_t dev
-)
+add_root_alias(const char * path)
 {
-  char tmp_path[PATH_MAX + 1];
-  int l, wd;
-  DIR * dir;
-  struct dirent * de;
-  struct stat st;
-  watchlist_data_t data;
+  char real_path[PATH_MAX + 1];
+  int resolved;
+  root_alias_t * alias;
+  size_t l;
 
-  if (verbose_mode > 1)
+  l = strnlen(path, PATH_MAX);
+  while (l > 1 && path[l - 1] == '/')
   {
-    msg_log("scanning %s", path);
+    l --;
   }
-
-  if (match_pattern_queue(target->pattern, path) != INCLUDE)
+  resolved = realpath(path, real_path) != NULL;
+  if (resolved && strlen(real_path) == l && ! memcmp(real_path, path, l))
   {
     return;
   }
 
-  if (lstat(path, &st))
+  alias = realloc(root_aliases, (n_root_aliases + 1) * sizeof(root_alias_t));
+  if (alias == NULL)
   {
-    if (errno == ENOENT)
-    {
-      return;
-    }
-    die("error: failed to stat \"%s\"", path);
+    die("error: failed to allocate memory for root aliases");
   }
-
-
-  if (
-    adjust_attrib(path, &st, target) ||
-    ! S_ISDIR(st.st_mode) ||
-    (no_device_crossing && dev && st.st_dev != dev)
-  )
+  root_aliases = alias;
+  alias += n_root_aliases;
+  alias->path = strndup(path, l);
+  alias->len = l;
+  alias->real_path = NULL;
+  if (resolved)
   {
-    return;
+    /*
+      The root directory is stored as an empty string so that the translated
+      paths start with a single slash.
+    */
+    alias->real_path = strdup(strcmp(real_path, "/") ? real_path : "");
   }
-
-  strcpy(tmp_path, path);
-  l = maybe_append_slash(tmp_path);
-
-  if (watch)
+  if (alias->path == NULL || (resolved && alias->real_path == NULL))
   {
-    wd = inotify_add_watch(INOTIFY_INSTANCE, path, EVENTS);
-    if (wd == -1)
-    {
-      die("error: failed to add watch (%s)", path);
-    }
+    die("error: failed to duplicate string");
+  }
+  n_root_aliases ++;
+}
 
 
-    data.target = target;
-    data.path = tmp_path;
 
-    if (data.path == NULL)
-    {
-      die("error: failed to duplicate string");
-    }
+/*!
+  @brief
+  Build the index of the directories matched by the targets.
 
-    wd_insert(wd_dict, wd, data);
-  }
+  @param
+  targets The targets, terminated by a target with a NULL path.
+*/
+void
+index_targets(target_t * targets)
+{
+  size_t i, j;
+  glob_t globbed;
+  struct stat st;
 
-  dir = opendir(path);
-  if (dir == NULL)
+  target_index = path_node_new();
+  if (target_index == NULL)
   {
-    if (errno == ENOENT)
-    {
-      return;
-    }
-    die("error: failed to open directory \"%s\"", path);
+    die("error: failed to create target index");
   }
-
-  errno = 0;
-  while ((de = readdir(dir)) != NULL && errno == 0)
+  for (i=0; targets[i].target != NULL; i++)
   {
-    // skip "." and ".."
-    if
-    (
-      de->d_name[0] == '.' &&
-      (
-        de->d_name[1] == '\0' ||
-        (
-          de->d_name[1] == '.' &&
-          de->d_name[2] == '\0'
-        )
-      )
-    )
+    /*
+      Failures are reported when the target is scanned.
+    */
+    if (glob(targets[i].target, GLOB_TILDE | GLOB_NOMAGIC, NULL, &globbed))
     {
       continue;
     }
-    strcpy(tmp_path+l, de->d_name);
-    scan(tmp_path, target, wd_dict, watch, st.st_dev);
+    for (j=0; j<globbed.gl_pathc; j++)
+    {
+      if (lstat(globbed.gl_pathv[j], &st) || ! S_ISDIR(st.st_mode))
+      {
+        continue;
+      }
+      if (target_index_add(target_index, globbed.gl_pathv[j], &targets[i]))
+      {
+        die("error: failed to index \"%s\"", globbed.gl_pathv[j]);
+      }
+      if (no_device_crossing)
+      {
+        add_root_alias(globbed.gl_pathv[j]);
+      }
+    }
+    globfree(&globbed);
   }
-  closedir(dir);
 }
 
 
+
 /*!
   @brief
-  Chown and chmod files and directories (recursively) and optionally watch them
-  for further changes.
-
-  @param
-  target The target struct.
-
-  @param
-  wd_dict The dictionary to populate with the watch descriptors.
-
-  @param
-  watch If "true" then found files and directories will be watched.
+  Free the root aliases.
 */
 void
-glob_scan(
-  target_t * target,
-  wd_node_t * wd_dict,
-  int watch
-)
+free_root_aliases(void)
 {
-  int i;
-  glob_t globbed;
-
-  if (
-    glob(
-      target->target,
-      GLOB_TILDE | GLOB_NOMAGIC,
-      glob_errfunc,
-      &globbed
-    )
-  )
-  {
-    die("error: globbing of \"%s\" failed", target->target);
-  }
-
-  for (i=0; i<globbed.gl_pathc; i++)
+  size_t i;
+  for (i=0; i<n_root_aliases; i++)
   {
-    scan(globbed.gl_pathv[i], target, wd_dict, watch, 0);
+    free(root_aliases[i].path);
+    free(root_aliases[i].real_path);
   }
-  globfree(&globbed);
+  free(root_aliases);
+  root_aliases = NULL;
+  n_root_aliases = 0;
 }
 
 
 
+/*!
+  @brief
+  Get the target that owns a path.
 
+  @param
+  path The path.
 
+  @param
+  target The target through which the path was found. It is returned if the
+  path is not within any indexed directory.
 
-/*!
-  @brief
-  Rabbit tree node traversal function to remove watches.
+  @return
+  The most specific target of the path.
 */
-int
-remove_all_watches(
-  wd_key_data_t * key_data,
-  wd_key_size_t height,
-  va_list args
-)
+static inline target_t *
+owning_target(char * path, target_t * target)
 {
-  inotify_rm_watch(INOTIFY_INSTANCE, (int) (* key_data->key));
-  return 0;
+  target_t * owner;
+  if (target_index == NULL)
+  {
+    return target;
+  }
+  owner = target_index_lookup(target_index, path);
+  return (owner == NULL) ? target : owner;
 }
 
 
 
-
-
 /*!
   @brief
-  Print the usage message to a file descriptor.
+  Check if a directory is a mount point that must not be entered.
+
+  The path is canonicalized before it is looked up in the mount index: trailing
+  slashes are ignored and paths below non-canonical target directories are
+  translated to their real paths. Target directories themselves are never
+  boundaries.
+
+  @param
+  path The path of the directory.
+
+  @return
+  1 if the directory is a mount point, 0 if it is not, or -1 if the mount index
+  cannot tell, in which case devices must be compared instead.
+*/
+int
+mount_boundary(const char * path)
+{
+  char canonical[PATH_MAX + 1];
+  size_t i, l, r;
+  root_alias_t * alias;
+
+  if (target_index != NULL && target_index_contains(target_index, path))
+  {
+    return 0;
+  }
+  if (mount_index.fd == -1)
+  {
+    return -1;
+  }
+
+  l = strnlen(path, PATH_MAX);
+  while (l > 1 && path[l - 1] == '/')
+  {
+    l --;
+  }
+
+  alias = NULL;
+  for (i=0; i<n_root_aliases; i++)
+  {
+    if (
+      root_aliases[i].len < l &&
+      path[root_aliases[i].len] == '/' &&
+      ! memcmp(path, root_aliases[i].path, root_aliases[i].len) &&
+      (alias == NULL || root_aliases[i].len > alias->len)
+    )
+    {
+      alias = &root_aliases[i];
+    }
+  }
+
+  if (alias == NULL)
+  {
+    if (path[0] != '/')
+    {
+      return -1;
+    }
+    memcpy(canonical, path, l);
+  }
+  else
+  {
+    if (alias->real_path == NULL)
+    {
+      return -1;
+    }
+    r = strlen(alias->real_path);
+    if (r + l - alias->len > PATH_MAX)
+    {
+      return -1;
+    }
+    memcpy(canonical, alias->real_path, r);
+    memcpy(canonical + r, path + alias->len, l - alias->len);
+    l = r + l - alias->len;
+  }
+  canonical[l] = '\0';
+  return mountinfo_is_mount_point(&mount_index, canonical);
+}
+
+
+
+/*!
+  @brief
+  Get the path entry of a directory that is being watched.
+
+  @param
+  path The path of the directory.
+
+  @param
+  parent The entry of the parent directory, or NULL if it is not watched. The
+  entry then holds the full path.
+
+  @param
+  old The current entry of the directory's watch descriptor, or NULL. It is
+  reused if it matches, e.g. when a watched directory is rescanned.
+
+  @return
+  A new reference to the entry.
+*/
+path_entry_t *
+watch_path_entry(char * path, path_entry_t * parent, path_entry_t * old)
+{
+  size_t start, l;
+  path_entry_t * entry;
+
+  l = strlen(path);
+  while (l > 0 && path[l - 1] == '/')
+  {
+    l --;
+  }
+  start = 0;
+  if (parent != NULL)
+  {
+    start = l;
+    while (start > 0 && path[start - 1] != '/')
+    {
+      start --;
+    }
+  }
+  if (
+    old != NULL &&
+    old->parent == parent &&
+    strlen(old->name) == l - start &&
+    ! memcmp(old->name, path + start, l - start)
+  )
+  {
+    return path_entry_ref(old);
+  }
+  entry = path_entry_new(parent, path + start, l - start);
+  if (entry == NULL)
+  {
+    die("error: failed to allocate path entry");
+  }
+  return entry;
+}
+
+
+
+/*!
+  @brief
+  Record a watch in the dictionary and in the path index of a watcher.
+
+  If the watch descriptor was already recorded for another path, e.g. because
+  the directory was moved, the other path is removed from the index.
+
+  @param
+  watcher The watcher.
+
+  @param
+  wd The watch descriptor.
+
+  @param
+  path The path of the watched directory.
+
+  @param
+  parent The path entry of the watched parent directory, or NULL.
+
+  @param
+  target The target.
+
+  @param
+  dev The device of the directory.
+
+  @return
+  A new reference to the path entry of the watch.
+*/
+path_entry_t *
+record_watch(
+  watcher_t * watcher,
+  int wd,
+  char * path,
+  path_entry_t * parent,
+  target_t * target,
+  dev_t dev
+)
+{
+  char old_path[PATH_MAX + 1];
+  watchlist_data_t data;
+  path_entry_t * old;
+
+  old = wd_retrieve(watcher->wd_dict, wd).path;
+  data.path = watch_path_entry(path, parent, old);
+  if (old != NULL && old != data.path && path_entry_format(old, old_path))
+  {
+    watch_index_delete(watcher->path_index, old_path, wd);
+  }
+  data.target = target;
+  data.dev = dev;
+  wd_insert(watcher->wd_dict, wd, data);
+  if (watch_index_add(watcher->path_index, path, wd))
+  {
+    die("error: failed to index watch (%s)", path);
+  }
+  watcher->changes ++;
+  return data.path;
+}
+
+
+
+/*!
+  @brief
+  Remove a watch from the dictionary and from the path index of a watcher. The
+  watch is not removed from the event source.
+
+  @param
+  watcher The watcher.
+
+  @param
+  wd The watch descriptor. Unknown watch descriptors are ignored.
+*/
+void
+forget_watch(watcher_t * watcher, int wd)
+{
+  char path[PATH_MAX + 1];
+  path_entry_t * entry;
+
+  entry = wd_retrieve(watcher->wd_dict, wd).path;
+  if (entry == NULL)
+  {
+    return;
+  }
+  if (path_entry_format(entry, path))
+  {
+    watch_index_delete(watcher->path_index, path, wd);
+  }
+  wd_delete(watcher->wd_dict, wd);
+  watcher->changes ++;
+}
+
+
+
+/*!
+  @brief
+  Remove the watches of a directory and of all watched directories below it,
+  e.g. when the directory has been moved away. The watches are removed from the
+  event source as well, so later events for them are not delivered.
+
+  @param
+  watcher The watcher.
+
+  @param
+  path The path of the directory.
+*/
+void
+drop_watches(watcher_t * watcher, const char * path)
+{
+  watch_list_t list;
+  size_t i;
+
+  list.wds = NULL;
+  list.n = 0;
+  list.size = 0;
+  if (watch_index_subtree(watcher->path_index, path, &list))
+  {
+    die("error: failed to collect watches (%s)", path);
+  }
+  if (verbose_mode > 1 && list.n)
+  {
+    msg_log("dropping %zu watch(es) below %s", list.n, path);
+  }
+  for (i=0; i<list.n; i++)
+  {
+    watcher->source->rm_watch(watcher->source, list.wds[i]);
+    forget_watch(watcher, list.wds[i]);
+  }
+  free(list.wds);
+}
+
+
+
+/*!
+  @brief
+  Recursively scan a directory, modifying attributes and building the watchlist.
+
+  @param
+  path The path.
+
+  @param
+  target The target struct.
+
+  @param
+  watcher The watcher with which to register watches.
+
+  @param
+  watch If "true" then found files and directories will be watched.
+
+  @param
+  dev The parent device. This is used to determine device crossing during
+  recursion.
+
+  @param
+  parent The path entry of the watched parent directory, or NULL.
+*/
+void
+scan(
+  char * path,
+  target_t * target,
+  watcher_t * watcher,
+  int watch,
+  dev_t dev,
+  path_entry_t * parent
+)
+{
+  char tmp_path[PATH_MAX + 1];
+  int l, wd, boundary;
+  DIR * dir;
+  struct dirent * de;
+  struct stat st;
+  target_t * owner;
+  path_entry_t * entry;
+
+  if (stopping)
+  {
+    return;
+  }
+
+  if (verbose_mode > 1)
+  {
+    msg_log("scanning %s", path);
+  }
+
+  owner = owning_target(path, target);
+  /*
+    Independent workers leave directories of nested targets to the workers of
+    those targets.
+  */
+  if (independent_targets && owner != target)
+  {
+    return;
+  }
+  target = owner;
+  if (match_pattern_queue(target->pattern, path) != INCLUDE)
+  {
+    return;
+  }
+
+  if (lstat(path, &st))
+  {
+    if (errno == ENOENT)
+    {
+      return;
+    }
+    die("error: failed to stat \"%s\"", path);
+  }
+
+
+  if (
+    adjust_attrib(path, &st, target) ||
+    ! S_ISDIR(st.st_mode) ||
+    (
+      no_device_crossing && dev &&
+      ((boundary = mount_boundary(path)) == -1 ? st.st_dev != dev : boundary)
+    )
+  )
+  {
+    return;
+  }
+
+  strcpy(tmp_path, path);
+  l = maybe_append_slash(tmp_path);
+
+  entry = NULL;
+  if (watch)
+  {
+    wd = watcher->source->add_watch(watcher->source, path, EVENTS);
+    if (wd == -1)
+    {
+      die("error: failed to add watch (%s)", path);
+    }
+
+    entry = record_watch(watcher, wd, path, parent, target, st.st_dev);
+  }
+
+  dir = opendir(path);
+  if (dir == NULL)
+  {
+    if (errno == ENOENT)
+    {
+      path_entry_unref(entry);
+      return;
+    }
+    die("error: failed to open directory \"%s\"", path);
+  }
+
+  errno = 0;
+  while ((de = readdir(dir)) != NULL && errno == 0)
+  {
+    // skip "." and ".."
+    if
+    (
+      de->d_name[0] == '.' &&
+      (
+        de->d_name[1] == '\0' ||
+        (
+          de->d_name[1] == '.' &&
+          de->d_name[2] == '\0'
+        )
+      )
+    )
+    {
+      continue;
+    }
+    strcpy(tmp_path+l, de->d_name);
+    scan(tmp_path, target, watcher, watch, st.st_dev, entry);
+  }
+  closedir(dir);
+  path_entry_unref(entry);
+}
+
+
+/*!
+  @brief
+  Chown and chmod files and directories (recursively) and optionally watch them
+  for further changes.
+
+  @param
+  target The target struct.
+
+  @param
+  watcher The watcher with which to register watches. It may be NULL if
+  `watch` is "false".
+
+  @param
+  watch If "true" then found files and directories will be watched.
+*/
+void
+glob_scan(
+  target_t * target,
+  watcher_t * watcher,
+  int watch
+)
+{
+  int i;
+  glob_t globbed;
+
+  if (
+    glob(
+      target->target,
+      GLOB_TILDE | GLOB_NOMAGIC,
+      glob_errfunc,
+      &globbed
+    )
+  )
+  {
+    die("error: globbing of \"%s\" failed", target->target);
+  }
+
+  for (i=0; i<globbed.gl_pathc; i++)
+  {
+    scan(globbed.gl_pathv[i], target, watcher, watch, 0, NULL);
+  }
+  globfree(&globbed);
+}
+
+
+
+/*!
+  @brief
+  A directory found by `watch_breadth_first()`.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The path of the directory.
+  */
+  char * path;
+
+  /*!
+    @brief
+    The target that led to the directory.
+  */
+  target_t * target;
+
+  /*!
+    @brief
+    If "false" then the directory is on another device and only its own
+    attributes should be adjusted.
+  */
+  int recurse;
+
+  /*!
+    @brief
+    The device of the directory. It is only set if `no_device_crossing` is set.
+  */
+  dev_t dev;
+
+  /*!
+    @brief
+    A reference to the path entry of the watched parent directory, or NULL.
+  */
+  path_entry_t * parent;
+}
+dir_entry_t;
+
+
+
+/*!
+  @brief
+  A growable queue of directories.
+
+  The same array is used first as the breadth-first queue for registering
+  watches and then as the work list for the attribute sweep.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The directories.
+  */
+  dir_entry_t * entries;
+
+  /*!
+    @brief
+    The number of directories in the queue.
+  */
+  size_t n;
+
+  /*!
+    @brief
+    The number of allocated entries.
+  */
+  size_t size;
+
+  /*!
+    @brief
+    The index of the next directory to sweep.
+  */
+  size_t sweep;
+}
+dir_queue_t;
+
+
+
+/*!
+  @brief
+  The state required to watch a set of targets and handle their events.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The watches of the targets.
+  */
+  watcher_t watcher;
+
+  /*!
+    @brief
+    The targets handled by the worker.
+  */
+  target_t * targets;
+
+  /*!
+    @brief
+    The number of targets.
+  */
+  size_t n_targets;
+
+  /*!
+    @brief
+    The queue of the attribute sweep.
+  */
+  dir_queue_t queue;
+
+  /*!
+    @brief
+    The trace to which events are recorded, or NULL.
+  */
+  trace_t * trace;
+
+  /*!
+    @brief
+    The thread of the worker if targets are handled independently.
+  */
+  pthread_t thread;
+
+  /*!
+    @brief
+    The barrier at which independent workers wait twice after registering
+    their initial watches so that the ownership of the targets can be checked,
+    or NULL.
+  */
+  pthread_barrier_t * started;
+}
+worker_t;
+
+
+
+/*!
+  @brief
+  Append a directory to the queue.
+
+  @param
+  queue The queue.
+
+  @param
+  path The path of the directory.
+
+  @param
+  target The target struct.
+
+  @param
+  recurse If "false" then the directory will not be entered.
+
+  @param
+  dev The device of the directory.
+
+  @param
+  parent The path entry of the watched parent directory, or NULL.
+*/
+void
+dir_queue_push(
+  dir_queue_t * queue,
+  char * path,
+  target_t * target,
+  int recurse,
+  dev_t dev,
+  path_entry_t * parent
+)
+{
+  dir_entry_t * tmp_entries;
+
+  if (queue->n == queue->size)
+  {
+    queue->size = queue->size ? queue->size * 2 : 0x400;
+    tmp_entries = realloc(queue->entries, queue->size * sizeof(dir_entry_t));
+    if (tmp_entries == NULL)
+    {
+      die("error: failed to allocate memory for directory queue");
+    }
+    queue->entries = tmp_entries;
+  }
+
+  queue->entries[queue->n].path = strdup(path);
+  if (queue->entries[queue->n].path == NULL)
+  {
+    die("error: failed to duplicate string");
+  }
+  queue->entries[queue->n].target = target;
+  queue->entries[queue->n].recurse = recurse;
+  queue->entries[queue->n].parent = path_entry_ref(parent);
+  queue->entries[queue->n].dev = dev;
+  queue->n ++;
+}
+
+
+
+/*!
+  @brief
+  Free the directories in a queue and reset it.
+
+  @param
+  queue The queue.
+*/
+void
+dir_queue_clear(dir_queue_t * queue)
+{
+  size_t i;
+  for (i=0; i<queue->n; i++)
+  {
+    free(queue->entries[i].path);
+    path_entry_unref(queue->entries[i].parent);
+  }
+  free(queue->entries);
+  queue->entries = NULL;
+  queue->n = 0;
+  queue->size = 0;
+  queue->sweep = 0;
+}
+
+
+
+/*!
+  @brief
+  Determine if a directory entry is a directory without following symlinks.
+
+  @param
+  path The full path of the entry.
+
+  @param
+  de The directory entry.
+
+  @param
+  st A stat struct to load if `lstat` is required.
+
+  @return
+  True if the entry is a directory.
+*/
+int
+entry_is_dir(char * path, struct dirent * de, struct stat * st)
+{
+  if (de->d_type != DT_UNKNOWN)
+  {
+    return de->d_type == DT_DIR;
+  }
+  if (lstat(path, st))
+  {
+    return 0;
+  }
+  return S_ISDIR(st->st_mode);
+}
+
+
+
+/*!
+  @brief
+  Watch all directories of a target breadth-first without adjusting attributes.
+
+  Every watched directory is appended to the queue so that attributes can be
+  adjusted later by `sweep_step()`. Directories are watched before they are
+  read so that items created while the rest of the hierarchy is being
+  registered will trigger events. Directories are queued with their most
+  specific target, which differs from the given one for nested targets.
+
+  @param
+  target The target struct.
+
+  @param
+  watcher The watcher with which to register watches.
+
+  @param
+  queue The queue to which watched directories are appended.
+*/
+void
+watch_breadth_first(
+  target_t * target,
+  watcher_t * watcher,
+  dir_queue_t * queue
+)
+{
+  char tmp_path[PATH_MAX + 1];
+  int l, wd, boundary;
+  size_t i, head;
+  dev_t dev;
+  DIR * dir;
+  struct dirent * de;
+  struct stat st;
+  glob_t globbed;
+  target_t * owner;
+  path_entry_t * entry;
+
+  if (
+    glob(
+      target->target,
+      GLOB_TILDE | GLOB_NOMAGIC,
+      glob_errfunc,
+      &globbed
+    )
+  )
+  {
+    die("error: globbing of \"%s\" failed", target->target);
+  }
+
+  /*
+    Directories of nested targets may already have been watched by the walk of
+    an enclosing target.
+  */
+  head = queue->n;
+  for (i=0; i<globbed.gl_pathc; i++)
+  {
+    owner = owning_target(globbed.gl_pathv[i], target);
+    if (
+      (! independent_targets || owner == target) &&
+      watch_index_lookup(watcher->path_index, globbed.gl_pathv[i]) == -1 &&
+      match_pattern_queue(owner->pattern, globbed.gl_pathv[i]) == INCLUDE &&
+      ! lstat(globbed.gl_pathv[i], &st) &&
+      S_ISDIR(st.st_mode)
+    )
+    {
+      dir_queue_push(queue, globbed.gl_pathv[i], owner, 1, st.st_dev, NULL);
+    }
+  }
+  globfree(&globbed);
+
+  for (; head<queue->n && ! stopping; head++)
+  {
+    if (! queue->entries[head].recurse)
+    {
+      continue;
+    }
+
+    strcpy(tmp_path, queue->entries[head].path);
+    target = queue->entries[head].target;
+
+    if (verbose_mode > 1)
+    {
+      msg_log("watching %s", tmp_path);
+    }
+
+    wd = watcher->source->add_watch(watcher->source, tmp_path, EVENTS);
+    if (wd == -1)
+    {
+      if (errno == ENOENT)
+      {
+        continue;
+      }
+      die("error: failed to add watch (%s)", tmp_path);
+    }
+    dev = queue->entries[head].dev;
+    entry = record_watch(watcher, wd, tmp_path, queue->entries[head].parent, target, dev);
+    l = maybe_append_slash(tmp_path);
+
+    dir = opendir(tmp_path);
+    if (dir == NULL)
+    {
+      if (errno == ENOENT)
+      {
+        path_entry_unref(entry);
+        continue;
+      }
+      die("error: failed to open directory \"%s\"", tmp_path);
+    }
+
+    errno = 0;
+    while ((de = readdir(dir)) != NULL && errno == 0)
+    {
+      if
+      (
+        de->d_name[0] == '.' &&
+        (
+          de->d_name[1] == '\0' ||
+          (
+            de->d_name[1] == '.' &&
+            de->d_name[2] == '\0'
+          )
+        )
+      )
+      {
+        continue;
+      }
+      strcpy(tmp_path+l, de->d_name);
+      if (! entry_is_dir(tmp_path, de, &st))
+      {
+        continue;
+      }
+      /*
+        Entering a nested target that was walked before, or that is left to
+        another worker.
+      */
+      owner = owning_target(tmp_path, target);
+      if (
+        (
+          owner != target &&
+          (
+            independent_targets ||
+            watch_index_lookup(watcher->path_index, tmp_path) != -1
+          )
+        ) ||
+        match_pattern_queue(owner->pattern, tmp_path) != INCLUDE
+      )
+      {
+        continue;
+      }
+      /*
+        Use the mount index to avoid stat'ing every directory. Fall back to
+        comparing devices if it cannot tell.
+      */
+      if (! no_device_crossing)
+      {
+        dir_queue_push(queue, tmp_path, owner, 1, 0, entry);
+      }
+      else if ((boundary = mount_boundary(tmp_path)) != -1)
+      {
+        dir_queue_push(queue, tmp_path, owner, ! boundary, dev, entry);
+      }
+      else
+      {
+        if (lstat(tmp_path, &st))
+        {
+          continue;
+        }
+        dir_queue_push(queue, tmp_path, owner, st.st_dev == dev, dev, entry);
+      }
+    }
+    closedir(dir);
+    path_entry_unref(entry);
+  }
+}
+
+
+
+/*!
+  @brief
+  Adjust the attributes of the next directories in the sweep.
+
+  Each directory is adjusted along with all of its entries that are not
+  directories. Subdirectories are adjusted when their own turn comes.
+
+  @param
+  queue The queue filled by `watch_breadth_first()`.
+
+  @param
+  n The maximum number of directories to process.
+
+  @return
+  True if directories remain to be swept.
+*/
+int
+sweep_step(dir_queue_t * queue, int n)
+{
+  char tmp_path[PATH_MAX + 1];
+  int l;
+  DIR * dir;
+  struct dirent * de;
+  struct stat st;
+  dir_entry_t * entry;
+
+  for (; n > 0 && queue->sweep < queue->n; n--)
+  {
+    entry = &(queue->entries[queue->sweep ++]);
+
+    if (verbose_mode > 1)
+    {
+      msg_log("sweeping %s", entry->path);
+    }
+
+    if (adjust_attrib(entry->path, NULL, entry->target) || ! entry->recurse)
+    {
+      continue;
+    }
+
+    strcpy(tmp_path, entry->path);
+    l = maybe_append_slash(tmp_path);
+
+    dir = opendir(tmp_path);
+    if (dir == NULL)
+    {
+      if (errno == ENOENT)
+      {
+        continue;
+      }
+      die("error: failed to open directory \"%s\"", tmp_path);
+    }
+
+    errno = 0;
+    while ((de = readdir(dir)) != NULL && errno == 0)
+    {
+      if (de->d_type == DT_DIR)
+      {
+        continue;
+      }
+      strcpy(tmp_path+l, de->d_name);
+      if (
+        match_pattern_queue(entry->target->pattern, tmp_path) != INCLUDE ||
+        lstat(tmp_path, &st) ||
+        S_ISDIR(st.st_mode)
+      )
+      {
+        continue;
+      }
+      adjust_attrib(tmp_path, &st, entry->target);
+    }
+    closedir(dir);
+  }
+  return queue->sweep < queue->n;
+}
+
+
+
+/*!
+  @brief
+  Return the number of seconds elapsed since the given time.
+
+  @param
+  start The start time, as returned by `clock_gettime()` with
+  `CLOCK_MONOTONIC`.
+*/
+double
+seconds_since(struct timespec * start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+
+/*!
+  @brief
+  Log the memory used by a watcher's watch descriptor dictionary and path
+  index.
+
+  @param
+  watcher The watcher.
+*/
+void
+log_watch_memory(watcher_t * watcher)
+{
+  wd_memory_t memory;
+  watch_path_node_stats_t stats;
+  size_t index_bytes, total;
+
+  wd_memory(watcher->wd_dict, &memory);
+  watch_path_node_stats(watcher->path_index, &stats);
+  index_bytes = stats.node_bytes + stats.key_bytes;
+  total = memory.map_bytes + memory.path_bytes + index_bytes;
+  msg_log(
+    "watch table: %zu watches, %zu bytes (%zu map, %zu paths, %zu index, %.1f per watch), depth %zu",
+    memory.entries,
+    total,
+    memory.map_bytes,
+    memory.path_bytes,
+    index_bytes,
+    memory.entries ? (double) total / memory.entries : 0.0,
+    memory.max_depth
+  );
+}
+
+
+
+
+
+
+/*!
+  @brief
+  `wd_foreach()` function to remove watches.
+
+  The event source must be passed as the argument.
+*/
+int
+remove_watch(int wd, watchlist_data_t * data, void * source)
+{
+  ((event_source_t *) source)->rm_watch(source, wd);
+  return 0;
+}
+
+
+
+
+
+/*!
+  @brief
+  Handle a single event.
+
+  @param
+  worker The worker that read the event. If the event queue overflowed, only
+  the targets of this worker are rescanned.
+
+  @param
+  event The event.
+
+  @param
+  data The watchlist data of the event's watch descriptor.
+*/
+void
+handle_event(worker_t * worker, struct inotify_event * event, watchlist_data_t * data)
+{
+  size_t j, l;
+  char tmp_path[PATH_MAX + 1];
+  watcher_t * watcher;
+  path_entry_t * entry;
+
+  watcher = &worker->watcher;
+
+  /*
+    Events of watch descriptors that are no longer in the dictionary have no
+    path, so only the events below that do not need one are handled for them.
+    The path entry is held until the event has been handled because the scans
+    may replace the value of the watch descriptor.
+  */
+  entry = path_entry_ref(data->path);
+  l = (entry == NULL) ? 0 : path_entry_format(entry, tmp_path);
+
+  /*
+    Triggered for items in watched directories: event->name is set
+  */
+  if (l && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+  {
+    strcpy(tmp_path + l, event->name);
+    scan(tmp_path, data->target, watcher, 1, data->dev, entry);
+  }
+
+
+  else if (l && (event->mask & IN_ATTRIB))
+  {
+    if (event->len)
+    {
+      strncat(tmp_path, event->name, event->len);
+    }
+    scan(tmp_path, data->target, watcher, 1, data->dev, event->len ? entry : entry->parent);
+  }
+
+
+  /*
+    Drop the watches of subdirectories that get moved away, along with all
+    watches below them. This event precedes the IN_MOVED_TO event of the new
+    location, if it is watched, so the rescan there adds new watches instead of
+    reusing the old ones, and the IN_MOVE_SELF and IN_IGNORED events of the old
+    watches are ignored.
+  */
+  else if (l && (event->mask & IN_MOVED_FROM))
+  {
+    if (event->mask & IN_ISDIR)
+    {
+      strcpy(tmp_path + l, event->name);
+      drop_watches(watcher, tmp_path);
+    }
+  }
+
+  /*
+    Rescan parent directories when contents are removed to see if a killmask
+    should be applied. The watches below removed subdirectories should already
+    be gone but are dropped in case their events were lost.
+  */
+  else if (l && (event->mask & IN_DELETE))
+  {
+    if (event->mask & IN_ISDIR)
+    {
+      strcpy(tmp_path + l, event->name);
+      drop_watches(watcher, tmp_path);
+      tmp_path[l] = '\0';
+    }
+    if (l > 1)
+    {
+      tmp_path[l - 1] = '\0';
+    }
+    scan(tmp_path, data->target, watcher, 1, data->dev, entry->parent);
+  }
+
+  /*
+     Remove directories that get moved without an IN_MOVED_FROM event, i.e.
+     those whose parent directories are not watched. No information is
+     provided about the new location, which may be outside of the
+     user-specified paths.
+  */
+  else if (l && (event->mask & IN_MOVE_SELF))
+  {
+    drop_watches(watcher, tmp_path);
+  }
+
+  /*
+    The kernel removes the watches of deleted directories itself and reports
+    each removed watch with IN_IGNORED, also when the watch was removed
+    otherwise.
+  */
+  else if (event->mask & (IN_DELETE_SELF | IN_IGNORED))
+  {
+    forget_watch(watcher, event->wd);
+  }
+
+
+  /*
+    Kill the watchlist and start over if the queue overflows.
+  */
+  if (event->mask & IN_Q_OVERFLOW)
+  {
+    /*
+      The full rescan below also reaches compliance.
+    */
+    if (verbose_mode)
+    {
+      msg_log("event queue overflow: rescanning %zu target(s)", worker->n_targets);
+    }
+    dir_queue_clear(&worker->queue);
+    wd_foreach(watcher->wd_dict, remove_watch, watcher->source);
+    wd_node_free(watcher->wd_dict);
+    watcher->wd_dict = wd_node_new();
+    watch_path_node_free(watcher->path_index);
+    watcher->path_index = watch_path_node_new();
+    watcher->changes ++;
+
+    for (j=0; j<worker->n_targets; j++)
+    {
+      glob_scan(&worker->targets[j], watcher, 1);
+    }
+  }
+  path_entry_unref(entry);
+}
+
+
+
+
+
+/*!
+  @brief
+  Watch the targets of a worker, then handle events until the event source is
+  exhausted.
+
+  This is also the thread routine when targets are handled independently.
+
+  @param
+  arg The worker.
+
+  @return
+  NULL
+*/
+void *
+run_worker(void * arg)
+{
+  char queue_buffer[BUF_LEN];
+  char trace_path[PATH_MAX + 1];
+  struct inotify_event * batch_events[EVENT_BATCH];
+  int batch_wds[EVENT_BATCH];
+  watchlist_data_t batch_data[EVENT_BATCH];
+  size_t i, k, n, end, window;
+  ssize_t j, l;
+  unsigned long events, changes;
+  double elapsed;
+  struct inotify_event * event;
+  struct timespec start_time, loop_time;
+  worker_t * worker;
+  watcher_t * watcher;
+  dir_queue_t * queue;
+
+  worker = arg;
+  watcher = &worker->watcher;
+  queue = &worker->queue;
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  if (watch_first)
+  {
+    for (i=0; i<worker->n_targets; i++)
+    {
+      watch_breadth_first(&worker->targets[i], watcher, queue);
+    }
+    if (verbose_mode)
+    {
+      msg_log("watches complete: %zu directories in %.3f s", queue->n, seconds_since(&start_time));
+      if (! queue->n)
+      {
+        msg_log("compliance sweep complete in %.3f s", seconds_since(&start_time));
+      }
+    }
+  }
+  else
+  {
+    for (i=0; i<worker->n_targets; i++)
+    {
+      glob_scan(&worker->targets[i], watcher, 1);
+    }
+    if (verbose_mode)
+    {
+      msg_log("watches complete and compliance reached in %.3f s", seconds_since(&start_time));
+    }
+  }
+  if (verbose_mode)
+  {
+    log_watch_memory(watcher);
+  }
+  if (worker->started != NULL)
+  {
+    pthread_barrier_wait(worker->started);
+    pthread_barrier_wait(worker->started);
+  }
+
+  events = 0;
+  window = EVENT_BATCH;
+  changes = 0;
+  clock_gettime(CLOCK_MONOTONIC, &loop_time);
+
+  while (! stopping)
+  {
+    /*
+      Continue the attribute sweep whenever no events are pending.
+    */
+    if (queue->n)
+    {
+      if (! watcher->source->pending(watcher->source))
+      {
+        if (! sweep_step(queue, SWEEP_BATCH))
+        {
+          if (verbose_mode)
+          {
+            msg_log("compliance sweep complete in %.3f s", seconds_since(&start_time));
+          }
+          dir_queue_clear(queue);
+        }
+        continue;
+      }
+    }
+
+    l = watcher->source->read(watcher->source, queue_buffer, BUF_LEN);
+    if (! l)
+    {
+      break;
+    }
+    if (no_device_crossing)
+    {
+      mountinfo_refresh(&mount_index);
+    }
+    n = 0;
+    j = 0;
+    while (j < l)
+    {
+      event = (struct inotify_event *) &queue_buffer[j];
+      j += EVENT_SIZE + event->len;
+      batch_events[n] = event;
+      batch_wds[n] = event->wd;
+      n ++;
+    }
+
+    end = 0;
+    for (k=0; k<n; k++)
+    {
+      /*
+        Resolve the watch descriptors of the buffer in batches. Modifications
+        of the dictionary invalidate retrieved paths, so the batches shrink
+        while events modify it and grow again while they do not.
+      */
+      if (k == end || watcher->changes != changes)
+      {
+        if (k < end)
+        {
+          window = (window > 1) ? window / 2 : 1;
+        }
+        else if (window < EVENT_BATCH)
+        {
+          window *= 2;
+        }
+        end = (n - k < window) ? n : k + window;
+        wd_retrieve_batch(watcher->wd_dict, batch_wds + k, batch_data + k, end - k);
+        changes = watcher->changes;
+      }
+
+      if (worker->trace != NULL)
+      {
+        if (batch_data[k].path == NULL || ! path_entry_format(batch_data[k].path, trace_path))
+        {
+          trace_record(worker->trace, batch_events[k], NULL);
+        }
+        else
+        {
+          trace_record(worker->trace, batch_events[k], trace_path);
+        }
+      }
+
+      handle_event(worker, batch_events[k], batch_data + k);
+      events ++;
+    }
+
+    if (watcher->source->handled != NULL)
+    {
+      watcher->source->handled(watcher->source);
+    }
+
+    /*
+      Keep the trace complete up to the last batch in case the daemon is killed.
+    */
+    if (worker->trace != NULL)
+    {
+      trace_flush(worker->trace);
+    }
+  }
+
+  /*
+    Only stopped workers and finite sources such as synthetic events and
+    replays get here.
+  */
+  if (stopping)
+  {
+    return NULL;
+  }
+  elapsed = seconds_since(&loop_time);
+  msg_log(
+    "events processed: %lu in %.3f s (%.0f events/s)",
+    events, elapsed, events / elapsed
+  );
+  log_watch_memory(watcher);
+  if (watcher->source->report != NULL)
+  {
+    watcher->source->report(watcher->source);
+  }
+  return NULL;
+}
+
+
+
+
+
+/*!
+  @brief
+  Check that each target directory is watched by the worker of its owning
+  target and by no other worker.
+
+  The workers must be paused.
+
+  @param
+  targets The targets.
+
+  @param
+  workers The workers.
+
+  @param
+  n_workers The number of workers.
+*/
+void
+check_target_ownership(target_t * targets, worker_t * workers, size_t n_workers)
+{
+  size_t i, j, k, n, checked;
+  int expected;
+  glob_t globbed;
+  struct stat st;
+  char * path;
+
+  checked = 0;
+  for (i=0; targets[i].target != NULL; i++)
+  {
+    if (glob(targets[i].target, GLOB_TILDE | GLOB_NOMAGIC, NULL, &globbed))
+    {
+      continue;
+    }
+    for (j=0; j<globbed.gl_pathc; j++)
+    {
+      path = globbed.gl_pathv[j];
+      if (
+        lstat(path, &st) ||
+        ! S_ISDIR(st.st_mode) ||
+        owning_target(path, NULL) != &targets[i]
+      )
+      {
+        continue;
+      }
+      expected = match_pattern_queue(targets[i].pattern, path) == INCLUDE;
+      n = 0;
+      for (k=0; k<n_workers; k++)
+      {
+        n += watch_index_lookup(workers[k].watcher.path_index, path) != -1;
+      }
+      if (n != expected)
+      {
+        msg_log("warning: \"%s\" is watched by %zu workers instead of %d", path, n, expected);
+      }
+      checked ++;
+    }
+    globfree(&globbed);
+  }
+  if (verbose_mode)
+  {
+    msg_log("target ownership checked: %zu directories", checked);
+  }
+}
+
+
+
+
+
+/*!
+  @brief
+  Print the usage message to a file descriptor.
 
   @param
   fd The output file descriptor.
@@ -621,8 +2195,20 @@ print_usage(FILE * fd)
 "  -k: enable the killmask (%03o)\n"
 "  -n: dry run\n"
 "  -h: display this message and exit\n"
+"  -i: handle each target independently with its own inotify instance and\n"
+"      thread so that queue overflows only affect the target that caused them\n"
 "  -p: <path>: write PID to path\n"
+"  -S <n>: benchmark event handling with n synthetic events instead of inotify\n"
+"          (implies -n)\n"
+"  -t <path>: record the event stream to a trace file\n"
+"  -T <path>: replay a trace file instead of using inotify, then report\n"
+"             throughput and latency; this modifies the watched paths, so only\n"
+"             use it with a scratch tree\n"
+"  -a <factor>: replay at <factor> times the recorded speed, or as fast as\n"
+"               possible if 0 (default: 1)\n"
+"  -R <path>: relocate replayed paths below this directory\n"
 "  -v: verbose mode (pass multiple times to increase verbosity)\n"
+"  -w: watch all directories first, then adjust attributes while handling events\n"
 "  -x: disable device crossing when recursing directories\n"
 "\n"
 "Read the man page for more information.\n"
@@ -635,23 +2221,38 @@ print_usage(FILE * fd)
 int
 main(int argc, char * * argv)
 {
-  int i, j, l, daemonize, update_and_exit;
-  char * pid_path, tmp_path[PATH_MAX + 1], queue_buffer[BUF_LEN];
-  struct inotify_event * event;
+  int i, daemonize, update_and_exit;
+  char * pid_path, * trace_path, * replay_path, * replay_root;
+  unsigned long synthetic_events;
+  double acceleration;
+  size_t j, n_targets, n_workers;
   FILE * f;
   pid_t pid;
   target_t * targets;
-  wd_node_t * wd_dict;
-  watchlist_data_t data;
+  worker_t * workers;
+  pthread_barrier_t started;
 
   update_and_exit = 0;
   daemonize = 0;
   pid_path = NULL;
+  synthetic_events = 0;
+  trace_path = NULL;
+  replay_path = NULL;
+  replay_root = NULL;
+  acceleration = 1;
 
-  while((i = getopt(argc, argv, "dehknp:vx")) != -1)
+  while((i = getopt(argc, argv, "a:dehiknp:R:S:t:T:vwx")) != -1)
   {
     switch(i)
     {
+      case 'a':
+        acceleration = strtod(optarg, NULL);
+        if (acceleration < 0)
+        {
+          errno = EINVAL;
+          die("error: invalid acceleration (%s)", optarg);
+        }
+        break;
       case 'h':
         print_usage(stdout);
         return(EXIT_SUCCESS);
@@ -662,6 +2263,9 @@ main(int argc, char * * argv)
       case 'e':
         update_and_exit = 1;
         break;
+      case 'i':
+        independent_targets = 1;
+        break;
       case 'k':
         enable_killmask = 1;
         break;
@@ -671,9 +2275,25 @@ main(int argc, char * * argv)
       case 'p':
         pid_path = optarg;
         break;
+      case 'R':
+        replay_root = optarg;
+        break;
+      case 'S':
+        synthetic_events = strtoul(optarg, NULL, 10);
+        dry_run = 1;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'T':
+        replay_path = optarg;
+        break;
       case 'v':
         verbose_mode += 1;
         break;
+      case 'w':
+        watch_first = 1;
+        break;
       case 'x':
         no_device_crossing = 1;
         break;
@@ -738,23 +2358,67 @@ main(int argc, char * * argv)
 
 
   targets = parse_targets(argv[optind]);
+  index_targets(targets);
+
+  if (no_device_crossing && mountinfo_load(&mount_index))
+  {
+    msg_log("warning: failed to load %s, falling back to device checks", MOUNTINFO_PATH);
+  }
 
   if (update_and_exit)
   {
     for (i=0; targets[i].target != NULL; i++)
     {
-      glob_scan(&targets[i], wd_dict, 0);
+      glob_scan(&targets[i], NULL, 0);
     }
+    path_node_free(target_index);
     free_targets(targets);
+    mountinfo_free(&mount_index);
+    free_root_aliases();
     exit(EXIT_SUCCESS);
   }
 
-  wd_dict = wd_node_new();
-  INOTIFY_INSTANCE = inotify_init();
+  if (independent_targets && (trace_path != NULL || replay_path != NULL))
+  {
+    errno = EINVAL;
+    die("error: -i cannot be combined with -t or -T");
+  }
 
-  for (i=0; targets[i].target != NULL; i++)
+  for (n_targets=0; targets[n_targets].target != NULL; n_targets++);
+  n_workers = independent_targets ? n_targets : 1;
+  workers = calloc(n_workers, sizeof(worker_t));
+  if (workers == NULL)
   {
-    glob_scan(&targets[i], wd_dict, 1);
+    die("error: failed to allocate memory for workers");
+  }
+
+  for (j=0; j<n_workers; j++)
+  {
+    if (independent_targets)
+    {
+      workers[j].targets = &targets[j];
+      workers[j].n_targets = 1;
+    }
+    else
+    {
+      workers[j].targets = targets;
+      workers[j].n_targets = n_targets;
+    }
+    workers[j].watcher.wd_dict = wd_node_new();
+    workers[j].watcher.path_index = watch_path_node_new();
+    if (synthetic_events)
+    {
+      workers[j].watcher.source = synthetic_source_new(synthetic_events);
+    }
+    else if (replay_path != NULL)
+    {
+      workers[j].watcher.source = replay_source_new(replay_path, replay_root, acceleration);
+    }
+    else
+    {
+      workers[j].watcher.source = inotify_source_new();
+    }
+    workers[j].trace = (trace_path == NULL) ? NULL : trace_open(trace_path);
   }
 
 
@@ -784,105 +2448,85 @@ main(int argc, char * * argv)
 
 
 
-  void cleanup(int signal)
-  {
-    close(INOTIFY_INSTANCE);
-//     wd_node_traverse_with_key(wd_dict, remove_all_watches);
-    wd_node_free(wd_dict);
-    free_targets(targets);
-    exit(EXIT_SUCCESS);
-  }
-
-
-  signal(SIGINT, cleanup);
-
-
-  while ((l = read(INOTIFY_INSTANCE, queue_buffer, BUF_LEN)))
+  void stop(int signal)
   {
-    i = 0;
-    while (i < l)
+    size_t k;
+    stopping = 1;
+    for (k=0; k<n_workers; k++)
     {
-//       e = event_queue[i];
-//       i ++;
-      event = (struct inotify_event *) &queue_buffer[i];
-      i += EVENT_SIZE + event->len;
-
-
-      /*
-        Triggered for items in watched directories: event->name is set
-      */
-      if (event->mask & (IN_CREATE | IN_MOVED_TO))
+      if (workers[k].watcher.source->interrupt != NULL)
       {
-        data = wd_retrieve(wd_dict, event->wd);
-        strcpy(tmp_path, data.path);
-        strcpy(tmp_path + strlen(tmp_path), event->name);
-        scan(tmp_path, data.target, wd_dict, 1, 0);
+        workers[k].watcher.source->interrupt(workers[k].watcher.source);
       }
+    }
+  }
 
 
-      else if (event->mask & IN_ATTRIB)
+  void cleanup(void)
+  {
+    for (j=0; j<n_workers; j++)
+    {
+      dir_queue_clear(&workers[j].queue);
+      workers[j].watcher.source->close(workers[j].watcher.source);
+      if (workers[j].trace != NULL)
       {
-        data = wd_retrieve(wd_dict, event->wd);
-        strcpy(tmp_path, data.path);
-        if (event->len)
-        {
-          strncat(tmp_path, event->name, event->len);
-        }
-        scan(tmp_path, data.target, wd_dict, 1, 0);
+        trace_close(workers[j].trace);
       }
+//       wd_foreach(workers[j].watcher.wd_dict, remove_watch, workers[j].watcher.source);
+      wd_node_free(workers[j].watcher.wd_dict);
+      watch_path_node_free(workers[j].watcher.path_index);
+    }
+    free(workers);
+    path_node_free(target_index);
+    free_targets(targets);
+    mountinfo_free(&mount_index);
+    free_root_aliases();
+    exit(EXIT_SUCCESS);
+  }
 
 
-      /*
-        Rescan parent directories when contents are removed to see if a killmask
-        should be applied.
-      */
-      else if (event->mask & IN_DELETE)
-      {
-        data = wd_retrieve(wd_dict, event->wd);
-        strcpy(tmp_path, data.path);
-        j = 0;
-        while ((tmp_path[j] = data.path[j]) != '\0')
-        {
-          j ++;
-        }
-        j--;
-        if (tmp_path[j] == '/');
-        {
-          tmp_path[j] = '\0';
-        }
-        scan(tmp_path, data.target, wd_dict, 1, 0);
-      }
-
-      /*
-         Remove directories that get moved. No information is provided about
-         the new location, which may be outside of the user-specified paths.
-         If the directory was moved to another location within the watched
-         hierarchy then it will be caught by IN_MOVED_TO above and re-added.
-      */
-      else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
-      {
-        wd_delete(wd_dict, event->wd);
-      }
+  /*
+    Stop the workers and release everything once they have returned.
+  */
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  signal(SIGHUP, stop);
 
 
-      /*
-        Kill the watchlist and start over if the queue overflows.
-      */
-      if (event->mask & IN_Q_OVERFLOW)
+  if (independent_targets)
+  {
+    errno = pthread_barrier_init(&started, NULL, n_workers + 1);
+    if (errno)
+    {
+      die("error: failed to create barrier");
+    }
+    for (j=0; j<n_workers; j++)
+    {
+      workers[j].started = &started;
+      errno = pthread_create(&workers[j].thread, NULL, run_worker, &workers[j]);
+      if (errno)
       {
-        wd_node_traverse_with_key(wd_dict, remove_all_watches);
-        wd_node_free(wd_dict);
-        wd_dict = wd_node_new();
-
-        for (i=0; targets[i].target != NULL; i++)
-        {
-          glob_scan(&targets[i], wd_dict, 1);
-        }
+        die("error: failed to create thread for %s", workers[j].targets->target);
       }
     }
+    pthread_barrier_wait(&started);
+    if (! stopping)
+    {
+      check_target_ownership(targets, workers, n_workers);
+    }
+    pthread_barrier_wait(&started);
+    for (j=0; j<n_workers; j++)
+    {
+      pthread_join(workers[j].thread, NULL);
+    }
+    pthread_barrier_destroy(&started);
+  }
+  else
+  {
+    run_worker(workers);
   }
 
-  cleanup(0);
+  cleanup();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,288 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "mountinfo.h"
+
+/*!
+  @brief
+  The size of the blocks in which the mount table is read.
+*/
+#define MOUNTINFO_BLOCK 0x4000
+
+
+
+/*!
+  @brief
+  Compare two mount points for sorting and searching.
+*/
+int
+mountinfo_compare(const void * a, const void * b)
+{
+  return strcmp(* (char * const *) a, * (char * const *) b);
+}
+
+
+
+/*!
+  @brief
+  Free the mount points of an index.
+
+  @param
+  mi The index.
+*/
+void
+mountinfo_clear(mountinfo_t * mi)
+{
+  size_t i;
+  for (i=0; i<mi->n; i++)
+  {
+    free(mi->mount_points[i]);
+  }
+  free(mi->mount_points);
+  mi->mount_points = NULL;
+  mi->n = 0;
+}
+
+
+
+/*!
+  @brief
+  Decode the octal escapes used for whitespace and backslashes in mount
+  points, in place.
+
+  @param
+  s The string.
+*/
+void
+mountinfo_unescape(char * s)
+{
+  char * c;
+  for (c = s; * s; c++)
+  {
+    if (
+      s[0] == '\\' &&
+      s[1] >= '0' && s[1] <= '3' &&
+      s[2] >= '0' && s[2] <= '7' &&
+      s[3] >= '0' && s[3] <= '7'
+    )
+    {
+      * c = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+      s += 4;
+    }
+    else
+    {
+      * c = * s;
+      s ++;
+    }
+  }
+  * c = '\0';
+}
+
+
+
+/*!
+  @brief
+  Read the mount table from the open file descriptor and rebuild the index.
+
+  @param
+  mi The index.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+int
+mountinfo_read(mountinfo_t * mi)
+{
+  char * buffer, * tmp, * line, * next, * field;
+  size_t len, size, n, size_points;
+  ssize_t l;
+  int i;
+  char * * tmp_points;
+
+  size = MOUNTINFO_BLOCK;
+  buffer = malloc(size);
+  if (buffer == NULL)
+  {
+    return -1;
+  }
+  if (lseek(mi->fd, 0, SEEK_SET) == -1)
+  {
+    free(buffer);
+    return -1;
+  }
+  len = 0;
+  while ((l = read(mi->fd, buffer + len, size - len - 1)) > 0)
+  {
+    len += l;
+    if (len == size - 1)
+    {
+      size *= 2;
+      tmp = realloc(buffer, size);
+      if (tmp == NULL)
+      {
+        free(buffer);
+        return -1;
+      }
+      buffer = tmp;
+    }
+  }
+  if (l < 0)
+  {
+    free(buffer);
+    return -1;
+  }
+  buffer[len] = '\0';
+
+  mountinfo_clear(mi);
+  n = 0;
+  size_points = 0x40;
+  mi->mount_points = malloc(size_points * sizeof(char *));
+  if (mi->mount_points == NULL)
+  {
+    free(buffer);
+    return -1;
+  }
+
+  /*
+    The mount point is the fifth space-separated field.
+  */
+  for (line = buffer; * line; line = next)
+  {
+    next = strchr(line, '\n');
+    if (next == NULL)
+    {
+      next = line + strlen(line);
+    }
+    else
+    {
+      * (next ++) = '\0';
+    }
+    field = line;
+    for (i=0; i<4 && field != NULL; i++)
+    {
+      field = strchr(field, ' ');
+      if (field != NULL)
+      {
+        field ++;
+      }
+    }
+    if (field == NULL)
+    {
+      continue;
+    }
+    tmp = strchr(field, ' ');
+    if (tmp != NULL)
+    {
+      * tmp = '\0';
+    }
+    mountinfo_unescape(field);
+
+    if (n == size_points)
+    {
+      size_points *= 2;
+      tmp_points = realloc(mi->mount_points, size_points * sizeof(char *));
+      if (tmp_points == NULL)
+      {
+        mi->n = n;
+        free(buffer);
+        return -1;
+      }
+      mi->mount_points = tmp_points;
+    }
+    mi->mount_points[n] = strdup(field);
+    if (mi->mount_points[n] == NULL)
+    {
+      mi->n = n;
+      free(buffer);
+      return -1;
+    }
+    n ++;
+  }
+  free(buffer);
+
+  qsort(mi->mount_points, n, sizeof(char *), mountinfo_compare);
+  mi->n = n;
+  return 0;
+}
+
+
+
+int
+mountinfo_load(mountinfo_t * mi)
+{
+  mi->mount_points = NULL;
+  mi->n = 0;
+  pthread_rwlock_init(&mi->lock, NULL);
+  mi->fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+  if (mi->fd == -1)
+  {
+    return -1;
+  }
+  if (mountinfo_read(mi))
+  {
+    mountinfo_free(mi);
+    return -1;
+  }
+  return 0;
+}
+
+
+
+int
+mountinfo_refresh(mountinfo_t * mi)
+{
+  struct pollfd pfd;
+
+  if (mi->fd == -1)
+  {
+    return 0;
+  }
+  pfd.fd = mi->fd;
+  pfd.events = POLLPRI;
+  if (poll(&pfd, 1, 0) <= 0 || ! (pfd.revents & (POLLPRI | POLLERR)))
+  {
+    return 0;
+  }
+  pthread_rwlock_wrlock(&mi->lock);
+  if (mountinfo_read(mi))
+  {
+    die("error: failed to reload %s", MOUNTINFO_PATH);
+  }
+  pthread_rwlock_unlock(&mi->lock);
+  return 1;
+}
+
+
+
+int
+mountinfo_is_mount_point(mountinfo_t * mi, const char * path)
+{
+  int found;
+  if (mi->fd == -1)
+  {
+    return 0;
+  }
+  pthread_rwlock_rdlock(&mi->lock);
+  found =
+    mi->n &&
+    bsearch(&path, mi->mount_points, mi->n, sizeof(char *), mountinfo_compare) != NULL;
+  pthread_rwlock_unlock(&mi->lock);
+  return found;
+}
+
+
+
+void
+mountinfo_free(mountinfo_t * mi)
+{
+  mountinfo_clear(mi);
+  if (mi->fd != -1)
+  {
+    close(mi->fd);
+    mi->fd = -1;
+  }
+}
@@ -0,0 +1,109 @@
+#ifndef MAOWN_MOUNTINFO_H
+#define MAOWN_MOUNTINFO_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*!
+  @brief
+  The mount table of the process.
+*/
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+
+/*!
+  @brief
+  A sorted index of mount points.
+
+  Unlike comparisons of `st_dev`, the index also recognizes bind mounts of the
+  same file system and it can be queried before a directory is stat'ed or
+  opened.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The sorted mount points.
+  */
+  char * * mount_points;
+
+  /*!
+    @brief
+    The number of mount points.
+  */
+  size_t n;
+
+  /*!
+    @brief
+    The open mount table, used to detect changes. It is -1 if the index is not
+    available.
+  */
+  int fd;
+
+  /*!
+    @brief
+    Lock held while the index is queried or reloaded, as it may be shared by
+    several threads.
+  */
+  pthread_rwlock_t lock;
+}
+mountinfo_t;
+
+/*!
+  @brief
+  Load the index. If the mount table cannot be opened then the index will be
+  empty and its file descriptor will be -1.
+
+  @param
+  mi The index.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+int
+mountinfo_load(mountinfo_t * mi);
+
+/*!
+  @brief
+  Reload the index if the mount table has changed since it was last read.
+
+  The kernel signals changes to the mount table with `POLLPRI`, so this only
+  costs a non-blocking `poll` if nothing has changed.
+
+  @param
+  mi The index.
+
+  @return
+  True if the index was reloaded.
+*/
+int
+mountinfo_refresh(mountinfo_t * mi);
+
+/*!
+  @brief
+  Check if a path is a mount point. This is safe to call while another thread
+  refreshes the index.
+
+  @param
+  mi The index.
+
+  @param
+  path The absolute path, without a trailing slash.
+
+  @return
+  True if the path is a mount point.
+*/
+int
+mountinfo_is_mount_point(mountinfo_t * mi, const char * path);
+
+/*!
+  @brief
+  Free the index and close the mount table.
+
+  @param
+  mi The index.
+*/
+void
+mountinfo_free(mountinfo_t * mi);
+
+#endif //MAOWN_MOUNTINFO_H
@@ -0,0 +1,213 @@
+#ifndef MAOWN_PATH_ENTRY_H
+#define MAOWN_PATH_ENTRY_H
+/*
+  Parent-linked path components of watched directories.
+
+  Each watched directory only stores its own name and a link to the entry of
+  its parent directory instead of its full path, so the common prefixes of deep
+  hierarchies are stored once. Full paths are assembled on demand.
+
+  Entries are reference-counted. Each holder of an entry, e.g. a watchlist
+  value or a child entry, owns one reference, so parent entries remain valid
+  while their descendants are still watched.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+  @brief
+  A path component.
+*/
+typedef
+struct path_entry
+{
+  /*!
+    @brief
+    The entry of the parent directory, or NULL if the name is a full path.
+  */
+  struct path_entry * parent;
+
+  /*!
+    @brief
+    The number of references to the entry.
+  */
+  unsigned int refs;
+
+  /*!
+    @brief
+    The name of the directory without slashes, or its full path without a
+    trailing slash if it has no parent entry.
+  */
+  char name[];
+}
+path_entry_t;
+
+
+
+/*!
+  @brief
+  Create an entry with a single reference, which belongs to the caller.
+
+  @param
+  parent The parent entry, or NULL. It gains a reference.
+
+  @param
+  name The name.
+
+  @param
+  length The length of the name.
+
+  @return
+  The entry, or NULL on error (check errno).
+*/
+static inline path_entry_t *
+path_entry_new(path_entry_t * parent, const char * name, size_t length)
+{
+  path_entry_t * entry;
+
+  entry = malloc(offsetof(path_entry_t, name) + length + 1);
+  if (entry == NULL)
+  {
+    return NULL;
+  }
+  entry->parent = parent;
+  if (parent != NULL)
+  {
+    parent->refs ++;
+  }
+  entry->refs = 1;
+  memcpy(entry->name, name, length);
+  entry->name[length] = '\0';
+  return entry;
+}
+
+
+
+/*!
+  @brief
+  Add a reference to an entry.
+
+  @param
+  entry The entry, or NULL.
+
+  @return
+  The entry.
+*/
+static inline path_entry_t *
+path_entry_ref(path_entry_t * entry)
+{
+  if (entry != NULL)
+  {
+    entry->refs ++;
+  }
+  return entry;
+}
+
+
+
+/*!
+  @brief
+  Release a reference to an entry. The entry is freed along with any parent
+  entries that are no longer referenced.
+
+  @param
+  entry The entry, or NULL.
+*/
+static inline void
+path_entry_unref(path_entry_t * entry)
+{
+  path_entry_t * parent;
+
+  while (entry != NULL && -- entry->refs == 0)
+  {
+    parent = entry->parent;
+    free(entry);
+    entry = parent;
+  }
+}
+
+
+
+/*!
+  @brief
+  Write the full path of an entry to a buffer, with a trailing slash.
+
+  @param
+  entry The entry.
+
+  @param
+  path The buffer of size `PATH_MAX + 1`.
+
+  @return
+  The length of the path, or 0 if it would exceed `PATH_MAX` (errno is then set
+  to `ENAMETOOLONG`).
+*/
+static inline size_t
+path_entry_format(path_entry_t * entry, char * path)
+{
+  path_entry_t * e;
+  size_t length, l, n;
+
+  length = 0;
+  for (e=entry; e!=NULL; e=e->parent)
+  {
+    length += strlen(e->name) + 1;
+  }
+  if (length > PATH_MAX)
+  {
+    errno = ENAMETOOLONG;
+    path[0] = '\0';
+    return 0;
+  }
+  path[length] = '\0';
+  l = length;
+  for (e=entry; e!=NULL; e=e->parent)
+  {
+    n = strlen(e->name);
+    path[-- l] = '/';
+    l -= n;
+    memcpy(path + l, e->name, n);
+  }
+  return length;
+}
+
+
+
+/*!
+  @brief
+  Print the full path of an entry.
+
+  @param
+  fd The output stream.
+
+  @param
+  entry The entry.
+*/
+static inline void
+path_entry_fprint(FILE * fd, path_entry_t * entry)
+{
+  if (entry != NULL)
+  {
+    path_entry_fprint(fd, entry->parent);
+    fprintf(fd, "%s/", entry->name);
+  }
+}
+
+
+
+/*!
+  @brief
+  Get the number of bytes allocated for an entry, excluding its parents.
+*/
+static inline size_t
+path_entry_bytes(path_entry_t * entry)
+{
+  return offsetof(path_entry_t, name) + strlen(entry->name) + 1;
+}
+
+#endif //MAOWN_PATH_ENTRY_H
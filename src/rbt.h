@@ -15,7 +15,7 @@
 #define RBT_KEY_SIZE_T_FORMAT "%u"
 #include <rbt/key.h>
 
-watchlist_data_t wd_empty_value = {.target = NULL, .path = NULL};
+watchlist_data_t wd_empty_value = {.target = NULL, .path = NULL, .dev = 0};
 
 #define RBT_NODE_H_PREFIX_ RBT_KEY_H_PREFIX_
 #define RBT_VALUE_T watchlist_data_t
@@ -24,52 +24,111 @@ watchlist_data_t wd_empty_value = {.target = NULL, .path = NULL};
 #define RBT_VALUE_IS_EQUAL(a, b)  \
 ( \
   (a.target == b.target) && \
-  ( \
-    (a.path == NULL) ? \
-    (b.path == NULL) : \
-    (strcmp(a.path, b.path) == 0) \
-  ) \
+  (a.dev == b.dev) && \
+  (a.path == b.path) \
 )
 
+/*
+  The path entries are shared by reference.
+*/
 #define RBT_VALUE_COPY(var,val,fail) \
 do \
 { \
-  var.target = val.target; \
-  if (var.path != NULL) \
-  { \
-    free(var.path); \
-    var.path = NULL; \
-  } \
-  if (val.path != NULL) \
-  { \
-    var.path = strdup(val.path); \
-    if (var.path == NULL) \
-    { \
-      fail; \
-    } \
-  } \
+  path_entry_ref(val.path); \
+  path_entry_unref(var.path); \
+  var = val; \
 } \
 while (0)
 
-#define RBT_VALUE_FREE(val) \
-do \
-{ \
-  if (val.path != NULL) \
-  { \
-    free(val.path); \
-  } \
-} \
-while (0)
+#define RBT_VALUE_FREE(val) path_entry_unref(val.path)
 
-#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, val.path)
+#define RBT_VALUE_FPRINT(fd, val) path_entry_fprint(fd, val.path)
+
+#define RBT_VALUE_HEAP_BYTES(val) ((val.path == NULL) ? 0 : path_entry_bytes(val.path))
+/*
+  Watch descriptors fit in a single pin, so store key fragments in the nodes.
+*/
+#ifndef RBT_NODE_KEY_INLINE_PINS
+#define RBT_NODE_KEY_INLINE_PINS 1
+#endif //RBT_NODE_KEY_INLINE_PINS
+/*
+  Allocate the nodes from per-tree slabs so that the tree can be rebuilt after
+  queue overflows without fragmenting the heap.
+*/
+#ifndef RBT_NODE_ARENA
+#define RBT_NODE_ARENA 0x10000
+#endif //RBT_NODE_ARENA
+/*
+  The keys have a fixed size, so traversals can use arrays for their stacks and
+  keys instead of allocating them.
+*/
+#define RBT_KEY_T int
+#define RBT_KEY_SIZE_FIXED sizeof(RBT_KEY_T)
 #include <rbt/node.h>
 
 #include <rbt/traverse_with_key.h>
 
+/*!
+  @brief
+  Pass each watch descriptor and its value to a function.
+
+  This uses an iterator instead of `wd_node_traverse_with_key()` so that the
+  function can be inlined.
+
+  @param
+  dict The tree.
+
+  @param
+  func The function. Iteration stops if it returns non-zero.
+
+  @param
+  arg An argument to pass to the function.
+*/
+static inline void
+wd_foreach(wd_node_t * dict, wd_foreach_function_t func, void * arg)
+{
+  wd_node_iterator_t iterator;
+  wd_key_data_t * key_data;
+
+  for (
+    key_data = wd_node_iterator_begin(&iterator, dict, 0);
+    key_data != NULL;
+    key_data = wd_node_iterator_next(&iterator)
+  )
+  {
+    if (func((int) (* key_data->key), &key_data->node->value, arg))
+    {
+      break;
+    }
+  }
+  wd_node_iterator_end(&iterator);
+}
+
+
+/*!
+  @brief
+  Get the memory used by the tree.
+
+  @param
+  dict The tree.
+
+  @param
+  memory The output memory statistics.
+*/
+static inline void
+wd_memory(wd_node_t * dict, wd_memory_t * memory)
+{
+  wd_node_stats_t stats;
+
+  wd_node_stats(dict, &stats);
+  memory->entries = stats.values;
+  memory->map_bytes = stats.arena_bytes ? stats.arena_bytes : stats.node_bytes + stats.key_bytes;
+  memory->path_bytes = stats.value_bytes;
+  memory->max_depth = stats.max_depth;
+}
+
 
 #define RBT_WRAPPER_H_PREFIX_ RBT_KEY_H_PREFIX_
-#define RBT_KEY_T int
-#define RBT_KEY_SIZE_FIXED sizeof(RBT_KEY_T)
 #define RBT_KEY_COUNT_BITS(key) (sizeof(RBT_KEY_T) * BITS_PER_BYTE)
 #define RBT_KEY_PTR(key) (&key)
 #define RBT_KEY_FPRINT(fd, key) fprintf(fd, "%d", key);
@@ -176,6 +176,7 @@
 #define RBT_HEADER_COMMON
 
 #include <limits.h>
+#include <stdint.h>
 
 /*!
   @brief
@@ -303,6 +304,42 @@
 */
 #define N_BIT_IS_1(x,n) (MOST_SIGNIFICANT_BIT(typeof(x)) & (x << n))
 
+/*!
+  @brief
+  Hint that the memory at an address will be read soon.
+
+  @param[in]
+  addr The address.
+*/
+#ifdef __GNUC__
+#define RBT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define RBT_PREFETCH(addr) ((void) (addr))
+#endif // __GNUC__
+
+
+/*!
+  @brief
+  Count the set bits of a 64-bit unsigned integer.
+
+  @param[in]
+  x The integer.
+*/
+#ifdef __GNUC__
+#define RBT_POPCOUNT64(x) __builtin_popcountll(x)
+#else
+#define RBT_POPCOUNT64(x) rbt_popcount64(x)
+
+static inline unsigned int
+rbt_popcount64(uint64_t x)
+{
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+#endif // __GNUC__
+
 /*!
   @brief
   Ceiling division of a positive integer.
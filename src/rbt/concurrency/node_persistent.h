@@ -0,0 +1,808 @@
+/*!
+  @file
+  @author Xyne
+  @copyright GPL2 only
+
+  This file is included automatically by node.h when
+  `RBT_CONCURRENCY_PERSISTENT` is defined. It provides a persistent wrapper
+  around trees that lets any number of threads read the tree without locks
+  while another thread modifies it.
+
+  Modifications never touch nodes that readers may see. Instead, each update
+  copies the nodes on the path from the root to the target, applies the normal
+  node functions to the copies and then publishes the new root atomically. All
+  other subtrees are shared between the old and new versions. Readers take a
+  snapshot of the current root and work on it with the usual read-only node
+  functions.
+
+  The replaced nodes are reclaimed with epochs. Each update retires its old
+  nodes under the current epoch and then advances it. Readers announce the
+  epoch in which they took their snapshot, and retired nodes are freed once no
+  active reader announced an epoch at or before their retirement.
+
+  Updates are serialized with a mutex. They cost one node and key copy per
+  level of the tree, plus a value copy with `RBT_VALUE_COPY()`, so this is
+  meant for trees that are read far more often than they are modified, or for
+  trees whose writer must never wait for readers.
+
+  This cannot be combined with `RBT_NODE_ARENA` because each version has a
+  different root node.
+*/
+
+#include <pthread.h>
+
+#if _RBT_NODE_ARENA > 0
+#error RBT_CONCURRENCY_PERSISTENT cannot be combined with RBT_NODE_ARENA.
+#endif // _RBT_NODE_ARENA
+
+/*!
+  @cond INTERNAL
+*/
+#undef RBT_NODE_PERSISTENT_T
+#define RBT_NODE_PERSISTENT_T                 RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_t)
+
+#undef RBT_NODE_PERSISTENT_READER_T
+#define RBT_NODE_PERSISTENT_READER_T          RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_reader_t)
+
+#undef RBT_NODE_PERSISTENT_NEW
+#define RBT_NODE_PERSISTENT_NEW               RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_new)
+
+#undef RBT_NODE_PERSISTENT_FREE
+#define RBT_NODE_PERSISTENT_FREE              RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_free)
+
+#undef RBT_NODE_PERSISTENT_READER_NEW
+#define RBT_NODE_PERSISTENT_READER_NEW        RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_reader_new)
+
+#undef RBT_NODE_PERSISTENT_READER_FREE
+#define RBT_NODE_PERSISTENT_READER_FREE       RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_reader_free)
+
+#undef RBT_NODE_PERSISTENT_READ_BEGIN
+#define RBT_NODE_PERSISTENT_READ_BEGIN        RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_read_begin)
+
+#undef RBT_NODE_PERSISTENT_READ_END
+#define RBT_NODE_PERSISTENT_READ_END          RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_read_end)
+
+#undef RBT_NODE_PERSISTENT_QUERY
+#define RBT_NODE_PERSISTENT_QUERY             RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_query)
+
+#undef RBT_NODE_PERSISTENT_RECLAIM
+#define RBT_NODE_PERSISTENT_RECLAIM           RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_reclaim)
+
+#undef _RBT_NODE_PERSISTENT_RETIRED_T
+#define _RBT_NODE_PERSISTENT_RETIRED_T        _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_retired_t)
+
+#undef _RBT_NODE_PERSISTENT_COPY_T
+#define _RBT_NODE_PERSISTENT_COPY_T           _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_copy_t)
+
+#undef _RBT_NODE_PERSISTENT_COPY
+#define _RBT_NODE_PERSISTENT_COPY             _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_copy)
+
+#undef _RBT_NODE_PERSISTENT_COPY_PATH
+#define _RBT_NODE_PERSISTENT_COPY_PATH        _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_copy_path)
+
+#undef _RBT_NODE_PERSISTENT_FREE_NODE
+#define _RBT_NODE_PERSISTENT_FREE_NODE        _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_persistent_free_node)
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  A reader of a persistent tree.
+
+  Each thread that reads the tree needs its own reader.
+*/
+typedef
+struct RBT_NODE_PERSISTENT_READER_T
+{
+  /*!
+    @brief
+    The epoch in which the current snapshot was taken, or 0 if the reader is
+    not reading.
+  */
+  unsigned long epoch;
+
+  /*!
+    @brief
+    The next reader of the tree.
+  */
+  struct RBT_NODE_PERSISTENT_READER_T * next;
+}
+RBT_NODE_PERSISTENT_READER_T;
+
+
+
+/*!
+  @cond INTERNAL
+*/
+/*!
+  @brief
+  A node that has been replaced and awaits reclamation.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The node.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The epoch in which the node was replaced.
+  */
+  unsigned long epoch;
+}
+_RBT_NODE_PERSISTENT_RETIRED_T;
+
+
+
+/*!
+  @brief
+  A node copied by the current update.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The node in the current version.
+  */
+  RBT_NODE_T * old;
+
+  /*!
+    @brief
+    Its copy in the next version.
+  */
+  RBT_NODE_T * copy;
+}
+_RBT_NODE_PERSISTENT_COPY_T;
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  A persistent tree.
+*/
+typedef
+struct RBT_NODE_PERSISTENT_T
+{
+  /*!
+    @brief
+    The root node of the current version. It is only replaced atomically.
+  */
+  RBT_NODE_T * root;
+
+  /*!
+    @brief
+    The current epoch. It starts at 1.
+  */
+  unsigned long epoch;
+
+  /*!
+    @brief
+    The mutex that serializes updates and protects the fields below.
+  */
+  pthread_mutex_t mutex;
+
+  /*!
+    @brief
+    The registered readers.
+  */
+  RBT_NODE_PERSISTENT_READER_T * readers;
+
+  /*!
+    @brief
+    The retired nodes, in order of retirement.
+  */
+  _RBT_NODE_PERSISTENT_RETIRED_T * retired;
+
+  /*!
+    @brief
+    The number of retired nodes.
+  */
+  size_t n_retired;
+
+  /*!
+    @brief
+    The number of allocated retired node entries.
+  */
+  size_t size_retired;
+
+  /*!
+    @brief
+    The nodes copied by the current update.
+  */
+  _RBT_NODE_PERSISTENT_COPY_T * copies;
+
+  /*!
+    @brief
+    The number of nodes copied by the current update.
+  */
+  size_t n_copies;
+
+  /*!
+    @brief
+    The number of allocated copy entries.
+  */
+  size_t size_copies;
+}
+RBT_NODE_PERSISTENT_T;
+
+
+
+/*!
+  @cond INTERNAL
+*/
+/*!
+  @brief
+  Free a single node without its children.
+
+  @param[in]
+  node The node.
+*/
+static inline void
+_RBT_NODE_PERSISTENT_FREE_NODE(
+  RBT_NODE_T * node
+)
+{
+  node->left = NULL;
+  node->right = NULL;
+  RBT_NODE_FREE(node);
+}
+
+
+
+/*!
+  @brief
+  Copy a node of the current version for the next version.
+
+  @param[in]
+  tree The tree.
+
+  @param[in]
+  node The node.
+
+  @return
+  The copy, or `NULL` on error (check errno).
+*/
+RBT_NODE_T *
+_RBT_NODE_PERSISTENT_COPY(
+  RBT_NODE_PERSISTENT_T * tree,
+  RBT_NODE_T * node
+)
+{
+  _RBT_NODE_PERSISTENT_COPY_T * copies;
+  size_t size;
+  RBT_NODE_T * copy;
+
+  if (tree->n_copies == tree->size_copies)
+  {
+    size = tree->size_copies ? tree->size_copies * 2 : 0x40;
+    copies = realloc(tree->copies, size * sizeof(_RBT_NODE_PERSISTENT_COPY_T));
+    if (copies == NULL)
+    {
+      return NULL;
+    }
+    tree->copies = copies;
+    tree->size_copies = size;
+  }
+  copy = RBT_NODE_CREATE(node->key, node->bits, node->value, node->left, node->right);
+  if (copy != NULL)
+  {
+    tree->copies[tree->n_copies].old = node;
+    tree->copies[tree->n_copies].copy = copy;
+    tree->n_copies ++;
+  }
+  return copy;
+}
+
+
+
+/*!
+  @brief
+  Copy the nodes that an update of the given key may modify.
+
+  This follows the same path as `RBT_NODE_RETRIEVE()` and copies every node on
+  it. Deletions may also merge the target's only child or the target's sibling
+  into another node, so those are copied as well.
+
+  @param[in]
+  tree The tree.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[in]
+  deletion Non-zero if the update removes an existing value.
+
+  @return
+  The root of the next version, or `NULL` on error (check errno). On error,
+  all copies are freed.
+*/
+RBT_NODE_T *
+_RBT_NODE_PERSISTENT_COPY_PATH(
+  RBT_NODE_PERSISTENT_T * tree,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  int deletion
+)
+{
+  RBT_KEY_SIZE_T common_bits, common_staggered_bits, common_pins;
+  RBT_NODE_T * root, * copy, * parent, * * child_ptr;
+  size_t i;
+
+  tree->n_copies = 0;
+  parent = NULL;
+  root = copy = _RBT_NODE_PERSISTENT_COPY(tree, tree->root);
+  if (copy == NULL)
+  {
+    goto fail;
+  }
+
+  /*
+    See RBT_NODE_RETRIEVE() for the special handling of keyless root nodes.
+  */
+  if (copy->bits == 0)
+  {
+    if (bits == 0 || (copy->left == NULL && copy->right == NULL))
+    {
+      return root;
+    }
+    child_ptr = FIRST_BIT_IS_1(key[0]) ? &copy->right : &copy->left;
+    if (* child_ptr == NULL)
+    {
+      return root;
+    }
+    parent = copy;
+    copy = * child_ptr = _RBT_NODE_PERSISTENT_COPY(tree, * child_ptr);
+    if (copy == NULL)
+    {
+      goto fail;
+    }
+  }
+
+  while (1)
+  {
+    common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, copy->key, MIN(bits, copy->bits));
+    if (common_bits == bits || common_bits != copy->bits)
+    {
+      break;
+    }
+    RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
+    key += common_pins;
+    bits += common_staggered_bits - common_bits;
+    child_ptr = N_BIT_IS_1(key[0], common_staggered_bits) ? &copy->right : &copy->left;
+    if (* child_ptr == NULL)
+    {
+      break;
+    }
+    parent = copy;
+    copy = * child_ptr = _RBT_NODE_PERSISTENT_COPY(tree, * child_ptr);
+    if (copy == NULL)
+    {
+      goto fail;
+    }
+  }
+
+  /*
+    See RBT_NODE_REMOVE() for the nodes that are merged.
+  */
+  if (deletion)
+  {
+    child_ptr = NULL;
+    if (copy->left == NULL)
+    {
+      if (copy->right != NULL)
+      {
+        child_ptr = &copy->right;
+      }
+      else if (parent != NULL && RBT_VALUE_IS_NULL(parent->value))
+      {
+        child_ptr = (parent->left == copy) ? &parent->right : &parent->left;
+      }
+    }
+    else if (copy->right == NULL)
+    {
+      child_ptr = &copy->left;
+    }
+    if (child_ptr != NULL && * child_ptr != NULL)
+    {
+      * child_ptr = _RBT_NODE_PERSISTENT_COPY(tree, * child_ptr);
+      if (* child_ptr == NULL)
+      {
+        goto fail;
+      }
+    }
+  }
+  return root;
+
+fail:
+  for (i=0; i<tree->n_copies; i++)
+  {
+    _RBT_NODE_PERSISTENT_FREE_NODE(tree->copies[i].copy);
+  }
+  tree->n_copies = 0;
+  return NULL;
+}
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Create a new persistent tree.
+
+  @return
+  The tree, or `NULL` on error (check errno).
+*/
+RBT_NODE_PERSISTENT_T *
+RBT_NODE_PERSISTENT_NEW()
+{
+  RBT_NODE_PERSISTENT_T * tree;
+
+  tree = calloc(1, sizeof(RBT_NODE_PERSISTENT_T));
+  if (tree == NULL)
+  {
+    return NULL;
+  }
+  tree->root = RBT_NODE_NEW();
+  if (tree->root == NULL)
+  {
+    free(tree);
+    return NULL;
+  }
+  tree->epoch = 1;
+  pthread_mutex_init(&tree->mutex, NULL);
+  return tree;
+}
+
+
+
+/*!
+  @brief
+  Free a persistent tree, its retired nodes and its readers.
+
+  No other thread may use the tree or its readers when it is freed.
+
+  @param[in]
+  tree The tree.
+*/
+void
+RBT_NODE_PERSISTENT_FREE(
+  RBT_NODE_PERSISTENT_T * tree
+)
+{
+  RBT_NODE_PERSISTENT_READER_T * reader;
+  size_t i;
+
+  RBT_NODE_FREE(tree->root);
+  for (i=0; i<tree->n_retired; i++)
+  {
+    _RBT_NODE_PERSISTENT_FREE_NODE(tree->retired[i].node);
+  }
+  while (tree->readers != NULL)
+  {
+    reader = tree->readers;
+    tree->readers = reader->next;
+    free(reader);
+  }
+  free(tree->retired);
+  free(tree->copies);
+  pthread_mutex_destroy(&tree->mutex);
+  free(tree);
+}
+
+
+
+/*!
+  @brief
+  Register a new reader.
+
+  @param[in]
+  tree The tree.
+
+  @return
+  The reader, or `NULL` on error (check errno).
+*/
+RBT_NODE_PERSISTENT_READER_T *
+RBT_NODE_PERSISTENT_READER_NEW(
+  RBT_NODE_PERSISTENT_T * tree
+)
+{
+  RBT_NODE_PERSISTENT_READER_T * reader;
+
+  reader = malloc(sizeof(RBT_NODE_PERSISTENT_READER_T));
+  if (reader == NULL)
+  {
+    return NULL;
+  }
+  reader->epoch = 0;
+  pthread_mutex_lock(&tree->mutex);
+  reader->next = tree->readers;
+  tree->readers = reader;
+  pthread_mutex_unlock(&tree->mutex);
+  return reader;
+}
+
+
+
+/*!
+  @brief
+  Unregister and free a reader. The reader must not be reading.
+
+  @param[in]
+  tree The tree.
+
+  @param[in]
+  reader The reader.
+*/
+void
+RBT_NODE_PERSISTENT_READER_FREE(
+  RBT_NODE_PERSISTENT_T * tree,
+  RBT_NODE_PERSISTENT_READER_T * reader
+)
+{
+  RBT_NODE_PERSISTENT_READER_T * * ptr;
+
+  pthread_mutex_lock(&tree->mutex);
+  for (ptr = &tree->readers; * ptr != NULL; ptr = &(* ptr)->next)
+  {
+    if (* ptr == reader)
+    {
+      * ptr = reader->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  free(reader);
+}
+
+
+
+/*!
+  @brief
+  Take a snapshot of the tree for reading.
+
+  The returned root remains valid and unchanged until
+  `RBT_NODE_PERSISTENT_READ_END()` is called with the same reader. It may only
+  be passed to node functions that do not modify the tree, such as
+  `RBT_NODE_QUERY()` with `RBT_QUERY_ACTION_RETRIEVE`, `RBT_NODE_TRAVERSE()`
+  and `RBT_NODE_COUNT()`. Snapshots should be short-lived because they prevent
+  the reclamation of all nodes replaced while they are held.
+
+  @param[in]
+  tree The tree.
+
+  @param[in]
+  reader The calling thread's reader.
+
+  @return
+  The root node of the snapshot.
+*/
+static inline RBT_NODE_T *
+RBT_NODE_PERSISTENT_READ_BEGIN(
+  RBT_NODE_PERSISTENT_T * tree,
+  RBT_NODE_PERSISTENT_READER_T * reader
+)
+{
+  /*
+    The announced epoch may already be outdated when it is stored, which only
+    delays reclamation. The root is loaded after the announcement is visible,
+    so any update that does not see the announcement has already published its
+    root.
+  */
+  __atomic_store_n(&reader->epoch, __atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&tree->root, __ATOMIC_SEQ_CST);
+}
+
+
+
+/*!
+  @brief
+  Release a snapshot.
+
+  @param[in]
+  reader The calling thread's reader.
+*/
+static inline void
+RBT_NODE_PERSISTENT_READ_END(
+  RBT_NODE_PERSISTENT_READER_T * reader
+)
+{
+  __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+
+/*!
+  @brief
+  Free the retired nodes that no reader can see anymore.
+
+  This is called by each update. It only needs to be called directly to
+  reclaim memory after readers have released their snapshots when no further
+  updates follow.
+
+  @param[in]
+  tree The tree.
+*/
+void
+RBT_NODE_PERSISTENT_RECLAIM(
+  RBT_NODE_PERSISTENT_T * tree
+)
+{
+  RBT_NODE_PERSISTENT_READER_T * reader;
+  unsigned long epoch, min_epoch;
+  size_t i;
+
+  pthread_mutex_lock(&tree->mutex);
+  min_epoch = ULONG_MAX;
+  for (reader = tree->readers; reader != NULL; reader = reader->next)
+  {
+    epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+    if (epoch && epoch < min_epoch)
+    {
+      min_epoch = epoch;
+    }
+  }
+  for (i=0; i<tree->n_retired && tree->retired[i].epoch < min_epoch; i++)
+  {
+    _RBT_NODE_PERSISTENT_FREE_NODE(tree->retired[i].node);
+  }
+  if (i)
+  {
+    tree->n_retired -= i;
+    memmove(tree->retired, tree->retired + i, tree->n_retired * sizeof(_RBT_NODE_PERSISTENT_RETIRED_T));
+  }
+  pthread_mutex_unlock(&tree->mutex);
+}
+
+
+
+/*!
+  @brief
+  Query a persistent tree.
+
+  This accepts the same actions as `RBT_NODE_QUERY()`. Updates create and
+  publish a new version of the tree and never block readers. Concurrent
+  updates are serialized.
+
+  Retrieval through this function takes the update mutex. Readers should use
+  `RBT_NODE_PERSISTENT_READ_BEGIN()` instead. Dynamically allocated values
+  returned by `RBT_QUERY_ACTION_RETRIEVE` remain owned by the tree and are only
+  valid until the next update.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+  The current version is kept if the copies cannot be created. If the update
+  itself fails, the next version is published as `RBT_NODE_QUERY()` left it.
+
+  @param[in]
+  tree The tree.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[in]
+  action The action that should be performed.
+
+  @param[in]
+  value The value with which the action will be performed.
+
+  @return
+  The value determined by the action.
+*/
+RBT_VALUE_T
+RBT_NODE_PERSISTENT_QUERY(
+  RBT_NODE_PERSISTENT_T * tree,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  rbt_query_action_t action,
+  RBT_VALUE_T value
+)
+{
+  _RBT_NODE_PERSISTENT_RETIRED_T * retired;
+  RBT_NODE_T * root, * target_node, * parent_node;
+  size_t i, size;
+  int deletion, err;
+
+  pthread_mutex_lock(&tree->mutex);
+  if (action == RBT_QUERY_ACTION_RETRIEVE)
+  {
+    value = RBT_NODE_QUERY(tree->root, key, bits, action, value);
+    err = errno;
+    pthread_mutex_unlock(&tree->mutex);
+    errno = err;
+    return value;
+  }
+
+  /*
+    Skip deletions of missing values before copying anything.
+  */
+  deletion = action == RBT_QUERY_ACTION_DELETE || RBT_VALUE_IS_NULL(value);
+  if (deletion)
+  {
+    target_node = RBT_NODE_RETRIEVE(
+      tree->root,
+      key,
+      bits,
+      RBT_RETRIEVE_ACTION_NOTHING,
+      RBT_VALUE_NULL,
+      &parent_node
+    );
+    if (errno || target_node == NULL || RBT_VALUE_IS_NULL(target_node->value))
+    {
+      err = errno;
+      pthread_mutex_unlock(&tree->mutex);
+      errno = err;
+      return RBT_VALUE_NULL;
+    }
+  }
+
+  /*
+    Make room for the retired nodes first so that a successful update can
+    always be published.
+  */
+  root = _RBT_NODE_PERSISTENT_COPY_PATH(tree, key, bits, deletion);
+  if (root != NULL && tree->n_retired + tree->n_copies > tree->size_retired)
+  {
+    size = tree->size_retired ? tree->size_retired : 0x100;
+    while (size < tree->n_retired + tree->n_copies)
+    {
+      size *= 2;
+    }
+    retired = realloc(tree->retired, size * sizeof(_RBT_NODE_PERSISTENT_RETIRED_T));
+    if (retired == NULL)
+    {
+      for (i=0; i<tree->n_copies; i++)
+      {
+        _RBT_NODE_PERSISTENT_FREE_NODE(tree->copies[i].copy);
+      }
+      root = NULL;
+    }
+    else
+    {
+      tree->retired = retired;
+      tree->size_retired = size;
+    }
+  }
+  if (root == NULL)
+  {
+    err = errno;
+    pthread_mutex_unlock(&tree->mutex);
+    errno = err;
+    return RBT_VALUE_NULL;
+  }
+
+  value = RBT_NODE_QUERY(root, key, bits, action, value);
+  err = errno;
+
+  for (i=0; i<tree->n_copies; i++)
+  {
+    tree->retired[tree->n_retired].node = tree->copies[i].old;
+    tree->retired[tree->n_retired].epoch = tree->epoch;
+    tree->n_retired ++;
+  }
+  tree->n_copies = 0;
+  __atomic_store_n(&tree->root, root, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&tree->epoch, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&tree->mutex);
+
+  RBT_NODE_PERSISTENT_RECLAIM(tree);
+  errno = err;
+  return value;
+}
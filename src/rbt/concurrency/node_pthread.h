@@ -3,12 +3,18 @@
   @author Xyne
   @copyright GPL2 only
 
-  This file is included automatically by node.h when certain macros are defined.
-  It provides macros and functions for using rabbit trees in a threadsafe way
-  when using pthreads.
-
-  @warning
-  This is currently untested.
+  This file is included automatically by node.h when `RBT_CONCURRENCY_PTHREAD`
+  is defined. It provides macros and functions for using rabbit trees in a
+  threadsafe way when using pthreads.
+
+  Trees are wrapped in a root type (`RBT_NODE_ROOT_T`) that holds the root node
+  along with a reader-writer lock. Any number of readers may use the tree
+  concurrently. Writers have exclusive access and take precedence over new
+  readers so that a steady stream of readers cannot starve them.
+
+  The node functions themselves are not modified. They must only be called on
+  a wrapped tree between the corresponding lock and unlock calls, or through
+  `RBT_NODE_ROOT_READ()` and `RBT_NODE_ROOT_WRITE()`.
 */
 
 #include <pthread.h>
@@ -17,11 +23,40 @@
   @cond INTERNAL
 */
 #undef RBT_NODE_ROOT_T
-#define RBT_NODE_ROOT_T RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_t)
+#define RBT_NODE_ROOT_T             RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_t)
+
+#undef RBT_NODE_ROOT_NEW
+#define RBT_NODE_ROOT_NEW           RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_new)
+
+#undef RBT_NODE_ROOT_FREE
+#define RBT_NODE_ROOT_FREE          RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_free)
+
+#undef RBT_NODE_ROOT_READ_LOCK
+#define RBT_NODE_ROOT_READ_LOCK     RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_read_lock)
+
+#undef RBT_NODE_ROOT_READ_UNLOCK
+#define RBT_NODE_ROOT_READ_UNLOCK   RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_read_unlock)
+
+#undef RBT_NODE_ROOT_WRITE_LOCK
+#define RBT_NODE_ROOT_WRITE_LOCK    RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_write_lock)
+
+#undef RBT_NODE_ROOT_WRITE_UNLOCK
+#define RBT_NODE_ROOT_WRITE_UNLOCK  RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_root_write_unlock)
 /*!
   @endcond
 */
 
+/*
+  This file is included before the node functions are defined.
+*/
+RBT_NODE_T *
+RBT_NODE_NEW();
+
+void
+RBT_NODE_FREE(RBT_NODE_T * node);
+
+
+
 /*!
   A convenient wrapper around root nodes to provide thread safety.
 */
@@ -42,13 +77,14 @@ struct RBT_NODE_ROOT_T
 
   /*!
     @brief
-    The number of queued write operations.
+    The number of pending or active write operations.
   */
   unsigned int writers;
 
   /*!
     @brief
-    The mutex that protects this root node.
+    The mutex that protects the counters. It is held for the duration of each
+    write operation.
   */
   pthread_mutex_t mutex;
 
@@ -61,110 +97,234 @@ struct RBT_NODE_ROOT_T
 RBT_NODE_ROOT_T;
 
 
+
 /*!
   @brief
   Create a new root node.
 
-  Create a new, empty root node. The root node type is a wrapper struct around the
+  Create a new, empty tree. The root node type is a wrapper struct around the
   node type. It includes mutexes and other variables that are used to protect
   the data in the tree from corruption caused by concurrent writes.
 
+  @return
+  The root, or NULL on error (check errno).
+
   @see
   RBT_NODE_ROOT_READ RBT_NODE_ROOT_WRITE
 */
-RBT_NODE_ROOT_T
-RBT_NODE_NEW()
+RBT_NODE_ROOT_T *
+RBT_NODE_ROOT_NEW()
 {
-  RBT_NODE_ROOT_T root;
-  root.node = RBT_NODE_CREATE(NULL, 0, RBT_VALUE_NULL, NULL, NULL);
-  root.mutex = PTHREAD_MUTEX_INITIALIZER;
-  root.cond = PTHREAD_COND_INITIALIZER;
-  root.readers = 0;
-  root.writers = 0;
+  RBT_NODE_ROOT_T * root;
+
+  root = malloc(sizeof(RBT_NODE_ROOT_T));
+  if (root == NULL)
+  {
+    return NULL;
+  }
+  root->node = RBT_NODE_NEW();
+  if (root->node == NULL)
+  {
+    free(root);
+    return NULL;
+  }
+  pthread_mutex_init(&root->mutex, NULL);
+  pthread_cond_init(&root->cond, NULL);
+  root->readers = 0;
+  root->writers = 0;
+  return root;
 }
 
+
+
 /*!
-  Execute a read-only operation on the root node. This will prevent any write
-  operation from interfering with the tree while the read operation occurs.
+  @brief
+  Free a root node and its tree.
+
+  No other thread may use the root when it is freed.
+
+  @param[in]
+  root The root.
+*/
+void
+RBT_NODE_ROOT_FREE(
+  RBT_NODE_ROOT_T * root
+)
+{
+  RBT_NODE_FREE(root->node);
+  pthread_cond_destroy(&root->cond);
+  pthread_mutex_destroy(&root->mutex);
+  free(root);
+}
+
+
+
+/*!
+  Begin a read-only operation on the root node. This will prevent any write
+  operation from interfering with the tree until `RBT_NODE_ROOT_READ_UNLOCK()`
+  is called.
 
   The steps:
 
   1. Lock the mutex.
-  2. Wait for writers to finish.
+  2. Wait for pending writers to finish.
   3. Increment readers to prevent writes from occuring while reading.
   4. Unlock the mutex to enable concurrent reads and the queuing of writes.
-  5. Proceed with read.
-  6. Lock the mutex.
-  7. Decrement readers.
-  8. Signal other threads on last reader.
-  9. Unlock the mutex.
 
   @param[in]
-  root The root node structure.
+  root The root.
+*/
+void
+RBT_NODE_ROOT_READ_LOCK(
+  RBT_NODE_ROOT_T * root
+)
+{
+  pthread_mutex_lock(&root->mutex);
+  while (root->writers)
+  {
+    pthread_cond_wait(&root->cond, &root->mutex);
+  }
+  root->readers ++;
+  pthread_mutex_unlock(&root->mutex);
+}
+
+
+
+/*!
+  End a read-only operation on the root node.
+
+  The steps:
+
+  1. Lock the mutex.
+  2. Decrement readers.
+  3. Wake waiting writers on last reader.
+  4. Unlock the mutex.
+
+  @param[in]
+  root The root.
+*/
+void
+RBT_NODE_ROOT_READ_UNLOCK(
+  RBT_NODE_ROOT_T * root
+)
+{
+  pthread_mutex_lock(&root->mutex);
+  root->readers --;
+  if (! root->readers)
+  {
+    pthread_cond_broadcast(&root->cond);
+  }
+  pthread_mutex_unlock(&root->mutex);
+}
+
+
+
+/*!
+  Begin a write operation on the root node. This will prevent any other
+  operation from interfering with the tree until `RBT_NODE_ROOT_WRITE_UNLOCK()`
+  is called.
+
+  The operation will wait for all read operations to finish. New read
+  operations will wait for it.
+
+  The steps:
+
+  1. Lock the mutex and increment writers to indicate that a write is pending.
+  2. Wait for all readers to finish. The mutex is held from then on, so other
+     writers cannot proceed.
+
+  @param[in]
+  root The root.
+*/
+void
+RBT_NODE_ROOT_WRITE_LOCK(
+  RBT_NODE_ROOT_T * root
+)
+{
+  pthread_mutex_lock(&root->mutex);
+  root->writers ++;
+  while (root->readers)
+  {
+    pthread_cond_wait(&root->cond, &root->mutex);
+  }
+}
+
+
+
+/*!
+  End a write operation on the root node.
+
+  The steps:
+
+  1. Decrement writers to indicate that the write is complete.
+  2. Wake all waiting threads.
+  3. Unlock the mutex.
+
+  @param[in]
+  root The root.
+*/
+void
+RBT_NODE_ROOT_WRITE_UNLOCK(
+  RBT_NODE_ROOT_T * root
+)
+{
+  root->writers --;
+  pthread_cond_broadcast(&root->cond);
+  pthread_mutex_unlock(&root->mutex);
+}
+
+
+
+/*!
+  Execute a read-only operation on the root node.
+
+  @param[in]
+  root A pointer to the root.
 
   @param[in]
   func The function to call. The first argument will be the node followed by any
-  additional arguments.
+  additional arguments. Its return value is discarded. Use
+  `RBT_NODE_ROOT_READ_LOCK()` and `RBT_NODE_ROOT_READ_UNLOCK()` directly to
+  keep it.
 
   @param[in]
   ... Additional arguments to pass to the function.
 */
 #undef RBT_NODE_ROOT_READ
 #define RBT_NODE_ROOT_READ(root, func, ...) \
-pthread_mutex_lock(&(root.mutex)); \
-while (root.writers) \
-{ \
-  pthread_cond_wait(&(root.cond), &(root.mutex)); \
-} \
-root.readers ++; \
-pthread_mutex_unlock(&(root.mutex)); \
-func(root.node, ##__VA_ARGS__); \
-pthread_mutex_lock(&(root.mutex)); \
-root.readers --; \
-if (! root.readers) \
+do \
 { \
-  pthread_cond_signal(&(root.cond)); \
+  RBT_NODE_ROOT_READ_LOCK(root); \
+  func((root)->node, ##__VA_ARGS__); \
+  RBT_NODE_ROOT_READ_UNLOCK(root); \
 } \
-pthread_mutex_unlock(&(root.mutex))
+while (0)
 
 
 /*!
-  Execute a write operation on the root node. This will prevent any other write
-  operation from interfering with the tree while the operation occurs.
-
-  The operation will wait for all read operations to finish.
-
-  The steps:
-
-  1. Lock the mutex and increment writers to indicate that a write is pending.
-  2. Wait for all readers to finish.
-  3. Proceed with write. Other writes cannot proceed until the mutex is unlocked.
-  4. Decrement writers to indicate that write is complete.
-  5. Signal other threads.
-  6. Unlock mutex.
+  Execute a write operation on the root node.
 
   @param[in]
-  root The root node structure.
+  root A pointer to the root.
 
   @param[in]
   func The function to call. The first argument will be the node followed by any
-  additional arguments.
+  additional arguments. Its return value is discarded. Use
+  `RBT_NODE_ROOT_WRITE_LOCK()` and `RBT_NODE_ROOT_WRITE_UNLOCK()` directly to
+  keep it.
 
   @param[in]
   ... Additional arguments to pass to the function.
 */
 #undef RBT_NODE_ROOT_WRITE
 #define RBT_NODE_ROOT_WRITE(root, func, ...) \
-pthread_mutex_lock(&(root.mutex)); \
-root.writers ++; \
-while (root.readers) \
+do \
 { \
-  pthread_cond_wait(&(root.cond), &(root.mutex)); \
+  RBT_NODE_ROOT_WRITE_LOCK(root); \
+  func((root)->node, ##__VA_ARGS__); \
+  RBT_NODE_ROOT_WRITE_UNLOCK(root); \
 } \
-func(root.node, ##__VA_ARGS__); \
-root.writers --; \
-pthread_cond_signal(&(root.cond)); \
-pthread_mutex_unlock(&(root.mutex))
+while (0)
 
 
 
@@ -187,12 +347,12 @@ pthread_mutex_t RBT_NODE_CACHE_MUTEX = PTHREAD_MUTEX_INITIALIZER;
   Lock the node cache.
 */
 #undef RBT_NODE_CACHE_LOCK
-#define RBT_NODE_CACHE_LOCK pthread_mutex_lock(&RBT_NODE_CACHE_MUTEX)
+#define RBT_NODE_CACHE_LOCK pthread_mutex_lock(&RBT_NODE_CACHE_MUTEX);
 
 /*!
   Unlock the node cache.
 */
 #undef RBT_NODE_CACHE_UNLOCK
-#define RBT_NODE_CACHE_UNLOCK pthread_mutex_unlock(&RBT_NODE_CACHE_MUTEX)
+#define RBT_NODE_CACHE_UNLOCK pthread_mutex_unlock(&RBT_NODE_CACHE_MUTEX);
 
 #endif //RBT_NODE_CACHE_SIZE
@@ -0,0 +1,653 @@
+/*!
+  @file
+  @author Xyne
+  @copyright GPL2 only
+
+  # Overview
+  Flat images of rabbit trees.
+
+  A tree can be serialized to a single contiguous image in which nodes refer to
+  each other by their offsets from the start of the image instead of by
+  pointers. The image is position-independent, so it can be written to a file
+  and later mapped into memory with `mmap()` and queried in place, without
+  rebuilding the tree:
+
+      size_t size;
+      void * image;
+
+      image = RBT_FLAT_SERIALIZE(node, &size);
+      fwrite(image, 1, size, file);
+      free(image);
+
+      ...
+
+      image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (RBT_FLAT_CHECK(image, size))
+      {
+        // not a valid image for this instantiation
+      }
+      value = RBT_FLAT_RETRIEVE(image, key, bits, &value_size);
+
+  Images use the native byte order and pin size. `RBT_FLAT_CHECK()` rejects
+  images that were written with others, as well as truncated or corrupt ones,
+  so that queries on checked images never read outside of them.
+
+  # Layout
+  The image starts with a `RBT_FLAT_HEADER_T`. The nodes follow in pre-order,
+  i.e. each node is followed by its left subtree and then by its right subtree.
+  Each node is a `RBT_FLAT_NODE_T` followed by the pins of its key fragment and
+  then by its value, each padded to a multiple of 8 bytes so that all records
+  are aligned.
+
+  # Values
+  By default the bytes of each non-empty value are copied into the image. This
+  suffices for values without pointers. Other values must be encoded by
+  defining both of the following macros:
+
+  - RBT_VALUE_FLAT_SIZE(val)
+
+    The number of bytes required to encode a value.
+
+  - RBT_VALUE_FLAT_WRITE(buffer, val)
+
+    Encode a value into a buffer of the size given by the previous macro.
+
+  `RBT_FLAT_RETRIEVE()` returns a pointer to the encoded bytes of a value
+  in the image, which is aligned to 8 bytes.
+
+  # Required Headers
+
+  - node.h
+
+  # Optional macro definitions
+
+  - RBT_FLAT_H_PREFIX_
+
+    The prefix for visible variable and function declarations in this header.
+    If not defined it defaults to `RBT_NODE_H_PREFIX_`.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ONLY_FOR_DOXYGEN
+#include "node.h"
+#endif //ONLY_FOR_DOXYGEN
+
+/*!
+  @cond INTERNAL
+*/
+
+#ifndef RBT_FLAT_H_PREFIX_
+#define RBT_FLAT_H_PREFIX_ RBT_NODE_H_PREFIX_
+#endif
+
+#ifndef RBT_VALUE_FLAT_SIZE
+#define RBT_VALUE_FLAT_SIZE(val) sizeof(RBT_VALUE_T)
+#define RBT_VALUE_FLAT_WRITE(buffer, val) memcpy(buffer, &(val), sizeof(RBT_VALUE_T))
+#endif // RBT_VALUE_FLAT_SIZE
+
+#ifndef RBT_VALUE_FLAT_WRITE
+#error RBT_VALUE_FLAT_WRITE is not defined.
+#endif // RBT_VALUE_FLAT_WRITE
+
+#undef RBT_FLAT_CHECK
+#define RBT_FLAT_CHECK        RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_check)
+
+#undef RBT_FLAT_HEADER_T
+#define RBT_FLAT_HEADER_T     RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_header_t)
+
+#undef RBT_FLAT_NODE_T
+#define RBT_FLAT_NODE_T       RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_node_t)
+
+#undef RBT_FLAT_RETRIEVE
+#define RBT_FLAT_RETRIEVE     RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_retrieve)
+
+#undef RBT_FLAT_SERIALIZE
+#define RBT_FLAT_SERIALIZE    RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_serialize)
+
+#undef _RBT_FLAT_PENDING_T
+#define _RBT_FLAT_PENDING_T   _RBT_TOKEN_2_W(RBT_FLAT_H_PREFIX_, flat_pending_t)
+
+/*!
+  @brief
+  The first bytes of every image.
+*/
+#undef _RBT_FLAT_MAGIC
+#define _RBT_FLAT_MAGIC "RBTFLAT"
+
+/*!
+  @brief
+  The version of the image layout.
+*/
+#undef _RBT_FLAT_VERSION
+#define _RBT_FLAT_VERSION 1
+
+/*!
+  @brief
+  A value written in the native byte order to detect images from platforms
+  with another byte order.
+*/
+#undef _RBT_FLAT_BYTE_ORDER
+#define _RBT_FLAT_BYTE_ORDER 0x01020304
+
+/*!
+  @brief
+  Round a size up to a multiple of 8.
+*/
+#undef _RBT_FLAT_ALIGN
+#define _RBT_FLAT_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Header of a flat image.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    "RBTFLAT", null-terminated.
+  */
+  char magic[8];
+
+  /*!
+    @brief
+    The version of the layout.
+  */
+  uint32_t version;
+
+  /*!
+    @brief
+    The size of the pin type.
+  */
+  uint32_t pin_size;
+
+  /*!
+    @brief
+    `_RBT_FLAT_BYTE_ORDER` in the byte order of the image.
+  */
+  uint32_t byte_order;
+
+  /*!
+    @brief
+    Unused, always 0.
+  */
+  uint32_t reserved;
+
+  /*!
+    @brief
+    The size of the image in bytes.
+  */
+  uint64_t size;
+
+  /*!
+    @brief
+    The number of nodes.
+  */
+  uint64_t count;
+
+  /*!
+    @brief
+    The offset of the root node.
+  */
+  uint64_t root;
+}
+RBT_FLAT_HEADER_T;
+
+
+
+/*!
+  @brief
+  A node in a flat image. Offsets are relative to the start of the image and 0
+  stands for NULL.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The offset of the left child.
+  */
+  uint64_t left;
+
+  /*!
+    @brief
+    The offset of the right child.
+  */
+  uint64_t right;
+
+  /*!
+    @brief
+    The offset of the encoded value, or 0 if the node is empty.
+  */
+  uint64_t value;
+
+  /*!
+    @brief
+    The size of the encoded value.
+  */
+  uint64_t value_size;
+
+  /*!
+    @brief
+    The number of significant bits in the key fragment, which follows the node.
+  */
+  uint64_t bits;
+}
+RBT_FLAT_NODE_T;
+
+
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  A node waiting to be written during serialization.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The node.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The offset of the field in the image that must be set to the offset of the
+    node.
+  */
+  size_t field;
+}
+_RBT_FLAT_PENDING_T;
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Serialize a tree to a flat image.
+
+  @param[in]
+  node The root node.
+
+  @param[out]
+  size The size of the image in bytes.
+
+  @return
+  The image, which must be freed, or NULL on error (check errno).
+*/
+void *
+RBT_FLAT_SERIALIZE(
+  RBT_NODE_T * node,
+  size_t * size
+)
+{
+  _RBT_FLAT_PENDING_T * pending, * pending_tmp;
+  RBT_FLAT_HEADER_T * header;
+  RBT_FLAT_NODE_T * record;
+  BYTE_T * image, * image_tmp;
+  size_t used, capacity, depth, max_depth, offset, pins_size, value_size, record_size;
+  uint64_t count, field;
+  int rc;
+
+  errno = 0;
+
+  if (node == NULL)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  capacity = 0x1000;
+  max_depth = 0x20;
+  image = malloc(capacity);
+  pending = malloc(max_depth * sizeof(_RBT_FLAT_PENDING_T));
+  if (image == NULL || pending == NULL)
+  {
+    free(pending);
+    free(image);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  header = (RBT_FLAT_HEADER_T *) image;
+  memset(header, 0, sizeof(RBT_FLAT_HEADER_T));
+  memcpy(header->magic, _RBT_FLAT_MAGIC, sizeof(_RBT_FLAT_MAGIC));
+  header->version = _RBT_FLAT_VERSION;
+  header->pin_size = RBT_PIN_SIZE;
+  header->byte_order = _RBT_FLAT_BYTE_ORDER;
+  used = _RBT_FLAT_ALIGN(sizeof(RBT_FLAT_HEADER_T));
+  count = 0;
+
+  pending[0].node = node;
+  pending[0].field = offsetof(RBT_FLAT_HEADER_T, root);
+  depth = 1;
+  rc = 0;
+
+  while (depth)
+  {
+    depth --;
+    node = pending[depth].node;
+    field = pending[depth].field;
+
+    pins_size = BITS_TO_PINS(node->bits) * RBT_PIN_SIZE;
+    value_size = RBT_VALUE_IS_NULL(node->value) ? 0 : RBT_VALUE_FLAT_SIZE(node->value);
+    record_size = sizeof(RBT_FLAT_NODE_T) + _RBT_FLAT_ALIGN(pins_size) + _RBT_FLAT_ALIGN(value_size);
+
+    if (used + record_size > capacity)
+    {
+      do
+      {
+        capacity *= 2;
+      }
+      while (used + record_size > capacity);
+      image_tmp = realloc(image, capacity);
+      if (image_tmp == NULL)
+      {
+        rc = ENOMEM;
+        break;
+      }
+      image = image_tmp;
+    }
+
+    /*
+      Zero the record so that the padding is deterministic.
+    */
+    offset = used;
+    record = (RBT_FLAT_NODE_T *) (image + offset);
+    memset(record, 0, record_size);
+    record->bits = node->bits;
+    if (pins_size)
+    {
+      memcpy(record + 1, node->key, pins_size);
+    }
+    if (! RBT_VALUE_IS_NULL(node->value))
+    {
+      record->value = offset + sizeof(RBT_FLAT_NODE_T) + _RBT_FLAT_ALIGN(pins_size);
+      record->value_size = value_size;
+      RBT_VALUE_FLAT_WRITE(image + record->value, node->value);
+    }
+    * (uint64_t *) (image + field) = offset;
+    used += record_size;
+    count ++;
+
+    /*
+      Push the right child first so that the left subtree is written first.
+    */
+    if (depth + 2 > max_depth)
+    {
+      max_depth *= 2;
+      pending_tmp = realloc(pending, max_depth * sizeof(_RBT_FLAT_PENDING_T));
+      if (pending_tmp == NULL)
+      {
+        rc = ENOMEM;
+        break;
+      }
+      pending = pending_tmp;
+    }
+    if (node->right != NULL)
+    {
+      pending[depth].node = node->right;
+      pending[depth].field = offset + offsetof(RBT_FLAT_NODE_T, right);
+      depth ++;
+    }
+    if (node->left != NULL)
+    {
+      pending[depth].node = node->left;
+      pending[depth].field = offset + offsetof(RBT_FLAT_NODE_T, left);
+      depth ++;
+    }
+  }
+
+  free(pending);
+  if (rc)
+  {
+    free(image);
+    errno = rc;
+    return NULL;
+  }
+  header = (RBT_FLAT_HEADER_T *) image;
+  header->size = used;
+  header->count = count;
+  * size = used;
+  return image;
+}
+
+
+
+/*!
+  @brief
+  Check that a flat image is valid.
+
+  This must be done before querying an image that may have been written by
+  another program, another instantiation or another platform, or that may have
+  been modified. It takes time proportional to the size of the image.
+
+  @param[in]
+  image The image.
+
+  @param[in]
+  size The size of the image in bytes.
+
+  @return
+  0 if the image is valid, otherwise -1 and `errno` is set to `EINVAL`, or to
+  `ENOMEM` if the check could not be done.
+*/
+int
+RBT_FLAT_CHECK(
+  const void * image,
+  size_t size
+)
+{
+  const BYTE_T * base;
+  const RBT_FLAT_HEADER_T * header;
+  const RBT_FLAT_NODE_T * record;
+  unsigned char * starts;
+  size_t offset, first, pins_size, record_size;
+  uint64_t count, child;
+  int i;
+
+  errno = 0;
+  base = image;
+  header = image;
+  if (
+    size < sizeof(RBT_FLAT_HEADER_T) ||
+    memcmp(header->magic, _RBT_FLAT_MAGIC, sizeof(_RBT_FLAT_MAGIC)) ||
+    header->version != _RBT_FLAT_VERSION ||
+    header->pin_size != RBT_PIN_SIZE ||
+    header->byte_order != _RBT_FLAT_BYTE_ORDER ||
+    header->size != size ||
+    size % 8
+  )
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /*
+    The records are contiguous, so they can be checked in a single pass. Their
+    offsets are marked so that the children can be checked in a second pass.
+  */
+  first = _RBT_FLAT_ALIGN(sizeof(RBT_FLAT_HEADER_T));
+  starts = calloc(size / 8 / BITS_PER_BYTE + 1, 1);
+  if (starts == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+  count = 0;
+  for (offset=first; offset<size; offset+=record_size)
+  {
+    record = (const RBT_FLAT_NODE_T *) (base + offset);
+    if (
+      size - offset < sizeof(RBT_FLAT_NODE_T) ||
+      (RBT_KEY_SIZE_T) record->bits != record->bits
+    )
+    {
+      break;
+    }
+    pins_size = BITS_TO_PINS(record->bits) * RBT_PIN_SIZE;
+    record_size = sizeof(RBT_FLAT_NODE_T) + _RBT_FLAT_ALIGN(pins_size);
+    if (record_size > size - offset)
+    {
+      break;
+    }
+    if (record->value)
+    {
+      if (
+        record->value != offset + record_size ||
+        record->value_size > size ||
+        _RBT_FLAT_ALIGN(record->value_size) > size - offset - record_size
+      )
+      {
+        break;
+      }
+      record_size += _RBT_FLAT_ALIGN(record->value_size);
+    }
+    starts[offset / 8 / BITS_PER_BYTE] |= 1 << (offset / 8 % BITS_PER_BYTE);
+    count ++;
+  }
+
+  if (offset != size || count != header->count || ! count || header->root != first)
+  {
+    free(starts);
+    errno = EINVAL;
+    return -1;
+  }
+
+  /*
+    Children must be records that follow their parents, so that there are no
+    cycles.
+  */
+  for (offset=first; offset<size; offset+=record_size)
+  {
+    record = (const RBT_FLAT_NODE_T *) (base + offset);
+    for (i=0; i<2; i++)
+    {
+      child = i ? record->right : record->left;
+      if (
+        child &&
+        (
+          child <= offset ||
+          child >= size ||
+          child % 8 ||
+          ! (starts[child / 8 / BITS_PER_BYTE] & (1 << (child / 8 % BITS_PER_BYTE)))
+        )
+      )
+      {
+        free(starts);
+        errno = EINVAL;
+        return -1;
+      }
+    }
+    record_size = sizeof(RBT_FLAT_NODE_T) + _RBT_FLAT_ALIGN(BITS_TO_PINS(record->bits) * RBT_PIN_SIZE);
+    if (record->value)
+    {
+      record_size += _RBT_FLAT_ALIGN(record->value_size);
+    }
+  }
+  free(starts);
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Retrieve a value from a flat image.
+
+  The image must have been checked with `RBT_FLAT_CHECK()` unless it was
+  created by `RBT_FLAT_SERIALIZE()` in the same program.
+
+  @param[in]
+  image The image.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[out]
+  value_size If not NULL, it is set to the size of the encoded value.
+
+  @return
+  A pointer to the encoded value in the image, or NULL if the key has no value.
+*/
+const void *
+RBT_FLAT_RETRIEVE(
+  const void * image,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  size_t * value_size
+)
+{
+  const BYTE_T * base;
+  const RBT_FLAT_NODE_T * node;
+  RBT_KEY_SIZE_T node_bits, common_bits, common_pins, common_staggered_bits;
+  uint64_t child;
+
+  base = image;
+  node = (const RBT_FLAT_NODE_T *) (base + ((const RBT_FLAT_HEADER_T *) image)->root);
+
+  /*
+    The root node may have an empty key fragment, as in RBT_NODE_RETRIEVE().
+  */
+  if (node->bits == 0 && bits > 0)
+  {
+    child = FIRST_BIT_IS_1(key[0]) ? node->right : node->left;
+    if (! child)
+    {
+      return NULL;
+    }
+    node = (const RBT_FLAT_NODE_T *) (base + child);
+  }
+
+  while (1)
+  {
+    node_bits = node->bits;
+    common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, (RBT_PIN_T *) (node + 1), MIN(bits, node_bits));
+    if (common_bits == bits)
+    {
+      if (common_bits != node_bits || ! node->value)
+      {
+        return NULL;
+      }
+      if (value_size != NULL)
+      {
+        * value_size = node->value_size;
+      }
+      return base + node->value;
+    }
+    else if (common_bits != node_bits)
+    {
+      return NULL;
+    }
+    RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
+    key += common_pins;
+    bits += common_staggered_bits - common_bits;
+    child = N_BIT_IS_1(key[0], common_staggered_bits) ? node->right : node->left;
+    if (! child)
+    {
+      return NULL;
+    }
+    node = (const RBT_FLAT_NODE_T *) (base + child);
+  }
+}
@@ -228,9 +228,205 @@ d = a % b
 
 
 
+/*
+  Comparison kernels
+
+  Keys are compared for equality a word or a vector at a time before the first
+  differing pin is located. Equality does not depend on the order of the bits
+  within a word, so the words can be loaded from the pin arrays regardless of
+  the pin type and the host byte order. Only the first differing byte is
+  located with the byte order, and the first differing bit is then found in the
+  pin that contains it.
+
+  This mostly benefits long keys with small pins, e.g. paths in byte pins. The
+  widest native integer is used and, when compiled for it, SSE2 or AVX2 vectors
+  for keys of at least 16 or 32 bytes.
+
+  Define RBT_KEY_PIN_COMPARISON before inclusion to compare keys pin by pin
+  instead, e.g. to compare the kernels.
+*/
+#undef _RBT_KEY_WORD_T
+#define _RBT_KEY_WORD_T unsigned long long
+
+#undef _RBT_KEY_WORDS
+#if defined(__GNUC__) && ! defined(RBT_KEY_PIN_COMPARISON) && \
+  defined(__BYTE_ORDER__) && \
+  (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define _RBT_KEY_WORDS 1
+#else
+#define _RBT_KEY_WORDS 0
+#endif
+
+#if _RBT_KEY_WORDS && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#endif
+
+#if _RBT_KEY_WORDS && ! defined(RBT_HEADER_KEY_WORDS)
+#define RBT_HEADER_KEY_WORDS
+#include <string.h>
+
+/*!
+  @brief
+  Get the index of the first differing byte from the XOR of two words.
+
+  @param[in]
+  x The non-zero XOR of the words as loaded from memory.
+*/
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define _RBT_KEY_WORD_FIRST_BYTE(x) (__builtin_ctzll(x) / BITS_PER_BYTE)
+#else
+#define _RBT_KEY_WORD_FIRST_BYTE(x) (__builtin_clzll(x) / BITS_PER_BYTE)
+#endif
+#endif // _RBT_KEY_WORDS && ! RBT_HEADER_KEY_WORDS
+
+#undef _RBT_FIRST_DIFFERENT_PIN
+#define _RBT_FIRST_DIFFERENT_PIN _RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_, first_different_pin)
+
+#undef _RBT_FIRST_DIFFERENT_PIN_WIDE
+#define _RBT_FIRST_DIFFERENT_PIN_WIDE _RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_, first_different_pin_wide)
+
+/*!
+  The minimum number of bytes to compare with the wide comparisons. Shorter
+  keys, e.g. integers and most key fragments in tree descents, are compared pin
+  by pin to avoid the setup of the wide comparisons.
+*/
+#undef _RBT_KEY_WIDE_BYTES
+#define _RBT_KEY_WIDE_BYTES (2 * sizeof(_RBT_KEY_WORD_T))
+
+
+
+#if _RBT_KEY_WORDS
+/*!
+  Skip the equal leading bytes of two pin arrays with words and vectors.
+
+  @param[in]
+  a The first pin array.
+
+  @param[in]
+  b The second pin array.
+
+  @param[in]
+  pins The number of pins to compare.
+
+  @return
+  The index of the first differing pin, or the index of the first pin that
+  contains bytes that have not been compared.
+*/
+static RBT_KEY_SIZE_T
+_RBT_FIRST_DIFFERENT_PIN_WIDE(
+  RBT_PIN_T * a,
+  RBT_PIN_T * b,
+  RBT_KEY_SIZE_T pins
+)
+{
+  const unsigned char * x, * y;
+  _RBT_KEY_WORD_T u, v;
+  size_t bytes, offset;
+#ifdef __AVX2__
+  __m256i ua, ub;
+  unsigned int mask32;
+#endif // __AVX2__
+#ifdef __SSE2__
+  __m128i va, vb;
+  unsigned int mask;
+#endif // __SSE2__
+
+  x = (const unsigned char *) a;
+  y = (const unsigned char *) b;
+  bytes = PINS_TO_BYTES((size_t) pins);
+  offset = 0;
+
+#ifdef __AVX2__
+  for (; offset + sizeof(__m256i) <= bytes; offset += sizeof(__m256i))
+  {
+    ua = _mm256_loadu_si256((const __m256i *) (x + offset));
+    ub = _mm256_loadu_si256((const __m256i *) (y + offset));
+    mask32 = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(ua, ub));
+    if (mask32 != 0xFFFFFFFFU)
+    {
+      return (offset + __builtin_ctz(~mask32)) / RBT_PIN_SIZE;
+    }
+  }
+#endif // __AVX2__
+
+#ifdef __SSE2__
+  for (; offset + sizeof(__m128i) <= bytes; offset += sizeof(__m128i))
+  {
+    va = _mm_loadu_si128((const __m128i *) (x + offset));
+    vb = _mm_loadu_si128((const __m128i *) (y + offset));
+    mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+    if (mask != 0xFFFFU)
+    {
+      return (offset + __builtin_ctz(~mask & 0xFFFFU)) / RBT_PIN_SIZE;
+    }
+  }
+#endif // __SSE2__
+
+  for (; offset + sizeof(_RBT_KEY_WORD_T) <= bytes; offset += sizeof(_RBT_KEY_WORD_T))
+  {
+    memcpy(&u, x + offset, sizeof(u));
+    memcpy(&v, y + offset, sizeof(v));
+    if (u != v)
+    {
+      return (offset + _RBT_KEY_WORD_FIRST_BYTE(u ^ v)) / RBT_PIN_SIZE;
+    }
+  }
+  return offset / RBT_PIN_SIZE;
+}
+#endif // _RBT_KEY_WORDS
+
+
+
+/*!
+  Find the first pin that differs between two pin arrays.
+
+  @param[in]
+  a The first pin array.
+
+  @param[in]
+  b The second pin array.
+
+  @param[in]
+  pins The number of pins to compare.
+
+  @return
+  The index of the first differing pin, or `pins` if all pins are equal.
+*/
+static inline RBT_KEY_SIZE_T
+_RBT_FIRST_DIFFERENT_PIN(
+  RBT_PIN_T * a,
+  RBT_PIN_T * b,
+  RBT_KEY_SIZE_T pins
+)
+{
+  RBT_KEY_SIZE_T i;
+
+  i = 0;
+#if _RBT_KEY_WORDS
+  /*
+    Keys that already differ in the first pin are common in descents.
+  */
+  if (PINS_TO_BYTES((size_t) pins) >= _RBT_KEY_WIDE_BYTES && a[0] == b[0])
+  {
+    i = _RBT_FIRST_DIFFERENT_PIN_WIDE(a, b, pins);
+  }
+#endif // _RBT_KEY_WORDS
+  while (i < pins && a[i] == b[i])
+  {
+    i ++;
+  }
+  return i;
+}
+
+
+
+
+
 /*!
   Determine the number of common bits at the beginning of two keys.
 
+  The first differing pin is found with the comparison kernels above.
+
   @param[in]
   a The first key.
 
@@ -242,9 +438,6 @@ d = a % b
 
   @return
   The number of common bits.
-
-  @todo
-  Investigate ways to optimize this (e.g. asm).
 */
 RBT_KEY_SIZE_T
 RBT_COMMON_BIT_PREFIX_LEN(
@@ -254,58 +447,43 @@ RBT_COMMON_BIT_PREFIX_LEN(
 )
 {
   RBT_PIN_T c;
-  RBT_KEY_SIZE_T length;
-
-  length = 0;
+  RBT_KEY_SIZE_T length, i;
 
-  while (length < max && * a == * b)
-  {
-    length += RBT_PIN_SIZE_BITS;
-    a ++;
-    b ++;
-  }
+  i = _RBT_FIRST_DIFFERENT_PIN(a, b, BITS_TO_PINS(max));
+  length = i * RBT_PIN_SIZE_BITS;
   if (length < max)
   {
-    c = *a ^ *b;
+    c = a[i] ^ b[i];
 #ifdef __GNUC__
     /*
       Make use of the GCC builtins:
       http://gcc.gnu.org/onlinedocs/gcc/Other-Builtins.html
 
-      TODO
-      At some point check if this is even worth it. Also consider checking
-      compatibility of the returned int with RBT_KEY_SIZE_T. Under normal operation
-      RBT_KEY_SIZE_T will be able to hold the value, but there may be overhead due
-      to conversion between types.
+      Pins smaller than an int are promoted, so the extra leading zeros are
+      subtracted.
     */
-    if (__builtin_types_compatible_p(RBT_PIN_T, unsigned int))
+    if (RBT_PIN_SIZE <= sizeof(unsigned int))
     {
       debug_print("__builtin_clz\n");
-      length += (RBT_KEY_SIZE_T) __builtin_clz(c);
+      length += (RBT_KEY_SIZE_T) (
+        __builtin_clz(c) - (sizeof(unsigned int) - RBT_PIN_SIZE) * BITS_PER_BYTE
+      );
     }
-    else if (__builtin_types_compatible_p(RBT_PIN_T, unsigned long int))
-    {
-      debug_print("__builtin_clzl\n");
-      length += (RBT_KEY_SIZE_T) __builtin_clzl(c);
-    }
-    else if (__builtin_types_compatible_p(RBT_PIN_T, unsigned long long int))
+    else if (RBT_PIN_SIZE <= sizeof(unsigned long long int))
     {
       debug_print("__builtin_clzll\n");
-      length += (RBT_KEY_SIZE_T) __builtin_clzll(c);
+      length += (RBT_KEY_SIZE_T) (
+        __builtin_clzll(c) - (sizeof(unsigned long long int) - RBT_PIN_SIZE) * BITS_PER_BYTE
+      );
     }
     else
     {
 #endif // __GNUC__
-//       debug_print("loop\n");
     /*
-      The condition above ensures that the length is less than the max, so it
-      cannot be exceeded here and there is no need to check before returning it.
-
       The leading 0's represent common bits due to the XOR operation above. The
-      previous loop ensures that *a and *b are not identical so there must be
-      at least one bit in c. By shifting it left and checking if the value is
-      less than MOST_SIGNIFICANT_BIT we can count the leading zeros and thus the
-      number of common bits.
+      pins at i differ so there must be at least one bit in c. By shifting it
+      left and checking if the value is less than MOST_SIGNIFICANT_BIT we can
+      count the leading zeros and thus the number of common bits.
     */
     while (c < MOST_SIGNIFICANT_BIT_W(RBT_PIN_T) && length < max)
     {
@@ -84,9 +84,98 @@
     This should be used when working with dynamic tree structures.
 
 
+  - RBT_NODE_CACHE_BATCH
+
+    A positive integer value. This only has an effect if `RBT_NODE_CACHE_SIZE`
+    is also set. Each thread then keeps its own cache of nodes without locking.
+    Nodes are exchanged with the global cache in batches of this many nodes:
+    a thread whose cache is empty takes a whole batch, and a thread whose cache
+    has grown to two batches returns one. The global cache is only locked for
+    these exchanges, so threads that create and free many nodes do not contend
+    for `RBT_NODE_CACHE_LOCK`.
+
+    Setting this value will also define the following:
+
+    - `RBT_NODE_CACHE_LOCAL`
+
+      The thread-local cache of type `RBT_NODE_CACHE_T`.
+
+    - `RBT_NODE_CACHE_FLUSH`
+
+      A function to return the calling thread's cached nodes to the global
+      cache. Threads should call this before they exit. Nodes that do not fill
+      a batch are freed.
+
+    The size limit of the global cache applies to whole batches.
+
+
+  - RBT_NODE_ARENA
+
+    A power of 2 no less than 4096. If set, the nodes and key fragments of each
+    tree are allocated from slabs of this many bytes that belong to the tree
+    instead of being allocated individually. Slabs are allocated in batches of
+    increasing size. Each slab is aligned to its size so
+    that the tree to which a node belongs can be found from the node's address,
+    which keeps the node functions' signatures unchanged. Freed nodes and key
+    fragments are kept in free lists for reuse by the same tree. Key fragments
+    are grouped in power-of-2 size classes.
+
+    Each call to `RBT_NODE_CREATE()` or `RBT_NODE_NEW()` starts a new tree with
+    its own arena. Freeing that node with `RBT_NODE_FREE()` releases the whole
+    arena at once after freeing the values, instead of returning each node and
+    key fragment to the allocator. Nodes must not be moved between trees.
+
+    This cannot be combined with `RBT_NODE_CACHE_SIZE`. Setting this value will
+    also define `RBT_NODE_ARENA_BYTES()` to get the number of bytes allocated
+    by a tree's arena.
+
+    This should be used for large, long-lived trees and for trees that are
+    frequently rebuilt.
+
+  - RBT_NODE_STATS_DEPTHS
+
+    The number of buckets in the depth histogram of `RBT_NODE_STATS_T`. The
+    last bucket also counts all deeper values. The default is 64.
+
+  - RBT_VALUE_HEAP_BYTES(val)
+
+    The number of bytes allocated on the heap for a value, e.g. for a string
+    that it owns. This is only used by `RBT_NODE_STATS()`, which reports 0
+    bytes for values if it is not defined.
+
+  - RBT_NODE_KEY_INLINE_PINS
+
+    An unsigned integer value. If it is positive, key fragments of up to this
+    many pins are stored in the node itself instead of in a separate
+    allocation. Longer fragments are still allocated on the heap. This saves an
+    allocation and a likely cache miss per node when keys are short, e.g. for
+    fixed-width integer keys. The node's `key` field always points to the
+    fragment, wherever it is stored.
+
+    The inline pins are placed after the `bits` field so that they can fill its
+    padding. For example, a single 32-bit pin with 64-bit pointers does not
+    increase the size of the node.
+
+  - RBT_KEY_SIZE_FIXED
+
+    The size of the keys, in bytes, if it is fixed or if a maximum key size can
+    be anticipated. If set, the traversal functions keep their stacks in arrays
+    sized for the deepest possible tree instead of allocating them, so full
+    traversals do not allocate any memory. Keys must not exceed this size.
+    The same macro is used by traverse_with_key.h and wrapper.h.
+
   - RBT_CONCURRENCY_PTHREAD
 
-    Define this macro to include concurrency/node_pthread.h
+    Define this macro to include concurrency/node_pthread.h. It provides a
+    reader-writer-locked root type for sharing trees between threads and it
+    protects the node cache with a mutex.
+
+  - RBT_CONCURRENCY_PERSISTENT
+
+    Define this macro to include concurrency/node_persistent.h. It provides a
+    persistent tree type that is updated by copying the path to the modified
+    node and publishing a new root, so that readers never wait for writers.
+    This cannot be combined with `RBT_NODE_ARENA`.
 
 
 
@@ -160,6 +249,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -214,6 +304,30 @@
 typedef RBT_VALUE_T                             RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_, value_t);
 
 
+#undef RBT_NODE_ARENA_BYTES
+#define RBT_NODE_ARENA_BYTES                  RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_bytes)
+
+#undef RBT_NODE_BULK_BEGIN
+#define RBT_NODE_BULK_BEGIN                   RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_begin)
+
+#undef RBT_NODE_BULK_BUILD
+#define RBT_NODE_BULK_BUILD                   RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_build)
+
+#undef RBT_NODE_BULK_END
+#define RBT_NODE_BULK_END                     RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_end)
+
+#undef RBT_NODE_BULK_INSERT
+#define RBT_NODE_BULK_INSERT                  RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_insert)
+
+#undef RBT_NODE_BULK_ITEM_T
+#define RBT_NODE_BULK_ITEM_T                  RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_item_t)
+
+#undef RBT_NODE_BULK_MERGE
+#define RBT_NODE_BULK_MERGE                   RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_merge)
+
+#undef RBT_NODE_BULK_T
+#define RBT_NODE_BULK_T                       RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_t)
+
 #undef RBT_NODE_COPY
 #define RBT_NODE_COPY                         RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_copy)
 
@@ -250,6 +364,9 @@ typedef RBT_VALUE_T                             RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_,
 #undef RBT_NODE_IS_COPY
 #define RBT_NODE_IS_COPY                      RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_is_copy)
 
+#undef RBT_NODE_LONGEST_PREFIX
+#define RBT_NODE_LONGEST_PREFIX               RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_longest_prefix)
+
 #undef RBT_NODE_MERGE_CHILD
 #define RBT_NODE_MERGE_CHILD                  RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_merge_child)
 
@@ -262,12 +379,21 @@ typedef RBT_VALUE_T                             RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_,
 #undef RBT_NODE_RETRIEVE
 #define RBT_NODE_RETRIEVE                     RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_retrieve)
 
+#undef RBT_NODE_RETRIEVE_BATCH
+#define RBT_NODE_RETRIEVE_BATCH               RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_retrieve_batch)
+
 #undef RBT_NODE_QUERY
 #define RBT_NODE_QUERY                        RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_query)
 
 #undef RBT_NODE_TRAVERSE
 #define RBT_NODE_TRAVERSE                        RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_traverse)
 
+#undef RBT_NODE_STATS
+#define RBT_NODE_STATS                        RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_stats)
+
+#undef RBT_NODE_STATS_T
+#define RBT_NODE_STATS_T                      RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_stats_t)
+
 #undef RBT_NODE_STACK_T
 #define RBT_NODE_STACK_T                      RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_stack_t)
 
@@ -314,13 +440,171 @@ typedef RBT_VALUE_T                             RBT_TOKEN_2_W(RBT_KEY_H_PREFIX_,
 #undef _RBT_NODE_FILTER_WITH_KEY_STACK_T
 #define _RBT_NODE_FILTER_WITH_KEY_STACK_T   _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_filter_with_key_stack_t)
 
+#undef _RBT_NODE_KEY_RESIZE
+#define _RBT_NODE_KEY_RESIZE                _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_key_resize)
+
+#undef _RBT_NODE_BATCH_LANE_T
+#define _RBT_NODE_BATCH_LANE_T              _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_batch_lane_t)
+
+#undef _RBT_NODE_BULK_ENTRY_T
+#define _RBT_NODE_BULK_ENTRY_T              _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_bulk_entry_t)
+
+#undef _RBT_NODE_ARENA_T
+#define _RBT_NODE_ARENA_T                   _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_t)
+
+#undef _RBT_NODE_ARENA_SLAB_T
+#define _RBT_NODE_ARENA_SLAB_T              _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_slab_t)
+
+#undef _RBT_NODE_ARENA_NEW
+#define _RBT_NODE_ARENA_NEW                 _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_new)
+
+#undef _RBT_NODE_ARENA_RELEASE
+#define _RBT_NODE_ARENA_RELEASE             _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_release)
+
+#undef _RBT_NODE_ARENA_ALLOC
+#define _RBT_NODE_ARENA_ALLOC               _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_alloc)
+
+#undef _RBT_NODE_ARENA_BATCH
+#define _RBT_NODE_ARENA_BATCH               _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_batch)
+
+#undef _RBT_NODE_ARENA_CLASS
+#define _RBT_NODE_ARENA_CLASS               _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_class)
+
+#undef _RBT_NODE_ARENA_ALLOC_KEY
+#define _RBT_NODE_ARENA_ALLOC_KEY           _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_alloc_key)
+
+#undef _RBT_NODE_ARENA_FREE_KEY
+#define _RBT_NODE_ARENA_FREE_KEY            _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_free_key)
+
+#undef _RBT_NODE_ARENA_ALLOC_NODE
+#define _RBT_NODE_ARENA_ALLOC_NODE          _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_alloc_node)
+
+#undef _RBT_NODE_ARENA_FREE_NODE
+#define _RBT_NODE_ARENA_FREE_NODE           _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_free_node)
+
+#undef _RBT_NODE_ARENA_FREE_VALUES
+#define _RBT_NODE_ARENA_FREE_VALUES         _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_arena_free_values)
+
+#undef _RBT_NODE_CREATE_IN
+#define _RBT_NODE_CREATE_IN                 _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_create_in)
+
+
+
+/*
+  Internal macros for the storage of node key fragments. See
+  RBT_NODE_KEY_INLINE_PINS.
+*/
+#undef _RBT_NODE_KEY_INLINE_PINS
+#ifdef RBT_NODE_KEY_INLINE_PINS
+#define _RBT_NODE_KEY_INLINE_PINS RBT_NODE_KEY_INLINE_PINS
+#else
+#define _RBT_NODE_KEY_INLINE_PINS 0
+#endif // RBT_NODE_KEY_INLINE_PINS
+
+#undef _RBT_NODE_ARENA
+#ifdef RBT_NODE_ARENA
+#define _RBT_NODE_ARENA RBT_NODE_ARENA
+#else
+#define _RBT_NODE_ARENA 0
+#endif // RBT_NODE_ARENA
+
+#undef _RBT_NODE_KEY_INIT
+#undef _RBT_NODE_KEY_IS_ALLOCATED
+#if _RBT_NODE_KEY_INLINE_PINS > 0
+#define _RBT_NODE_KEY_INIT(node) (node)->key = (node)->key_inline
+#define _RBT_NODE_KEY_IS_ALLOCATED(node) ((node)->key != (node)->key_inline)
+#else
+#define _RBT_NODE_KEY_INIT(node) (node)->key = NULL
+#define _RBT_NODE_KEY_IS_ALLOCATED(node) ((node)->key != NULL)
+#endif // _RBT_NODE_KEY_INLINE_PINS
+
+/*
+  Allocated key fragments always have the size required by the bits of their
+  node, so the size does not need to be stored.
+*/
+#undef _RBT_NODE_KEY_DEALLOC
+#if _RBT_NODE_ARENA > 0
+#define _RBT_NODE_KEY_DEALLOC(node) \
+  _RBT_NODE_ARENA_FREE_KEY( \
+    _RBT_NODE_ARENA_OF(node), \
+    (node)->key, \
+    BITS_TO_PINS_TO_BYTES((node)->bits) \
+  )
+#else
+#define _RBT_NODE_KEY_DEALLOC(node) free((node)->key)
+#endif // _RBT_NODE_ARENA
+
+#undef _RBT_NODE_KEY_FREE
+#define _RBT_NODE_KEY_FREE(node) \
+do \
+{ \
+  if (_RBT_NODE_KEY_IS_ALLOCATED(node)) \
+  { \
+    _RBT_NODE_KEY_DEALLOC(node); \
+  } \
+} \
+while (0)
+
 
 
 /*
-  The following are internal convencience macros for managing a stack using a
-  linked list. To prevent unnecessary cycles of allocation and freeing as the
-  stack changes, previously allocated elements are reused.
+  The following are internal convencience macros for managing the stacks of
+  the traversal functions.
+
+  If the key size is fixed then the depth of the tree is bounded by the number
+  of bits in the key because each node below the root adds at least one bit.
+  The stack is then an array on the function's stack and the stack pointer
+  points to its top element, or is NULL if the stack is empty. This avoids all
+  allocations during traversal.
+
+  Otherwise the stack is a linked list. To prevent unnecessary cycles of
+  allocation and freeing as the stack changes, previously allocated elements
+  are reused.
+
+  In both cases the stack is accessed through the pointer to its top element.
+  Functions must declare each stack with _RBT_NODE_STACK_DECLARE after its
+  pointer variables. It includes the terminating semicolon.
 */
+#ifdef RBT_KEY_SIZE_FIXED
+
+#undef _RBT_NODE_STACK_SIZE
+#define _RBT_NODE_STACK_SIZE (RBT_KEY_SIZE_FIXED * BITS_PER_BYTE + 1)
+
+#undef _RBT_NODE_STACK_DECLARE
+#define _RBT_NODE_STACK_DECLARE(stack, stack_t) \
+stack_t stack ## _array[_RBT_NODE_STACK_SIZE];
+
+#undef _RBT_NODE_STACK_ALLOCATE
+#define _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, stack_t) \
+do \
+{ \
+  stack = (stack == NULL) ? stack ## _array : stack + 1; \
+} \
+while(0)
+
+#undef _RBT_NODE_STACK_POP
+#define _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused) \
+do \
+{ \
+  stack = (stack == stack ## _array) ? NULL : stack - 1; \
+} \
+while(0)
+
+#undef _RBT_NODE_STACK_FREE
+#define _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused) \
+do \
+{ \
+  (void) stack_tmp; \
+  (void) stack_unused; \
+  stack = NULL; \
+} \
+while(0)
+
+#else
+
+#undef _RBT_NODE_STACK_DECLARE
+#define _RBT_NODE_STACK_DECLARE(stack, stack_t)
+
 #undef _RBT_NODE_STACK_ALLOCATE
 #define _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, stack_t) \
 do \
@@ -377,6 +661,8 @@ do \
 } \
 while(0)
 
+#endif // RBT_KEY_SIZE_FIXED
+
 /*!
   @endcond
 */
@@ -437,6 +723,16 @@ struct RBT_NODE_T
   */
   RBT_KEY_SIZE_T bits;
 
+#if _RBT_NODE_KEY_INLINE_PINS > 0
+  /*!
+    @brief
+    Inline storage for short key segments.
+
+    The key points here if the segment fits.
+  */
+  RBT_PIN_T key_inline[_RBT_NODE_KEY_INLINE_PINS];
+#endif // _RBT_NODE_KEY_INLINE_PINS
+
   /*!
     @brief
     Value associated with the node.
@@ -520,6 +816,14 @@ RBT_KEY_DATA_T;
 #define RBT_NODE_CACHE_T    RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_t)
 #undef RBT_NODE_CACHE_FREE
 #define RBT_NODE_CACHE_FREE RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_free)
+#undef RBT_NODE_CACHE_LOCAL
+#define RBT_NODE_CACHE_LOCAL RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_local)
+#undef RBT_NODE_CACHE_FLUSH
+#define RBT_NODE_CACHE_FLUSH RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_flush)
+#undef _RBT_NODE_CACHE_GET
+#define _RBT_NODE_CACHE_GET _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_get)
+#undef _RBT_NODE_CACHE_PUT_BATCH
+#define _RBT_NODE_CACHE_PUT_BATCH _RBT_TOKEN_2_W(RBT_NODE_H_PREFIX_, node_cache_put_batch)
 
 /*!
   @brief
@@ -535,6 +839,10 @@ struct RBT_NODE_CACHE_T
 
     A pointer to the first cached node. The nodes are used as linked lists with
     the left child pointer pointing to the next node in the cache.
+
+    If `RBT_NODE_CACHE_BATCH` is set, the global cache holds a list of batches
+    instead. The right child pointer of the first node of each batch points to
+    the next batch.
   */
   RBT_NODE_T * node;
 
@@ -557,2579 +865,4163 @@ RBT_NODE_CACHE_T;
 */
 RBT_NODE_CACHE_T RBT_NODE_CACHE = {.node=NULL, .n=0};
 
+#ifdef RBT_NODE_CACHE_BATCH
+/*!
+  @brief
+  The node cache of the current thread.
+*/
+__thread RBT_NODE_CACHE_T RBT_NODE_CACHE_LOCAL = {.node=NULL, .n=0};
+#endif //RBT_NODE_CACHE_BATCH
+
 #endif //RBT_NODE_CACHE_SIZE
 
 
 
-//////////////////////////// Concurrency Inclusions ////////////////////////////
-#ifdef RBT_CONCURRENCY_PTHREAD
-#  include "concurrency/pthread.h"
-#endif //RBT_CONCURRENCY_PTHREAD
+////////////////////////////////// Node Arena //////////////////////////////////
+#if _RBT_NODE_ARENA > 0
 
+#ifdef RBT_NODE_CACHE_SIZE
+#error RBT_NODE_ARENA cannot be combined with RBT_NODE_CACHE_SIZE.
+#endif // RBT_NODE_CACHE_SIZE
 
+#if (_RBT_NODE_ARENA & (_RBT_NODE_ARENA - 1)) || _RBT_NODE_ARENA < 0x1000
+#error RBT_NODE_ARENA must be a power of 2 no less than 4096.
+#endif // _RBT_NODE_ARENA
 
-#ifdef RBT_NODE_CACHE_SIZE
-#  ifndef RBT_NODE_CACHE_LOCK
-#    define RBT_NODE_CACHE_LOCK
-#  endif //RBT_NODE_CACHE_LOCK
+/*
+  The alignment of all blocks allocated from the slabs.
+*/
+#undef _RBT_NODE_ARENA_ALIGN
+#define _RBT_NODE_ARENA_ALIGN \
+  (_Alignof(RBT_NODE_T) > sizeof(void *) ? _Alignof(RBT_NODE_T) : sizeof(void *))
 
-#  ifndef RBT_NODE_CACHE_UNLOCK
-#    define RBT_NODE_CACHE_UNLOCK
-#  endif //RBT_NODE_CACHE_UNLOCK
+#undef _RBT_NODE_ARENA_ROUND
+#define _RBT_NODE_ARENA_ROUND(bytes) \
+  (((bytes) + _RBT_NODE_ARENA_ALIGN - 1) & ~(_RBT_NODE_ARENA_ALIGN - 1))
 
+/*
+  Get the arena of the slab containing the given address.
+*/
+#undef _RBT_NODE_ARENA_OF
+#define _RBT_NODE_ARENA_OF(ptr) \
+  (((_RBT_NODE_ARENA_SLAB_T *) ((uintptr_t) (ptr) & ~((uintptr_t) _RBT_NODE_ARENA - 1)))->arena)
 
 /*!
-  Free the nodes in the cache. This should be called when no more nodes will be
-  needed and before the program exits.
+  @brief
+  The header at the start of each slab.
 */
-
-void
-RBT_NODE_CACHE_FREE()
+typedef
+struct _RBT_NODE_ARENA_SLAB_T
 {
-  RBT_NODE_T * node_tmp;
-  RBT_NODE_CACHE_LOCK
-  while (RBT_NODE_CACHE.node != NULL)
-  {
-    node_tmp = (RBT_NODE_CACHE.node)->left;
-    free(RBT_NODE_CACHE.node);
-    RBT_NODE_CACHE.node = node_tmp;
-  }
-  RBT_NODE_CACHE.n = 0;
-  RBT_NODE_CACHE_UNLOCK
+  /*!
+    @brief
+    The arena to which the slab belongs.
+  */
+  struct _RBT_NODE_ARENA_T * arena;
+
+  /*!
+    @brief
+    The next batch of slabs of the arena. This is only set in the first slab of
+    each batch.
+  */
+  struct _RBT_NODE_ARENA_SLAB_T * next;
 }
-#endif //RBT_NODE_CACHE_SIZE
+_RBT_NODE_ARENA_SLAB_T;
+
+/*!
+  @brief
+  The arena of a tree. It is stored in the tree's first slab.
 
+  Slabs are allocated in batches that double in size up to
+  `_RBT_NODE_ARENA_BATCH_MAX` slabs. Aligned allocations may waste up to the
+  alignment, so this keeps the waste small without committing much memory to
+  small trees.
+*/
+typedef
+struct _RBT_NODE_ARENA_T
+{
+  /*!
+    @brief
+    The batches of slabs, most recent first.
+  */
+  _RBT_NODE_ARENA_SLAB_T * batches;
 
+  /*!
+    @brief
+    The total size of the batches.
+  */
+  size_t bytes;
 
+  /*!
+    @brief
+    The unused space of the current slab.
+  */
+  BYTE_T * next;
 
+  /*!
+    @brief
+    The end of the current slab.
+  */
+  BYTE_T * end;
 
+  /*!
+    @brief
+    The next unused slab of the current batch.
+  */
+  BYTE_T * slab;
 
-/*!
-  @brief
-  Linked list of nodes.
+  /*!
+    @brief
+    The end of the current batch.
+  */
+  BYTE_T * slab_end;
 
-  A unidirectional linked list used for implementing dynamic stacks of nodes for
-  e.g. tracking parent nodes when traversing a tree.
-*/
+  /*!
+    @brief
+    The number of slabs in the next batch.
+  */
+  size_t batch_slabs;
 
-typedef
-struct RBT_NODE_STACK_T
-{
   /*!
-    The node.
+    @brief
+    Freed nodes, linked through their left child pointers.
   */
-  RBT_NODE_T * node;
+  RBT_NODE_T * nodes;
 
   /*!
-    The next item.
+    @brief
+    Freed key fragments by size class, linked through their first bytes. Class
+    `i` holds fragments of `2^i` bytes.
   */
-  struct RBT_NODE_STACK_T * next;
+  void * keys[sizeof(size_t) * CHAR_BIT];
+
+  /*!
+    @brief
+    The root node of the tree.
+  */
+  RBT_NODE_T * root;
 }
-RBT_NODE_STACK_T;
+_RBT_NODE_ARENA_T;
 
+#undef _RBT_NODE_ARENA_BATCH_MAX
+#define _RBT_NODE_ARENA_BATCH_MAX 0x40
 
+#undef _RBT_NODE_ARENA_HEADER
+#define _RBT_NODE_ARENA_HEADER _RBT_NODE_ARENA_ROUND(sizeof(_RBT_NODE_ARENA_SLAB_T))
 
-/*
-  Print a node and its descendents to a file descriptor in a simple format.
-  This is mostly for debugging but may be expanded later.
-void
-RBT_NODE_FPRINT(FILE * fd, RBT_NODE_T * node, int indent, int skip)
+
+
+/*!
+  @brief
+  Allocate a batch of slabs and initialize the header of its first slab.
+
+  @param
+  arena The arena, or NULL if the batch will hold the arena.
+
+  @param
+  bytes The size of the batch. It must be a multiple of the slab size.
+
+  @return
+  The first slab, or NULL on failure.
+*/
+_RBT_NODE_ARENA_SLAB_T *
+_RBT_NODE_ARENA_BATCH(
+  _RBT_NODE_ARENA_T * arena,
+  size_t bytes
+)
 {
-  int i = indent;
-  while(i--)
-  {
-//     fprintf(fd, "  ");
-    fputc('.', fd);
-  }
-  RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
-  fprintf(fd, " ");
-  fprintf(fd, " (%p) ", node);
-  RBT_VALUE_FPRINT(fd, node->value);
-  fprintf(fd, "\n");
-  indent += node->bits - skip;
-  skip = node->bits % RBT_PIN_SIZE_BITS;
-  if (node->left != NULL)
+  _RBT_NODE_ARENA_SLAB_T * slab;
+  void * ptr;
+
+  if (posix_memalign(&ptr, _RBT_NODE_ARENA, bytes))
   {
-    RBT_NODE_FPRINT(fd, node->left, indent, skip);
+    debug_printf("failed to allocate %zu bytes for slabs\n", bytes);
+    errno = ENOMEM;
+    return NULL;
   }
-  if (node->right != NULL)
+  slab = ptr;
+  slab->arena = arena;
+  slab->next = NULL;
+  if (arena != NULL)
   {
-    RBT_NODE_FPRINT(fd, node->right, indent, skip);
+    slab->next = arena->batches;
+    arena->batches = slab;
+    arena->bytes += bytes;
   }
+  return slab;
 }
-*/
 
 
-/*
-  The original recursive version that I wrote for initial testing.
 
-void
-RBT_NODE_FPRINT_INTERNAL(FILE * fd, RBT_NODE_T * node, int print_bits, RBT_KEY_SIZE_T indent, unsigned long vert, int end, int skip)
+/*!
+  @brief
+  Create an arena.
+
+  @return
+  The arena, or NULL on failure.
+*/
+_RBT_NODE_ARENA_T *
+_RBT_NODE_ARENA_NEW()
 {
-  RBT_KEY_SIZE_T i;
-  unsigned long shifted_vert;
+  _RBT_NODE_ARENA_SLAB_T * slab;
+  _RBT_NODE_ARENA_T * arena;
 
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[32m");
-#endif
+  slab = _RBT_NODE_ARENA_BATCH(NULL, _RBT_NODE_ARENA);
+  if (slab == NULL)
+  {
+    return NULL;
+  }
+  arena = (_RBT_NODE_ARENA_T *) (((BYTE_T *) slab) + _RBT_NODE_ARENA_HEADER);
+  memset(arena, 0, sizeof(_RBT_NODE_ARENA_T));
+  slab->arena = arena;
+  arena->batches = slab;
+  arena->bytes = _RBT_NODE_ARENA;
+  arena->next = ((BYTE_T *) arena) + _RBT_NODE_ARENA_ROUND(sizeof(_RBT_NODE_ARENA_T));
+  arena->end = ((BYTE_T *) slab) + _RBT_NODE_ARENA;
+  arena->batch_slabs = 2;
+  return arena;
+}
 
-  fprintf(fd, "%10p ", node);
 
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[34m");
-#endif
 
-  if (indent)
-  {
-    for (i = indent - 1; i; i--)
+/*!
+  @brief
+  Free all slabs of an arena, including the arena itself.
+
+  @param
+  arena The arena.
+*/
+void
+_RBT_NODE_ARENA_RELEASE(
+  _RBT_NODE_ARENA_T * arena
+)
+{
+  _RBT_NODE_ARENA_SLAB_T * slab, * next;
+
+  for (slab = arena->batches; slab != NULL; slab = next)
+  {
+    next = slab->next;
+    free(slab);
+  }
+}
+
+
+
+/*!
+  @brief
+  Allocate a block from an arena.
+
+  Blocks that do not fit in a slab get a batch of their own.
+
+  @param
+  arena The arena.
+
+  @param
+  bytes The size of the block.
+
+  @return
+  The block, or NULL on failure.
+*/
+void *
+_RBT_NODE_ARENA_ALLOC(
+  _RBT_NODE_ARENA_T * arena,
+  size_t bytes
+)
+{
+  _RBT_NODE_ARENA_SLAB_T * slab;
+  size_t size;
+  void * ptr;
+
+  bytes = _RBT_NODE_ARENA_ROUND(bytes);
+  if ((size_t) (arena->end - arena->next) < bytes)
+  {
+    if (bytes > _RBT_NODE_ARENA - _RBT_NODE_ARENA_HEADER)
     {
-      shifted_vert = (vert >> i);
-      if (shifted_vert & 1)
-      {
-        fprintf(fd, "│");
-      }
-      else
+      size = (_RBT_NODE_ARENA_HEADER + bytes + _RBT_NODE_ARENA - 1) & ~((size_t) _RBT_NODE_ARENA - 1);
+      slab = _RBT_NODE_ARENA_BATCH(arena, size);
+      if (slab == NULL)
       {
-        fprintf(fd, " ");
+        return NULL;
       }
+      return ((BYTE_T *) slab) + _RBT_NODE_ARENA_HEADER;
     }
-    if (indent)
+    if (arena->slab == arena->slab_end)
     {
-      if (end)
+      size = arena->batch_slabs * _RBT_NODE_ARENA;
+      slab = _RBT_NODE_ARENA_BATCH(arena, size);
+      if (slab == NULL)
       {
-        fprintf(fd, "└");
+        return NULL;
       }
-      else
+      arena->slab = (BYTE_T *) slab;
+      arena->slab_end = arena->slab + size;
+      if (arena->batch_slabs < _RBT_NODE_ARENA_BATCH_MAX)
       {
-        fprintf(fd, "├");
+        arena->batch_slabs *= 2;
       }
     }
+    slab = (_RBT_NODE_ARENA_SLAB_T *) arena->slab;
+    slab->arena = arena;
+    arena->next = arena->slab + _RBT_NODE_ARENA_HEADER;
+    arena->end = arena->slab + _RBT_NODE_ARENA;
+    arena->slab += _RBT_NODE_ARENA;
   }
+  ptr = arena->next;
+  arena->next += bytes;
+  return ptr;
+}
 
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[35m");
-#endif
 
 
-  if (print_bits)
+/*!
+  @brief
+  Get the size class of a key fragment.
+
+  @param
+  bytes The size of the key fragment.
+
+  @return
+  The size class.
+*/
+unsigned int
+_RBT_NODE_ARENA_CLASS(
+  size_t bytes
+)
+{
+  unsigned int class;
+  class = 0;
+  while (((size_t) 1 << class) < sizeof(void *))
   {
-    RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
-    fprintf(fd, " ");
-    i = node->bits - skip;
+    class ++;
   }
-  else
+  while (((size_t) 1 << class) < bytes)
   {
-    fprintf(fd, "● ");
-    i = 1;
+    class ++;
   }
+  return class;
+}
 
-  indent += i;
-  vert <<= i;
-  vert ++;
 
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[36m");
-#endif
 
-  RBT_VALUE_FPRINT(fd, node->value);
-  fprintf(fd, "\n");
+/*!
+  @brief
+  Allocate a key fragment from an arena.
 
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[0m");
-#endif
+  @param
+  arena The arena.
 
+  @param
+  bytes The size of the key fragment.
 
-  skip = node->bits % RBT_PIN_SIZE_BITS;
-  if (node->left != NULL)
-  {
-    RBT_NODE_FPRINT_INTERNAL(fd, node->left, print_bits, indent, vert, (node->right == NULL), skip);
-  }
-  if (node->right != NULL)
+  @return
+  The key fragment, or NULL on failure.
+*/
+RBT_PIN_T *
+_RBT_NODE_ARENA_ALLOC_KEY(
+  _RBT_NODE_ARENA_T * arena,
+  size_t bytes
+)
+{
+  unsigned int class;
+  void * key;
+
+  class = _RBT_NODE_ARENA_CLASS(bytes);
+  key = arena->keys[class];
+  if (key != NULL)
   {
-    vert --;
-    RBT_NODE_FPRINT_INTERNAL(fd, node->right, print_bits, indent, vert, 1, skip);
+    arena->keys[class] = * (void * *) key;
+    return key;
   }
+  return _RBT_NODE_ARENA_ALLOC(arena, (size_t) 1 << class);
 }
-*/
+
+
 
 /*!
-  @cond INTERNAL
+  @brief
+  Return a key fragment to an arena.
+
+  @param
+  arena The arena.
+
+  @param
+  key The key fragment.
+
+  @param
+  bytes The size of the key fragment.
 */
+void
+_RBT_NODE_ARENA_FREE_KEY(
+  _RBT_NODE_ARENA_T * arena,
+  RBT_PIN_T * key,
+  size_t bytes
+)
+{
+  unsigned int class;
+
+  class = _RBT_NODE_ARENA_CLASS(bytes);
+  * (void * *) key = arena->keys[class];
+  arena->keys[class] = key;
+}
+
+
 
 /*!
   @brief
-  Linked list for implementing RBT_NODE_FPRINT_INTERNAL's dynamic stack.
+  Allocate a node from an arena.
 
-  \warning
-  This is an internal structure.
-*/
+  @param
+  arena The arena. If NULL, a new arena is created and the node becomes the
+  root of its tree.
 
-typedef
-struct _RBT_NODE_PRINT_STACK_T
+  @return
+  The node, or NULL on failure.
+*/
+RBT_NODE_T *
+_RBT_NODE_ARENA_ALLOC_NODE(
+  _RBT_NODE_ARENA_T * arena
+)
 {
-  /*!
-    @brief
-    The node.
-  */
   RBT_NODE_T * node;
 
-  /*!
-    @brief
-    The indentation level.
-  */
-  RBT_KEY_SIZE_T indent;
+  if (arena == NULL)
+  {
+    arena = _RBT_NODE_ARENA_NEW();
+    if (arena == NULL)
+    {
+      return NULL;
+    }
+    node = _RBT_NODE_ARENA_ALLOC(arena, sizeof(RBT_NODE_T));
+    arena->root = node;
+    return node;
+  }
+  node = arena->nodes;
+  if (node != NULL)
+  {
+    arena->nodes = node->left;
+    return node;
+  }
+  return _RBT_NODE_ARENA_ALLOC(arena, sizeof(RBT_NODE_T));
+}
 
-  /*!
-    @brief
-    A number tracking unprinted siblings.
 
-    This number tracks siblings for drawing branches with vertical box-drawing
-    characters. Each bit in the number is used as a switch to determine whether
-    or not a vertical bar should be drawn to the left of the node
-    representation.
-  */
-  RBT_KEY_SIZE_T vert;
 
-  /*!
-    @brief
-    A boolean indicating if the node is the last child of its parent.
-  */
-  int is_last_child;
+/*!
+  @brief
+  Return a node to its arena. Returning the root releases the arena.
 
-  /*!
-    @brief
-    The number of bits to skip in the nodes key.
-  */
-  int skip;
+  @param
+  node The node. Its key and value must have been freed.
+*/
+void
+_RBT_NODE_ARENA_FREE_NODE(
+  RBT_NODE_T * node
+)
+{
+  _RBT_NODE_ARENA_T * arena;
 
-  /*!
-    @brief
-    The next item in the stack.
-  */
-  struct _RBT_NODE_PRINT_STACK_T * next;
+  arena = _RBT_NODE_ARENA_OF(node);
+  if (node == arena->root)
+  {
+    _RBT_NODE_ARENA_RELEASE(arena);
+    return;
+  }
+  node->left = arena->nodes;
+  arena->nodes = node;
 }
-_RBT_NODE_PRINT_STACK_T;
+
+
 
 /*!
-  @endcond
+  @brief
+  Free the values of all nodes in a tree without returning the nodes to the
+  arena. The tree is destroyed.
+
+  Left children are rotated up until the current node has none, so no stack is
+  required.
+
+  @param
+  node The root node.
 */
+void
+_RBT_NODE_ARENA_FREE_VALUES(
+  RBT_NODE_T * node
+)
+{
+  RBT_NODE_T * next;
+
+  while (node != NULL)
+  {
+    if (node->left != NULL)
+    {
+      next = node->left;
+      node->left = next->right;
+      next->right = node;
+      node = next;
+    }
+    else
+    {
+      RBT_VALUE_FREE(node->value);
+      node = node->right;
+    }
+  }
+}
+
+
 
 /*!
-  The internal function used by RBT_NODE_FPRINT() for printing trees using
-  box-drawing characters.
+  @brief
+  Get the number of bytes allocated by the arena of a tree.
 
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
+  @param
+  node Any node of the tree.
 
-  @param[in]
-  fd The output file descriptor.
+  @return
+  The number of bytes.
+*/
+size_t
+RBT_NODE_ARENA_BYTES(
+  RBT_NODE_T * node
+)
+{
+  return _RBT_NODE_ARENA_OF(node)->bytes;
+}
 
-  @param[in]
-  node A pointer to the target root node.
 
-  @param[in]
-  print_bits A boolean value to determine if the key bits of each node should
-  be printed. If false, the character '●' will be printed instead.
 
-  @param[in]
-  print_pointer A value indicating if the pointer should be printed. If
-  non-zero, the value will be used as the width of the pointer in the call to
-  fprintf.
+/*
+  Create a node in the same tree as the given address.
+*/
+#undef _RBT_NODE_CREATE_NEAR
+#define _RBT_NODE_CREATE_NEAR(ptr, key, bits, value, left, right) \
+  _RBT_NODE_CREATE_IN(_RBT_NODE_ARENA_OF(ptr), key, bits, value, left, right)
 
-  @param[in]
-  indent The indentation level.
+#undef _RBT_NODE_DEALLOC
+#define _RBT_NODE_DEALLOC(node) _RBT_NODE_ARENA_FREE_NODE(node)
 
-  @param[in]
-  vert A numerical value used to track vertical branches that should be printed
-  to the left of the current node.
+#else
 
-  @param[in]
-  is_last_child A boolean value indicating if the current node is the last child of
-  its parent.
+#undef _RBT_NODE_CREATE_NEAR
+#define _RBT_NODE_CREATE_NEAR(ptr, key, bits, value, left, right) \
+  RBT_NODE_CREATE(key, bits, value, left, right)
 
-  @param[in]
-  skip The number of bits held by this node that should be skipped. These are
-  the staggered bits of the parent node.
+#undef _RBT_NODE_DEALLOC
+#define _RBT_NODE_DEALLOC(node) free(node)
 
-  @see
-  - `RBT_NODE_FPRINT()`
-*/
+#endif // _RBT_NODE_ARENA
 
-void
-RBT_NODE_FPRINT_INTERNAL(
-  FILE * fd,
-  RBT_NODE_T * node,
-  int print_bits,
-  int print_pointer,
-  RBT_KEY_SIZE_T indent,
-  RBT_KEY_SIZE_T vert,
-  int is_last_child,
-  int skip
-)
-{
-  RBT_KEY_SIZE_T i;
-  _RBT_NODE_PRINT_STACK_T * stack, * stack_tmp, * stack_unused;
-  int rc;
-  unsigned long shifted_vert;
 
-  errno = 0;
 
-  if (node == NULL)
-  {
-    return;
-  }
+//////////////////////////// Concurrency Inclusions ////////////////////////////
+#ifdef RBT_CONCURRENCY_PTHREAD
+#  include "concurrency/node_pthread.h"
+#endif //RBT_CONCURRENCY_PTHREAD
 
-  stack = NULL;
-  stack_unused = NULL;
-  rc = 0;
 
-  while (1)
-  {
-    if (print_pointer)
-    {
-#ifdef RBT_USE_COLOR
-      fprintf(fd, "\033[32m");
-#endif
-      fprintf(fd, "%*p ", print_pointer, node);
-    }
 
-#ifdef RBT_USE_COLOR
-    fprintf(fd, "\033[34m");
-#endif
+#ifdef RBT_NODE_CACHE_SIZE
+#  ifndef RBT_NODE_CACHE_LOCK
+#    define RBT_NODE_CACHE_LOCK
+#  endif //RBT_NODE_CACHE_LOCK
 
-    if (indent)
-    {
-      for (i = indent - 1; i; i--)
-      {
-        shifted_vert = (vert >> i);
-        if (shifted_vert & 1)
-        {
-          fprintf(fd, "│");
-        }
-        else
-        {
-          fprintf(fd, " ");
-        }
-      }
-      if (indent)
-      {
-        if (is_last_child)
-        {
-          fprintf(fd, "└");
-        }
-        else
-        {
-          fprintf(fd, "├");
-        }
-      }
-    }
+#  ifndef RBT_NODE_CACHE_UNLOCK
+#    define RBT_NODE_CACHE_UNLOCK
+#  endif //RBT_NODE_CACHE_UNLOCK
 
-#ifdef RBT_USE_COLOR
-    fprintf(fd, "\033[35m");
-#endif
 
+#ifdef RBT_NODE_CACHE_BATCH
+/*!
+  Move a batch of nodes from the thread-local cache to the global cache, or free
+  them if the global cache is full. The local cache must hold at least one
+  batch.
+*/
+
+void
+_RBT_NODE_CACHE_PUT_BATCH()
+{
+  RBT_NODE_T * first, * last;
+  unsigned int i;
 
-    if (print_bits)
-    {
-      RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
-      fprintf(fd, " ");
-      i = node->bits - skip;
-    }
-    else
+  first = RBT_NODE_CACHE_LOCAL.node;
+  last = first;
+  for (i=1; i<RBT_NODE_CACHE_BATCH; i++)
+  {
+    last = last->left;
+  }
+  RBT_NODE_CACHE_LOCAL.node = last->left;
+  RBT_NODE_CACHE_LOCAL.n -= RBT_NODE_CACHE_BATCH;
+  last->left = NULL;
+
+  RBT_NODE_CACHE_LOCK
+  if (
+    ! RBT_NODE_CACHE_SIZE ||
+    RBT_NODE_CACHE.n + RBT_NODE_CACHE_BATCH <= RBT_NODE_CACHE_SIZE
+  )
+  {
+    first->right = RBT_NODE_CACHE.node;
+    RBT_NODE_CACHE.node = first;
+    RBT_NODE_CACHE.n += RBT_NODE_CACHE_BATCH;
+    RBT_NODE_CACHE_UNLOCK
+  }
+  else
+  {
+    RBT_NODE_CACHE_UNLOCK
+    while (first != NULL)
     {
-      fprintf(fd, "● ");
-      i = 1;
+      last = first->left;
+      free(first);
+      first = last;
     }
+  }
+}
 
-    indent += i;
-    vert <<= i;
-    vert ++;
 
-#ifdef RBT_USE_COLOR
-    fprintf(fd, "\033[36m");
-#endif
 
-    RBT_VALUE_FPRINT(fd, node->value);
-    fprintf(fd, "\n");
+/*!
+  Take a node from the thread-local cache, refilling it with a batch from the
+  global cache if it is empty.
 
+  @return
+  The node, or NULL if both caches are empty.
+*/
 
-    skip = node->bits % RBT_PIN_SIZE_BITS;
-    if (node->left != NULL)
-    {
-      is_last_child = (node->right == NULL);
-      if (!is_last_child)
-      {
-        /*
-          errno and rc may be set to non-zero values here, in which case the
-          loop will also be broken.
-        */
-        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_PRINT_STACK_T);
-        stack->node = node->right;
-        stack->indent = indent;
-        stack->vert = vert - 1;
-        stack->is_last_child = 1;
-        stack->skip = skip;
-      }
-      node = node->left;
-    }
-    else if (node->right != NULL)
-    {
-      vert --;
-      is_last_child = 1;
-      node = node->right;
-    }
-    else if (stack != NULL)
+RBT_NODE_T *
+_RBT_NODE_CACHE_GET()
+{
+  RBT_NODE_T * node;
+
+  node = RBT_NODE_CACHE_LOCAL.node;
+  if (node == NULL)
+  {
+    RBT_NODE_CACHE_LOCK
+    node = RBT_NODE_CACHE.node;
+    if (node != NULL)
     {
-      node = stack->node;
-      indent = stack->indent;
-      vert = stack->vert;
-      is_last_child = stack->is_last_child;
-      skip = stack->skip;
-      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+      RBT_NODE_CACHE.node = node->right;
+      RBT_NODE_CACHE.n -= RBT_NODE_CACHE_BATCH;
     }
-    else
+    RBT_NODE_CACHE_UNLOCK
+    if (node == NULL)
     {
-      break;
+      return NULL;
     }
+    RBT_NODE_CACHE_LOCAL.n = RBT_NODE_CACHE_BATCH;
   }
-
-#ifdef RBT_USE_COLOR
-  fprintf(fd, "\033[0m");
-#endif
-
-  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
-  errno = rc;
+  RBT_NODE_CACHE_LOCAL.node = node->left;
+  RBT_NODE_CACHE_LOCAL.n --;
+  return node;
 }
 
 
 
-
 /*!
-  @brief
-  Print trees using box-drawing characters.
-
-  A function for printing representations of trees using box-drawing characters.
-  This function is mostly for debugging purposes. It will visualize the tree
-  hierarchy and optionally show the pointers of each node along with the key
-  bits that they contain.
-
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
-
-  @param[in]
-  fd The output file descriptor.
-
-  @param[in]
-  node A pointer to the target root node.
-
-  @param[in]
-  print_bits A boolean value to determine if the key bits of each node should
-  be printed. If false, the character '●' will be printed instead.
-
-  @param[in]
-  print_pointer A value indicating if the pointer should be printed. If
-  non-zero, the value will be used as the width of the pointer in the call to
-  fprintf.
+  Return the nodes in the calling thread's cache to the global cache. Nodes that
+  do not fill a batch are freed. Threads should call this before they exit.
 */
 
 void
-RBT_NODE_FPRINT(
-  FILE * fd,
-  RBT_NODE_T * node,
-  int print_bits,
-  int print_pointer
-)
+RBT_NODE_CACHE_FLUSH()
 {
-  RBT_NODE_FPRINT_INTERNAL(fd, node, print_bits, print_pointer, 0, 0, 0, 0);
+  RBT_NODE_T * node_tmp;
+  while (RBT_NODE_CACHE_LOCAL.n >= RBT_NODE_CACHE_BATCH)
+  {
+    _RBT_NODE_CACHE_PUT_BATCH();
+  }
+  while (RBT_NODE_CACHE_LOCAL.node != NULL)
+  {
+    node_tmp = (RBT_NODE_CACHE_LOCAL.node)->left;
+    free(RBT_NODE_CACHE_LOCAL.node);
+    RBT_NODE_CACHE_LOCAL.node = node_tmp;
+  }
+  RBT_NODE_CACHE_LOCAL.n = 0;
 }
+#endif //RBT_NODE_CACHE_BATCH
 
 
 
 /*!
-  @brief
-  Create a node.
+  Free the nodes in the cache. This should be called when no more nodes will be
+  needed and before the program exits. If `RBT_NODE_CACHE_BATCH` is set then
+  the calling thread's cache is freed as well.
+*/
 
-  Create a node to hold the given key fragment and insert the given value.
-  The memory is dynamically allocated and should be freed with `RBT_NODE_FREE()`
-  when no longer needed.
+void
+RBT_NODE_CACHE_FREE()
+{
+  RBT_NODE_T * node_tmp;
+#ifdef RBT_NODE_CACHE_BATCH
+  RBT_NODE_T * batch_tmp;
 
-  If `RBT_NODE_CACHE_SIZE` is defined, a previously allocated node will be
-  taken from the cache if available instead of allocating a new block of
-  memory.
+  RBT_NODE_CACHE_FLUSH();
+  RBT_NODE_CACHE_LOCK
+  while (RBT_NODE_CACHE.node != NULL)
+  {
+    batch_tmp = (RBT_NODE_CACHE.node)->right;
+    while (RBT_NODE_CACHE.node != NULL)
+    {
+      node_tmp = (RBT_NODE_CACHE.node)->left;
+      free(RBT_NODE_CACHE.node);
+      RBT_NODE_CACHE.node = node_tmp;
+    }
+    RBT_NODE_CACHE.node = batch_tmp;
+  }
+#else
+  RBT_NODE_CACHE_LOCK
+  while (RBT_NODE_CACHE.node != NULL)
+  {
+    node_tmp = (RBT_NODE_CACHE.node)->left;
+    free(RBT_NODE_CACHE.node);
+    RBT_NODE_CACHE.node = node_tmp;
+  }
+#endif //RBT_NODE_CACHE_BATCH
+  RBT_NODE_CACHE.n = 0;
+  RBT_NODE_CACHE_UNLOCK
+}
+#endif //RBT_NODE_CACHE_SIZE
 
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
 
-  @param[in]
-  key A pointer to the key fragment.
 
-  @param[in]
-  bits The number of bits in the key fragment.
 
-  @param[in]
-  value The value to insert.
 
-  @param[in]
-  left The left child. The first new bit in this child will be 0.
 
-  @param[in]
-  right The right child. The first new bit in this child will be 1.
+/*!
+  @brief
+  Linked list of nodes.
 
-  @return
-  A pointer to the new node, or `NULL` if an error occured.
+  A unidirectional linked list used for implementing dynamic stacks of nodes for
+  e.g. tracking parent nodes when traversing a tree.
 */
-RBT_NODE_T *
-RBT_NODE_CREATE(
-  RBT_PIN_T * key,
-  RBT_KEY_SIZE_T bits,
-  RBT_VALUE_T value,
-  RBT_NODE_T * left,
-  RBT_NODE_T * right
-)
+
+typedef
+struct RBT_NODE_STACK_T
 {
+  /*!
+    The node.
+  */
   RBT_NODE_T * node;
-  RBT_KEY_SIZE_T bytes;
 
-#ifdef RBT_NODE_CACHE_SIZE
-  RBT_NODE_CACHE_LOCK
-  node = RBT_NODE_CACHE.node;
-  if (node != NULL)
-  {
-    RBT_NODE_CACHE.node = node->left;
-    RBT_NODE_CACHE.n --;
-    RBT_NODE_CACHE_UNLOCK
-  }
-  else
-  {
-    RBT_NODE_CACHE_UNLOCK
-#endif
-
-    debug_print("creating node\n");
-    node = malloc(sizeof(RBT_NODE_T));
-    if (node == NULL)
-    {
-      debug_print("failed to allocate memory for node\n");
-      return NULL;
-    }
+  /*!
+    The next item.
+  */
+  struct RBT_NODE_STACK_T * next;
+}
+RBT_NODE_STACK_T;
 
-#ifdef RBT_NODE_CACHE_SIZE
-  }
-#endif
 
-  bytes = BITS_TO_PINS_TO_BYTES(bits);
-  node->key = malloc(bytes);
-  if (node->key == NULL)
+
+/*
+  Print a node and its descendents to a file descriptor in a simple format.
+  This is mostly for debugging but may be expanded later.
+void
+RBT_NODE_FPRINT(FILE * fd, RBT_NODE_T * node, int indent, int skip)
+{
+  int i = indent;
+  while(i--)
   {
-    debug_printf("failed to allocate %" RBT_KEY_SIZE_T_FORMAT " bytes for key\n", bits);
-    free(node);
-    return NULL;
+//     fprintf(fd, "  ");
+    fputc('.', fd);
+  }
+  RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
+  fprintf(fd, " ");
+  fprintf(fd, " (%p) ", node);
+  RBT_VALUE_FPRINT(fd, node->value);
+  fprintf(fd, "\n");
+  indent += node->bits - skip;
+  skip = node->bits % RBT_PIN_SIZE_BITS;
+  if (node->left != NULL)
+  {
+    RBT_NODE_FPRINT(fd, node->left, indent, skip);
+  }
+  if (node->right != NULL)
+  {
+    RBT_NODE_FPRINT(fd, node->right, indent, skip);
   }
-  memcpy(node->key, key, bytes);
-  node->bits = bits;
-  node->value = RBT_VALUE_NULL;
-  RBT_VALUE_COPY(node->value, value, free(node->key);free(node);return NULL);
-  node->left = left;
-  node->right = right;
-  debug_printf("created node %p\n", node);
-  debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
-  return node;
 }
-
-
-
-/*!
-  A conditional macro that either caches nodes or frees them depending on the
-  value of `RBT_NODE_CACHE_SIZE`. It is used internally by `RBT_NODE_FREE()`.
 */
-#ifdef RBT_NODE_CACHE_SIZE
-  /*!
-    The displayed definition is for the caching variant.
-  */
-  #undef RBT_NODE_CACHE_OR_FREE
-  #define RBT_NODE_CACHE_OR_FREE(node) \
-  do \
-  { \
-    RBT_NODE_CACHE_LOCK \
-    if ( \
-      ! RBT_NODE_CACHE_SIZE || \
-      RBT_NODE_CACHE.n <= RBT_NODE_CACHE_SIZE \
-    ) \
-    { \
-      node->left = RBT_NODE_CACHE.node; \
-      RBT_NODE_CACHE.node = node; \
-      RBT_NODE_CACHE.n ++; \
-      RBT_NODE_CACHE_UNLOCK \
-    } \
-    else \
-    { \
-      RBT_NODE_CACHE_UNLOCK \
-      free(node); \
-    } \
-  } \
-  while (0)
-#else
-  /*!
-    The displayed definition is for the non-caching variant.
-  */
-  #undef RBT_NODE_CACHE_OR_FREE
-  #define RBT_NODE_CACHE_OR_FREE(node) free(node)
-#endif
 
-/*!
-  Free the target node and all its descendents. If `RBT_NODE_CACHE_SIZE` is set
-  then the nodes will be stored in the cache instead of being freed, if the
-  cache is not full.
 
-  @param[in]
-  node The target node.
+/*
+  The original recursive version that I wrote for initial testing.
 
-  @see
-  - `RBT_NODE_CACHE_OR_FREE()`
-*/
 void
-RBT_NODE_FREE(
-  RBT_NODE_T * node
-)
+RBT_NODE_FPRINT_INTERNAL(FILE * fd, RBT_NODE_T * node, int print_bits, RBT_KEY_SIZE_T indent, unsigned long vert, int end, int skip)
 {
-//   debug_printf("freeing node %p\n", node);
-  RBT_NODE_T * orphan, * heir, * descendent;
-
-  errno = 0;
-
-  if (node == NULL)
-  {
-    return;
-  }
+  RBT_KEY_SIZE_T i;
+  unsigned long shifted_vert;
 
-  descendent = NULL;
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[32m");
+#endif
 
-  /*
-    Do it this way to avoid recursion, which would require two calls per
-    invocation to handle both child nodes.
+  fprintf(fd, "%10p ", node);
 
-    The idea here is to free the top node then append the right tree to the
-    bottom of the left tree. The left tree's top node then replaces the current
-    node. The path to the bottom of the left tree will grow for every node
-    with two children. To avoid descending the tree from the top each time,
-    the last leftmost descendent is tracked.
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[34m");
+#endif
 
-    Tree traversal is thus reduces to traversing a linked list.
-  */
-  while (1)
+  if (indent)
   {
-//     debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
-    debug_printf("freeing node: %p\n", node);
-//     debug_printf("node key pointer: %p\n", node->key);
-    free(node->key);
-    RBT_VALUE_FREE(node->value);
-    if (node->right == NULL)
+    for (i = indent - 1; i; i--)
     {
-      if (node->left == NULL)
+      shifted_vert = (vert >> i);
+      if (shifted_vert & 1)
       {
-        RBT_NODE_CACHE_OR_FREE(node);
-//         debug_print("freed\n");
-        return;
+        fprintf(fd, "│");
       }
       else
       {
-        heir = node->left;
-        RBT_NODE_CACHE_OR_FREE(node);
-        node = heir;
+        fprintf(fd, " ");
       }
     }
-    else if (node->left == NULL)
-    {
-      heir = node->right;
-      RBT_NODE_CACHE_OR_FREE(node);
-      node = heir;
-    }
-    else
+    if (indent)
     {
-      orphan = node->right;
-      heir = node->left;
-      RBT_NODE_CACHE_OR_FREE(node);
-      node = heir;
-      if (descendent == NULL)
+      if (end)
       {
-        descendent = heir;
-        while (descendent->left !=NULL)
-        {
-          descendent = descendent->left;
-        }
+        fprintf(fd, "└");
       }
-      descendent->left = orphan;
-      descendent = orphan;
-      while (descendent->left !=NULL)
+      else
       {
-        descendent = descendent->left;
+        fprintf(fd, "├");
       }
     }
   }
-  debug_print("freed\n");
-}
-
 
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[35m");
+#endif
 
-/*!
-  Merge a child node into the parent. The value and children of the target child
-  will be inserted into the parent and the key bits will be merged.
 
-  The merged child should be the only child of the parent. If it is not, the sibling will
-  be removed and freed along with the target child.
+  if (print_bits)
+  {
+    RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
+    fprintf(fd, " ");
+    i = node->bits - skip;
+  }
+  else
+  {
+    fprintf(fd, "● ");
+    i = 1;
+  }
 
-  Logically this removes the parent node from the tree.
+  indent += i;
+  vert <<= i;
+  vert ++;
 
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[36m");
+#endif
 
-  @param[in]
-  parent_node The parent node.
+  RBT_VALUE_FPRINT(fd, node->value);
+  fprintf(fd, "\n");
 
-  @param[in]
-  child_node The child node.
-*/
-void
-RBT_NODE_MERGE_CHILD(
-  RBT_NODE_T * parent_node,
-  RBT_NODE_T * child_node
-)
-{
-  debug_printf("merging child node %p (parent: %p)\n", child_node, parent_node);
-  RBT_PIN_T * tmp_key;
-  RBT_KEY_SIZE_T parent_bytes, child_bytes;
-  RBT_VALUE_T tmp_value;
-  RBT_NODE_T * tmp_node;
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[0m");
+#endif
 
-  errno = 0;
 
-  /*
-    Flooring division is required for parent to truncate overlap.
-  */
-  parent_bytes = PINS_TO_BYTES(parent_node->bits / RBT_PIN_SIZE_BITS);
-  child_bytes = BITS_TO_PINS_TO_BYTES(child_node->bits);
-  tmp_key = realloc(parent_node->key, parent_bytes + child_bytes);
-  if (tmp_key == NULL)
+  skip = node->bits % RBT_PIN_SIZE_BITS;
+  if (node->left != NULL)
   {
-    debug_printf("failed to realloc key (%s)\n", strerror(errno));
-    return;
+    RBT_NODE_FPRINT_INTERNAL(fd, node->left, print_bits, indent, vert, (node->right == NULL), skip);
+  }
+  if (node->right != NULL)
+  {
+    vert --;
+    RBT_NODE_FPRINT_INTERNAL(fd, node->right, print_bits, indent, vert, 1, skip);
   }
+}
+*/
 
-  parent_node->key = tmp_key;
-  memcpy(((BYTE_T *) parent_node->key) + parent_bytes, child_node->key, child_bytes);
-  parent_node->bits = (parent_bytes * BITS_PER_BYTE) + child_node->bits;
+/*!
+  @cond INTERNAL
+*/
 
-  /*
-    Swap the values around so the value can be freed if necessary when freeing
-    the child node. Do *not* use RBT_VALUE_COPY here.
-  */
-  tmp_value = parent_node->value;
-  parent_node->value = child_node->value;
-  child_node->value = tmp_value;
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_FPRINT_INTERNAL's dynamic stack.
 
-  /*
-    Give the unexpected sibling to the child so that it can be freed along with
-    the sibling.
+  \warning
+  This is an internal structure.
+*/
+
+typedef
+struct _RBT_NODE_PRINT_STACK_T
+{
+  /*!
+    @brief
+    The node.
   */
-  if (parent_node->left == child_node)
-  {
-    tmp_node = parent_node->right;
-  }
-  else
-  {
-    tmp_node = parent_node->left;
-  }
-  parent_node->left = child_node->left;
-  parent_node->right = child_node->right;
-  // Prefer the left node because of the left bias in RBT_NODE_FREE
-  child_node->left = tmp_node;
-  child_node->right = NULL;
+  RBT_NODE_T * node;
 
-  RBT_NODE_FREE(child_node);
-  debug_print("merged\n");
-}
+  /*!
+    @brief
+    The indentation level.
+  */
+  RBT_KEY_SIZE_T indent;
+
+  /*!
+    @brief
+    A number tracking unprinted siblings.
+
+    This number tracks siblings for drawing branches with vertical box-drawing
+    characters. Each bit in the number is used as a switch to determine whether
+    or not a vertical bar should be drawn to the left of the node
+    representation.
+  */
+  RBT_KEY_SIZE_T vert;
 
+  /*!
+    @brief
+    A boolean indicating if the node is the last child of its parent.
+  */
+  int is_last_child;
 
+  /*!
+    @brief
+    The number of bits to skip in the nodes key.
+  */
+  int skip;
 
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_PRINT_STACK_T * next;
+}
+_RBT_NODE_PRINT_STACK_T;
 
 /*!
-  @brief
-  Remove a node from a tree.
+  @endcond
+*/
 
-  Logically remove a node from a tree. If the node can be completely removed, it
-  will be freed and the parent node will be restructured as necessary.
+/*!
+  The internal function used by RBT_NODE_FPRINT() for printing trees using
+  box-drawing characters.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
 
+  @param[in]
+  fd The output file descriptor.
 
-  - `RBT_NODE_MERGE_CHILD()`
-  - `RBT_NODE_FREE()`
+  @param[in]
+  node A pointer to the target root node.
 
   @param[in]
-  node A pointer to the target node.
+  print_bits A boolean value to determine if the key bits of each node should
+  be printed. If false, the character '●' will be printed instead.
 
   @param[in]
-  parent_node The parent node of the target node.
+  print_pointer A value indicating if the pointer should be printed. If
+  non-zero, the value will be used as the width of the pointer in the call to
+  fprintf.
 
-  @return
-  The passed node if it remains in the tree, otherwise the parent.
+  @param[in]
+  indent The indentation level.
+
+  @param[in]
+  vert A numerical value used to track vertical branches that should be printed
+  to the left of the current node.
+
+  @param[in]
+  is_last_child A boolean value indicating if the current node is the last child of
+  its parent.
+
+  @param[in]
+  skip The number of bits held by this node that should be skipped. These are
+  the staggered bits of the parent node.
+
+  @see
+  - `RBT_NODE_FPRINT()`
 */
 
-RBT_NODE_T *
-RBT_NODE_REMOVE(
+void
+RBT_NODE_FPRINT_INTERNAL(
+  FILE * fd,
   RBT_NODE_T * node,
-  RBT_NODE_T * parent_node
+  int print_bits,
+  int print_pointer,
+  RBT_KEY_SIZE_T indent,
+  RBT_KEY_SIZE_T vert,
+  int is_last_child,
+  int skip
 )
 {
-  debug_printf("removing node %p (parent: %p)\n", node, parent_node);
+  RBT_KEY_SIZE_T i;
+  _RBT_NODE_PRINT_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_PRINT_STACK_T)
+  int rc;
+  unsigned long shifted_vert;
 
-  if (node->left == NULL)
+  errno = 0;
+
+  if (node == NULL)
   {
-    if (node->right == NULL)
+    return;
+  }
+
+  stack = NULL;
+  stack_unused = NULL;
+  rc = 0;
+
+  while (1)
+  {
+    if (print_pointer)
     {
-      debug_print("no children\n");
-      /*
-        If the parent is null then this is a childless root node. It cannot be
-        removed, but it can be emptied.
-      */
-      if (parent_node == NULL)
+#ifdef RBT_USE_COLOR
+      fprintf(fd, "\033[32m");
+#endif
+      fprintf(fd, "%*p ", print_pointer, node);
+    }
+
+#ifdef RBT_USE_COLOR
+    fprintf(fd, "\033[34m");
+#endif
+
+    if (indent)
+    {
+      for (i = indent - 1; i; i--)
       {
-        debug_print("root node\n");
-        RBT_VALUE_COPY(node->value, RBT_VALUE_NULL, );
-        free(node->key);
-        node->key = NULL;
-        node->bits = 0;
+        shifted_vert = (vert >> i);
+        if (shifted_vert & 1)
+        {
+          fprintf(fd, "│");
+        }
+        else
+        {
+          fprintf(fd, " ");
+        }
       }
-      /*
-        This node can be removed from the parent if it has no children. If the
-        parent value is empty (i.e. the parent is a placeholder node) then the
-        parent needs to be merged with the sibling node.
-      */
-      else
+      if (indent)
       {
-        if (RBT_VALUE_IS_NULL(parent_node->value))
+        if (is_last_child)
         {
-          if (parent_node->left == node)
-          {
-            RBT_NODE_MERGE_CHILD(parent_node, parent_node->right);
-          }
-          else
-          {
-            RBT_NODE_MERGE_CHILD(parent_node, parent_node->left);
-          }
+          fprintf(fd, "└");
         }
         else
         {
-          if (parent_node->left == node)
-          {
-            parent_node->left = NULL;
-          }
-          else
-          {
-            parent_node->right = NULL;
-          }
-          RBT_NODE_FREE(node);
+          fprintf(fd, "├");
         }
-        node = parent_node;
       }
     }
-    /*
-      A single child should be merged into this node.
-    */
+
+#ifdef RBT_USE_COLOR
+    fprintf(fd, "\033[35m");
+#endif
+
+
+    if (print_bits)
+    {
+      RBT_FPRINT_BITS(fd, node->key, node->bits - skip, skip);
+      fprintf(fd, " ");
+      i = node->bits - skip;
+    }
     else
     {
-      debug_print("right child\n");
-      RBT_NODE_MERGE_CHILD(node, node->right);
+      fprintf(fd, "● ");
+      i = 1;
     }
-  }
-  /*
-    A single child should be merged into this node.
-  */
-  else if (node->right == NULL)
-  {
-    debug_print("left child\n");
-    RBT_NODE_MERGE_CHILD(node, node->left);
-  }
-  /*
-    If the node has two children then the value needs to be emptied and key
-    information must be kept.
-  */
-  else
-  {
-    debug_print("two children\n");
-    RBT_VALUE_COPY(node->value, RBT_VALUE_NULL, );
-  }
-  debug_print("removed\n");
-  return node;
-}
 
+    indent += i;
+    vert <<= i;
+    vert ++;
 
-/*!
-  @brief
-  Insert a parent node.
+#ifdef RBT_USE_COLOR
+    fprintf(fd, "\033[36m");
+#endif
 
-  Insert a parent node above the given node to hold the given value. The key
-  will be extracted from the beginning of the current key.
+    RBT_VALUE_FPRINT(fd, node->value);
+    fprintf(fd, "\n");
 
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
 
-  @param[in]
-  node The current node.
+    skip = node->bits % RBT_PIN_SIZE_BITS;
+    if (node->left != NULL)
+    {
+      is_last_child = (node->right == NULL);
+      if (!is_last_child)
+      {
+        /*
+          errno and rc may be set to non-zero values here, in which case the
+          loop will also be broken.
+        */
+        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_PRINT_STACK_T);
+        stack->node = node->right;
+        stack->indent = indent;
+        stack->vert = vert - 1;
+        stack->is_last_child = 1;
+        stack->skip = skip;
+      }
+      node = node->left;
+    }
+    else if (node->right != NULL)
+    {
+      vert --;
+      is_last_child = 1;
+      node = node->right;
+    }
+    else if (stack != NULL)
+    {
+      node = stack->node;
+      indent = stack->indent;
+      vert = stack->vert;
+      is_last_child = stack->is_last_child;
+      skip = stack->skip;
+      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+#ifdef RBT_USE_COLOR
+  fprintf(fd, "\033[0m");
+#endif
+
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  errno = rc;
+}
+
+
+
+
+/*!
+  @brief
+  Print trees using box-drawing characters.
+
+  A function for printing representations of trees using box-drawing characters.
+  This function is mostly for debugging purposes. It will visualize the tree
+  hierarchy and optionally show the pointers of each node along with the key
+  bits that they contain.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
 
   @param[in]
-  bits The number of key bits that will be made part of the parent node.
+  fd The output file descriptor.
 
   @param[in]
-  value The value to insert.
+  node A pointer to the target root node.
 
-  @see
-  - `RBT_NODE_INSERT_SIBLING()`
-  - `RBT_NODE_INSERT_CHILD()`
+  @param[in]
+  print_bits A boolean value to determine if the key bits of each node should
+  be printed. If false, the character '●' will be printed instead.
+
+  @param[in]
+  print_pointer A value indicating if the pointer should be printed. If
+  non-zero, the value will be used as the width of the pointer in the call to
+  fprintf.
 */
+
 void
-RBT_NODE_INSERT_PARENT(
+RBT_NODE_FPRINT(
+  FILE * fd,
   RBT_NODE_T * node,
-  RBT_KEY_SIZE_T bits,
-  RBT_VALUE_T value
+  int print_bits,
+  int print_pointer
+)
+{
+  RBT_NODE_FPRINT_INTERNAL(fd, node, print_bits, print_pointer, 0, 0, 0, 0);
+}
+
+
+
+/*!
+  @brief
+  Resize the key fragment of a node.
+
+  The key is moved between the inline storage and the heap or arena as
+  necessary. The leading bytes of the current key fragment are preserved up to
+  the new size. The key is left unchanged on failure.
+
+  @param
+  node The node. Its key must have been initialized with `_RBT_NODE_KEY_INIT`
+  and its bits must still match the current key fragment.
+
+  @param
+  bytes The new size of the key fragment, in bytes.
+
+  @return
+  0 on success, -1 on failure (check errno).
+*/
+int
+_RBT_NODE_KEY_RESIZE(
+  RBT_NODE_T * node,
+  size_t bytes
 )
 {
-  debug_print("inserting parent\n");
-  RBT_KEY_SIZE_T pins, staggered_bits, parent_pins;
-  RBT_NODE_T * child;
   RBT_PIN_T * tmp_key;
+  size_t old_bytes;
 
-  RBT_DIVMOD(bits, RBT_PIN_SIZE_BITS, pins, staggered_bits);
+  old_bytes = BITS_TO_PINS_TO_BYTES(node->bits);
 
-  /*
-    RBT_NODE_CREATE will copy the value passed to it, so pass it the new value
-    and then swap the values of the parent and child below, instead of using
-    superfluous RBT_VALUE_COPY statements.
-  */
-  child = RBT_NODE_CREATE(
-    node->key + pins,
-    node->bits - bits + staggered_bits,
-    value,
-    node->left,
-    node->right
-  );
-  if (child == NULL)
+#if _RBT_NODE_KEY_INLINE_PINS > 0
+  if (bytes <= sizeof(node->key_inline))
   {
-    debug_printf("failed to create child node (%s)\n", strerror(errno));
-    return;
+    /*
+      Allocated keys are always larger than the inline storage.
+    */
+    if (_RBT_NODE_KEY_IS_ALLOCATED(node))
+    {
+      memcpy(node->key_inline, node->key, bytes);
+      _RBT_NODE_KEY_DEALLOC(node);
+      node->key = node->key_inline;
+    }
+    return 0;
+  }
+#else
+  if (bytes == 0)
+  {
+    _RBT_NODE_KEY_FREE(node);
+    node->key = NULL;
+    return 0;
   }
+#endif // _RBT_NODE_KEY_INLINE_PINS
 
-  parent_pins = pins;
-  if (staggered_bits > 0)
+#if _RBT_NODE_ARENA > 0
+  if (
+    _RBT_NODE_KEY_IS_ALLOCATED(node) &&
+    _RBT_NODE_ARENA_CLASS(old_bytes) == _RBT_NODE_ARENA_CLASS(bytes)
+  )
   {
-    parent_pins ++;
+    return 0;
   }
-  tmp_key = realloc(node->key, parent_pins * RBT_PIN_SIZE);
-  if (tmp_key == NULL && parent_pins)
+  tmp_key = _RBT_NODE_ARENA_ALLOC_KEY(_RBT_NODE_ARENA_OF(node), bytes);
+#else
+  if (_RBT_NODE_KEY_IS_ALLOCATED(node))
   {
-    debug_printf("failed to realloc key (%s)\n", strerror(errno));
-    return;
+    tmp_key = realloc(node->key, bytes);
+    if (tmp_key == NULL)
+    {
+      debug_printf("failed to realloc key (%s)\n", strerror(errno));
+      return -1;
+    }
+    node->key = tmp_key;
+    return 0;
   }
-  node->key = tmp_key;
-  node->bits = bits;
-  /*
-    Swap the values. Do *not* use RBT_VALUE_COPY.
-  */
-  value = child->value;
-  child->value = node->value;
-  node->value = value;
-
-  if (N_BIT_IS_1(child->key[0], staggered_bits))
+  tmp_key = malloc(bytes);
+#endif // _RBT_NODE_ARENA
+  if (tmp_key == NULL)
   {
-    node->right = child;
-    node->left = NULL;
+    debug_printf("failed to allocate %zu bytes for key (%s)\n", bytes, strerror(errno));
+    return -1;
   }
-  else
+  if (node->key != NULL && old_bytes)
   {
-    node->left = NULL;
-    node->right = child;
+    memcpy(tmp_key, node->key, MIN(old_bytes, bytes));
   }
-  debug_print("inserted\n");
+  _RBT_NODE_KEY_FREE(node);
+  node->key = tmp_key;
+  return 0;
 }
 
-/*!
-  @brief
-  Insert a child node.
-
-  Insert a child node to hold the given value.
-
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
-
-  @param[in]
-  child_node_ptr The child node pointer of the parent node that should be set to
-  point to this node.
-
-  @param[in]
-  key The key fragment that should be held by this node.
-
-  @param[in]
-  bits The number of bits in the key fragment.
-
-  @param[in]
-  value The value to insert.
-
-  @see
-  - `RBT_NODE_INSERT_PARENT()`
-  - `RBT_NODE_INSERT_SIBLING()`
-*/
-void
-RBT_NODE_INSERT_CHILD(
-  RBT_NODE_T * * child_node_ptr,
-  RBT_PIN_T * key,
-  RBT_KEY_SIZE_T bits,
-  RBT_VALUE_T value
-)
-{
-  debug_print("inserting child\n");
-  RBT_NODE_T * node;
-  node = RBT_NODE_CREATE(key, bits, value, NULL, NULL);
-  * child_node_ptr = node;
-  debug_print("inserted\n");
-}
 
 
 /*!
   @brief
-  Insert a sibling node.
+  Create a node.
 
-  Insert a sibling node to hold the given value. The given node is made a
-  placeholder parent and the current data in the node is moved to a new node
-  that is inserted as a child of the parent. The new data is inserted into
-  a second new node and made the second child of the parent.
+  Create a node to hold the given key fragment and insert the given value.
+  The memory is dynamically allocated and should be freed with `RBT_NODE_FREE()`
+  when no longer needed.
+
+  If `RBT_NODE_CACHE_SIZE` is defined, a previously allocated node will be
+  taken from the cache if available instead of allocating a new block of
+  memory.
+
+  If `RBT_NODE_ARENA` is defined, the node will be the root of a new tree with
+  its own arena.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
 
   @param[in]
-  node The current node.
-
-  @param[in]
-  key The key fragment that spans the current node and the target child node.
+  key A pointer to the key fragment.
 
   @param[in]
   bits The number of bits in the key fragment.
 
   @param[in]
-  common_bits The number of common bits between the current node's key fragment
-  and the given key. These will form the key fragment of the new parent node.
-
-  @param[in]
-  common_pins The number of common pins between the current node's key fragment
-  and the given key.
+  value The value to insert.
 
   @param[in]
-  common_staggered_bits The number of uncommon bits in the current node's key
-  fragment. These will form the key fragment of the sibling node.
+  left The left child. The first new bit in this child will be 0.
 
   @param[in]
-  value The value to insert.
+  right The right child. The first new bit in this child will be 1.
 
   @return
-  A pointer to the new node holding the value, or NULL if an error occured.
-
-  This function is called internally by `RBT_NODE_RETRIEVE()`, which calculates
-  `common_bits`, `common_pins` and `common_staggered_bits` for tree traversal.
-  The value are accepted as parameters here to avoid redundant calculations.
-
-  In contrast to the other insertion functions, this function returns a pointer
-  to the inserted child. This is to avoid redundant calculations for determining
-  whether the new child is the left or right child of the node.
-
-  @see
-  - `RBT_NODE_INSERT_PARENT()`
-  - `RBT_NODE_INSERT_CHILD()`
-
+  A pointer to the new node, or `NULL` if an error occured.
 */
+#if _RBT_NODE_ARENA > 0
 RBT_NODE_T *
-RBT_NODE_INSERT_SIBLING(
-  RBT_NODE_T * node,
+_RBT_NODE_CREATE_IN(
+  _RBT_NODE_ARENA_T * arena,
   RBT_PIN_T * key,
   RBT_KEY_SIZE_T bits,
-  RBT_KEY_SIZE_T common_bits,
-  RBT_KEY_SIZE_T common_pins,
-  RBT_KEY_SIZE_T common_staggered_bits,
-  RBT_VALUE_T value
+  RBT_VALUE_T value,
+  RBT_NODE_T * left,
+  RBT_NODE_T * right
 )
-{
-  RBT_KEY_SIZE_T parent_pins;
-  RBT_NODE_T * sibling, * baby;
-  RBT_PIN_T * tmp_key;
-
-  /*
-    `sibling` is the node to which the existing data is moved.
-    `baby` is the new node used to hold the new value.
-  */
-
-  debug_printf(
-    "inserting sibling (%"
-    RBT_KEY_SIZE_T_FORMAT ", %"
-    RBT_KEY_SIZE_T_FORMAT ", %"
-    RBT_KEY_SIZE_T_FORMAT ", %"
-    RBT_KEY_SIZE_T_FORMAT ")\n",
-    bits, common_bits, common_pins, common_staggered_bits
-  );
-
-  baby = RBT_NODE_CREATE(
-    key + common_pins,
-    bits - common_bits + common_staggered_bits,
-    value,
-    NULL,
-    NULL
-  );
+#else
+RBT_NODE_T *
+RBT_NODE_CREATE(
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  RBT_VALUE_T value,
+  RBT_NODE_T * left,
+  RBT_NODE_T * right
+)
+#endif // _RBT_NODE_ARENA
+{
+  RBT_NODE_T * node;
+  RBT_KEY_SIZE_T bytes;
 
-  if (baby == NULL)
+#if _RBT_NODE_ARENA > 0
+  debug_print("creating node\n");
+  node = _RBT_NODE_ARENA_ALLOC_NODE(arena);
+  if (node == NULL)
   {
-    debug_printf("failed to create baby node (%s)\n", strerror(errno));
+    debug_print("failed to allocate memory for node\n");
     return NULL;
   }
-
-  /*
-    Insert a null value here and then swap it with the current node's value to
-    avoid redundant copying. The `value` variable above can be used as a
-    placeholder.
-  */
-  sibling = RBT_NODE_CREATE(
-    node->key + common_pins,
-    node->bits - common_bits + common_staggered_bits,
-    RBT_VALUE_NULL,
-    node->left,
-    node->right
-  );
-
-  if (sibling == NULL)
+#else
+#ifdef RBT_NODE_CACHE_SIZE
+#ifdef RBT_NODE_CACHE_BATCH
+  node = _RBT_NODE_CACHE_GET();
+  if (node == NULL)
   {
-    debug_printf("failed to create sibling node (%s)\n", strerror(errno));
-    RBT_NODE_FREE(baby);
-    return NULL;
-  }
-
-
-  parent_pins = common_pins;
-  if (common_staggered_bits > 0)
+#else
+  RBT_NODE_CACHE_LOCK
+  node = RBT_NODE_CACHE.node;
+  if (node != NULL)
   {
-    parent_pins ++;
+    RBT_NODE_CACHE.node = node->left;
+    RBT_NODE_CACHE.n --;
+    RBT_NODE_CACHE_UNLOCK
   }
-  tmp_key = realloc(node->key, parent_pins * RBT_PIN_SIZE);
-  // parent_pins may be 0, in which case realloc should return NULL.
-  if (tmp_key == NULL && parent_pins)
+  else
   {
-    debug_printf("failed to realloc key (%s)\n", strerror(errno));
-    RBT_NODE_FREE(sibling);
-    RBT_NODE_FREE(baby);
-    return NULL;
-  }
+    RBT_NODE_CACHE_UNLOCK
+#endif //RBT_NODE_CACHE_BATCH
+#endif
 
-  node->key = tmp_key;
-  node->bits = common_bits;
+    debug_print("creating node\n");
+    node = malloc(sizeof(RBT_NODE_T));
+    if (node == NULL)
+    {
+      debug_print("failed to allocate memory for node\n");
+      return NULL;
+    }
 
-  value = node->value;
-  node->value = sibling->value;
-  sibling->value = value;
+#ifdef RBT_NODE_CACHE_SIZE
+  }
+#endif
+#endif // _RBT_NODE_ARENA
 
-  if (N_BIT_IS_1(baby->key[0], common_staggered_bits))
+  bytes = BITS_TO_PINS_TO_BYTES(bits);
+  _RBT_NODE_KEY_INIT(node);
+  node->bits = 0;
+  if (_RBT_NODE_KEY_RESIZE(node, bytes))
   {
-    node->right = baby;
-    node->left = sibling;
+    _RBT_NODE_DEALLOC(node);
+    return NULL;
   }
-  else
+  if (bytes)
   {
-    node->left = baby;
-    node->right = sibling;
+    memcpy(node->key, key, bytes);
   }
-  debug_print("inserted\n");
-  return baby;
+  node->bits = bits;
+  node->value = RBT_VALUE_NULL;
+  RBT_VALUE_COPY(node->value, value, _RBT_NODE_KEY_FREE(node);_RBT_NODE_DEALLOC(node);return NULL);
+  node->left = left;
+  node->right = right;
+  debug_printf("created node %p\n", node);
+  debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
+  return node;
 }
 
-
-
-/*!
-  @brief
-  Create a new tree.
-
-  Create a new, empty node. This should be used to create root nodes for new
-  trees.
-*/
+#if _RBT_NODE_ARENA > 0
 RBT_NODE_T *
-RBT_NODE_NEW()
+RBT_NODE_CREATE(
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  RBT_VALUE_T value,
+  RBT_NODE_T * left,
+  RBT_NODE_T * right
+)
 {
-  return RBT_NODE_CREATE(NULL, 0, RBT_VALUE_NULL, NULL, NULL);
+  return _RBT_NODE_CREATE_IN(NULL, key, bits, value, left, right);
 }
+#endif // _RBT_NODE_ARENA
 
 
 
-
-
-
-
-
-///////////////////////////////////// Copy /////////////////////////////////////
-
-/*!
-  @cond INTERNAL
-*/
-
 /*!
-  @brief
-  Linked list for implementing RBT_NODE_COPY's dynamic stack.
-
-  \warning
-  This is an internal structure.
+  A conditional macro that either caches nodes or frees them depending on the
+  value of `RBT_NODE_CACHE_SIZE`. It is used internally by `RBT_NODE_FREE()`.
 */
-
-typedef
-struct _RBT_NODE_COPY_STACK_T
-{
+#if defined(RBT_NODE_CACHE_SIZE) && defined(RBT_NODE_CACHE_BATCH)
   /*!
-    @brief
-    The node.
+    The displayed definition is for the thread-local caching variant.
   */
-  RBT_NODE_T * node;
-
+  #undef RBT_NODE_CACHE_OR_FREE
+  #define RBT_NODE_CACHE_OR_FREE(node) \
+  do \
+  { \
+    node->left = RBT_NODE_CACHE_LOCAL.node; \
+    RBT_NODE_CACHE_LOCAL.node = node; \
+    RBT_NODE_CACHE_LOCAL.n ++; \
+    if (RBT_NODE_CACHE_LOCAL.n >= 2 * RBT_NODE_CACHE_BATCH) \
+    { \
+      _RBT_NODE_CACHE_PUT_BATCH(); \
+    } \
+  } \
+  while (0)
+#elif defined(RBT_NODE_CACHE_SIZE)
   /*!
-    @brief
-    The child pointer of the target parent node into which the node should be
-    inserted.
+    The displayed definition is for the caching variant.
   */
-
-  RBT_NODE_T * * ptr;
-
+  #undef RBT_NODE_CACHE_OR_FREE
+  #define RBT_NODE_CACHE_OR_FREE(node) \
+  do \
+  { \
+    RBT_NODE_CACHE_LOCK \
+    if ( \
+      ! RBT_NODE_CACHE_SIZE || \
+      RBT_NODE_CACHE.n <= RBT_NODE_CACHE_SIZE \
+    ) \
+    { \
+      node->left = RBT_NODE_CACHE.node; \
+      RBT_NODE_CACHE.node = node; \
+      RBT_NODE_CACHE.n ++; \
+      RBT_NODE_CACHE_UNLOCK \
+    } \
+    else \
+    { \
+      RBT_NODE_CACHE_UNLOCK \
+      free(node); \
+    } \
+  } \
+  while (0)
+#else
   /*!
-    @brief
-    The next item in the stack.
+    The displayed definition is for the non-caching variant. Nodes are returned
+    to the arena if `RBT_NODE_ARENA` is set.
   */
-  struct _RBT_NODE_COPY_STACK_T * next;
-}
-_RBT_NODE_COPY_STACK_T;
-
-/*!
-  @endcond
-*/
-
-
-
+  #undef RBT_NODE_CACHE_OR_FREE
+  #define RBT_NODE_CACHE_OR_FREE(node) _RBT_NODE_DEALLOC(node)
+#endif
 
 /*!
-  @brief
-  Copy a tree.
-
-  Create a node-by-node copy of a tree given the root node.
+  Free the target node and all its descendents. If `RBT_NODE_CACHE_SIZE` is set
+  then the nodes will be stored in the cache instead of being freed, if the
+  cache is not full.
 
-  @warning
-  If the values held by the tree are pointers then the data referenced by the
-  copy will obviously be the same as the data referenced by the original and the
-  two will not be independent. If, however, the data itself is held by the node
-  then the copy will be completely independent.
+  If `RBT_NODE_ARENA` is set and the target node is the root of its tree, the
+  values are freed and then the tree's arena is released in one step.
 
   @param[in]
-  node The root node of the original tree to copy.
+  node The target node.
 
-  @return
-  A pointer to the root node of the copy.
+  @see
+  - `RBT_NODE_CACHE_OR_FREE()`
 */
-RBT_NODE_T *
-RBT_NODE_COPY(
+void
+RBT_NODE_FREE(
   RBT_NODE_T * node
 )
 {
-  RBT_NODE_T * new_root, * new_node;
-  RBT_NODE_T * * child_ptr;
-  _RBT_NODE_COPY_STACK_T * stack, * stack_tmp, * stack_unused;
-  int rc;
+//   debug_printf("freeing node %p\n", node);
+  RBT_NODE_T * orphan, * heir, * descendent;
+#if _RBT_NODE_ARENA > 0
+  _RBT_NODE_ARENA_T * arena;
+#endif // _RBT_NODE_ARENA
 
   errno = 0;
 
   if (node == NULL)
   {
-    return NULL;
+    return;
   }
 
+#if _RBT_NODE_ARENA > 0
+  if (node == _RBT_NODE_ARENA_OF(node)->root)
+  {
+    arena = _RBT_NODE_ARENA_OF(node);
+    _RBT_NODE_ARENA_FREE_VALUES(node);
+    _RBT_NODE_ARENA_RELEASE(arena);
+    return;
+  }
+#endif // _RBT_NODE_ARENA
 
-  child_ptr = &new_root;
-  stack = NULL;
-  stack_unused = NULL;
-  rc = 0;
+  descendent = NULL;
 
-  while (node != NULL)
-  {
-    new_node = RBT_NODE_CREATE(node->key, node->bits, node->value, NULL, NULL);
-    * child_ptr = new_node;
+  /*
+    Do it this way to avoid recursion, which would require two calls per
+    invocation to handle both child nodes.
 
-    if (node->left != NULL)
-    {
-      if (node->right != NULL)
-      {
-        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_COPY_STACK_T);
-        stack->node = node->right;
-        stack->ptr = &(new_node->right);
-      }
-      child_ptr = &(new_node->left);
-      node = node->left;
-    }
-    else if (node->right != NULL)
+    The idea here is to free the top node then append the right tree to the
+    bottom of the left tree. The left tree's top node then replaces the current
+    node. The path to the bottom of the left tree will grow for every node
+    with two children. To avoid descending the tree from the top each time,
+    the last leftmost descendent is tracked.
+
+    Tree traversal is thus reduces to traversing a linked list.
+  */
+  while (1)
+  {
+//     debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
+    debug_printf("freeing node: %p\n", node);
+//     debug_printf("node key pointer: %p\n", node->key);
+    _RBT_NODE_KEY_FREE(node);
+    RBT_VALUE_FREE(node->value);
+    if (node->right == NULL)
     {
-      child_ptr = &(new_node->right);
-      node = node->right;
+      if (node->left == NULL)
+      {
+        RBT_NODE_CACHE_OR_FREE(node);
+//         debug_print("freed\n");
+        return;
+      }
+      else
+      {
+        heir = node->left;
+        RBT_NODE_CACHE_OR_FREE(node);
+        node = heir;
+      }
     }
-    else if (stack != NULL)
+    else if (node->left == NULL)
     {
-      node = stack->node;
-      child_ptr = stack->ptr;
-      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+      /*
+        The last leftmost descendent is freed here once it is reached. It is
+        found again from its heir when it is next needed.
+      */
+      if (node == descendent)
+      {
+        descendent = NULL;
+      }
+      heir = node->right;
+      RBT_NODE_CACHE_OR_FREE(node);
+      node = heir;
     }
     else
     {
-      break;
+      orphan = node->right;
+      heir = node->left;
+      RBT_NODE_CACHE_OR_FREE(node);
+      node = heir;
+      if (descendent == NULL)
+      {
+        descendent = heir;
+        while (descendent->left !=NULL)
+        {
+          descendent = descendent->left;
+        }
+      }
+      descendent->left = orphan;
+      descendent = orphan;
+      while (descendent->left !=NULL)
+      {
+        descendent = descendent->left;
+      }
     }
   }
-  if (rc)
-  {
-    RBT_NODE_FREE(new_root);
-  }
-  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
-  errno = rc;
-  return new_root;
+  debug_print("freed\n");
 }
 
 
 
+/*!
+  Merge a child node into the parent. The value and children of the target child
+  will be inserted into the parent and the key bits will be merged.
 
+  The merged child should be the only child of the parent. If it is not, the sibling will
+  be removed and freed along with the target child.
 
-//////////////////////////////////// Filter ////////////////////////////////////
+  Logically this removes the parent node from the tree.
 
-/*!
-  @cond INTERNAL
-*/
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
 
-/*!
-  @brief
-  Linked list for implementing RBT_NODE_FILTER's dynamic stack.
+  @param[in]
+  parent_node The parent node.
 
-  \warning
-  This is an internal structure.
+  @param[in]
+  child_node The child node.
 */
-
-typedef
-struct _RBT_NODE_FILTER_STACK_T
+void
+RBT_NODE_MERGE_CHILD(
+  RBT_NODE_T * parent_node,
+  RBT_NODE_T * child_node
+)
 {
-  /*!
-    @brief
-    The node.
-  */
-  RBT_NODE_T * node;
+  debug_printf("merging child node %p (parent: %p)\n", child_node, parent_node);
+  RBT_KEY_SIZE_T parent_bytes, child_bytes;
+  RBT_VALUE_T tmp_value;
+  RBT_NODE_T * tmp_node;
 
-  /*!
-    @brief
-    The stack of parent nodes for this node.
-  */
-  RBT_NODE_STACK_T * parent_stack;
+  errno = 0;
 
-  /*!
-    @brief
-    The next item in the stack.
+  /*
+    Flooring division is required for parent to truncate overlap.
   */
-  struct _RBT_NODE_FILTER_STACK_T * next;
-}
-_RBT_NODE_FILTER_STACK_T;
+  parent_bytes = PINS_TO_BYTES(parent_node->bits / RBT_PIN_SIZE_BITS);
+  child_bytes = BITS_TO_PINS_TO_BYTES(child_node->bits);
+  if (_RBT_NODE_KEY_RESIZE(parent_node, parent_bytes + child_bytes))
+  {
+    return;
+  }
 
-/*!
-  @endcond
-*/
+  memcpy(((BYTE_T *) parent_node->key) + parent_bytes, child_node->key, child_bytes);
+  parent_node->bits = (parent_bytes * BITS_PER_BYTE) + child_node->bits;
 
+  /*
+    Swap the values around so the value can be freed if necessary when freeing
+    the child node. Do *not* use RBT_VALUE_COPY here.
+  */
+  tmp_value = parent_node->value;
+  parent_node->value = child_node->value;
+  child_node->value = tmp_value;
 
+  /*
+    Give the unexpected sibling to the child so that it can be freed along with
+    the sibling.
+  */
+  if (parent_node->left == child_node)
+  {
+    tmp_node = parent_node->right;
+  }
+  else
+  {
+    tmp_node = parent_node->left;
+  }
+  parent_node->left = child_node->left;
+  parent_node->right = child_node->right;
+  // Prefer the left node because of the left bias in RBT_NODE_FREE
+  child_node->left = tmp_node;
+  child_node->right = NULL;
 
-/*!
-  @brief
-  The function type accepted by `RBT_NODE_FILTER()`.
+  RBT_NODE_FREE(child_node);
+  debug_print("merged\n");
+}
 
-  @param[in]
-  value A pointer to the current node's value.
 
-  @param[in]
-  args A `va_list` containing the additional arguments passed to
-  `RBT_NODE_FILTER()`.
 
-  @return
-  An `int`. If it is non-zero, the current node will be *removed*.
-*/
-typedef
-int
-(* RBT_NODE_FILTER_FUNCTION_T)(
-  RBT_VALUE_T * value,
-  va_list args
-);
 
 /*!
   @brief
-  Filter tree nodes.
+  Remove a node from a tree.
 
-  Remove nodes for which the supplied function returns a non-zero int. The
-  function is passed a pointer to the value instead of the value itself so that
-  it can also modify it if necessary.
+  Logically remove a node from a tree. If the node can be completely removed, it
+  will be freed and the parent node will be restructured as necessary.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
 
-  @warning
-  See the warning for `RBT_NODE_RETRIEVE()` about directly inserting
-  `RBT_VALUE_NULL` values.
-
-  @param[in]
-  node The root node.
 
-  @param[in]
-  func_v A function of type `RBT_NODE_FILTER_FUNCTION_T` for filtering nodes by
-  value.
+  - `RBT_NODE_MERGE_CHILD()`
+  - `RBT_NODE_FREE()`
 
   @param[in]
-  include_empty Pass empty nodes to the function.
+  node A pointer to the target node.
 
   @param[in]
-  ... Additional arguments to pass to `func_v`. They will be passed in a
-  `va_list`, which will be re-initialized before each call.
+  parent_node The parent node of the target node.
 
-  @see
-  - `RBT_NODE_FILTER_FUNCTION_T`
+  @return
+  The passed node if it remains in the tree, otherwise the parent.
 */
 
-void
-RBT_NODE_FILTER(
+RBT_NODE_T *
+RBT_NODE_REMOVE(
   RBT_NODE_T * node,
-  RBT_NODE_FILTER_FUNCTION_T func_v,
-  int include_empty,
-  ...
+  RBT_NODE_T * parent_node
 )
 {
-  int rc, unwanted, is_left, placeholder;
-  RBT_NODE_T * tmp_node, * sibling_node;
-  RBT_NODE_STACK_T * parent_stack, * parent_stack_tmp, * parent_stack_unused;
-  _RBT_NODE_FILTER_STACK_T * stack, * stack_tmp, * stack_unused;
-  va_list func_args;
-
-  errno = 0;
-
-  if (node == NULL)
-  {
-    return;
-  }
-
-  stack = NULL;
-  stack_unused = NULL;
-  parent_stack = NULL;
-  parent_stack_unused = NULL;
-  rc = 0;
-
-//   RBT_NODE_T * root
-//   root = node;
+  debug_printf("removing node %p (parent: %p)\n", node, parent_node);
 
-  while (1)
+  if (node->left == NULL)
   {
-//     if (RBT_DEBUG)
-//     {
-//       RBT_NODE_FPRINT(RBT_DEBUG_FD, root, 0, 1);
-//     }
-    if (node != NULL)
+    if (node->right == NULL)
     {
-      if (parent_stack != NULL)
+      debug_print("no children\n");
+      /*
+        If the parent is null then this is a childless root node. It cannot be
+        removed, but it can be emptied.
+      */
+      if (parent_node == NULL)
       {
-        debug_printf("filtering node: %p (parent: %p)\n", node, parent_stack->node);
+        debug_print("root node\n");
+        RBT_VALUE_COPY(node->value, RBT_VALUE_NULL, );
+        _RBT_NODE_KEY_RESIZE(node, 0);
+        node->bits = 0;
       }
-      else
-      {
-        debug_printf("filtering node: %p (no parent)\n", node);
-      }
-      if (include_empty || !RBT_VALUE_IS_NULL(node->value))
+      /*
+        This node can be removed from the parent if it has no children. If the
+        parent value is empty (i.e. the parent is a placeholder node) then the
+        parent needs to be merged with the sibling node.
+      */
+      else
       {
-        va_start(func_args, include_empty);
-        /*
-          This would purge superfluous nodes:
-        */
-//         unwanted = func_v(node->value, func_args) || RBT_VALUE_IS_NULL(node->value);
-        unwanted = func_v(&(node->value), func_args);
-        va_end(func_args);
-        if (errno)
-        {
-          rc = errno;
-          break;
-        }
-        if (unwanted)
+        if (RBT_VALUE_IS_NULL(parent_node->value))
         {
-          if (parent_stack != NULL)
+          if (parent_node->left == node)
           {
-            is_left = parent_stack->node->left == node;
-            /*
-              The node will not be removed if it has any children. If it has
-              two then it will be left as a placeholder node. If it has only
-              one then it will be merged and we will need to continue the loop.
-            */
-            placeholder = (node->left != NULL) && (node->right != NULL);
-            if (is_left)
-            {
-              sibling_node = parent_stack->node->right;
-            }
-            else
-            {
-              sibling_node = parent_stack->node->left;
-            }
-            tmp_node = RBT_NODE_REMOVE(node, parent_stack->node);
-            if (errno)
-            {
-              rc = errno;
-              break;
-            }
-            /*
-              If the node has been completely removed then the sibling may have
-              been merged into the parent. Go back to the parent in that case.
-            */
-            if (tmp_node != node)
-            {
-              if (is_left)
-              {
-                /*
-                  Jump directly to the sibling node if it has not changed.
-                */
-                if (parent_stack->node->right == sibling_node)
-                {
-                  node = sibling_node;
-                }
-                /*
-                  Otherwise jump to the parent.
-                */
-                else
-                {
-                  node = parent_stack->node;
-                  _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
-                  if (stack != NULL && stack->parent_stack->node == node)
-                  {
-                    _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-                  }
-                }
-              }
-              /*
-                If the node was the right child, then jump back to the last
-                right child.
-              */
-              else
-              {
-                if (stack != NULL)
-                {
-                  node = stack->node;
-                  while (parent_stack != NULL && parent_stack != stack->parent_stack)
-                  {
-                    _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
-                  }
-                  _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-                }
-                else
-                {
-                  break;
-                }
-              }
-              continue;
-            }
-            /*
-              If the node remains, it is either a placeholder or it has been
-              merged with a child. In the latter case, continue to filter the
-              new value of the node.
-            */
-            if (! placeholder)
-            {
-              continue;
-            }
+            RBT_NODE_MERGE_CHILD(parent_node, parent_node->right);
           }
           else
           {
-            RBT_NODE_REMOVE(node, NULL);
-            if (errno)
-            {
-              rc = errno;
-              break;
-            }
+            RBT_NODE_MERGE_CHILD(parent_node, parent_node->left);
           }
         }
-      }
-      if (node->left != NULL)
-      {
-        _RBT_NODE_STACK_ALLOCATE(parent_stack, parent_stack_tmp, parent_stack_unused, RBT_NODE_STACK_T);
-        parent_stack->node = node;
-        if (node->right != NULL)
+        else
         {
-          _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_FILTER_STACK_T);
-          stack->node = node->right;
-          stack->parent_stack = parent_stack;
+          if (parent_node->left == node)
+          {
+            parent_node->left = NULL;
+          }
+          else
+          {
+            parent_node->right = NULL;
+          }
+          RBT_NODE_FREE(node);
         }
-        node = node->left;
-        continue;
-      }
-      else if (node->right != NULL)
-      {
-        _RBT_NODE_STACK_ALLOCATE(parent_stack, parent_stack_tmp, parent_stack_unused, RBT_NODE_STACK_T);
-        parent_stack->node = node;
-        node = node->right;
-        continue;
-      }
-    }
-    if (stack != NULL)
-    {
-      node = stack->node;
-      while (parent_stack != NULL && parent_stack != stack->parent_stack)
-      {
-        _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
+        node = parent_node;
       }
-      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
     }
+    /*
+      A single child should be merged into this node.
+    */
     else
     {
-      break;
+      debug_print("right child\n");
+      RBT_NODE_MERGE_CHILD(node, node->right);
     }
   }
-  _RBT_NODE_STACK_FREE(parent_stack, parent_stack_tmp, parent_stack_unused);
-  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
-  errno = rc;
-}
-
-
-
-/////////////////////////////////// Is Copy ////////////////////////////////////
-
-/*!
-  @cond INTERNAL
-*/
-
-/*!
-  @brief
-  Linked list for implementing RBT_NODE_IS_COPY's dynamic stack.
-
-  \warning
-  This is an internal structure.
-*/
-
-typedef
-struct _RBT_NODE_IS_COPY_STACK_T
-{
-  /*!
-    @brief
-    One of the nodes to compare.
-  */
-  RBT_NODE_T * a;
-
-  /*!
-    @brief
-    The other node to compare.
+  /*
+    A single child should be merged into this node.
   */
-  RBT_NODE_T * b;
-
-  /*!
-    @brief
-    The next item in the stack.
+  else if (node->right == NULL)
+  {
+    debug_print("left child\n");
+    RBT_NODE_MERGE_CHILD(node, node->left);
+  }
+  /*
+    If the node has two children then the value needs to be emptied and key
+    information must be kept.
   */
-  struct _RBT_NODE_IS_COPY_STACK_T * next;
+  else
+  {
+    debug_print("two children\n");
+    RBT_VALUE_COPY(node->value, RBT_VALUE_NULL, );
+  }
+  debug_print("removed\n");
+  return node;
 }
-_RBT_NODE_IS_COPY_STACK_T;
 
-/*!
-  @endcond
-*/
 
 /*!
   @brief
-  Check if a tree is a copy.
+  Insert a parent node.
 
-  Determine if two trees are copies of each other. A node-by-node comparison is
-  used.
+  Insert a parent node above the given node to hold the given value. The key
+  will be extracted from the beginning of the current key.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
 
   @param[in]
-  a The first root node.
+  node The current node.
 
   @param[in]
-  b The second root node.
+  bits The number of key bits that will be made part of the parent node.
 
-  @return
-  An `int` that will be non-zero if the trees are copies.
-*/
+  @param[in]
+  value The value to insert.
 
-int
-RBT_NODE_IS_COPY(
-  RBT_NODE_T * a,
-  RBT_NODE_T * b
+  @see
+  - `RBT_NODE_INSERT_SIBLING()`
+  - `RBT_NODE_INSERT_CHILD()`
+*/
+void
+RBT_NODE_INSERT_PARENT(
+  RBT_NODE_T * node,
+  RBT_KEY_SIZE_T bits,
+  RBT_VALUE_T value
 )
 {
-  _RBT_NODE_IS_COPY_STACK_T * stack, * stack_tmp, * stack_unused;
-  int rc;
+  debug_print("inserting parent\n");
+  RBT_KEY_SIZE_T pins, staggered_bits, parent_pins;
+  RBT_NODE_T * child;
 
-  errno = 0;
+  RBT_DIVMOD(bits, RBT_PIN_SIZE_BITS, pins, staggered_bits);
 
-  if (a == NULL)
-  {
-    if (b == NULL)
-    {
-      return 1;
-    }
-    else
-    {
-      return 0;
-    }
-  }
-  else if (b == NULL)
+  /*
+    RBT_NODE_CREATE will copy the value passed to it, so pass it the new value
+    and then swap the values of the parent and child below, instead of using
+    superfluous RBT_VALUE_COPY statements.
+  */
+  child = _RBT_NODE_CREATE_NEAR(
+    node,
+    node->key + pins,
+    node->bits - bits + staggered_bits,
+    value,
+    node->left,
+    node->right
+  );
+  if (child == NULL)
   {
-    return 0;
+    debug_printf("failed to create child node (%s)\n", strerror(errno));
+    return;
   }
 
-  stack = NULL;
-  stack_unused = NULL;
+  parent_pins = pins;
+  if (staggered_bits > 0)
+  {
+    parent_pins ++;
+  }
+  if (_RBT_NODE_KEY_RESIZE(node, parent_pins * RBT_PIN_SIZE))
+  {
+    child->left = NULL;
+    child->right = NULL;
+    RBT_NODE_FREE(child);
+    return;
+  }
+  node->bits = bits;
+  /*
+    Swap the values. Do *not* use RBT_VALUE_COPY.
+  */
+  value = child->value;
+  child->value = node->value;
+  node->value = value;
 
-  rc = 1;
-  while (rc)
+  if (N_BIT_IS_1(child->key[0], staggered_bits))
   {
-    if (
-      a->bits != b->bits ||
-      (a->left == NULL) != (b->left == NULL) ||
-      (a->right == NULL) != (b->right == NULL) ||
-      ! RBT_VALUE_IS_EQUAL(a->value, b->value) ||
-      RBT_COMMON_BIT_PREFIX_LEN(a->key, b->key, a->bits) != a->bits
-    )
-    {
-      rc = 0;
-      break;
-    }
-    if (a->left != NULL)
-    {
-      if (a->right != NULL)
-      {
-        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_IS_COPY_STACK_T);
-        stack->a = a->right;
-        stack->b = b->right;
-      }
-      a = a->left;
-      b = b->left;
-    }
-    else if (a->right != NULL)
-    {
-      a = a->right;
-      b = b->right;
-    }
-    else if (stack != NULL)
-    {
-      a = stack->a;
-      b = stack->b;
-      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-    }
-    else
-    {
-      break;
-    }
+    node->right = child;
+    node->left = NULL;
   }
-  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
-  return rc;
+  else
+  {
+    node->left = child;
+    node->right = NULL;
+  }
+  debug_print("inserted\n");
 }
 
+/*!
+  @brief
+  Insert a child node.
 
+  Insert a child node to hold the given value.
 
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
 
+  @param[in]
+  child_node_ptr The child node pointer of the parent node that should be set to
+  point to this node.
 
+  @param[in]
+  key The key fragment that should be held by this node.
 
+  @param[in]
+  bits The number of bits in the key fragment.
 
+  @param[in]
+  value The value to insert.
 
-/////////////////////////////////// Retrieve ///////////////////////////////////
-/*
-  @cond INTERNAL
-  Use a macro to avoid repetition in the function. This is strictly internal
-  and independent of user-defined macros.
+  @see
+  - `RBT_NODE_INSERT_PARENT()`
+  - `RBT_NODE_INSERT_SIBLING()`
 */
+void
+RBT_NODE_INSERT_CHILD(
+  RBT_NODE_T * * child_node_ptr,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  RBT_VALUE_T value
+)
+{
+  debug_print("inserting child\n");
+  RBT_NODE_T * node;
+  node = _RBT_NODE_CREATE_NEAR(child_node_ptr, key, bits, value, NULL, NULL);
+  * child_node_ptr = node;
+  debug_print("inserted\n");
+}
 
-#ifndef _RBT_RETRIEVE_RETURN_WITH_PARENT
-  #define _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr) \
-  do \
-  { \
-    if (parent_node_ptr != NULL) \
-    { \
-      * parent_node_ptr = parent_node; \
-    } \
-    return node; \
-  } \
-  while (0)
-#endif
-
-/*!
-  @endcond
-*/
 
 /*!
   @brief
-  Retrieve a node matching the given key.
-
-  A function to retrieve a node from a tree given a key. If a matching node is
-  found, it is returned. Depending on the given action, missing nodes may also
-  be inserted along with a given value, or the value of an existing node may be
-  updated. The latter action is supported as a matter of algorithmic
-  convenience.
+  Insert a sibling node.
 
-  This function does not remove nodes. Instead it will update a given pointer to
-  point to the parent node of the returned node. A wrapper function  such as `RBT_NODE_ may then
-  call `RBT_NODE_REMOVE()`, perhaps conditionally given the current value of the
-  node. This provides versatility without the complexity of handling multiple
-  cases in this function along with the concomitant overhead of additional
-  checks.
+  Insert a sibling node to hold the given value. The given node is made a
+  placeholder parent and the current data in the node is moved to a new node
+  that is inserted as a child of the parent. The new data is inserted into
+  a second new node and made the second child of the parent.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
 
-  @warning
-  The value of a node that is not `RBT_VALUE_NULL` should not be directly set to
-  `RBT_VALUE_NULL`. Nodes with a value of `RBT_VALUE_NULL` are considered
-  placeholder nodes and are only used as parent nodes when required for the tree
-  structure. Manually inserting `RBT_VALUE_NULL` will cause some assumptions
-  about the tree structure to fail. To remove a node, pass it to
-  `RBT_NODE_REMOVE()` along with the parent pointer, which will restructure the
-  tree if necessary.
-
-  @warning
-  There are some exceptional cases in which this may nevertheless be useful. In
-  those it should be possible to pass `RBT_VALUE_NULL` to `RBT_NODE_FILTER()` to
-  remove the unexpected nodes. However, all functions are written under certain
-  assumptions about the tree structure. It is up to you to determine if any
-  would be broken by the presence of such nodes.
+  @param[in]
+  node The current node.
 
-  @warning
-  In summary, don't do this unless you really know what you're doing.
+  @param[in]
+  key The key fragment that spans the current node and the target child node.
 
   @param[in]
-  node A pointer to the root node.
+  bits The number of bits in the key fragment.
 
   @param[in]
-  key The key.
+  common_bits The number of common bits between the current node's key fragment
+  and the given key. These will form the key fragment of the new parent node.
 
   @param[in]
-  bits The number of significant bits in the key. Bits beyond these will
-  be ignored.
+  common_pins The number of common pins between the current node's key fragment
+  and the given key.
 
   @param[in]
-  action The action that should be performed.
+  common_staggered_bits The number of uncommon bits in the current node's key
+  fragment. These will form the key fragment of the sibling node.
 
   @param[in]
-  value The value with which the action will be performed.
+  value The value to insert.
 
-  @param[out]
-  parent_node_ptr An optional pointer to a parent node pointer. This
-  pointer will be updated with the target node's parent for some actions if it
-  is not NULL. This is required for deleting nodes in a wrapper function. For
-  other actions it has a special use (mostly for wrapper functions).
+  @return
+  A pointer to the new node holding the value, or NULL if an error occured.
 
-  RBT_RETRIEVE_ACTION_PREFIX_SUBTREE
-  :   The point must point to an allocated node. The bits field of the node
-      will be updated to indicate the bit different between the retrieved node
-      and the target prefix. This is used to construct the matching subtree in
-      a separate function.
+  This function is called internally by `RBT_NODE_RETRIEVE()`, which calculates
+  `common_bits`, `common_pins` and `common_staggered_bits` for tree traversal.
+  The value are accepted as parameters here to avoid redundant calculations.
 
-  @return
-  The target node pointer, or `NULL` if no matching node was found or an
-  error occured.
+  In contrast to the other insertion functions, this function returns a pointer
+  to the inserted child. This is to avoid redundant calculations for determining
+  whether the new child is the left or right child of the node.
 
   @see
-  - `RBT_NODE_QUERY()`
-*/
+  - `RBT_NODE_INSERT_PARENT()`
+  - `RBT_NODE_INSERT_CHILD()`
 
+*/
 RBT_NODE_T *
-RBT_NODE_RETRIEVE(
+RBT_NODE_INSERT_SIBLING(
   RBT_NODE_T * node,
   RBT_PIN_T * key,
   RBT_KEY_SIZE_T bits,
-  rbt_retrieve_action_t action,
-  RBT_VALUE_T value,
-  RBT_NODE_T * * parent_node_ptr
+  RBT_KEY_SIZE_T common_bits,
+  RBT_KEY_SIZE_T common_pins,
+  RBT_KEY_SIZE_T common_staggered_bits,
+  RBT_VALUE_T value
 )
 {
-  debug_print_func(RBT_FPRINT_BITS, 1, key, bits, 0);
-  debug_printf("bits: %" RBT_KEY_SIZE_T_FORMAT "\n", bits);
-  debug_printf("action: %s\n", rbt_retrieve_action_string(action));
+  RBT_KEY_SIZE_T parent_pins;
+  RBT_NODE_T * sibling, * baby;
+
   /*
-    The "pin" is the unit of the key array in the node. If the array is a byte
-    array then the pin is a byte, etc. The name is from the pins in a tumbler
-    lock.
+    `sibling` is the node to which the existing data is moved.
+    `baby` is the new node used to hold the new value.
   */
-  int rc;
-  RBT_KEY_SIZE_T common_bits, common_staggered_bits, common_pins;
-  RBT_NODE_T * parent_node;
-  RBT_NODE_T * * child_node_ptr;
-  RBT_PIN_T * tmp_key;
 
-  errno = rc = 0;
-  parent_node = NULL;
-  child_node_ptr = NULL;
+  debug_printf(
+    "inserting sibling (%"
+    RBT_KEY_SIZE_T_FORMAT ", %"
+    RBT_KEY_SIZE_T_FORMAT ", %"
+    RBT_KEY_SIZE_T_FORMAT ", %"
+    RBT_KEY_SIZE_T_FORMAT ")\n",
+    bits, common_bits, common_pins, common_staggered_bits
+  );
 
-  /*
-    The root node is the only node that may have 0 bits in its key and which
+  baby = _RBT_NODE_CREATE_NEAR(
+    node,
+    key + common_pins,
+    bits - common_bits + common_staggered_bits,
+    value,
+    NULL,
+    NULL
+  );
+
+  if (baby == NULL)
+  {
+    debug_printf("failed to create baby node (%s)\n", strerror(errno));
+    return NULL;
+  }
+
+  /*
+    Insert a null value here and then swap it with the current node's value to
+    avoid redundant copying. The `value` variable above can be used as a
+    placeholder.
+  */
+  sibling = _RBT_NODE_CREATE_NEAR(
+    node,
+    node->key + common_pins,
+    node->bits - common_bits + common_staggered_bits,
+    RBT_VALUE_NULL,
+    node->left,
+    node->right
+  );
+
+  if (sibling == NULL)
+  {
+    debug_printf("failed to create sibling node (%s)\n", strerror(errno));
+    RBT_NODE_FREE(baby);
+    return NULL;
+  }
+
+
+  parent_pins = common_pins;
+  if (common_staggered_bits > 0)
+  {
+    parent_pins ++;
+  }
+  if (_RBT_NODE_KEY_RESIZE(node, parent_pins * RBT_PIN_SIZE))
+  {
+    sibling->left = NULL;
+    sibling->right = NULL;
+    RBT_NODE_FREE(sibling);
+    RBT_NODE_FREE(baby);
+    return NULL;
+  }
+
+  node->bits = common_bits;
+
+  value = node->value;
+  node->value = sibling->value;
+  sibling->value = value;
+
+  if (N_BIT_IS_1(baby->key[0], common_staggered_bits))
+  {
+    node->right = baby;
+    node->left = sibling;
+  }
+  else
+  {
+    node->left = baby;
+    node->right = sibling;
+  }
+  debug_print("inserted\n");
+  return baby;
+}
+
+
+
+/*!
+  @brief
+  Create a new tree.
+
+  Create a new, empty node. This should be used to create root nodes for new
+  trees.
+*/
+RBT_NODE_T *
+RBT_NODE_NEW()
+{
+  return RBT_NODE_CREATE(NULL, 0, RBT_VALUE_NULL, NULL, NULL);
+}
+
+
+
+
+
+
+
+
+///////////////////////////////////// Copy /////////////////////////////////////
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_COPY's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+
+typedef
+struct _RBT_NODE_COPY_STACK_T
+{
+  /*!
+    @brief
+    The node.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The child pointer of the target parent node into which the node should be
+    inserted.
+  */
+
+  RBT_NODE_T * * ptr;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_COPY_STACK_T * next;
+}
+_RBT_NODE_COPY_STACK_T;
+
+/*!
+  @endcond
+*/
+
+
+
+
+/*!
+  @brief
+  Copy a tree.
+
+  Create a node-by-node copy of a tree given the root node.
+
+  @warning
+  If the values held by the tree are pointers then the data referenced by the
+  copy will obviously be the same as the data referenced by the original and the
+  two will not be independent. If, however, the data itself is held by the node
+  then the copy will be completely independent.
+
+  @param[in]
+  node The root node of the original tree to copy.
+
+  @return
+  A pointer to the root node of the copy.
+*/
+RBT_NODE_T *
+RBT_NODE_COPY(
+  RBT_NODE_T * node
+)
+{
+  RBT_NODE_T * new_root, * new_node;
+  RBT_NODE_T * * child_ptr;
+  _RBT_NODE_COPY_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_COPY_STACK_T)
+  int rc;
+
+  errno = 0;
+
+  if (node == NULL)
+  {
+    return NULL;
+  }
+
+
+  child_ptr = &new_root;
+  stack = NULL;
+  stack_unused = NULL;
+  rc = 0;
+
+  while (node != NULL)
+  {
+    /*
+      The first node starts the new tree.
+    */
+    if (child_ptr == &new_root)
+    {
+      new_node = RBT_NODE_CREATE(node->key, node->bits, node->value, NULL, NULL);
+    }
+    else
+    {
+      new_node = _RBT_NODE_CREATE_NEAR(child_ptr, node->key, node->bits, node->value, NULL, NULL);
+    }
+    * child_ptr = new_node;
+
+    if (node->left != NULL)
+    {
+      if (node->right != NULL)
+      {
+        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_COPY_STACK_T);
+        stack->node = node->right;
+        stack->ptr = &(new_node->right);
+      }
+      child_ptr = &(new_node->left);
+      node = node->left;
+    }
+    else if (node->right != NULL)
+    {
+      child_ptr = &(new_node->right);
+      node = node->right;
+    }
+    else if (stack != NULL)
+    {
+      node = stack->node;
+      child_ptr = stack->ptr;
+      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (rc)
+  {
+    RBT_NODE_FREE(new_root);
+  }
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  errno = rc;
+  return new_root;
+}
+
+
+
+
+
+//////////////////////////////////// Filter ////////////////////////////////////
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_FILTER's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+
+typedef
+struct _RBT_NODE_FILTER_STACK_T
+{
+  /*!
+    @brief
+    The node.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The stack of parent nodes for this node.
+  */
+  RBT_NODE_STACK_T * parent_stack;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_FILTER_STACK_T * next;
+}
+_RBT_NODE_FILTER_STACK_T;
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  The function type accepted by `RBT_NODE_FILTER()`.
+
+  @param[in]
+  value A pointer to the current node's value.
+
+  @param[in]
+  args A `va_list` containing the additional arguments passed to
+  `RBT_NODE_FILTER()`.
+
+  @return
+  An `int`. If it is non-zero, the current node will be *removed*.
+*/
+typedef
+int
+(* RBT_NODE_FILTER_FUNCTION_T)(
+  RBT_VALUE_T * value,
+  va_list args
+);
+
+/*!
+  @brief
+  Filter tree nodes.
+
+  Remove nodes for which the supplied function returns a non-zero int. The
+  function is passed a pointer to the value instead of the value itself so that
+  it can also modify it if necessary.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @warning
+  See the warning for `RBT_NODE_RETRIEVE()` about directly inserting
+  `RBT_VALUE_NULL` values.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  func_v A function of type `RBT_NODE_FILTER_FUNCTION_T` for filtering nodes by
+  value.
+
+  @param[in]
+  include_empty Pass empty nodes to the function.
+
+  @param[in]
+  ... Additional arguments to pass to `func_v`. They will be passed in a
+  `va_list`, which will be re-initialized before each call.
+
+  @see
+  - `RBT_NODE_FILTER_FUNCTION_T`
+*/
+
+void
+RBT_NODE_FILTER(
+  RBT_NODE_T * node,
+  RBT_NODE_FILTER_FUNCTION_T func_v,
+  int include_empty,
+  ...
+)
+{
+  int rc, unwanted, is_left, placeholder;
+  RBT_NODE_T * tmp_node, * sibling_node;
+  RBT_NODE_STACK_T * parent_stack, * parent_stack_tmp, * parent_stack_unused;
+  _RBT_NODE_STACK_DECLARE(parent_stack, RBT_NODE_STACK_T)
+  _RBT_NODE_FILTER_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_FILTER_STACK_T)
+  va_list func_args;
+
+  errno = 0;
+
+  if (node == NULL)
+  {
+    return;
+  }
+
+  stack = NULL;
+  stack_unused = NULL;
+  parent_stack = NULL;
+  parent_stack_unused = NULL;
+  rc = 0;
+
+//   RBT_NODE_T * root
+//   root = node;
+
+  while (1)
+  {
+//     if (RBT_DEBUG)
+//     {
+//       RBT_NODE_FPRINT(RBT_DEBUG_FD, root, 0, 1);
+//     }
+    if (node != NULL)
+    {
+      if (parent_stack != NULL)
+      {
+        debug_printf("filtering node: %p (parent: %p)\n", node, parent_stack->node);
+      }
+      else
+      {
+        debug_printf("filtering node: %p (no parent)\n", node);
+      }
+      if (include_empty || !RBT_VALUE_IS_NULL(node->value))
+      {
+        va_start(func_args, include_empty);
+        /*
+          This would purge superfluous nodes:
+        */
+//         unwanted = func_v(node->value, func_args) || RBT_VALUE_IS_NULL(node->value);
+        unwanted = func_v(&(node->value), func_args);
+        va_end(func_args);
+        if (errno)
+        {
+          rc = errno;
+          break;
+        }
+        if (unwanted)
+        {
+          if (parent_stack != NULL)
+          {
+            is_left = parent_stack->node->left == node;
+            /*
+              The node will not be removed if it has any children. If it has
+              two then it will be left as a placeholder node. If it has only
+              one then it will be merged and we will need to continue the loop.
+            */
+            placeholder = (node->left != NULL) && (node->right != NULL);
+            if (is_left)
+            {
+              sibling_node = parent_stack->node->right;
+            }
+            else
+            {
+              sibling_node = parent_stack->node->left;
+            }
+            tmp_node = RBT_NODE_REMOVE(node, parent_stack->node);
+            if (errno)
+            {
+              rc = errno;
+              break;
+            }
+            /*
+              If the node has been completely removed then the sibling may have
+              been merged into the parent. Go back to the parent in that case.
+            */
+            if (tmp_node != node)
+            {
+              if (is_left)
+              {
+                /*
+                  Jump directly to the sibling node if it has not changed.
+                */
+                if (parent_stack->node->right == sibling_node)
+                {
+                  node = sibling_node;
+                }
+                /*
+                  Otherwise jump to the parent.
+                */
+                else
+                {
+                  node = parent_stack->node;
+                  _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
+                  if (stack != NULL && stack->parent_stack->node == node)
+                  {
+                    _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+                  }
+                }
+              }
+              /*
+                If the node was the right child, then jump back to the last
+                right child.
+              */
+              else
+              {
+                if (stack != NULL)
+                {
+                  node = stack->node;
+                  while (parent_stack != NULL && parent_stack != stack->parent_stack)
+                  {
+                    _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
+                  }
+                  _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+                }
+                else
+                {
+                  break;
+                }
+              }
+              continue;
+            }
+            /*
+              If the node remains, it is either a placeholder or it has been
+              merged with a child. In the latter case, continue to filter the
+              new value of the node.
+            */
+            if (! placeholder)
+            {
+              continue;
+            }
+          }
+          else
+          {
+            RBT_NODE_REMOVE(node, NULL);
+            if (errno)
+            {
+              rc = errno;
+              break;
+            }
+          }
+        }
+      }
+      if (node->left != NULL)
+      {
+        _RBT_NODE_STACK_ALLOCATE(parent_stack, parent_stack_tmp, parent_stack_unused, RBT_NODE_STACK_T);
+        parent_stack->node = node;
+        if (node->right != NULL)
+        {
+          _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_FILTER_STACK_T);
+          stack->node = node->right;
+          stack->parent_stack = parent_stack;
+        }
+        node = node->left;
+        continue;
+      }
+      else if (node->right != NULL)
+      {
+        _RBT_NODE_STACK_ALLOCATE(parent_stack, parent_stack_tmp, parent_stack_unused, RBT_NODE_STACK_T);
+        parent_stack->node = node;
+        node = node->right;
+        continue;
+      }
+    }
+    if (stack != NULL)
+    {
+      node = stack->node;
+      while (parent_stack != NULL && parent_stack != stack->parent_stack)
+      {
+        _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
+      }
+      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+    }
+    else
+    {
+      break;
+    }
+  }
+  _RBT_NODE_STACK_FREE(parent_stack, parent_stack_tmp, parent_stack_unused);
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  errno = rc;
+}
+
+
+
+/////////////////////////////////// Is Copy ////////////////////////////////////
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_IS_COPY's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+
+typedef
+struct _RBT_NODE_IS_COPY_STACK_T
+{
+  /*!
+    @brief
+    One of the nodes to compare.
+  */
+  RBT_NODE_T * a;
+
+  /*!
+    @brief
+    The other node to compare.
+  */
+  RBT_NODE_T * b;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_IS_COPY_STACK_T * next;
+}
+_RBT_NODE_IS_COPY_STACK_T;
+
+/*!
+  @endcond
+*/
+
+/*!
+  @brief
+  Check if a tree is a copy.
+
+  Determine if two trees are copies of each other. A node-by-node comparison is
+  used.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  a The first root node.
+
+  @param[in]
+  b The second root node.
+
+  @return
+  An `int` that will be non-zero if the trees are copies.
+*/
+
+int
+RBT_NODE_IS_COPY(
+  RBT_NODE_T * a,
+  RBT_NODE_T * b
+)
+{
+  _RBT_NODE_IS_COPY_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_IS_COPY_STACK_T)
+  int rc;
+
+  errno = 0;
+
+  if (a == NULL)
+  {
+    if (b == NULL)
+    {
+      return 1;
+    }
+    else
+    {
+      return 0;
+    }
+  }
+  else if (b == NULL)
+  {
+    return 0;
+  }
+
+  stack = NULL;
+  stack_unused = NULL;
+
+  rc = 1;
+  while (rc)
+  {
+    if (
+      a->bits != b->bits ||
+      (a->left == NULL) != (b->left == NULL) ||
+      (a->right == NULL) != (b->right == NULL) ||
+      ! RBT_VALUE_IS_EQUAL(a->value, b->value) ||
+      RBT_COMMON_BIT_PREFIX_LEN(a->key, b->key, a->bits) != a->bits
+    )
+    {
+      rc = 0;
+      break;
+    }
+    if (a->left != NULL)
+    {
+      if (a->right != NULL)
+      {
+        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_IS_COPY_STACK_T);
+        stack->a = a->right;
+        stack->b = b->right;
+      }
+      a = a->left;
+      b = b->left;
+    }
+    else if (a->right != NULL)
+    {
+      a = a->right;
+      b = b->right;
+    }
+    else if (stack != NULL)
+    {
+      a = stack->a;
+      b = stack->b;
+      _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+    }
+    else
+    {
+      break;
+    }
+  }
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  return rc;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////// Retrieve ///////////////////////////////////
+/*
+  @cond INTERNAL
+  Use a macro to avoid repetition in the function. This is strictly internal
+  and independent of user-defined macros.
+*/
+
+#ifndef _RBT_RETRIEVE_RETURN_WITH_PARENT
+  #define _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr) \
+  do \
+  { \
+    if (parent_node_ptr != NULL) \
+    { \
+      * parent_node_ptr = parent_node; \
+    } \
+    return node; \
+  } \
+  while (0)
+#endif
+
+/*!
+  @endcond
+*/
+
+/*!
+  @brief
+  Retrieve a node matching the given key.
+
+  A function to retrieve a node from a tree given a key. If a matching node is
+  found, it is returned. Depending on the given action, missing nodes may also
+  be inserted along with a given value, or the value of an existing node may be
+  updated. The latter action is supported as a matter of algorithmic
+  convenience.
+
+  This function does not remove nodes. Instead it will update a given pointer to
+  point to the parent node of the returned node. A wrapper function  such as `RBT_NODE_ may then
+  call `RBT_NODE_REMOVE()`, perhaps conditionally given the current value of the
+  node. This provides versatility without the complexity of handling multiple
+  cases in this function along with the concomitant overhead of additional
+  checks.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @warning
+  The value of a node that is not `RBT_VALUE_NULL` should not be directly set to
+  `RBT_VALUE_NULL`. Nodes with a value of `RBT_VALUE_NULL` are considered
+  placeholder nodes and are only used as parent nodes when required for the tree
+  structure. Manually inserting `RBT_VALUE_NULL` will cause some assumptions
+  about the tree structure to fail. To remove a node, pass it to
+  `RBT_NODE_REMOVE()` along with the parent pointer, which will restructure the
+  tree if necessary.
+
+  @warning
+  There are some exceptional cases in which this may nevertheless be useful. In
+  those it should be possible to pass `RBT_VALUE_NULL` to `RBT_NODE_FILTER()` to
+  remove the unexpected nodes. However, all functions are written under certain
+  assumptions about the tree structure. It is up to you to determine if any
+  would be broken by the presence of such nodes.
+
+  @warning
+  In summary, don't do this unless you really know what you're doing.
+
+  @param[in]
+  node A pointer to the root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key. Bits beyond these will
+  be ignored.
+
+  @param[in]
+  action The action that should be performed.
+
+  @param[in]
+  value The value with which the action will be performed.
+
+  @param[out]
+  parent_node_ptr An optional pointer to a parent node pointer. This
+  pointer will be updated with the target node's parent for some actions if it
+  is not NULL. This is required for deleting nodes in a wrapper function. For
+  other actions it has a special use (mostly for wrapper functions).
+
+  RBT_RETRIEVE_ACTION_PREFIX_SUBTREE
+  :   The point must point to an allocated node. The bits field of the node
+      will be updated to indicate the bit different between the retrieved node
+      and the target prefix. This is used to construct the matching subtree in
+      a separate function.
+
+  @return
+  The target node pointer, or `NULL` if no matching node was found or an
+  error occured.
+
+  @see
+  - `RBT_NODE_QUERY()`
+*/
+
+RBT_NODE_T *
+RBT_NODE_RETRIEVE(
+  RBT_NODE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  rbt_retrieve_action_t action,
+  RBT_VALUE_T value,
+  RBT_NODE_T * * parent_node_ptr
+)
+{
+  debug_print_func(RBT_FPRINT_BITS, 1, key, bits, 0);
+  debug_printf("bits: %" RBT_KEY_SIZE_T_FORMAT "\n", bits);
+  debug_printf("action: %s\n", rbt_retrieve_action_string(action));
+  /*
+    The "pin" is the unit of the key array in the node. If the array is a byte
+    array then the pin is a byte, etc. The name is from the pins in a tumbler
+    lock.
+  */
+  int rc;
+  RBT_KEY_SIZE_T common_bits, common_staggered_bits, common_pins;
+  RBT_NODE_T * parent_node;
+  RBT_NODE_T * * child_node_ptr;
+
+  errno = rc = 0;
+  parent_node = NULL;
+  child_node_ptr = NULL;
+
+  /*
+    The root node is the only node that may have 0 bits in its key and which
     cannot be deleted. Handle it as a special case.
   */
-  if (node->bits == 0)
+  if (node->bits == 0)
+  {
+    debug_print("keyless root node\n");
+    /*
+      The key has no bits. This should be uncommon but there is no reason to
+      prevent it.
+    */
+    if (bits == 0)
+    {
+      debug_print("received empty key\n");
+      switch (action)
+      {
+        case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+          RBT_VALUE_COPY(node->value, value, return NULL);
+
+        default:
+          _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+          break;
+      }
+    }
+    /*
+      The requested key is non-zero here whereas the root node is zero. If the
+      root node has no children then there are two possibilities: it is empty
+      and can be used to hold a new value, or it is not empty and a new child
+      would be required to hold the value.
+    */
+    else if (node->left == NULL && node->right == NULL)
+    {
+      debug_print("root node has no children\n");
+      switch (action)
+      {
+        case RBT_RETRIEVE_ACTION_INSERT:
+        case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+          if (RBT_VALUE_IS_NULL(node->value))
+          {
+             debug_print("root node is empty\n");
+            /*
+               common_pins is a misnomer here (variable re-use).
+            */
+            common_pins = BITS_TO_PINS_TO_BYTES(bits);
+            /*
+              The key is preserved if the allocation fails.
+            */
+            if (_RBT_NODE_KEY_RESIZE(node, common_pins))
+            {
+              return NULL;
+            }
+            memcpy(node->key, key, common_pins);
+            node->bits = bits;
+            RBT_VALUE_COPY(node->value, value, return NULL);
+            debug_print("target is root node\n");
+          }
+          else
+          {
+            parent_node = node;
+            node = _RBT_NODE_CREATE_NEAR(parent_node, key, bits, value, NULL, NULL);
+            if (node == NULL)
+            {
+              debug_printf("failed to create node (%s)\n", strerror(errno));
+              return NULL;
+            }
+            if (FIRST_BIT_IS_1(key[0]))
+            {
+              parent_node->right = node;
+            }
+            else
+            {
+              parent_node->left = node;
+            }
+            debug_print("target is child of root node\n");
+          }
+          _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+          break;
+
+        default:
+          return NULL;
+          break;
+      }
+    }
+    /*
+      If the root node has children and no key, then a non-zero key must lead
+      to one of the children.
+    */
+    else
+    {
+      debug_print("root node has at least one child\n");
+      parent_node = node;
+      if (FIRST_BIT_IS_1(key[0]))
+      {
+        debug_print("checking right child\n");
+        child_node_ptr = &node->right;
+      }
+      else
+      {
+        debug_print("checking left child\n");
+        child_node_ptr = &node->left;
+      }
+      parent_node = node;
+      /*
+        The target child is missing.
+      */
+      if (* child_node_ptr == NULL)
+      {
+        debug_print("target child of root node is missing\n");
+        switch (action)
+        {
+          case RBT_RETRIEVE_ACTION_INSERT:
+          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+            node = _RBT_NODE_CREATE_NEAR(parent_node, key, bits, value, NULL, NULL);
+            if (node == NULL)
+            {
+              debug_printf("failed to create node (%s)\n", strerror(errno));
+              return NULL;
+            }
+            * child_node_ptr = node;
+            debug_print("inserted missing child\n");
+            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+            break;
+
+          default:
+            return NULL;
+            break;
+        }
+      }
+      else
+      {
+        node = * child_node_ptr;
+      }
+    }
+  }
+
+  /*
+    Walk along the nodes until:
+    a) we find a matching node (all bits are common)
+    b) we run out of nodes (a new child is needed)
+    c) we run out of key bits (a new parent is needed)
+    d) we find mismatched bits (a new sibling is needed)
+  */
+//   while (node != NULL)
+  while (1)
+  {
+    common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, node->key, MIN(bits, node->bits));
+    debug_print_func(RBT_FPRINT_BITS, 1, key, bits, 0);
+    debug_printf("node %p\n", node);
+    debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
+    debug_printf("common bits: %" RBT_KEY_SIZE_T_FORMAT "\n", common_bits);
+    /*
+      If the common bits match the remaining bits then we have matched our
+      input key. The matching node is either this one or a missing parent.
+    */
+    if (common_bits == bits)
+    {
+      /*
+        If all of the node bits are also common then this node matches.
+      */
+      if (common_bits == node->bits)
+      {
+        debug_print("matched\n");
+        switch (action)
+        {
+          case RBT_RETRIEVE_ACTION_PREFIX_SUBTREE:
+            if (parent_node_ptr != NULL)
+            {
+              (* parent_node_ptr)->bits = 0;
+            }
+            return node;
+            break;
+
+          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+            RBT_VALUE_COPY(node->value, value, return NULL);
+
+          default:
+            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+            break;
+        }
+      }
+      /*
+        Else the node contains more bits and does not match. The matching node
+        is a missing parent node. Inserting the parent node will update the
+        current node, so it and the parent node remain valid.
+      */
+      else
+      {
+        debug_print("target is parent\n");
+        switch (action)
+        {
+          case RBT_RETRIEVE_ACTION_PREFIX_SUBTREE:
+            if (parent_node_ptr != NULL)
+            {
+              (* parent_node_ptr)->bits = node->bits - common_bits;
+            }
+            return node;
+            break;
+
+          case RBT_RETRIEVE_ACTION_INSERT:
+          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+            RBT_NODE_INSERT_PARENT(node, bits, value);
+            if (errno)
+            {
+              return NULL;
+            }
+            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+            break;
+
+          default:
+            return NULL;
+            break;
+        }
+      }
+    }
+    else
+    {
+      RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
+      /*
+        If the node bits are common then the key contains more bits than
+        the node. The matching node will be a child.
+      */
+      if (common_bits == node->bits)
+      {
+        key += common_pins;
+        bits +=  common_staggered_bits - common_bits;
+        debug_print("found parent\n");
+        parent_node = node;
+        if (N_BIT_IS_1(key[0], common_staggered_bits))
+        {
+          debug_print("right\n");
+          child_node_ptr = &(node->right);
+        }
+        else
+        {
+          debug_print("left\n");
+          child_node_ptr = &(node->left);
+        }
+        /*
+          The child node does not exist.
+        */
+        if (* child_node_ptr == NULL)
+        {
+          debug_print("missing child\n");
+          switch (action)
+          {
+            case RBT_RETRIEVE_ACTION_INSERT:
+            case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+              RBT_NODE_INSERT_CHILD(child_node_ptr, key, bits, value);
+              if (errno)
+              {
+                return NULL;
+              }
+              parent_node = node;
+              node = * child_node_ptr;
+              _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+              break;
+
+            default:
+              return NULL;
+              break;
+          }
+        }
+        else
+        {
+          debug_print("checking child\n");
+          node = * child_node_ptr;
+        }
+      }
+      /*
+        If there are common bits followed by divergent bits then the missing
+        node is a sibling node and a new parent is required to hold both.
+      */
+      else
+      {
+        debug_print("target is sibling\n");
+        switch (action)
+        {
+          case RBT_RETRIEVE_ACTION_INSERT:
+          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
+            parent_node = node;
+            node = RBT_NODE_INSERT_SIBLING(
+              node,
+              key,
+              bits,
+              common_bits,
+              common_pins,
+              common_staggered_bits,
+              value
+            );
+            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
+            break;
+
+          default:
+            return NULL;
+            break;
+        }
+      }
+    }
+  }
+  /*
+    This should be unreachable. It is included to prevent compiler warnings.
+  */
+//   errno = ENOTSUP;
+  errno = ENOTRECOVERABLE;
+  error_print("control has escaped loop\n");
+  return NULL;
+}
+
+
+
+
+
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  The number of lookups that `RBT_NODE_RETRIEVE_BATCH()` interleaves.
+*/
+#undef _RBT_NODE_BATCH_WIDTH
+#define _RBT_NODE_BATCH_WIDTH 8
+
+/*!
+  @brief
+  A lookup in progress in `RBT_NODE_RETRIEVE_BATCH()`.
+*/
+typedef
+struct _RBT_NODE_BATCH_LANE_T
+{
+  /*!
+    @brief
+    The next node to compare, or NULL if the lane is unused.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The remainder of the key, starting with the pin of the node's key fragment.
+  */
+  RBT_PIN_T * key;
+
+  /*!
+    @brief
+    The number of remaining key bits, including those of the first pin that
+    precede the node's key fragment.
+  */
+  RBT_KEY_SIZE_T bits;
+
+  /*!
+    @brief
+    The index of the key.
+  */
+  size_t i;
+}
+_RBT_NODE_BATCH_LANE_T;
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Retrieve the nodes matching several keys.
+
+  This is equivalent to calling `RBT_NODE_RETRIEVE()` with
+  `RBT_RETRIEVE_ACTION_NOTHING` for each key, but the lookups are interleaved.
+  Each step of a lookup prefetches the next node and the other lookups are
+  advanced while it is loaded, so the latencies of cache misses in large trees
+  overlap instead of adding up.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  keys The keys.
+
+  @param[in]
+  bits The number of significant bits in each key.
+
+  @param[in]
+  n The number of keys.
+
+  @param[out]
+  nodes The matching node for each key, or NULL if there is none. Nodes may be
+  empty placeholders, as with `RBT_NODE_RETRIEVE()`.
+
+  @see
+  - `RBT_NODE_RETRIEVE()`
+*/
+void
+RBT_NODE_RETRIEVE_BATCH(
+  RBT_NODE_T * node,
+  RBT_PIN_T * * keys,
+  RBT_KEY_SIZE_T * bits,
+  size_t n,
+  RBT_NODE_T * * nodes
+)
+{
+  _RBT_NODE_BATCH_LANE_T lanes[_RBT_NODE_BATCH_WIDTH], * lane;
+  RBT_KEY_SIZE_T common_bits, common_pins, common_staggered_bits;
+  RBT_NODE_T * child;
+  size_t next, active;
+
+  next = 0;
+  active = 0;
+  for (lane=lanes; lane<lanes+_RBT_NODE_BATCH_WIDTH; lane++)
+  {
+    lane->node = NULL;
+  }
+
+  while (1)
+  {
+    for (lane=lanes; lane<lanes+_RBT_NODE_BATCH_WIDTH; lane++)
+    {
+      /*
+        Start the next lookup in an unused lane. The keyless root node is
+        handled here as in RBT_NODE_RETRIEVE(), so lookups may end at once.
+      */
+      while (lane->node == NULL && next < n)
+      {
+        lane->i = next;
+        lane->key = keys[next];
+        lane->bits = bits[next];
+        next ++;
+        if (node->bits > 0)
+        {
+          lane->node = node;
+        }
+        else if (lane->bits == 0)
+        {
+          nodes[lane->i] = node;
+        }
+        else
+        {
+          child = FIRST_BIT_IS_1(lane->key[0]) ? node->right : node->left;
+          nodes[lane->i] = NULL;
+          lane->node = child;
+          RBT_PREFETCH(child);
+        }
+        if (lane->node != NULL)
+        {
+          active ++;
+        }
+      }
+      if (lane->node == NULL)
+      {
+        continue;
+      }
+
+      common_bits = RBT_COMMON_BIT_PREFIX_LEN(lane->key, lane->node->key, MIN(lane->bits, lane->node->bits));
+      child = NULL;
+      if (common_bits == lane->bits)
+      {
+        if (common_bits == lane->node->bits)
+        {
+          nodes[lane->i] = lane->node;
+        }
+        else
+        {
+          nodes[lane->i] = NULL;
+        }
+      }
+      else if (common_bits == lane->node->bits)
+      {
+        RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
+        lane->key += common_pins;
+        lane->bits += common_staggered_bits - common_bits;
+        if (N_BIT_IS_1(lane->key[0], common_staggered_bits))
+        {
+          child = lane->node->right;
+        }
+        else
+        {
+          child = lane->node->left;
+        }
+        if (child == NULL)
+        {
+          nodes[lane->i] = NULL;
+        }
+        else
+        {
+          RBT_PREFETCH(child);
+        }
+      }
+      else
+      {
+        nodes[lane->i] = NULL;
+      }
+      lane->node = child;
+      if (child == NULL)
+      {
+        active --;
+      }
+    }
+    if (! active && next == n)
+    {
+      break;
+    }
+  }
+}
+
+
+
+
+
+
+//////////////////////////////////// Query /////////////////////////////////////
+
+/*!
+  @brief
+  Query a tree.
+
+  A function to retrieve a node from a tree given a key. If a matching node is
+  found, it is returned. Depending on the given action, missing nodes may also
+  be inserted along with a given value, or the value of an existing node may be
+  updated. The latter action is supported as a matter of algorithmic
+  convenience.
+
+  This function does not remove nodes. Instead it will update a given pointer to
+  point to the parent node of the returned node. A wrapper function  such as `RBT_NODE_ may then
+  call `RBT_NODE_REMOVE()`, perhaps conditionally given the current value of the
+  node. This provides versatility without the complexity of handling multiple
+  cases in this function along with the concomitant overhead of additional
+  checks.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  root_node A pointer to the root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key. Bits beyond these will
+  be ignored.
+
+  @param[in]
+  action The action that should be performed.
+
+  @param[in]
+  value The value with which the action will be performed.
+
+  @return
+  The value determined by the action.
+
+  @see
+  - `RBT_NODE_RETRIEVE()`
+*/
+
+RBT_VALUE_T
+RBT_NODE_QUERY(
+  RBT_NODE_T * root_node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  rbt_query_action_t action,
+  RBT_VALUE_T value
+)
+{
+  RBT_NODE_T * target_node, * parent_node;
+  RBT_VALUE_T target_value;
+  int effective_deletion;
+
+  /*
+    Inserting an empty value is effectively a deletion.
+
+    Store the value here to avoid possible overhead from multiple calls.
+  */
+  effective_deletion = RBT_VALUE_IS_NULL(value);
+
+  switch (action)
   {
-    debug_print("keyless root node\n");
-    /*
-      The key has no bits. This should be uncommon but there is no reason to
-      prevent it.
-    */
-    if (bits == 0)
-    {
-      debug_print("received empty key\n");
-      switch (action)
+    case RBT_QUERY_ACTION_INSERT:
+      if (effective_deletion)
       {
-        case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-          RBT_VALUE_COPY(node->value, value, return NULL);
+        action = RBT_QUERY_ACTION_DELETE;
+      }
+      break;
 
-        default:
-          _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-          break;
+    default:
+      break;
+  }
+
+  /*
+    # TODO
+    Consider mergine the following switch statements. They were separated to
+    centralize the call to RBT_NODE_RETRIEVE.
+  */
+
+  switch (action)
+  {
+    case RBT_QUERY_ACTION_DELETE:
+      target_node = RBT_NODE_RETRIEVE(
+        root_node,
+        key,
+        bits,
+        RBT_RETRIEVE_ACTION_NOTHING,
+        RBT_VALUE_NULL,
+        &parent_node
+      );
+      if (errno)
+      {
+        return RBT_VALUE_NULL;
       }
-    }
-    /*
-      The requested key is non-zero here whereas the root node is zero. If the
-      root node has no children then there are two possibilities: it is empty
-      and can be used to hold a new value, or it is not empty and a new child
-      would be required to hold the value.
-    */
-    else if (node->left == NULL && node->right == NULL)
-    {
-      debug_print("root node has no children\n");
-      switch (action)
+      if (target_node != NULL && ! RBT_VALUE_IS_NULL(target_node->value))
       {
-        case RBT_RETRIEVE_ACTION_INSERT:
-        case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-          if (RBT_VALUE_IS_NULL(node->value))
-          {
-             debug_print("root node is empty\n");
-            /*
-               common_pins is a misnomer here (variable re-use).
-            */
-            common_pins = BITS_TO_PINS_TO_BYTES(bits);
-            /*
-              Use tmp key to preserve node if malloc fails.
-            */
-            tmp_key = malloc(common_pins);
-            if (tmp_key == NULL)
-            {
-              debug_printf(
-                "failed to malloc %" RBT_KEY_SIZE_T_FORMAT " bytes for key (error: %s)\n",
-                common_pins,
-                strerror(errno)
-              );
-              return NULL;
-            }
-            free(node->key);
-            node->key = tmp_key;
-            memcpy(node->key, key, common_pins);
-            node->bits = bits;
-            RBT_VALUE_COPY(node->value, value, return NULL);
-            debug_print("target is root node\n");
-          }
-          else
-          {
-            parent_node = node;
-            node = RBT_NODE_CREATE(key, bits, value, NULL, NULL);
-            if (node == NULL)
-            {
-              debug_printf("failed to create node (%s)\n", strerror(errno));
-              return NULL;
-            }
-            if (FIRST_BIT_IS_1(key[0]))
-            {
-              parent_node->right = node;
-            }
-            else
-            {
-              parent_node->left = node;
-            }
-            debug_print("target is child of root node\n");
-          }
-          _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-          break;
+        RBT_NODE_REMOVE(target_node, parent_node);
+      }
+      return RBT_VALUE_NULL;
+      break;
 
-        default:
-          return NULL;
-          break;
+
+
+    case RBT_QUERY_ACTION_RETRIEVE:
+      target_node = RBT_NODE_RETRIEVE(
+        root_node,
+        key,
+        bits,
+        RBT_RETRIEVE_ACTION_NOTHING,
+        RBT_VALUE_NULL,
+        &parent_node
+      );
+      if (errno || target_node == NULL)
+      {
+        return RBT_VALUE_NULL;
       }
-    }
-    /*
-      If the root node has children and no key, then a non-zero key must lead
-      to one of the children.
-    */
-    else
-    {
-      debug_print("root node has at least one child\n");
-      parent_node = node;
-      if (FIRST_BIT_IS_1(key[0]))
+      else
       {
-        debug_print("checking right child\n");
-        child_node_ptr = &node->right;
+        return target_node->value;
+      }
+      break;
+
+
+
+    case RBT_QUERY_ACTION_INSERT:
+      target_node = RBT_NODE_RETRIEVE(
+        root_node,
+        key,
+        bits,
+        RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE,
+        value,
+        &parent_node
+      );
+      if (errno)
+      {
+        return RBT_VALUE_NULL;
+      }
+      return value;
+      break;
+
+
+
+    case RBT_QUERY_ACTION_RETRIEVE_AND_INSERT:
+      target_node = RBT_NODE_RETRIEVE(
+        root_node,
+        key,
+        bits,
+        RBT_RETRIEVE_ACTION_INSERT,
+        RBT_VALUE_NULL,
+        &parent_node
+      );
+      if (errno)
+      {
+        return RBT_VALUE_NULL;
+      }
+      /*
+        There is no need to copy this value as it would be overwritten when
+        the updated with the new value.
+      */
+      target_value = target_node->value;
+      target_node->value = RBT_VALUE_NULL;
+      if (effective_deletion)
+      {
+        RBT_NODE_REMOVE(target_node, parent_node);
+        if (errno)
+        {
+          return RBT_VALUE_NULL;
+        }
       }
       else
       {
-        debug_print("checking left child\n");
-        child_node_ptr = &node->left;
+        /*
+          If something goes wrong, restore the value and return the input value.
+        */
+        RBT_VALUE_COPY(target_node->value, value, target_node->value = target_value; return value);
+      }
+      return target_value;
+      break;
+
+
+
+    case RBT_QUERY_ACTION_SWAP:
+      target_node = RBT_NODE_RETRIEVE(
+        root_node,
+        key,
+        bits,
+        RBT_RETRIEVE_ACTION_INSERT,
+        RBT_VALUE_NULL,
+        &parent_node
+      );
+      if (errno)
+      {
+        return RBT_VALUE_NULL;
       }
-      parent_node = node;
-      /*
-        The target child is missing.
-      */
-      if (* child_node_ptr == NULL)
+      target_value = target_node->value;
+      if (effective_deletion)
       {
-        debug_print("target child of root node is missing\n");
-        switch (action)
+        /*
+          Prevent target_value from being freed.
+        */
+        target_node->value = RBT_VALUE_NULL;
+        RBT_NODE_REMOVE(target_node, parent_node);
+        if (errno)
         {
-          case RBT_RETRIEVE_ACTION_INSERT:
-          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-            node = RBT_NODE_CREATE(key, bits, value, NULL, NULL);
-            if (node == NULL)
-            {
-              debug_printf("failed to create node (%s)\n", strerror(errno));
-              return NULL;
-            }
-            * child_node_ptr = node;
-            debug_print("inserted missing child\n");
-            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-            break;
-
-          default:
-            return NULL;
-            break;
+          return RBT_VALUE_NULL;
         }
       }
       else
       {
-        node = * child_node_ptr;
+        target_node->value = value;
       }
-    }
+      return target_value;
+      break;
   }
+  /*
+    This should be unreachable, but compile complains if there is not return
+    statement.
+  */
+  return RBT_VALUE_NULL;
+}
+
+
+
+
+
+
+
+//////////////////////////////// Longest Prefix ////////////////////////////////
+
+/*!
+  @brief
+  Find the longest key in a tree that is a prefix of the given key.
+
+  The tree is descended once along the key, so this takes time proportional to
+  the length of the key regardless of the number of keys in the tree. The key
+  itself is also a prefix of the key.
+
+  @param[in]
+  node A pointer to the root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[out]
+  prefix_bits An optional pointer to the number of bits of the matched key. It
+  is only set if a node is found.
+
+  @return
+  The node with the longest matching key and a value other than
+  `RBT_VALUE_NULL`, or NULL if no key in the tree is a prefix of the key.
+*/
+RBT_NODE_T *
+RBT_NODE_LONGEST_PREFIX(
+  RBT_NODE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  RBT_KEY_SIZE_T * prefix_bits
+)
+{
+  RBT_NODE_T * match;
+  RBT_KEY_SIZE_T common_bits, common_pins, common_staggered_bits, offset, match_bits;
+
+  match = NULL;
+  match_bits = 0;
+  offset = 0;
 
   /*
-    Walk along the nodes until:
-    a) we find a matching node (all bits are common)
-    b) we run out of nodes (a new child is needed)
-    c) we run out of key bits (a new parent is needed)
-    d) we find mismatched bits (a new sibling is needed)
+    The keyless root node matches every key.
   */
-//   while (node != NULL)
-  while (1)
+  if (node->bits == 0)
   {
-    common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, node->key, MIN(bits, node->bits));
-    debug_print_func(RBT_FPRINT_BITS, 1, key, bits, 0);
-    debug_printf("node %p\n", node);
-    debug_print_func(RBT_FPRINT_BITS, 1, node->key, node->bits, 0);
-    debug_printf("common bits: %" RBT_KEY_SIZE_T_FORMAT "\n", common_bits);
-    /*
-      If the common bits match the remaining bits then we have matched our
-      input key. The matching node is either this one or a missing parent.
-    */
+    if (! RBT_VALUE_IS_NULL(node->value))
+    {
+      match = node;
+    }
+    if (bits == 0)
+    {
+      node = NULL;
+    }
+    else
+    {
+      node = FIRST_BIT_IS_1(key[0]) ? node->right : node->left;
+    }
+  }
+
+  while (node != NULL && node->bits <= bits)
+  {
+    common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, node->key, node->bits);
+    if (common_bits < node->bits)
+    {
+      break;
+    }
+    if (! RBT_VALUE_IS_NULL(node->value))
+    {
+      match = node;
+      match_bits = offset + common_bits;
+    }
     if (common_bits == bits)
     {
-      /*
-        If all of the node bits are also common then this node matches.
-      */
-      if (common_bits == node->bits)
-      {
-        debug_print("matched\n");
-        switch (action)
-        {
-          case RBT_RETRIEVE_ACTION_PREFIX_SUBTREE:
-            if (parent_node_ptr != NULL)
-            {
-              (* parent_node_ptr)->bits = 0;
-            }
-            return node;
-            break;
+      break;
+    }
+    RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
+    key += common_pins;
+    bits += common_staggered_bits - common_bits;
+    offset += common_bits - common_staggered_bits;
+    if (N_BIT_IS_1(key[0], common_staggered_bits))
+    {
+      node = node->right;
+    }
+    else
+    {
+      node = node->left;
+    }
+  }
+
+  if (match != NULL && prefix_bits != NULL)
+  {
+    * prefix_bits = match_bits;
+  }
+  return match;
+}
+
+
+
+
+
+
+
+/////////////////////////////////// Traverse ///////////////////////////////////
+
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_TRAVERSE's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+
+typedef struct _RBT_NODE_TRAVERSE_STACK_T
+{
+  /*!
+    @brief
+    The node on the stack.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The height of the node above the root node (or the depth, depending on
+    how you look at it).
+  */
+  RBT_KEY_SIZE_T height;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_TRAVERSE_STACK_T * next;
+}
+_RBT_NODE_TRAVERSE_STACK_T;
+
+/*!
+  @endcond
+*/
+
+
+/*!
+  @brief
+  A tree traversal function.
+
+  The type of function called by `RBT_NODE_TRAVERSE()` for each node as
+  the tree is traversed.
+
+  The returned value can be used to stop traversal.
+
+  @param[in]
+  node The current node.
+
+  @param[in]
+  height The height of the current node above the root node (or the depth if
+  you view the root node as being at the top).
+
+  @param[in]
+  args A `va_list` containing the additional arguments passed to
+  `RBT_NODE_TRAVERSE()`.
+
+  @return
+  An `int` that will stop traversal if non-zero.
+*/
+typedef
+int
+(* RBT_NODE_TRAVERSE_FUNCTION_T)(
+  RBT_NODE_T * node,
+  RBT_KEY_SIZE_T height,
+  va_list args
+);
+
+
+
+/*!
+  Traverse a tree and pass each node to a function along with its height.
+
+  This function does not reconstruct the key associated with each node.
+
+  @see RBT_NODE_TRAVERSE_WITH_KEY()
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  func_v The function to call with each node.
+
+  @param[in]
+  ... Additional argument to pass to the called function along with each node.
+  These will be passed as a `va_list`.
+*/
+void
+RBT_NODE_TRAVERSE(
+  RBT_NODE_T * node,
+  RBT_NODE_TRAVERSE_FUNCTION_T func_v,
+  ...
+)
+{
+  int rc;
+  _RBT_NODE_TRAVERSE_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_TRAVERSE_STACK_T)
+  RBT_KEY_SIZE_T height;
+  va_list func_args;
 
-          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-            RBT_VALUE_COPY(node->value, value, return NULL);
+  errno = 0;
 
-          default:
-            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-            break;
-        }
-      }
-      /*
-        Else the node contains more bits and does not match. The matching node
-        is a missing parent node. Inserting the parent node will update the
-        current node, so it and the parent node remain valid.
-      */
-      else
-      {
-        debug_print("target is parent\n");
-        switch (action)
-        {
-          case RBT_RETRIEVE_ACTION_PREFIX_SUBTREE:
-            if (parent_node_ptr != NULL)
-            {
-              (* parent_node_ptr)->bits = node->bits - common_bits;
-            }
-            return node;
-            break;
+  if (node == NULL)
+  {
+    return;
+  }
 
-          case RBT_RETRIEVE_ACTION_INSERT:
-          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-            RBT_NODE_INSERT_PARENT(node, bits, value);
-            if (errno)
-            {
-              return NULL;
-            }
-            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-            break;
+  height = 0;
+  stack = NULL;
+  stack_unused = NULL;
+  rc = 0;
 
-          default:
-            return NULL;
-            break;
-        }
-      }
+  while (1)
+  {
+    va_start(func_args, func_v);
+    if (func_v(node, height, func_args) || errno)
+    {
+      rc = errno;
+      break;
     }
-    else
+    va_end(func_args);
+
+    if (node->right == NULL)
     {
-      RBT_DIVMOD(common_bits, RBT_PIN_SIZE_BITS, common_pins, common_staggered_bits);
-      /*
-        If the node bits are common then the key contains more bits than
-        the node. The matching node will be a child.
-      */
-      if (common_bits == node->bits)
+      if (node->left == NULL)
       {
-        key += common_pins;
-        bits +=  common_staggered_bits - common_bits;
-        debug_print("found parent\n");
-        parent_node = node;
-        if (N_BIT_IS_1(key[0], common_staggered_bits))
-        {
-          debug_print("right\n");
-          child_node_ptr = &(node->right);
-        }
-        else
-        {
-          debug_print("left\n");
-          child_node_ptr = &(node->left);
-        }
-        /*
-          The child node does not exist.
-        */
-        if (* child_node_ptr == NULL)
+        if (stack == NULL)
         {
-          debug_print("missing child\n");
-          switch (action)
-          {
-            case RBT_RETRIEVE_ACTION_INSERT:
-            case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-              RBT_NODE_INSERT_CHILD(child_node_ptr, key, bits, value);
-              if (errno)
-              {
-                return NULL;
-              }
-              parent_node = node;
-              node = * child_node_ptr;
-              _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-              break;
-
-            default:
-              return NULL;
-              break;
-          }
+          break;
         }
         else
         {
-          debug_print("checking child\n");
-          node = * child_node_ptr;
+          node = stack->node;
+          height = stack->height;
+          _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+          continue;
         }
       }
-      /*
-        If there are common bits followed by divergent bits then the missing
-        node is a sibling node and a new parent is required to hold both.
-      */
       else
       {
-        debug_print("target is sibling\n");
-        switch (action)
-        {
-          case RBT_RETRIEVE_ACTION_INSERT:
-          case RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE:
-            parent_node = node;
-            node = RBT_NODE_INSERT_SIBLING(
-              node,
-              key,
-              bits,
-              common_bits,
-              common_pins,
-              common_staggered_bits,
-              value
-            );
-            _RBT_RETRIEVE_RETURN_WITH_PARENT(node, parent_node_ptr);
-            break;
-
-          default:
-            return NULL;
-            break;
-        }
+        node = node->left;
+        height ++;
       }
     }
+    else if (node->left == NULL)
+    {
+      node = node->right;
+      height ++;
+    }
+    else
+    {
+      _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_TRAVERSE_STACK_T);
+      height ++;
+      stack->node = node->right;
+      stack->height = height;
+      node = node->left;
+    }
   }
-  /*
-    This should be unreachable. It is included to prevent compiler warnings.
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  errno = rc;
+}
+
+
+
+
+
+
+
+
+/*
+  This is unaffected by fixed length keys, so keep it here.
+*/
+
+/*!
+  @cond INTERNAL
+*/
+
+
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_FILTER_WITH_KEY's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+typedef struct _RBT_NODE_FILTER_WITH_KEY_STACK_T
+{
+  /*!
+    @brief
+    The node on the stack.
   */
-//   errno = ENOTSUP;
-  errno = ENOTRECOVERABLE;
-  error_print("control has escaped loop\n");
-  return NULL;
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The number of bytes in the key prefix for this node.
+  */
+  RBT_KEY_SIZE_T bytes_in_key_prefix;
+
+  /*!
+    @brief
+    The stack of parent nodes for this node.
+  */
+  RBT_NODE_STACK_T * parent_stack;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_FILTER_WITH_KEY_STACK_T * next;
+}
+_RBT_NODE_FILTER_WITH_KEY_STACK_T;
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Linked list for implementing RBT_NODE_TRAVERSE_WITH_KEY's dynamic stack.
+
+  \warning
+  This is an internal structure.
+*/
+
+typedef struct _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T
+{
+  /*!
+    @brief
+    The node on the stack.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The number of bytes in the key prefix for this node.
+  */
+  RBT_KEY_SIZE_T bytes_in_key_prefix;
+
+  /*!
+    @brief
+    The height of the node above the root node (or the depth, depending on
+    how you look at it).
+  */
+  RBT_KEY_SIZE_T height;
+
+  /*!
+    @brief
+    The next item in the stack.
+  */
+  struct _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * next;
 }
+_RBT_NODE_TRAVERSE_WITH_KEY_STACK_T;
 
 
 
+/*!
+  @brief
+  The function type accepted by `RBT_NODE_FILTER_WITH_KEY()`.
 
+  @param[in]
+  key_data The full key associated with the node. This must not be modified by
+  the function.
+
+  @param[in]
+  args A `va_list` containing the additional arguments passed to
+  `RBT_NODE_FILTER()`.
+
+  @return
+  An `int`. If it is non-zero, the current node will be *removed*.
+*/
+typedef
+int
+(* RBT_NODE_FILTER_WITH_KEY_FUNCTION_T)(
+  RBT_KEY_DATA_T * key_data,
+  va_list args
+);
 
 
-//////////////////////////////////// Query /////////////////////////////////////
 
 /*!
   @brief
-  Query a tree.
-
-  A function to retrieve a node from a tree given a key. If a matching node is
-  found, it is returned. Depending on the given action, missing nodes may also
-  be inserted along with a given value, or the value of an existing node may be
-  updated. The latter action is supported as a matter of algorithmic
-  convenience.
+  A tree traversal function.
 
-  This function does not remove nodes. Instead it will update a given pointer to
-  point to the parent node of the returned node. A wrapper function  such as `RBT_NODE_ may then
-  call `RBT_NODE_REMOVE()`, perhaps conditionally given the current value of the
-  node. This provides versatility without the complexity of handling multiple
-  cases in this function along with the concomitant overhead of additional
-  checks.
+  The type of function called by `RBT_NODE_TRAVERSE_WITH_KEY()` for each node
+  as the tree is traversed.
 
-  @attention
-  The value of `errno` should be checked for errors when this function returns.
+  The returned value can be used to stop traversal.
 
   @param[in]
-  root_node A pointer to the root node.
+  key_data The full key associated with the node. This must not be modified by
+  the function.
 
   @param[in]
-  key The key.
+  height The height of the current node above the root node (or the depth if
+  you view the root node as being at the top).
 
   @param[in]
-  bits The number of significant bits in the key. Bits beyond these will
-  be ignored.
+  args A `va_list` containing the additional arguments passed to
+  `RBT_NODE_TRAVERSE_WITH_KEY()`.
 
-  @param[in]
-  action The action that should be performed.
+  @return
+  An `int` that will stop traversal if non-zero.
+*/
+typedef
+int
+(* RBT_NODE_TRAVERSE_WITH_KEY_FUNCTION_T)(
+  RBT_KEY_DATA_T * key_data,
+  RBT_KEY_SIZE_T height,
+  va_list args
+);
 
-  @param[in]
-  value The value with which the action will be performed.
 
-  @return
-  The value determined by the action.
+//////////////////////////////////// Count /////////////////////////////////////
+/*!
+  Count the number of values in the tree.
 
-  @see
-  - `RBT_NODE_RETRIEVE()`
+  @param[in]
+  node The root node.
 */
-
-RBT_VALUE_T
-RBT_NODE_QUERY(
-  RBT_NODE_T * root_node,
-  RBT_PIN_T * key,
-  RBT_KEY_SIZE_T bits,
-  rbt_query_action_t action,
-  RBT_VALUE_T value
+size_t
+RBT_NODE_COUNT(
+  RBT_NODE_T * node
 )
 {
-  RBT_NODE_T * target_node, * parent_node;
-  RBT_VALUE_T target_value;
-  int effective_deletion;
-
-  /*
-    Inserting an empty value is effectively a deletion.
+  int rc;
+  RBT_NODE_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, RBT_NODE_STACK_T)
+  size_t n;
 
-    Store the value here to avoid possible overhead from multiple calls.
-  */
-  effective_deletion = RBT_VALUE_IS_NULL(value);
+  errno = 0;
 
-  switch (action)
+  if (node == NULL)
   {
-    case RBT_QUERY_ACTION_INSERT:
-      if (effective_deletion)
-      {
-        action = RBT_QUERY_ACTION_DELETE;
-      }
-      break;
-
-    default:
-      break;
+    return 0;
   }
 
-  /*
-    # TODO
-    Consider mergine the following switch statements. They were separated to
-    centralize the call to RBT_NODE_RETRIEVE.
-  */
+  n = 0;
+  stack = NULL;
+  stack_unused = NULL;
+  rc = 0;
 
-  switch (action)
+  while (1)
   {
-    case RBT_QUERY_ACTION_DELETE:
-      target_node = RBT_NODE_RETRIEVE(
-        root_node,
-        key,
-        bits,
-        RBT_RETRIEVE_ACTION_NOTHING,
-        RBT_VALUE_NULL,
-        &parent_node
-      );
-      if (errno)
-      {
-        return RBT_VALUE_NULL;
-      }
-      if (target_node != NULL && ! RBT_VALUE_IS_NULL(target_node->value))
-      {
-        RBT_NODE_REMOVE(target_node, parent_node);
-      }
-      return RBT_VALUE_NULL;
-      break;
-
-
-
-    case RBT_QUERY_ACTION_RETRIEVE:
-      target_node = RBT_NODE_RETRIEVE(
-        root_node,
-        key,
-        bits,
-        RBT_RETRIEVE_ACTION_NOTHING,
-        RBT_VALUE_NULL,
-        &parent_node
-      );
-      if (errno || target_node == NULL)
-      {
-        return RBT_VALUE_NULL;
-      }
-      else
-      {
-        return target_node->value;
-      }
-      break;
-
-
-
-    case RBT_QUERY_ACTION_INSERT:
-      target_node = RBT_NODE_RETRIEVE(
-        root_node,
-        key,
-        bits,
-        RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE,
-        value,
-        &parent_node
-      );
-      if (errno)
-      {
-        return RBT_VALUE_NULL;
-      }
-      return value;
-      break;
-
-
+    if (! RBT_VALUE_IS_NULL(node->value))
+    {
+      n ++;
+    }
 
-    case RBT_QUERY_ACTION_RETRIEVE_AND_INSERT:
-      target_node = RBT_NODE_RETRIEVE(
-        root_node,
-        key,
-        bits,
-        RBT_RETRIEVE_ACTION_INSERT,
-        RBT_VALUE_NULL,
-        &parent_node
-      );
-      if (errno)
-      {
-        return RBT_VALUE_NULL;
-      }
-      /*
-        There is no need to copy this value as it would be overwritten when
-        the updated with the new value.
-      */
-      target_value = target_node->value;
-      target_node->value = RBT_VALUE_NULL;
-      if (effective_deletion)
+    if (node->right == NULL)
+    {
+      if (node->left == NULL)
       {
-        RBT_NODE_REMOVE(target_node, parent_node);
-        if (errno)
+        if (stack == NULL)
         {
-          return RBT_VALUE_NULL;
+          break;
         }
-      }
-      else
-      {
-        /*
-          If something goes wrong, restore the value and return the input value.
-        */
-        RBT_VALUE_COPY(target_node->value, value, target_node->value = target_value; return value);
-      }
-      return target_value;
-      break;
-
-
-
-    case RBT_QUERY_ACTION_SWAP:
-      target_node = RBT_NODE_RETRIEVE(
-        root_node,
-        key,
-        bits,
-        RBT_RETRIEVE_ACTION_INSERT,
-        RBT_VALUE_NULL,
-        &parent_node
-      );
-      if (errno)
-      {
-        return RBT_VALUE_NULL;
-      }
-      target_value = target_node->value;
-      if (effective_deletion)
-      {
-        /*
-          Prevent target_value from being freed.
-        */
-        target_node->value = RBT_VALUE_NULL;
-        RBT_NODE_REMOVE(target_node, parent_node);
-        if (errno)
+        else
         {
-          return RBT_VALUE_NULL;
+          node = stack->node;
+          _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
+          continue;
         }
       }
       else
       {
-        target_node->value = value;
+        node = node->left;
       }
-      return target_value;
-      break;
+    }
+    else if (node->left == NULL)
+    {
+      node = node->right;
+    }
+    else
+    {
+      _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, RBT_NODE_STACK_T);
+      stack->node = node->right;
+      node = node->left;
+    }
   }
-  /*
-    This should be unreachable, but compile complains if there is not return
-    statement.
-  */
-  return RBT_VALUE_NULL;
+  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  errno = rc;
+  return n;
 }
 
 
 
+////////////////////////////////// Statistics //////////////////////////////////
 
+#undef _RBT_NODE_STATS_DEPTHS
+#ifdef RBT_NODE_STATS_DEPTHS
+#define _RBT_NODE_STATS_DEPTHS RBT_NODE_STATS_DEPTHS
+#else
+#define _RBT_NODE_STATS_DEPTHS 64
+#endif // RBT_NODE_STATS_DEPTHS
 
+#undef _RBT_VALUE_HEAP_BYTES
+#ifdef RBT_VALUE_HEAP_BYTES
+#define _RBT_VALUE_HEAP_BYTES(val) RBT_VALUE_HEAP_BYTES(val)
+#else
+#define _RBT_VALUE_HEAP_BYTES(val) 0
+#endif // RBT_VALUE_HEAP_BYTES
 
-
-/////////////////////////////////// Traverse ///////////////////////////////////
-
-
-/*!
-  @cond INTERNAL
+/*
+  The number of bytes allocated for a node's key fragment, or 0 if it is stored
+  in the node.
 */
+#undef _RBT_NODE_KEY_BYTES
+#if _RBT_NODE_ARENA > 0
+#define _RBT_NODE_KEY_BYTES(node) \
+( \
+  _RBT_NODE_KEY_IS_ALLOCATED(node) ? \
+  ((size_t) 1 << _RBT_NODE_ARENA_CLASS(BITS_TO_PINS_TO_BYTES((node)->bits))) : \
+  0 \
+)
+#else
+#define _RBT_NODE_KEY_BYTES(node) \
+( \
+  _RBT_NODE_KEY_IS_ALLOCATED(node) ? \
+  (size_t) BITS_TO_PINS_TO_BYTES((node)->bits) : \
+  0 \
+)
+#endif // _RBT_NODE_ARENA
 
 /*!
   @brief
-  Linked list for implementing RBT_NODE_TRAVERSE's dynamic stack.
+  Memory and shape statistics of a tree, as collected by `RBT_NODE_STATS()`.
 
-  \warning
-  This is an internal structure.
+  The byte counts are those requested by the tree. They do not include the
+  allocator's own overhead.
 */
-
-typedef struct _RBT_NODE_TRAVERSE_STACK_T
+typedef
+struct RBT_NODE_STATS_T
 {
   /*!
     @brief
-    The node on the stack.
+    The number of nodes, including placeholders.
   */
-  RBT_NODE_T * node;
+  size_t nodes;
 
   /*!
     @brief
-    The height of the node above the root node (or the depth, depending on
-    how you look at it).
+    The number of nodes with a value.
   */
-  RBT_KEY_SIZE_T height;
+  size_t values;
 
   /*!
     @brief
-    The next item in the stack.
+    The number of nodes with the null value, i.e. the nodes that only join
+    their children and an empty root node.
   */
-  struct _RBT_NODE_TRAVERSE_STACK_T * next;
-}
-_RBT_NODE_TRAVERSE_STACK_T;
-
-/*!
-  @endcond
-*/
-
-
-/*!
-  @brief
-  A tree traversal function.
+  size_t placeholders;
 
-  The type of function called by `RBT_NODE_TRAVERSE()` for each node as
-  the tree is traversed.
-
-  The returned value can be used to stop traversal.
-
-  @param[in]
-  node The current node.
+  /*!
+    @brief
+    The number of bytes used by the nodes themselves, including any inline key
+    fragments.
+  */
+  size_t node_bytes;
 
-  @param[in]
-  height The height of the current node above the root node (or the depth if
-  you view the root node as being at the top).
+  /*!
+    @brief
+    The number of bytes used by key fragments that are not stored in the
+    nodes. With an arena, this is the size of their size classes.
+  */
+  size_t key_bytes;
 
-  @param[in]
-  args A `va_list` containing the additional arguments passed to
-  `RBT_NODE_TRAVERSE()`.
+  /*!
+    @brief
+    The number of bytes allocated by the values, as given by
+    `RBT_VALUE_HEAP_BYTES()`.
+  */
+  size_t value_bytes;
 
-  @return
-  An `int` that will stop traversal if non-zero.
-*/
-typedef
-int
-(* RBT_NODE_TRAVERSE_FUNCTION_T)(
-  RBT_NODE_T * node,
-  RBT_KEY_SIZE_T height,
-  va_list args
-);
+  /*!
+    @brief
+    The number of bytes allocated by the tree's arena, including free space
+    for later nodes and key fragments. This is 0 without an arena, in which
+    case `node_bytes` and `key_bytes` are allocated individually.
+  */
+  size_t arena_bytes;
 
+  /*!
+    @brief
+    The greatest depth of any node, where the root node is at depth 0.
+  */
+  size_t max_depth;
 
+  /*!
+    @brief
+    The number of values at each depth. This is the number of nodes that must
+    be visited to retrieve them, minus 1.
+  */
+  size_t depths[_RBT_NODE_STATS_DEPTHS];
+}
+RBT_NODE_STATS_T;
 
 /*!
-  Traverse a tree and pass each node to a function along with its height.
-
-  This function does not reconstruct the key associated with each node.
+  @brief
+  Collect memory and shape statistics of a tree.
 
-  @see RBT_NODE_TRAVERSE_WITH_KEY()
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
 
   @param[in]
   node The root node.
 
-  @param[in]
-  func_v The function to call with each node.
-
-  @param[in]
-  ... Additional argument to pass to the called function along with each node.
-  These will be passed as a `va_list`.
+  @param[out]
+  stats The statistics.
 */
 void
-RBT_NODE_TRAVERSE(
+RBT_NODE_STATS(
   RBT_NODE_T * node,
-  RBT_NODE_TRAVERSE_FUNCTION_T func_v,
-  ...
+  RBT_NODE_STATS_T * stats
 )
 {
   int rc;
   _RBT_NODE_TRAVERSE_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_TRAVERSE_STACK_T)
   RBT_KEY_SIZE_T height;
-  va_list func_args;
 
   errno = 0;
+  memset(stats, 0, sizeof(RBT_NODE_STATS_T));
 
   if (node == NULL)
   {
     return;
   }
 
+#if _RBT_NODE_ARENA > 0
+  stats->arena_bytes = RBT_NODE_ARENA_BYTES(node);
+#endif // _RBT_NODE_ARENA
+
   height = 0;
   stack = NULL;
   stack_unused = NULL;
@@ -3137,13 +5029,24 @@ RBT_NODE_TRAVERSE(
 
   while (1)
   {
-    va_start(func_args, func_v);
-    if (func_v(node, height, func_args) || errno)
+    stats->nodes ++;
+    stats->key_bytes += _RBT_NODE_KEY_BYTES(node);
+    if (height > stats->max_depth)
     {
-      rc = errno;
-      break;
+      stats->max_depth = height;
+    }
+    if (RBT_VALUE_IS_NULL(node->value))
+    {
+      stats->placeholders ++;
+    }
+    else
+    {
+      stats->values ++;
+      stats->value_bytes += _RBT_VALUE_HEAP_BYTES(node->value);
+      stats->depths[
+        (height < _RBT_NODE_STATS_DEPTHS) ? height : (_RBT_NODE_STATS_DEPTHS - 1)
+      ] ++;
     }
-    va_end(func_args);
 
     if (node->right == NULL)
     {
@@ -3175,6 +5078,10 @@ RBT_NODE_TRAVERSE(
     else
     {
       _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_TRAVERSE_STACK_T);
+      if (rc)
+      {
+        break;
+      }
       height ++;
       stack->node = node->right;
       stack->height = height;
@@ -3182,315 +5089,534 @@ RBT_NODE_TRAVERSE(
     }
   }
   _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
+  stats->node_bytes = stats->nodes * sizeof(RBT_NODE_T);
   errno = rc;
 }
 
 
+/////////////////////////////////// Subtree ////////////////////////////////////
+
+/*!
+  @brief
+  Perform some action on the subtree defined by a common prefix.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  node A pointer to the root node.
+
+  @param[in]
+  key The key, i.e. the prefix.
+
+  @param[in]
+  bits The number of significant bits in the key. Bits beyond these will
+  be ignored. This can thus determine the different prefixes for the same key.
+
+  @param[in]
+  func_v The function to call with the subtree.
+
+  @param[in]
+  ... Additional arguments to func_v.
+
+  @return
+  1 if a matching subtree was found,
+  0 if no matching subtree was found or if an error occured (check errno).
+*/
+
+int
+RBT_NODE_WITH_PREFIX_SUBTREE_DO(
+  RBT_NODE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  void (* func_v)(RBT_NODE_T * subtree, va_list args),
+  ...
+)
+{
+  RBT_NODE_T subroot_node, * tmp_node, * node_ptr;
+  RBT_KEY_SIZE_T bytes, prefix_bytes, total_bits, extra_bits;
+  va_list func_args;
+
+  node_ptr = & subroot_node;
+
+  tmp_node = RBT_NODE_RETRIEVE(
+    node, key, bits,
+    RBT_RETRIEVE_ACTION_PREFIX_SUBTREE,
+    RBT_VALUE_NULL,
+    & node_ptr
+  );
+
+  if (tmp_node == NULL)
+  {
+    return 0;
+  }
+
+  extra_bits = subroot_node.bits;
+  total_bits = bits + extra_bits;
+  bytes = BITS_TO_PINS_TO_BYTES(total_bits);
+  subroot_node.key = malloc(bytes);
+  if (subroot_node.key == NULL)
+  {
+    debug_printf("failed to allocate memory for key (%s)\n", strerror(errno));
+    return 0;
+  }
+  prefix_bytes = (bits + extra_bits - tmp_node->bits) / BITS_PER_BYTE;
+  memcpy(subroot_node.key, key, prefix_bytes);
+  memcpy(subroot_node.key + prefix_bytes, tmp_node->key, bytes - prefix_bytes);
+  subroot_node.bits = total_bits;
+  subroot_node.value = tmp_node->value;
+  subroot_node.left = tmp_node->left;
+  subroot_node.right = tmp_node->right;
+
+
+  va_start(func_args, func_v);
+  func_v(&subroot_node, func_args);
+  va_end(func_args);
 
+  free(subroot_node.key);
+  return 1;
+}
 
 
 
 
+///////////////////////////////////// Bulk /////////////////////////////////////
 
 /*
-  This is unaffected by fixed length keys, so keep it here.
+  Sorted keys share long prefixes with their predecessors, so most of the
+  descent from the root for each key repeats the previous one. A bulk insertion
+  keeps the path to the previously inserted node and resumes each descent from
+  the deepest node on that path that is still a prefix of the new key. For keys
+  sorted in tree order (i.e. the order of RBT_NODE_TRAVERSE()), each node is
+  then visited a bounded number of times and a tree is built or merged in a
+  single linear pass.
+
+  The insertion itself is done by RBT_NODE_RETRIEVE() from the resumption node,
+  so the resulting tree is identical to one built with individual insertions.
+  Unsorted keys are still inserted correctly, only without the speedup.
 */
 
 /*!
   @cond INTERNAL
 */
 
+/*!
+  @brief
+  A node on the path of a bulk insertion.
+*/
+typedef
+struct _RBT_NODE_BULK_ENTRY_T
+{
+  /*!
+    @brief
+    The node.
+  */
+  RBT_NODE_T * node;
+
+  /*!
+    @brief
+    The number of key bits that precede the node's key fragment. This is always
+    a multiple of the pin size.
+  */
+  RBT_KEY_SIZE_T start;
+}
+_RBT_NODE_BULK_ENTRY_T;
+
+/*!
+  @endcond
+*/
+
 
 
 /*!
   @brief
-  Linked list for implementing RBT_NODE_FILTER_WITH_KEY's dynamic stack.
+  The state of a bulk insertion.
 
-  \warning
-  This is an internal structure.
+  @see RBT_NODE_BULK_BEGIN()
 */
-typedef struct _RBT_NODE_FILTER_WITH_KEY_STACK_T
+typedef
+struct RBT_NODE_BULK_T
 {
   /*!
     @brief
-    The node on the stack.
+    The path from the root node to the previously inserted node.
   */
-  RBT_NODE_T * node;
+  _RBT_NODE_BULK_ENTRY_T * path;
+
+  /*!
+    @brief
+    The number of nodes on the path.
+  */
+  size_t depth;
+
+  /*!
+    @brief
+    The previously inserted key.
+  */
+  RBT_PIN_T * key;
+
+  /*!
+    @brief
+    The number of bits in the previously inserted key.
+  */
+  RBT_KEY_SIZE_T bits;
+
+#ifdef RBT_KEY_SIZE_FIXED
+  /*!
+    @brief
+    The storage of the path.
+  */
+  _RBT_NODE_BULK_ENTRY_T path_array[_RBT_NODE_STACK_SIZE];
 
   /*!
     @brief
-    The number of bytes in the key prefix for this node.
+    The storage of the key.
   */
-  RBT_KEY_SIZE_T bytes_in_key_prefix;
-
+  RBT_PIN_T key_array[(RBT_KEY_SIZE_FIXED + RBT_PIN_SIZE - 1) / RBT_PIN_SIZE];
+#else
   /*!
     @brief
-    The stack of parent nodes for this node.
+    The allocated number of path entries.
   */
-  RBT_NODE_STACK_T * parent_stack;
+  size_t size;
 
   /*!
     @brief
-    The next item in the stack.
+    The allocated size of the key, in bytes.
   */
-  struct _RBT_NODE_FILTER_WITH_KEY_STACK_T * next;
+  size_t key_size;
+#endif //RBT_KEY_SIZE_FIXED
 }
-_RBT_NODE_FILTER_WITH_KEY_STACK_T;
-
-/*!
-  @endcond
-*/
+RBT_NODE_BULK_T;
 
 
 
 /*!
   @brief
-  Linked list for implementing RBT_NODE_TRAVERSE_WITH_KEY's dynamic stack.
-
-  \warning
-  This is an internal structure.
+  A key and value for RBT_NODE_BULK_BUILD() and RBT_NODE_BULK_MERGE().
 */
-
-typedef struct _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T
+typedef
+struct RBT_NODE_BULK_ITEM_T
 {
   /*!
     @brief
-    The node on the stack.
-  */
-  RBT_NODE_T * node;
-
-  /*!
-    @brief
-    The number of bytes in the key prefix for this node.
+    The key.
   */
-  RBT_KEY_SIZE_T bytes_in_key_prefix;
+  RBT_PIN_T * key;
 
   /*!
     @brief
-    The height of the node above the root node (or the depth, depending on
-    how you look at it).
+    The number of significant bits in the key.
   */
-  RBT_KEY_SIZE_T height;
+  RBT_KEY_SIZE_T bits;
 
   /*!
     @brief
-    The next item in the stack.
+    The value. It must not be `RBT_VALUE_NULL`.
   */
-  struct _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * next;
+  RBT_VALUE_T value;
 }
-_RBT_NODE_TRAVERSE_WITH_KEY_STACK_T;
+RBT_NODE_BULK_ITEM_T;
 
 
 
 /*!
   @brief
-  The function type accepted by `RBT_NODE_FILTER_WITH_KEY()`.
+  Begin a bulk insertion into a tree.
 
-  @param[in]
-  key_data The full key associated with the node. This must not be modified by
-  the function.
+  The tree must not be modified by other means until `RBT_NODE_BULK_END()` is
+  called. The state contains pointers to its own members and must not be
+  copied.
+
+  @param[out]
+  bulk The state of the bulk insertion.
 
   @param[in]
-  args A `va_list` containing the additional arguments passed to
-  `RBT_NODE_FILTER()`.
+  node The root node.
 
-  @return
-  An `int`. If it is non-zero, the current node will be *removed*.
+  @see RBT_NODE_BULK_INSERT() RBT_NODE_BULK_END()
 */
-typedef
-int
-(* RBT_NODE_FILTER_WITH_KEY_FUNCTION_T)(
-  RBT_KEY_DATA_T * key_data,
-  va_list args
-);
+void
+RBT_NODE_BULK_BEGIN(
+  RBT_NODE_BULK_T * bulk,
+  RBT_NODE_T * node
+)
+{
+#ifdef RBT_KEY_SIZE_FIXED
+  bulk->path = bulk->path_array;
+  bulk->key = bulk->key_array;
+#else
+  bulk->size = 0x20;
+  bulk->path = malloc(sizeof(_RBT_NODE_BULK_ENTRY_T) * bulk->size);
+  bulk->key = NULL;
+  bulk->key_size = 0;
+#endif //RBT_KEY_SIZE_FIXED
+  bulk->bits = 0;
+  /*
+    If the path cannot be allocated, the depth remains 0 and insertions fail.
+  */
+  bulk->depth = 0;
+  if (bulk->path != NULL)
+  {
+    bulk->path->node = node;
+    bulk->path->start = 0;
+    bulk->depth = 1;
+  }
+}
 
 
 
 /*!
   @brief
-  A tree traversal function.
+  Insert a key into a tree during a bulk insertion.
 
-  The type of function called by `RBT_NODE_TRAVERSE_WITH_KEY()` for each node
-  as the tree is traversed.
+  Existing values are replaced as with `RBT_QUERY_ACTION_INSERT`.
 
-  The returned value can be used to stop traversal.
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in,out]
+  bulk The state of the bulk insertion.
 
   @param[in]
-  key_data The full key associated with the node. This must not be modified by
-  the function.
+  key The key. It is only read during the call.
 
   @param[in]
-  height The height of the current node above the root node (or the depth if
-  you view the root node as being at the top).
+  bits The number of significant bits in the key.
 
   @param[in]
-  args A `va_list` containing the additional arguments passed to
-  `RBT_NODE_TRAVERSE_WITH_KEY()`.
+  value The value. Deletions are not supported, so it must not be
+  `RBT_VALUE_NULL`.
 
   @return
-  An `int` that will stop traversal if non-zero.
-*/
-typedef
-int
-(* RBT_NODE_TRAVERSE_WITH_KEY_FUNCTION_T)(
-  RBT_KEY_DATA_T * key_data,
-  RBT_KEY_SIZE_T height,
-  va_list args
-);
-
-
-//////////////////////////////////// Count /////////////////////////////////////
-/*!
-  Count the number of values in the tree.
-
-  @param[in]
-  node The root node.
+  The node that holds the value, or NULL on error.
 */
-RBT_KEY_SIZE_T
-RBT_NODE_COUNT(
-  RBT_NODE_T * node
+RBT_NODE_T *
+RBT_NODE_BULK_INSERT(
+  RBT_NODE_BULK_T * bulk,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  RBT_VALUE_T value
 )
 {
-  int rc;
-  RBT_NODE_STACK_T * stack, * stack_tmp, * stack_unused;
-  RBT_KEY_SIZE_T n;
+  RBT_KEY_SIZE_T common_bits, end, bytes;
+  _RBT_NODE_BULK_ENTRY_T * entry;
+  RBT_NODE_T * node, * target;
+  void * tmp;
 
   errno = 0;
-
-  if (node == NULL)
+  if (bulk->depth == 0 || RBT_VALUE_IS_NULL(value))
   {
-    return 0;
+    errno = (bulk->depth == 0) ? ENOMEM : EINVAL;
+    return NULL;
   }
 
-  n = 0;
-  stack = NULL;
-  stack_unused = NULL;
-  rc = 0;
+  /*
+    Resume from the deepest node on the previous path that ends within the
+    common prefix of the keys. The root node is always kept because it may
+    be split.
+  */
+  common_bits = RBT_COMMON_BIT_PREFIX_LEN(key, bulk->key, MIN(bits, bulk->bits));
+  entry = bulk->path + bulk->depth - 1;
+  while (entry > bulk->path && entry->start + entry->node->bits > common_bits)
+  {
+    entry --;
+  }
+  bulk->depth = entry - bulk->path + 1;
 
-  while (1)
+  target = RBT_NODE_RETRIEVE(
+    entry->node,
+    key + entry->start / RBT_PIN_SIZE_BITS,
+    bits - entry->start,
+    RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE,
+    value,
+    NULL
+  );
+  if (errno)
   {
-    if (! RBT_VALUE_IS_NULL(node->value))
-    {
-      n ++;
-    }
+    return NULL;
+  }
 
-    if (node->right == NULL)
+  /*
+    Extend the path to the target node. Insertions only modify the resumption
+    node and its descendents, so the retained entries remain valid.
+  */
+  node = entry->node;
+  end = entry->start + node->bits;
+  while (node != target)
+  {
+#ifndef RBT_KEY_SIZE_FIXED
+    if (bulk->depth == bulk->size)
     {
-      if (node->left == NULL)
-      {
-        if (stack == NULL)
-        {
-          break;
-        }
-        else
-        {
-          node = stack->node;
-          _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-          continue;
-        }
-      }
-      else
+      tmp = realloc(bulk->path, sizeof(_RBT_NODE_BULK_ENTRY_T) * bulk->size * 2);
+      if (tmp == NULL)
       {
-        node = node->left;
+        return NULL;
       }
+      bulk->path = tmp;
+      bulk->size *= 2;
     }
-    else if (node->left == NULL)
+#endif //RBT_KEY_SIZE_FIXED
+    if (N_BIT_IS_1(key[end / RBT_PIN_SIZE_BITS], end % RBT_PIN_SIZE_BITS))
     {
       node = node->right;
     }
     else
     {
-      _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, stack_unused, _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T);
-      stack->node = node->right;
       node = node->left;
     }
+    entry = bulk->path + bulk->depth;
+    entry->node = node;
+    entry->start = end - end % RBT_PIN_SIZE_BITS;
+    end = entry->start + node->bits;
+    bulk->depth ++;
   }
-  _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
-  errno = rc;
-  return n;
+
+  bytes = BITS_TO_PINS_TO_BYTES(bits);
+#ifndef RBT_KEY_SIZE_FIXED
+  if (bytes > bulk->key_size)
+  {
+    tmp = realloc(bulk->key, bytes * 2);
+    if (tmp == NULL)
+    {
+      bulk->bits = 0;
+      return NULL;
+    }
+    bulk->key = tmp;
+    bulk->key_size = bytes * 2;
+  }
+#else
+  (void) tmp;
+#endif //RBT_KEY_SIZE_FIXED
+  if (bytes)
+  {
+    memcpy(bulk->key, key, bytes);
+  }
+  bulk->bits = bits;
+  return target;
 }
 
 
-/////////////////////////////////// Subtree ////////////////////////////////////
 
 /*!
   @brief
-  Perform some action on the subtree defined by a common prefix.
+  End a bulk insertion and free its resources.
+
+  @param[in,out]
+  bulk The state of the bulk insertion.
+*/
+void
+RBT_NODE_BULK_END(
+  RBT_NODE_BULK_T * bulk
+)
+{
+#ifndef RBT_KEY_SIZE_FIXED
+  free(bulk->path);
+  free(bulk->key);
+  bulk->key = NULL;
+#endif //RBT_KEY_SIZE_FIXED
+  bulk->path = NULL;
+  bulk->depth = 0;
+}
+
+
+
+/*!
+  @brief
+  Insert an array of keys and values into a tree.
+
+  This is equivalent to inserting each item with `RBT_QUERY_ACTION_INSERT`, in
+  order, but it is done in a single pass if the items are sorted by key in tree
+  order. For integer keys stored in pins of the same width, this is ascending
+  numerical order.
 
   @attention
   The value of `errno` should be checked for errors when this function returns.
+  Items before the failed one remain inserted.
 
   @param[in]
-  node A pointer to the root node.
+  node The root node.
 
   @param[in]
-  key The key, i.e. the prefix.
+  items The items.
 
   @param[in]
-  bits The number of significant bits in the key. Bits beyond these will
-  be ignored. This can thus determine the different prefixes for the same key.
+  n The number of items.
+
+  @return
+  The number of inserted items.
+
+  @see RBT_NODE_BULK_BUILD()
+*/
+size_t
+RBT_NODE_BULK_MERGE(
+  RBT_NODE_T * node,
+  RBT_NODE_BULK_ITEM_T * items,
+  size_t n
+)
+{
+  RBT_NODE_BULK_T bulk;
+  size_t i;
+  int rc;
+
+  rc = 0;
+  RBT_NODE_BULK_BEGIN(&bulk, node);
+  for (i=0; i<n; i++)
+  {
+    if (RBT_NODE_BULK_INSERT(&bulk, items[i].key, items[i].bits, items[i].value) == NULL)
+    {
+      rc = errno;
+      break;
+    }
+  }
+  RBT_NODE_BULK_END(&bulk);
+  errno = rc;
+  return i;
+}
+
+
+
+/*!
+  @brief
+  Build a tree from an array of keys and values.
 
   @param[in]
-  func_v The function to call with the subtree.
+  items The items, preferably sorted as described for `RBT_NODE_BULK_MERGE()`.
 
   @param[in]
-  ... Additional arguments to func_v.
+  n The number of items.
 
   @return
-  1 if a matching subtree was found,
-  0 if no matching subtree was found or if an error occured (check errno).
+  The root node of the new tree, or NULL on error (check errno).
 */
-
-int
-RBT_NODE_WITH_PREFIX_SUBTREE_DO(
-  RBT_NODE_T * node,
-  RBT_PIN_T * key,
-  RBT_KEY_SIZE_T bits,
-  void (* func_v)(RBT_NODE_T * subtree, va_list args),
-  ...
+RBT_NODE_T *
+RBT_NODE_BULK_BUILD(
+  RBT_NODE_BULK_ITEM_T * items,
+  size_t n
 )
 {
-  RBT_NODE_T subroot_node, * tmp_node, * node_ptr;
-  RBT_KEY_SIZE_T bytes, prefix_bytes, total_bits, extra_bits;
-  va_list func_args;
-
-  node_ptr = & subroot_node;
-
-  tmp_node = RBT_NODE_RETRIEVE(
-    node, key, bits,
-    RBT_RETRIEVE_ACTION_PREFIX_SUBTREE,
-    RBT_VALUE_NULL,
-    & node_ptr
-  );
+  RBT_NODE_T * node;
+  int rc;
 
-  if (tmp_node == NULL)
+  node = RBT_NODE_NEW();
+  if (node == NULL)
   {
-    return 0;
+    return NULL;
   }
-
-  extra_bits = subroot_node.bits;
-  total_bits = bits + extra_bits;
-  bytes = BITS_TO_PINS_TO_BYTES(total_bits);
-  subroot_node.key = malloc(bytes);
-  if (subroot_node.key == NULL)
+  RBT_NODE_BULK_MERGE(node, items, n);
+  if (errno)
   {
-    debug_printf("failed to allocate memory for key (%s)\n", strerror(errno));
-    return 0;
+    rc = errno;
+    RBT_NODE_FREE(node);
+    errno = rc;
+    return NULL;
   }
-  prefix_bytes = (bits + extra_bits - tmp_node->bits) / BITS_PER_BYTE;
-  memcpy(subroot_node.key, key, prefix_bytes);
-  memcpy(subroot_node.key + prefix_bytes, tmp_node->key, bytes - prefix_bytes);
-  subroot_node.bits = total_bits;
-  subroot_node.value = tmp_node->value;
-  subroot_node.left = tmp_node->left;
-  subroot_node.right = tmp_node->right;
+  return node;
+}
 
 
-  va_start(func_args, func_v);
-  func_v(&subroot_node, func_args);
-  va_end(func_args);
 
-  free(subroot_node.key);
-  return 1;
-}
 
+#ifdef RBT_CONCURRENCY_PERSISTENT
+#  include "concurrency/node_persistent.h"
+#endif //RBT_CONCURRENCY_PERSISTENT
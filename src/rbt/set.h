@@ -49,10 +49,19 @@
     The size of the key, in bytes, if it is fixed or if a maximum key size
     can be anticipated.
 
+  - RBT_SET_PARALLEL
+
+    Define this to include the parallel set operations. They require pthreads.
+
 */
 
 #include <stdint.h>
 
+#ifdef RBT_SET_PARALLEL
+#include <pthread.h>
+#include <unistd.h>
+#endif //RBT_SET_PARALLEL
+
 #include "common.h"
 #include "debug.h"
 
@@ -121,6 +130,30 @@
 #undef RBT_SET_MODIFY_UNION
 #define RBT_SET_MODIFY_UNION                 RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_modify_union)
 
+#undef RBT_SET_PARALLEL_DIFFERENCE
+#define RBT_SET_PARALLEL_DIFFERENCE                   RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_difference)
+
+#undef RBT_SET_PARALLEL_EXCLUSIVE_DISJUNCTION
+#define RBT_SET_PARALLEL_EXCLUSIVE_DISJUNCTION        RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_exclusive_disjunction)
+
+#undef RBT_SET_PARALLEL_INTERSECTION
+#define RBT_SET_PARALLEL_INTERSECTION                 RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_intersection)
+
+#undef RBT_SET_PARALLEL_UNION
+#define RBT_SET_PARALLEL_UNION                        RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_union)
+
+#undef RBT_SET_PARALLEL_MODIFY_DIFFERENCE
+#define RBT_SET_PARALLEL_MODIFY_DIFFERENCE            RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_modify_difference)
+
+#undef RBT_SET_PARALLEL_MODIFY_EXCLUSIVE_DISJUNCTION
+#define RBT_SET_PARALLEL_MODIFY_EXCLUSIVE_DISJUNCTION RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_modify_exclusive_disjunction)
+
+#undef RBT_SET_PARALLEL_MODIFY_INTERSECTION
+#define RBT_SET_PARALLEL_MODIFY_INTERSECTION          RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_modify_intersection)
+
+#undef RBT_SET_PARALLEL_MODIFY_UNION
+#define RBT_SET_PARALLEL_MODIFY_UNION                 RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_modify_union)
+
 
 
 /*
@@ -138,8 +171,8 @@
 #undef _RBT_SET_MODIFY_INTERSECTION_TRAVERSE
 #define _RBT_SET_MODIFY_INTERSECTION_TRAVERSE          _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_modify_intersection_traverse)
 
-#undef _RBT_SET_MODIFY_IS_SUBSET_TRAVERSE
-#define _RBT_SET_MODIFY_IS_SUBSET_TRAVERSE             _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_modify_subset_traverse)
+#undef _RBT_SET_IS_SUBSET_TRAVERSE
+#define _RBT_SET_IS_SUBSET_TRAVERSE                    _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_is_subset_traverse)
 
 #undef _RBT_SET_MODIFY_UNION_TRAVERSE
 #define _RBT_SET_MODIFY_UNION_TRAVERSE                 _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_modify_union_traverse)
@@ -147,6 +180,42 @@
 #undef _RBT_SET_MODIFY_DIFFERENCE_TRAVERSE
 #define _RBT_SET_MODIFY_DIFFERENCE_TRAVERSE            _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_modify_difference_traverse)
 
+#undef _RBT_SET_PARALLEL_ITEM_T
+#define _RBT_SET_PARALLEL_ITEM_T                       _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_item_t)
+
+#undef _RBT_SET_PARALLEL_TASK_T
+#define _RBT_SET_PARALLEL_TASK_T                       _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_task_t)
+
+#undef _RBT_SET_PARALLEL_T
+#define _RBT_SET_PARALLEL_T                            _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_t)
+
+#undef _RBT_SET_PARALLEL_CURSOR
+#define _RBT_SET_PARALLEL_CURSOR                       _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_cursor)
+
+#undef _RBT_SET_PARALLEL_SPLIT
+#define _RBT_SET_PARALLEL_SPLIT                        _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_split)
+
+#undef _RBT_SET_PARALLEL_COMPARE
+#define _RBT_SET_PARALLEL_COMPARE                      _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_compare)
+
+#undef _RBT_SET_PARALLEL_EMIT
+#define _RBT_SET_PARALLEL_EMIT                         _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_emit)
+
+#undef _RBT_SET_PARALLEL_JOIN
+#define _RBT_SET_PARALLEL_JOIN                         _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_join)
+
+#undef _RBT_SET_PARALLEL_WORKER
+#define _RBT_SET_PARALLEL_WORKER                       _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_worker)
+
+#undef _RBT_SET_PARALLEL_APPLY
+#define _RBT_SET_PARALLEL_APPLY                        _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_apply)
+
+#undef _RBT_SET_PARALLEL
+#define _RBT_SET_PARALLEL                              _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel)
+
+#undef _RBT_SET_PARALLEL_NEW
+#define _RBT_SET_PARALLEL_NEW                          _RBT_TOKEN_2_W(RBT_SET_H_PREFIX_, set_parallel_new)
+
 
 
 
@@ -247,8 +316,11 @@ _RBT_SET_MODIFY_UNION_TRAVERSE(
   {
     target = va_arg(args, RBT_NODE_T *);
 
+    /*
+      The target may already hold the key as an empty placeholder node.
+    */
     RBT_NODE_RETRIEVE(
-      target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_INSERT, 1, NULL
+      target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE, 1, NULL
     );
   }
   return 0;
@@ -332,7 +404,7 @@ _RBT_SET_MODIFY_DIFFERENCE_TRAVERSE(
     target = RBT_NODE_RETRIEVE(
       target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_NOTHING, RBT_VALUE_NULL, &parent
     );
-    if (target != NULL)
+    if (target != NULL && ! RBT_VALUE_IS_NULL(target->value))
     {
       RBT_NODE_REMOVE(target, parent);
     }
@@ -388,12 +460,13 @@ _RBT_SET_DIFFERENCE_TRAVERSE(
       b, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_NOTHING, RBT_VALUE_NULL, NULL
     );
     /*
-      If the value does not exist in b, insert it.
+      If the value does not exist in b, insert it. Placeholder nodes in b do not
+      hold values.
     */
-    if (b == NULL)
+    if (b == NULL || RBT_VALUE_IS_NULL(b->value))
     {
       RBT_NODE_RETRIEVE(
-        c, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE, b->value, NULL
+        c, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_INSERT_OR_REPLACE, key_data->node->value, NULL
       );
     }
   }
@@ -456,7 +529,7 @@ _RBT_SET_MODIFY_INTERSECTION_FILTER(
     target = RBT_NODE_RETRIEVE(
       target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_NOTHING, RBT_VALUE_NULL, NULL
     );
-    return (target == NULL);
+    return (target == NULL || RBT_VALUE_IS_NULL(target->value));
   }
   return 1;
 }
@@ -533,7 +606,7 @@ _RBT_SET_MODIFY_EXCLUSIVE_DISJUNCTION_TRAVERSE(
     target = va_arg(args, RBT_NODE_T *);
 
     target = RBT_NODE_RETRIEVE(
-      target, key_data->key, key_data->bits, RBT_QUERY_ACTION_INSERT, RBT_VALUE_NULL, &parent
+      target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_INSERT, RBT_VALUE_NULL, &parent
     );
     if (target->value)
     {
@@ -621,7 +694,7 @@ _RBT_SET_IS_SUBSET_TRAVERSE(
     target = RBT_NODE_RETRIEVE(
       target, key_data->key, key_data->bits, RBT_RETRIEVE_ACTION_NOTHING, RBT_VALUE_NULL, NULL
     );
-    if (target == NULL)
+    if (target == NULL || RBT_VALUE_IS_NULL(target->value))
     {
       * is_subset = 0;
       return 1;
@@ -711,3 +784,1187 @@ RBT_SET_INCLUDES(RBT_NODE_T * set, RBT_KEY_T item)
   return RBT_HAS_KEY(set, item);
 }
 
+
+
+
+/////////////////////////////////// Parallel ///////////////////////////////////
+
+#ifdef RBT_SET_PARALLEL
+
+/*
+  The parallel set operations do not look up the items of one set in the other.
+  Both trees are first split together along their structure: wherever the key
+  fragments of both trees share a prefix, the pair of subtrees is split into its
+  left and right children, and wherever they diverge, each side becomes a
+  separate task. The resulting tasks cover disjoint key ranges in tree order.
+
+  Each task then iterates over its pair of subtrees in step, as in the merge of
+  two sorted lists, and records the keys that the result must contain or that
+  must be changed in the target set. The tasks are processed by a pool of
+  threads without locks because the trees are only read.
+
+  Finally the recorded keys are applied to the target tree in tree order by a
+  single thread, with the bulk insertion functions of node.h, so that the tree
+  itself never has to be modified concurrently.
+*/
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  The number of tasks to aim for per thread so that uneven subtrees can be
+  balanced between the threads.
+*/
+#undef _RBT_SET_PARALLEL_TASKS_PER_THREAD
+#define _RBT_SET_PARALLEL_TASKS_PER_THREAD 8
+
+/*!
+  @brief
+  Membership classes of keys during a parallel set operation.
+*/
+#undef _RBT_SET_PARALLEL_ONLY_A
+#define _RBT_SET_PARALLEL_ONLY_A 1
+#undef _RBT_SET_PARALLEL_ONLY_B
+#define _RBT_SET_PARALLEL_ONLY_B 2
+#undef _RBT_SET_PARALLEL_BOTH
+#define _RBT_SET_PARALLEL_BOTH 4
+
+/*!
+  @brief
+  A key recorded by a task.
+*/
+typedef
+struct _RBT_SET_PARALLEL_ITEM_T
+{
+  /*!
+    @brief
+    The offset of the key in the task's pins.
+  */
+  size_t offset;
+
+  /*!
+    @brief
+    The number of bits in the key.
+  */
+  RBT_KEY_SIZE_T bits;
+
+  /*!
+    @brief
+    The value to insert, or `RBT_VALUE_NULL` to remove the key.
+  */
+  RBT_VALUE_T value;
+}
+_RBT_SET_PARALLEL_ITEM_T;
+
+/*!
+  @brief
+  A pair of subtrees, one from each set, that covers a range of keys.
+*/
+typedef
+struct _RBT_SET_PARALLEL_TASK_T
+{
+  /*!
+    @brief
+    The root node of the subtree of each set, or NULL if the set has no keys in
+    the range.
+  */
+  RBT_NODE_T * node[2];
+
+  /*!
+    @brief
+    The full key of each node, including the preceding key fragments.
+  */
+  RBT_PIN_T * key[2];
+
+  /*!
+    @brief
+    The number of bits in each full key.
+  */
+  RBT_KEY_SIZE_T bits[2];
+
+  /*!
+    @brief
+    If non-zero, only the values of the nodes belong to the task and not their
+    descendents.
+  */
+  int head;
+
+  /*!
+    @brief
+    The recorded keys.
+  */
+  _RBT_SET_PARALLEL_ITEM_T * items;
+
+  /*!
+    @brief
+    The number of recorded keys.
+  */
+  size_t n_items;
+
+  /*!
+    @brief
+    The allocated number of items.
+  */
+  size_t size_items;
+
+  /*!
+    @brief
+    The storage of the recorded keys.
+  */
+  RBT_PIN_T * pins;
+
+  /*!
+    @brief
+    The number of used pins.
+  */
+  size_t n_pins;
+
+  /*!
+    @brief
+    The allocated number of pins.
+  */
+  size_t size_pins;
+
+  /*!
+    @brief
+    The error that ended the task, or 0.
+  */
+  int error;
+}
+_RBT_SET_PARALLEL_TASK_T;
+
+/*!
+  @brief
+  The shared state of the threads of a parallel set operation.
+*/
+typedef
+struct _RBT_SET_PARALLEL_T
+{
+  /*!
+    @brief
+    The tasks.
+  */
+  _RBT_SET_PARALLEL_TASK_T * tasks;
+
+  /*!
+    @brief
+    The number of tasks.
+  */
+  size_t n;
+
+  /*!
+    @brief
+    The index of the next unclaimed task.
+  */
+  size_t next;
+
+  /*!
+    @brief
+    The membership classes of the keys to record.
+  */
+  int record;
+
+  /*!
+    @brief
+    The membership classes of the recorded keys that are inserted. The others
+    are removed.
+  */
+  int insert;
+}
+_RBT_SET_PARALLEL_T;
+
+
+
+/*!
+  @brief
+  Set one of the subtrees of a task to a child node.
+
+  @param[in,out]
+  task The task.
+
+  @param[in]
+  i The index of the set.
+
+  @param[in]
+  node The node.
+
+  @param[in]
+  prefix The full key of the node's parent, or NULL for a root node.
+
+  @param[in]
+  prefix_bits The number of bits in the prefix.
+
+  @return
+  0, or an error code.
+*/
+static int
+_RBT_SET_PARALLEL_CURSOR(
+  _RBT_SET_PARALLEL_TASK_T * task,
+  int i,
+  RBT_NODE_T * node,
+  RBT_PIN_T * prefix,
+  RBT_KEY_SIZE_T prefix_bits
+)
+{
+  size_t prefix_bytes, bytes;
+
+  /*
+    Child key fragments begin with the pin that contains the parent's last bit.
+  */
+  prefix_bytes = (prefix_bits / RBT_PIN_SIZE_BITS) * RBT_PIN_SIZE;
+  task->bits[i] = prefix_bytes * BITS_PER_BYTE + node->bits;
+  bytes = BITS_TO_PINS_TO_BYTES(task->bits[i]);
+  task->key[i] = malloc(bytes ? bytes : RBT_PIN_SIZE);
+  if (task->key[i] == NULL)
+  {
+    return errno;
+  }
+  if (prefix_bytes)
+  {
+    memcpy(task->key[i], prefix, prefix_bytes);
+  }
+  if (bytes > prefix_bytes)
+  {
+    memcpy(((uint8_t *) task->key[i]) + prefix_bytes, node->key, bytes - prefix_bytes);
+  }
+  task->node[i] = node;
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Split a task into the tasks that cover its key range.
+
+  The new tasks are appended to an array in tree order. The keys of the split
+  task are either moved to the new tasks or freed.
+
+  @param[in,out]
+  task The task to split. Its keys are cleared.
+
+  @param[out]
+  out The array to which to append the new tasks. It must have room for 3.
+
+  @return
+  The number of new tasks, 0 if the task cannot be split, or -1 on error.
+*/
+static int
+_RBT_SET_PARALLEL_SPLIT(
+  _RBT_SET_PARALLEL_TASK_T * task,
+  _RBT_SET_PARALLEL_TASK_T * out
+)
+{
+  _RBT_SET_PARALLEL_TASK_T * new_task;
+  RBT_NODE_T * child;
+  RBT_KEY_SIZE_T bits, common;
+  int i, n, side, first, has_value, has_children;
+
+  if (task->head)
+  {
+    return 0;
+  }
+
+  /*
+    If the keys of the subtrees diverge, every key of one subtree precedes
+    every key of the other. Give each its own task.
+  */
+  if (task->node[0] != NULL && task->node[1] != NULL)
+  {
+    bits = MIN(task->bits[0], task->bits[1]);
+    common = RBT_COMMON_BIT_PREFIX_LEN(task->key[0], task->key[1], bits);
+    if (common < bits)
+    {
+      first = N_BIT_IS_1(task->key[0][common / RBT_PIN_SIZE_BITS], common % RBT_PIN_SIZE_BITS) ? 1 : 0;
+      for (n=0; n<2; n++)
+      {
+        i = n ? ! first : first;
+        memset(out + n, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+        out[n].node[i] = task->node[i];
+        out[n].key[i] = task->key[i];
+        out[n].bits[i] = task->bits[i];
+      }
+      memset(task, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+      return 2;
+    }
+  }
+  else if (task->node[0] != NULL)
+  {
+    bits = task->bits[0];
+  }
+  else
+  {
+    bits = task->bits[1];
+  }
+
+  /*
+    The keys of both subtrees share the first `bits` bits. The nodes that end
+    there hold the only keys of that length and their children split the
+    remaining keys by the next bit. Longer nodes go to one side.
+  */
+  has_value = 0;
+  has_children = 0;
+  for (i=0; i<2; i++)
+  {
+    if (task->node[i] != NULL && task->bits[i] == bits)
+    {
+      has_value = has_value || ! RBT_VALUE_IS_NULL(task->node[i]->value);
+      has_children = has_children || task->node[i]->left != NULL || task->node[i]->right != NULL;
+    }
+    else if (task->node[i] != NULL)
+    {
+      has_children = 1;
+    }
+  }
+  if (! has_children)
+  {
+    return 0;
+  }
+
+  n = 0;
+  if (has_value)
+  {
+    new_task = out + n;
+    memset(new_task, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+    new_task->head = 1;
+    for (i=0; i<2; i++)
+    {
+      if (task->node[i] != NULL && task->bits[i] == bits)
+      {
+        new_task->node[i] = task->node[i];
+        new_task->bits[i] = bits;
+        new_task->key[i] = malloc(BITS_TO_PINS_TO_BYTES(bits) + RBT_PIN_SIZE);
+        if (new_task->key[i] == NULL)
+        {
+          break;
+        }
+        memcpy(new_task->key[i], task->key[i], BITS_TO_PINS_TO_BYTES(bits));
+      }
+    }
+    n ++;
+    if (i < 2)
+    {
+      return -1;
+    }
+  }
+
+  for (side=0; side<2; side++)
+  {
+    new_task = out + n;
+    memset(new_task, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+    for (i=0; i<2; i++)
+    {
+      if (task->node[i] == NULL)
+      {
+        continue;
+      }
+      if (task->bits[i] == bits)
+      {
+        child = side ? task->node[i]->right : task->node[i]->left;
+        if (child != NULL && _RBT_SET_PARALLEL_CURSOR(new_task, i, child, task->key[i], bits))
+        {
+          return -1;
+        }
+      }
+      else if ((N_BIT_IS_1(task->key[i][bits / RBT_PIN_SIZE_BITS], bits % RBT_PIN_SIZE_BITS) ? 1 : 0) == side)
+      {
+        new_task->node[i] = task->node[i];
+        new_task->key[i] = task->key[i];
+        new_task->bits[i] = task->bits[i];
+        task->node[i] = NULL;
+        task->key[i] = NULL;
+      }
+    }
+    if (new_task->node[0] != NULL || new_task->node[1] != NULL)
+    {
+      n ++;
+    }
+  }
+
+  for (i=0; i<2; i++)
+  {
+    free(task->key[i]);
+  }
+  memset(task, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+  return n;
+}
+
+
+
+/*!
+  @brief
+  Compare two keys in tree order.
+
+  @return
+  A negative number, zero or a positive number if the first key precedes,
+  equals or follows the second key, respectively.
+*/
+static inline int
+_RBT_SET_PARALLEL_COMPARE(
+  RBT_PIN_T * a,
+  RBT_KEY_SIZE_T a_bits,
+  RBT_PIN_T * b,
+  RBT_KEY_SIZE_T b_bits
+)
+{
+  RBT_KEY_SIZE_T bits, common;
+
+  bits = MIN(a_bits, b_bits);
+  common = RBT_COMMON_BIT_PREFIX_LEN(a, b, bits);
+  if (common == bits)
+  {
+    return (a_bits > b_bits) - (a_bits < b_bits);
+  }
+  return N_BIT_IS_1(a[common / RBT_PIN_SIZE_BITS], common % RBT_PIN_SIZE_BITS) ? 1 : -1;
+}
+
+
+
+/*!
+  @brief
+  Record a key in a task if its membership class requires it.
+
+  @param[in]
+  parallel The shared state.
+
+  @param[in,out]
+  task The task.
+
+  @param[in]
+  membership The membership class of the key.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of bits in the key.
+
+  @return
+  0, or an error code.
+*/
+static inline int
+_RBT_SET_PARALLEL_EMIT(
+  _RBT_SET_PARALLEL_T * parallel,
+  _RBT_SET_PARALLEL_TASK_T * task,
+  int membership,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits
+)
+{
+  _RBT_SET_PARALLEL_ITEM_T * item;
+  size_t pins, size;
+  void * tmp;
+
+  if (! (parallel->record & membership))
+  {
+    return 0;
+  }
+  pins = BITS_TO_PINS(bits);
+  if (task->n_items == task->size_items)
+  {
+    size = task->size_items ? task->size_items * 2 : 0x100;
+    tmp = realloc(task->items, size * sizeof(_RBT_SET_PARALLEL_ITEM_T));
+    if (tmp == NULL)
+    {
+      return errno;
+    }
+    task->items = tmp;
+    task->size_items = size;
+  }
+  if (task->n_pins + pins > task->size_pins)
+  {
+    size = (task->n_pins + pins) * 2;
+    tmp = realloc(task->pins, size * RBT_PIN_SIZE);
+    if (tmp == NULL)
+    {
+      return errno;
+    }
+    task->pins = tmp;
+    task->size_pins = size;
+  }
+  item = task->items + task->n_items;
+  item->offset = task->n_pins;
+  item->bits = bits;
+  item->value = (parallel->insert & membership) ? 1 : RBT_VALUE_NULL;
+  if (pins)
+  {
+    memcpy(task->pins + task->n_pins, key, pins * RBT_PIN_SIZE);
+  }
+  task->n_pins += pins;
+  task->n_items ++;
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Process a task by iterating over both of its subtrees in step.
+
+  @param[in]
+  parallel The shared state.
+
+  @param[in,out]
+  task The task.
+*/
+static void
+_RBT_SET_PARALLEL_JOIN(
+  _RBT_SET_PARALLEL_T * parallel,
+  _RBT_SET_PARALLEL_TASK_T * task
+)
+{
+  RBT_NODE_ITERATOR_T iterators[2];
+  RBT_NODE_T subroots[2];
+  RBT_KEY_DATA_T * key_data[2];
+  int i, rc, cmp, membership;
+
+  if (task->head)
+  {
+    membership = 0;
+    for (i=0; i<2; i++)
+    {
+      if (task->node[i] != NULL && ! RBT_VALUE_IS_NULL(task->node[i]->value))
+      {
+        membership |= i ? _RBT_SET_PARALLEL_ONLY_B : _RBT_SET_PARALLEL_ONLY_A;
+      }
+    }
+    if (membership == (_RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B))
+    {
+      membership = _RBT_SET_PARALLEL_BOTH;
+    }
+    i = (task->node[0] != NULL) ? 0 : 1;
+    if (membership)
+    {
+      task->error = _RBT_SET_PARALLEL_EMIT(parallel, task, membership, task->key[i], task->bits[i]);
+    }
+    return;
+  }
+
+  /*
+    Iterate over copies of the subtree root nodes with their full keys so that
+    the iterators return full keys.
+  */
+  for (i=0; i<2; i++)
+  {
+    if (task->node[i] != NULL)
+    {
+      subroots[i] = * task->node[i];
+      subroots[i].key = task->key[i];
+      subroots[i].bits = task->bits[i];
+      key_data[i] = RBT_NODE_ITERATOR_BEGIN(iterators + i, subroots + i, 0);
+    }
+    else
+    {
+      key_data[i] = RBT_NODE_ITERATOR_BEGIN(iterators + i, NULL, 0);
+    }
+  }
+
+  rc = 0;
+  while (key_data[0] != NULL || key_data[1] != NULL)
+  {
+    if (key_data[0] == NULL)
+    {
+      cmp = 1;
+    }
+    else if (key_data[1] == NULL)
+    {
+      cmp = -1;
+    }
+    else
+    {
+      cmp = _RBT_SET_PARALLEL_COMPARE(
+        key_data[0]->key, key_data[0]->bits, key_data[1]->key, key_data[1]->bits
+      );
+    }
+    if (cmp < 0)
+    {
+      rc = _RBT_SET_PARALLEL_EMIT(parallel, task, _RBT_SET_PARALLEL_ONLY_A, key_data[0]->key, key_data[0]->bits);
+      key_data[0] = RBT_NODE_ITERATOR_NEXT(iterators);
+    }
+    else if (cmp > 0)
+    {
+      rc = _RBT_SET_PARALLEL_EMIT(parallel, task, _RBT_SET_PARALLEL_ONLY_B, key_data[1]->key, key_data[1]->bits);
+      key_data[1] = RBT_NODE_ITERATOR_NEXT(iterators + 1);
+    }
+    else
+    {
+      rc = _RBT_SET_PARALLEL_EMIT(parallel, task, _RBT_SET_PARALLEL_BOTH, key_data[0]->key, key_data[0]->bits);
+      key_data[0] = RBT_NODE_ITERATOR_NEXT(iterators);
+      key_data[1] = RBT_NODE_ITERATOR_NEXT(iterators + 1);
+    }
+    if (rc)
+    {
+      break;
+    }
+  }
+  for (i=0; i<2; i++)
+  {
+    if (RBT_NODE_ITERATOR_END(iterators + i) && ! rc)
+    {
+      rc = errno;
+    }
+  }
+  task->error = rc;
+}
+
+
+
+/*!
+  @brief
+  Process tasks until none are left.
+
+  @param[in]
+  arg The shared state.
+
+  @return
+  NULL
+*/
+static void *
+_RBT_SET_PARALLEL_WORKER(
+  void * arg
+)
+{
+  _RBT_SET_PARALLEL_T * parallel;
+  size_t i;
+
+  parallel = arg;
+  while ((i = __atomic_fetch_add(&parallel->next, 1, __ATOMIC_RELAXED)) < parallel->n)
+  {
+    _RBT_SET_PARALLEL_JOIN(parallel, parallel->tasks + i);
+  }
+  return NULL;
+}
+
+
+
+/*!
+  @brief
+  Apply the recorded keys of all tasks to a tree.
+
+  Removals are applied first, then insertions in tree order with a single bulk
+  insertion.
+
+  @param[in]
+  parallel The shared state.
+
+  @param[in]
+  target The root node of the tree.
+
+  @return
+  0, or an error code.
+*/
+static int
+_RBT_SET_PARALLEL_APPLY(
+  _RBT_SET_PARALLEL_T * parallel,
+  RBT_NODE_T * target
+)
+{
+  RBT_NODE_BULK_T bulk;
+  _RBT_SET_PARALLEL_TASK_T * task;
+  _RBT_SET_PARALLEL_ITEM_T * item;
+  RBT_NODE_T * node, * parent;
+  size_t i, j;
+  int rc;
+
+  rc = 0;
+  if (parallel->insert != (_RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B | _RBT_SET_PARALLEL_BOTH))
+  {
+    for (i=0; i<parallel->n && ! rc; i++)
+    {
+      task = parallel->tasks + i;
+      for (j=0; j<task->n_items; j++)
+      {
+        item = task->items + j;
+        if (RBT_VALUE_IS_NULL(item->value))
+        {
+          node = RBT_NODE_RETRIEVE(
+            target, task->pins + item->offset, item->bits,
+            RBT_RETRIEVE_ACTION_NOTHING, RBT_VALUE_NULL, &parent
+          );
+          if (node != NULL && ! RBT_VALUE_IS_NULL(node->value))
+          {
+            RBT_NODE_REMOVE(node, parent);
+          }
+          if (errno)
+          {
+            rc = errno;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  RBT_NODE_BULK_BEGIN(&bulk, target);
+  for (i=0; i<parallel->n && ! rc; i++)
+  {
+    task = parallel->tasks + i;
+    for (j=0; j<task->n_items; j++)
+    {
+      item = task->items + j;
+      if (
+        ! RBT_VALUE_IS_NULL(item->value) &&
+        RBT_NODE_BULK_INSERT(&bulk, task->pins + item->offset, item->bits, item->value) == NULL
+      )
+      {
+        rc = errno;
+        break;
+      }
+    }
+  }
+  RBT_NODE_BULK_END(&bulk);
+  return rc;
+}
+
+
+
+/*!
+  @brief
+  Perform a parallel set operation.
+
+  @param[in]
+  a The first set.
+
+  @param[in]
+  b The second set.
+
+  @param[in]
+  op The membership classes of the keys in the result.
+
+  @param[in]
+  target The root node of an empty tree to hold the result, or NULL to modify
+  `a` in place.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  0, or an error code.
+*/
+static int
+_RBT_SET_PARALLEL(
+  RBT_NODE_T * a,
+  RBT_NODE_T * b,
+  int op,
+  RBT_NODE_T * target,
+  unsigned int threads
+)
+{
+  _RBT_SET_PARALLEL_T parallel;
+  _RBT_SET_PARALLEL_TASK_T * tasks, * tmp;
+  pthread_t * thread_ids;
+  size_t i, n, size, wanted;
+  long processors;
+  unsigned int started;
+  int rc, split;
+
+  if (threads == 0)
+  {
+    processors = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (processors > 0) ? processors : 1;
+  }
+  if (target == NULL)
+  {
+    /*
+      Only keys whose membership in `a` changes are recorded. Keys only in `b`
+      are inserted and the others are removed.
+    */
+    parallel.record = (
+      (~op & (_RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_BOTH)) |
+      (op & _RBT_SET_PARALLEL_ONLY_B)
+    );
+    parallel.insert = _RBT_SET_PARALLEL_ONLY_B;
+  }
+  else
+  {
+    parallel.record = op;
+    parallel.insert = _RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B | _RBT_SET_PARALLEL_BOTH;
+  }
+
+  /*
+    Start with a single task that covers both trees.
+  */
+  size = 1;
+  tasks = calloc(size, sizeof(_RBT_SET_PARALLEL_TASK_T));
+  if (tasks == NULL)
+  {
+    return errno;
+  }
+  n = 0;
+  rc = 0;
+  if (! RBT_VALUE_IS_NULL(a->value) || a->left != NULL || a->right != NULL)
+  {
+    rc = _RBT_SET_PARALLEL_CURSOR(tasks, 0, a, NULL, 0);
+  }
+  if (! rc && (! RBT_VALUE_IS_NULL(b->value) || b->left != NULL || b->right != NULL))
+  {
+    rc = _RBT_SET_PARALLEL_CURSOR(tasks, 1, b, NULL, 0);
+  }
+  if (tasks->node[0] != NULL || tasks->node[1] != NULL)
+  {
+    n = 1;
+  }
+
+  /*
+    Split all tasks until there are enough of them or none can be split.
+  */
+  wanted = (threads > 1) ? (size_t) threads * _RBT_SET_PARALLEL_TASKS_PER_THREAD : 1;
+  split = 1;
+  while (! rc && split && n < wanted)
+  {
+    tmp = calloc(n * 3, sizeof(_RBT_SET_PARALLEL_TASK_T));
+    if (tmp == NULL)
+    {
+      rc = errno;
+      break;
+    }
+    split = 0;
+    size = 0;
+    for (i=0; i<n; i++)
+    {
+      rc = _RBT_SET_PARALLEL_SPLIT(tasks + i, tmp + size);
+      if (rc < 0)
+      {
+        rc = errno ? errno : ENOMEM;
+        /*
+          Keep the partial results of the failed split so that they are freed.
+        */
+        size += 3;
+        break;
+      }
+      if (rc)
+      {
+        size += rc;
+        split = 1;
+        rc = 0;
+      }
+      else
+      {
+        tmp[size ++] = tasks[i];
+        memset(tasks + i, 0, sizeof(_RBT_SET_PARALLEL_TASK_T));
+      }
+    }
+    for (; i<n; i++)
+    {
+      tmp[size ++] = tasks[i];
+    }
+    free(tasks);
+    tasks = tmp;
+    n = size;
+  }
+
+  parallel.tasks = tasks;
+  parallel.n = n;
+  parallel.next = 0;
+
+  if (! rc)
+  {
+    /*
+      The calling thread also processes tasks, so the operation proceeds even
+      if no threads can be started.
+    */
+    started = 0;
+    thread_ids = NULL;
+    if (threads > 1 && n > 1)
+    {
+      if (threads > n)
+      {
+        threads = n;
+      }
+      thread_ids = malloc((threads - 1) * sizeof(pthread_t));
+      if (thread_ids != NULL)
+      {
+        while (
+          started < threads - 1 &&
+          pthread_create(thread_ids + started, NULL, _RBT_SET_PARALLEL_WORKER, &parallel) == 0
+        )
+        {
+          started ++;
+        }
+      }
+    }
+    _RBT_SET_PARALLEL_WORKER(&parallel);
+    while (started)
+    {
+      pthread_join(thread_ids[-- started], NULL);
+    }
+    free(thread_ids);
+
+    for (i=0; i<n && ! rc; i++)
+    {
+      rc = tasks[i].error;
+    }
+    if (! rc)
+    {
+      rc = _RBT_SET_PARALLEL_APPLY(&parallel, (target == NULL) ? a : target);
+    }
+  }
+
+  for (i=0; i<n; i++)
+  {
+    free(tasks[i].key[0]);
+    free(tasks[i].key[1]);
+    free(tasks[i].items);
+    free(tasks[i].pins);
+  }
+  free(tasks);
+  errno = rc;
+  return rc;
+}
+
+
+
+/*!
+  @brief
+  Create a set that holds the result of a parallel set operation.
+
+  @param[in]
+  a The first set.
+
+  @param[in]
+  b The second set.
+
+  @param[in]
+  op The membership classes of the keys in the result.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  The resulting set, or NULL on error (check errno).
+*/
+static RBT_NODE_T *
+_RBT_SET_PARALLEL_NEW(
+  RBT_NODE_T * a,
+  RBT_NODE_T * b,
+  int op,
+  unsigned int threads
+)
+{
+  RBT_NODE_T * c;
+  int rc;
+
+  c = RBT_NODE_NEW();
+  if (c != NULL && _RBT_SET_PARALLEL(a, b, op, c, threads))
+  {
+    rc = errno;
+    RBT_NODE_FREE(c);
+    errno = rc;
+    c = NULL;
+  }
+  return c;
+}
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  Add all elements of set `b` to set `a` with multiple threads.
+
+  This is equivalent to `RBT_SET_MODIFY_UNION()`. `b` is not changed. Neither
+  set may be modified by other threads during the operation.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  a The set to which to add the elements of the other set.
+
+  @param[in]
+  b The other set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+*/
+void
+RBT_SET_PARALLEL_MODIFY_UNION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  _RBT_SET_PARALLEL(
+    a, b,
+    _RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B | _RBT_SET_PARALLEL_BOTH,
+    NULL, threads
+  );
+}
+
+/*!
+  Create the union of sets `a` and `b` with multiple threads.
+
+  This is equivalent to `RBT_SET_UNION()`. Neither set is changed.
+
+  @param[in]
+  a The first set.
+
+  @param[in]
+  b The second set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  The set containing the union, or NULL on error (check errno).
+*/
+RBT_NODE_T *
+RBT_SET_PARALLEL_UNION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  return _RBT_SET_PARALLEL_NEW(
+    a, b,
+    _RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B | _RBT_SET_PARALLEL_BOTH,
+    threads
+  );
+}
+
+/*!
+  Remove all elements of `b` from `a` with multiple threads.
+
+  This is equivalent to `RBT_SET_MODIFY_DIFFERENCE()`. `b` is not changed.
+  Neither set may be modified by other threads during the operation.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  a The set from which to remove elements of the other set.
+
+  @param[in]
+  b The other set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+*/
+void
+RBT_SET_PARALLEL_MODIFY_DIFFERENCE(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  _RBT_SET_PARALLEL(a, b, _RBT_SET_PARALLEL_ONLY_A, NULL, threads);
+}
+
+/*!
+  Create a set that contains all items in set `a` that are not in set `b` with
+  multiple threads.
+
+  This is equivalent to `RBT_SET_DIFFERENCE()`. Neither set is changed.
+
+  @param[in]
+  a The main set.
+
+  @param[in]
+  b The set to remove.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  The resulting set, or NULL on error (check errno).
+*/
+RBT_NODE_T *
+RBT_SET_PARALLEL_DIFFERENCE(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  return _RBT_SET_PARALLEL_NEW(a, b, _RBT_SET_PARALLEL_ONLY_A, threads);
+}
+
+/*!
+  Modify `a` in place to be the result of an intersection with `b` with
+  multiple threads.
+
+  This is equivalent to `RBT_SET_MODIFY_INTERSECTION()`. `b` is not changed.
+  Neither set may be modified by other threads during the operation.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  a The set to hold the intersection of itself and another set.
+
+  @param[in]
+  b The other set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+*/
+void
+RBT_SET_PARALLEL_MODIFY_INTERSECTION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  _RBT_SET_PARALLEL(a, b, _RBT_SET_PARALLEL_BOTH, NULL, threads);
+}
+
+/*!
+  Create the intersection of sets `a` and `b` with multiple threads.
+
+  This is equivalent to `RBT_SET_INTERSECTION()`. Neither set is changed.
+
+  @param[in]
+  a The first set.
+
+  @param[in]
+  b The second set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  The set of the intersection, or NULL on error (check errno).
+*/
+RBT_NODE_T *
+RBT_SET_PARALLEL_INTERSECTION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  return _RBT_SET_PARALLEL_NEW(a, b, _RBT_SET_PARALLEL_BOTH, threads);
+}
+
+/*!
+  Update `a` in place to be the result of an exclusive disjunction (xor) with
+  `b` with multiple threads.
+
+  This is equivalent to `RBT_SET_MODIFY_EXCLUSIVE_DISJUNCTION()`. `b` is not
+  changed. Neither set may be modified by other threads during the operation.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  a The set to hold the exclusive disjunction of itself and another set.
+
+  @param[in]
+  b The other set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+*/
+void
+RBT_SET_PARALLEL_MODIFY_EXCLUSIVE_DISJUNCTION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  _RBT_SET_PARALLEL(
+    a, b, _RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B, NULL, threads
+  );
+}
+
+/*!
+  Create the exclusive disjunction of sets `a` and `b` with multiple threads.
+
+  This is equivalent to `RBT_SET_EXCLUSIVE_DISJUNCTION()`. Neither set is
+  changed.
+
+  @param[in]
+  a The first set.
+
+  @param[in]
+  b The second set.
+
+  @param[in]
+  threads The number of threads, or 0 for one per online processor.
+
+  @return
+  The set of the exclusive disjunction, or NULL on error (check errno).
+*/
+RBT_NODE_T *
+RBT_SET_PARALLEL_EXCLUSIVE_DISJUNCTION(RBT_NODE_T * a, RBT_NODE_T * b, unsigned int threads)
+{
+  return _RBT_SET_PARALLEL_NEW(
+    a, b, _RBT_SET_PARALLEL_ONLY_A | _RBT_SET_PARALLEL_ONLY_B, threads
+  );
+}
+
+#endif //RBT_SET_PARALLEL
@@ -0,0 +1,845 @@
+/*!
+  @file
+  @author Xyne
+  @copyright GPL2 only
+
+  # Overview
+  Multi-bit stride tries with the query interface of node.h.
+
+  Rabbit tree nodes branch on a single key bit. Sparse regions of the key space
+  are compressed into long key fragments, but dense regions such as sequential
+  integers still require one node per bit of the key that varies, i.e. up to 32
+  dependent pointer hops for 32-bit keys.
+
+  The nodes in this header consume `RBT_STRIDE_BITS` key bits at a time instead.
+  Each node has one child slot per value of the next `RBT_STRIDE_BITS` bits and
+  one value slot per key that ends within those bits. Only occupied slots are
+  allocated: each node keeps two bitmaps of the occupied slots and the rank of a
+  slot in its bitmap, counted with `RBT_POPCOUNT64()`, is its index in the
+  compressed array of children or values.
+
+  The depth of a tree is thus limited to the number of key bits divided by
+  `RBT_STRIDE_BITS`, e.g. 8 hops for 32-bit keys with a 4-bit stride. There is
+  no path compression, so sparse keys use more memory than rabbit trees.
+
+  Keys are the same arrays of pins with the same number of significant bits as
+  for `RBT_NODE_QUERY()`, and keys of different lengths are distinct.
+
+  # Required Headers
+
+  - key.h
+
+  # Required Macro Definitions:
+
+  - RBT_STRIDE_H_PREFIX_
+
+    The prefix for visible variable and function declarations in this header.
+
+  - RBT_VALUE_T, RBT_VALUE_NULL, RBT_VALUE_IS_EQUAL(a, b),
+    RBT_VALUE_COPY(a, b, fail) and RBT_VALUE_FREE(val)
+
+    The same as for node.h.
+
+  # Optional Macro Definitions
+
+  - RBT_STRIDE_BITS
+
+    The number of key bits consumed by each node: 1, 2, 4 or 8. The default is
+    4, which gives 16-way nodes. 8-bit strides give 256-way nodes and shallower
+    trees at the cost of larger nodes.
+
+  # Example
+
+      #define RBT_STRIDE_H_PREFIX_ wd_
+      #define RBT_STRIDE_BITS 8
+      #include <rbt/stride.h>
+
+      wd_stride_t * tree;
+      int wd;
+
+      tree = wd_stride_new();
+      wd_stride_query(
+        tree, (wd_pin_t *) &wd, sizeof(wd) * BITS_PER_BYTE,
+        RBT_QUERY_ACTION_INSERT, value
+      );
+      wd_stride_free(tree);
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#ifdef ONLY_FOR_DOXYGEN
+#include "key.h"
+#endif //ONLY_FOR_DOXYGEN
+
+/*!
+  @cond INTERNAL
+*/
+
+#ifndef RBT_STRIDE_H_PREFIX_
+#error RBT_STRIDE_H_PREFIX_ is not defined.
+#endif // RBT_STRIDE_H_PREFIX_
+
+#ifndef RBT_VALUE_T
+#error RBT_VALUE_T is not defined.
+#endif // RBT_VALUE_T
+
+#ifndef RBT_VALUE_NULL
+#error RBT_VALUE_NULL is not defined.
+#endif // RBT_VALUE_NULL
+
+#ifndef RBT_VALUE_IS_EQUAL
+#error RBT_VALUE_IS_EQUAL is not defined.
+#endif // RBT_VALUE_IS_EQUAL
+
+#ifndef RBT_VALUE_COPY
+#error RBT_VALUE_COPY is not defined.
+#endif // RBT_VALUE_COPY
+
+#ifndef RBT_VALUE_FREE
+#error RBT_VALUE_FREE is not defined.
+#endif // RBT_VALUE_FREE
+
+#ifndef RBT_STRIDE_BITS
+#define RBT_STRIDE_BITS 4
+#endif // RBT_STRIDE_BITS
+
+#if RBT_STRIDE_BITS != 1 && RBT_STRIDE_BITS != 2 && RBT_STRIDE_BITS != 4 && RBT_STRIDE_BITS != 8
+#error RBT_STRIDE_BITS must be 1, 2, 4 or 8.
+#endif // RBT_STRIDE_BITS
+
+
+#undef RBT_STRIDE_COUNT
+#define RBT_STRIDE_COUNT             RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_count)
+
+#undef RBT_STRIDE_FREE
+#define RBT_STRIDE_FREE              RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_free)
+
+#undef RBT_STRIDE_NEW
+#define RBT_STRIDE_NEW               RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_new)
+
+#undef RBT_STRIDE_QUERY
+#define RBT_STRIDE_QUERY             RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_query)
+
+#undef RBT_STRIDE_T
+#define RBT_STRIDE_T                 RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_t)
+
+#undef _RBT_STRIDE_ARRAY_INSERT
+#define _RBT_STRIDE_ARRAY_INSERT     _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_array_insert)
+
+#undef _RBT_STRIDE_ARRAY_REMOVE
+#define _RBT_STRIDE_ARRAY_REMOVE     _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_array_remove)
+
+#undef _RBT_STRIDE_DESCEND
+#define _RBT_STRIDE_DESCEND          _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_descend)
+
+#undef _RBT_STRIDE_RANK
+#define _RBT_STRIDE_RANK             _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_rank)
+
+#undef _RBT_STRIDE_REMOVE
+#define _RBT_STRIDE_REMOVE           _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_remove)
+
+#undef _RBT_STRIDE_SLOT
+#define _RBT_STRIDE_SLOT             _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_slot)
+
+#undef _RBT_STRIDE_UNSLOT
+#define _RBT_STRIDE_UNSLOT           _RBT_TOKEN_2_W(RBT_STRIDE_H_PREFIX_, stride_unslot)
+
+/*!
+  @brief
+  The number of child slots per node.
+*/
+#undef _RBT_STRIDE_SLOTS
+#define _RBT_STRIDE_SLOTS (1U << RBT_STRIDE_BITS)
+
+/*!
+  @brief
+  The number of 64-bit words in a bitmap of the slots.
+*/
+#undef _RBT_STRIDE_WORDS
+#define _RBT_STRIDE_WORDS ((_RBT_STRIDE_SLOTS + 63) / 64)
+
+/*!
+  @brief
+  Check if a slot is set in a bitmap.
+*/
+#undef _RBT_STRIDE_TEST
+#define _RBT_STRIDE_TEST(bitmap, i) (((bitmap)[(i) / 64] >> ((i) % 64)) & 1)
+
+/*!
+  @brief
+  Set a slot in a bitmap.
+*/
+#undef _RBT_STRIDE_SET
+#define _RBT_STRIDE_SET(bitmap, i) ((bitmap)[(i) / 64] |= UINT64_C(1) << ((i) % 64))
+
+/*!
+  @brief
+  Clear a slot in a bitmap.
+*/
+#undef _RBT_STRIDE_CLEAR
+#define _RBT_STRIDE_CLEAR(bitmap, i) ((bitmap)[(i) / 64] &= ~(UINT64_C(1) << ((i) % 64)))
+
+/*!
+  @brief
+  The `RBT_STRIDE_BITS` key bits starting at a given offset. The offset must be
+  a multiple of `RBT_STRIDE_BITS`, so the bits never span two pins.
+*/
+#undef _RBT_STRIDE_CHUNK
+#define _RBT_STRIDE_CHUNK(key, offset) \
+  ( \
+    (unsigned int) ( \
+      (key)[(offset) / RBT_PIN_SIZE_BITS] >> \
+      (RBT_PIN_SIZE_BITS - RBT_STRIDE_BITS - (offset) % RBT_PIN_SIZE_BITS) \
+    ) & (_RBT_STRIDE_SLOTS - 1) \
+  )
+
+/*!
+  @endcond
+*/
+
+
+///////////////////////////////////// Node /////////////////////////////////////
+
+/*!
+  @brief
+  Stride trie node.
+
+  The value slot of a key that ends `r` bits into the node, with `r` less than
+  `RBT_STRIDE_BITS`, and whose last `r` bits are `p` is `2^r - 1 + p`, so each
+  node has `2^RBT_STRIDE_BITS - 1` value slots. Keys with `RBT_STRIDE_BITS` or
+  more remaining bits continue in the child of the next `RBT_STRIDE_BITS` bits.
+*/
+typedef
+struct RBT_STRIDE_T
+{
+  /*!
+    @brief
+    The occupied value slots.
+  */
+  uint64_t internal[_RBT_STRIDE_WORDS];
+
+  /*!
+    @brief
+    The occupied child slots.
+  */
+  uint64_t external[_RBT_STRIDE_WORDS];
+
+  /*!
+    @brief
+    The values of the occupied value slots, in slot order.
+  */
+  RBT_VALUE_T * values;
+
+  /*!
+    @brief
+    The children of the occupied child slots, in slot order.
+  */
+  struct RBT_STRIDE_T * * children;
+}
+RBT_STRIDE_T;
+
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Count the set slots of a bitmap that precede a given slot.
+
+  @param[in]
+  bitmap The bitmap.
+
+  @param[in]
+  i The slot. It may be equal to the number of slots to count all set slots.
+
+  @return
+  The number of set slots before the slot, i.e. its index in the compressed
+  array.
+*/
+static inline unsigned int
+_RBT_STRIDE_RANK(const uint64_t * bitmap, unsigned int i)
+{
+  unsigned int n, w;
+
+  n = 0;
+  for (w=0; w<i/64; w++)
+  {
+    n += RBT_POPCOUNT64(bitmap[w]);
+  }
+  if (i % 64)
+  {
+    n += RBT_POPCOUNT64(bitmap[w] & ((UINT64_C(1) << (i % 64)) - 1));
+  }
+  return n;
+}
+
+
+
+/*!
+  @brief
+  Make room for an element in a compressed array.
+
+  @param[in,out]
+  array A pointer to the array.
+
+  @param[in]
+  size The size of an element.
+
+  @param[in]
+  n The current number of elements.
+
+  @param[in]
+  i The index of the new element.
+
+  @return
+  0 on success, otherwise -1 and `errno` is set.
+*/
+static int
+_RBT_STRIDE_ARRAY_INSERT(void * array, size_t size, unsigned int n, unsigned int i)
+{
+  BYTE_T * elements;
+
+  elements = realloc(* (void * *) array, (n + 1) * size);
+  if (elements == NULL)
+  {
+    return -1;
+  }
+  memmove(elements + (i + 1) * size, elements + i * size, (n - i) * size);
+  * (void * *) array = elements;
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Remove an element from a compressed array.
+
+  @param[in,out]
+  array A pointer to the array.
+
+  @param[in]
+  size The size of an element.
+
+  @param[in]
+  n The current number of elements.
+
+  @param[in]
+  i The index of the element.
+*/
+static void
+_RBT_STRIDE_ARRAY_REMOVE(void * array, size_t size, unsigned int n, unsigned int i)
+{
+  BYTE_T * elements;
+
+  elements = * (void * *) array;
+  if (n == 1)
+  {
+    free(elements);
+    * (void * *) array = NULL;
+    return;
+  }
+  memmove(elements + i * size, elements + (i + 1) * size, (n - i - 1) * size);
+  /*
+    The array is only shrunk if the allocator allows it.
+  */
+  elements = realloc(elements, (n - 1) * size);
+  if (elements != NULL)
+  {
+    * (void * *) array = elements;
+  }
+}
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Create a new tree.
+
+  @return
+  The root node, or NULL if it could not be allocated.
+*/
+RBT_STRIDE_T *
+RBT_STRIDE_NEW()
+{
+  return calloc(1, sizeof(RBT_STRIDE_T));
+}
+
+
+
+/*!
+  @brief
+  Free a node, its values and all its descendents.
+
+  @param[in]
+  node The node.
+*/
+void
+RBT_STRIDE_FREE(
+  RBT_STRIDE_T * node
+)
+{
+  unsigned int i, n;
+
+  if (node == NULL)
+  {
+    return;
+  }
+  n = _RBT_STRIDE_RANK(node->internal, _RBT_STRIDE_SLOTS - 1);
+  for (i=0; i<n; i++)
+  {
+    RBT_VALUE_FREE(node->values[i]);
+  }
+  n = _RBT_STRIDE_RANK(node->external, _RBT_STRIDE_SLOTS);
+  for (i=0; i<n; i++)
+  {
+    RBT_STRIDE_FREE(node->children[i]);
+  }
+  free(node->values);
+  free(node->children);
+  free(node);
+  errno = 0;
+}
+
+
+
+/*!
+  @brief
+  Count the number of values in a tree.
+
+  @param[in]
+  node The root node.
+*/
+size_t
+RBT_STRIDE_COUNT(
+  RBT_STRIDE_T * node
+)
+{
+  unsigned int i, n;
+  size_t count;
+
+  if (node == NULL)
+  {
+    return 0;
+  }
+  count = _RBT_STRIDE_RANK(node->internal, _RBT_STRIDE_SLOTS - 1);
+  n = _RBT_STRIDE_RANK(node->external, _RBT_STRIDE_SLOTS);
+  for (i=0; i<n; i++)
+  {
+    count += RBT_STRIDE_COUNT(node->children[i]);
+  }
+  return count;
+}
+
+
+
+//////////////////////////////////// Query /////////////////////////////////////
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Find the node in which a key ends.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[in]
+  create If non-zero, missing nodes are created.
+
+  @param[out]
+  slot The value slot of the key in the returned node.
+
+  @return
+  The node, or NULL if it does not exist or could not be created. `errno` is
+  set in the latter case.
+*/
+static inline RBT_STRIDE_T *
+_RBT_STRIDE_DESCEND(
+  RBT_STRIDE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  int create,
+  unsigned int * slot
+)
+{
+  RBT_STRIDE_T * child;
+  RBT_KEY_SIZE_T offset, remaining;
+  unsigned int chunk, i;
+
+  offset = 0;
+  remaining = bits;
+  while (remaining >= RBT_STRIDE_BITS)
+  {
+    chunk = _RBT_STRIDE_CHUNK(key, offset);
+    i = _RBT_STRIDE_RANK(node->external, chunk);
+    if (_RBT_STRIDE_TEST(node->external, chunk))
+    {
+      node = node->children[i];
+    }
+    else if (! create)
+    {
+      return NULL;
+    }
+    else
+    {
+      child = RBT_STRIDE_NEW();
+      if (
+        child == NULL ||
+        _RBT_STRIDE_ARRAY_INSERT(
+          &node->children, sizeof(RBT_STRIDE_T *),
+          _RBT_STRIDE_RANK(node->external, _RBT_STRIDE_SLOTS), i
+        )
+      )
+      {
+        free(child);
+        errno = ENOMEM;
+        return NULL;
+      }
+      node->children[i] = child;
+      _RBT_STRIDE_SET(node->external, chunk);
+      node = child;
+    }
+    offset += RBT_STRIDE_BITS;
+    remaining -= RBT_STRIDE_BITS;
+  }
+  if (remaining)
+  {
+    * slot = (1U << remaining) - 1 + (_RBT_STRIDE_CHUNK(key, offset) >> (RBT_STRIDE_BITS - remaining));
+  }
+  else
+  {
+    * slot = 0;
+  }
+  return node;
+}
+
+
+
+/*!
+  @brief
+  Get the value of a slot, occupying it with the null value if necessary.
+
+  @param[in]
+  node The node.
+
+  @param[in]
+  slot The value slot.
+
+  @param[out]
+  created Set to non-zero if the slot was not occupied.
+
+  @return
+  A pointer to the value, or NULL if it could not be allocated.
+*/
+static RBT_VALUE_T *
+_RBT_STRIDE_SLOT(
+  RBT_STRIDE_T * node,
+  unsigned int slot,
+  int * created
+)
+{
+  unsigned int i;
+
+  i = _RBT_STRIDE_RANK(node->internal, slot);
+  * created = ! _RBT_STRIDE_TEST(node->internal, slot);
+  if (* created)
+  {
+    if (
+      _RBT_STRIDE_ARRAY_INSERT(
+        &node->values, sizeof(RBT_VALUE_T),
+        _RBT_STRIDE_RANK(node->internal, _RBT_STRIDE_SLOTS - 1), i
+      )
+    )
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+    node->values[i] = RBT_VALUE_NULL;
+    _RBT_STRIDE_SET(node->internal, slot);
+  }
+  return node->values + i;
+}
+
+
+
+/*!
+  @brief
+  Release an occupied value slot without freeing its value.
+
+  @param[in]
+  node The node.
+
+  @param[in]
+  slot The value slot.
+*/
+static void
+_RBT_STRIDE_UNSLOT(
+  RBT_STRIDE_T * node,
+  unsigned int slot
+)
+{
+  _RBT_STRIDE_ARRAY_REMOVE(
+    &node->values, sizeof(RBT_VALUE_T),
+    _RBT_STRIDE_RANK(node->internal, _RBT_STRIDE_SLOTS - 1),
+    _RBT_STRIDE_RANK(node->internal, slot)
+  );
+  _RBT_STRIDE_CLEAR(node->internal, slot);
+}
+
+
+
+/*!
+  @brief
+  Remove a key from a tree along with any nodes that become empty.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key.
+
+  @param[in]
+  free_value If non-zero, free the removed value, otherwise return it.
+
+  @return
+  The removed value if it is not freed, otherwise `RBT_VALUE_NULL`.
+*/
+static RBT_VALUE_T
+_RBT_STRIDE_REMOVE(
+  RBT_STRIDE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  int free_value
+)
+{
+  RBT_STRIDE_T * cut, * child;
+  RBT_KEY_SIZE_T offset, remaining;
+  RBT_VALUE_T value;
+  unsigned int chunk, cut_chunk, slot, i, n;
+
+  /*
+    Track the deepest node on the path that must be kept if the target node
+    becomes empty: the root and any node with a value or another child. All
+    nodes below it on the path can then be removed together.
+  */
+  cut = NULL;
+  cut_chunk = 0;
+  offset = 0;
+  remaining = bits;
+  while (remaining >= RBT_STRIDE_BITS)
+  {
+    chunk = _RBT_STRIDE_CHUNK(key, offset);
+    if (! _RBT_STRIDE_TEST(node->external, chunk))
+    {
+      return RBT_VALUE_NULL;
+    }
+    n = _RBT_STRIDE_RANK(node->external, _RBT_STRIDE_SLOTS);
+    if (cut == NULL || n > 1 || _RBT_STRIDE_RANK(node->internal, _RBT_STRIDE_SLOTS - 1))
+    {
+      cut = node;
+      cut_chunk = chunk;
+    }
+    node = node->children[_RBT_STRIDE_RANK(node->external, chunk)];
+    offset += RBT_STRIDE_BITS;
+    remaining -= RBT_STRIDE_BITS;
+  }
+  if (remaining)
+  {
+    slot = (1U << remaining) - 1 + (_RBT_STRIDE_CHUNK(key, offset) >> (RBT_STRIDE_BITS - remaining));
+  }
+  else
+  {
+    slot = 0;
+  }
+  if (! _RBT_STRIDE_TEST(node->internal, slot))
+  {
+    return RBT_VALUE_NULL;
+  }
+
+  value = node->values[_RBT_STRIDE_RANK(node->internal, slot)];
+  _RBT_STRIDE_UNSLOT(node, slot);
+  if (free_value)
+  {
+    RBT_VALUE_FREE(value);
+    value = RBT_VALUE_NULL;
+  }
+
+  if (
+    cut != NULL &&
+    node->values == NULL &&
+    node->children == NULL
+  )
+  {
+    i = _RBT_STRIDE_RANK(cut->external, cut_chunk);
+    child = cut->children[i];
+    _RBT_STRIDE_ARRAY_REMOVE(
+      &cut->children, sizeof(RBT_STRIDE_T *),
+      _RBT_STRIDE_RANK(cut->external, _RBT_STRIDE_SLOTS), i
+    );
+    _RBT_STRIDE_CLEAR(cut->external, cut_chunk);
+    RBT_STRIDE_FREE(child);
+  }
+  return value;
+}
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Query a tree.
+
+  This accepts the same arguments and actions as `RBT_NODE_QUERY()` and returns
+  the same values.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  key The key.
+
+  @param[in]
+  bits The number of significant bits in the key. Bits beyond these will
+  be ignored.
+
+  @param[in]
+  action The action that should be performed.
+
+  @param[in]
+  value The value with which the action will be performed.
+
+  @return
+  The value determined by the action.
+*/
+RBT_VALUE_T
+RBT_STRIDE_QUERY(
+  RBT_STRIDE_T * node,
+  RBT_PIN_T * key,
+  RBT_KEY_SIZE_T bits,
+  rbt_query_action_t action,
+  RBT_VALUE_T value
+)
+{
+  RBT_STRIDE_T * target;
+  RBT_VALUE_T * target_value;
+  RBT_VALUE_T old_value;
+  unsigned int slot;
+  int created, failed;
+
+  errno = 0;
+
+  /*
+    Inserting an empty value is effectively a deletion.
+  */
+  if (RBT_VALUE_IS_EQUAL(value, RBT_VALUE_NULL))
+  {
+    switch (action)
+    {
+      case RBT_QUERY_ACTION_INSERT:
+        action = RBT_QUERY_ACTION_DELETE;
+        break;
+
+      case RBT_QUERY_ACTION_RETRIEVE_AND_INSERT:
+      case RBT_QUERY_ACTION_SWAP:
+        return _RBT_STRIDE_REMOVE(node, key, bits, 0);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  switch (action)
+  {
+    case RBT_QUERY_ACTION_DELETE:
+      return _RBT_STRIDE_REMOVE(node, key, bits, 1);
+      break;
+
+
+
+    case RBT_QUERY_ACTION_RETRIEVE:
+      target = _RBT_STRIDE_DESCEND(node, key, bits, 0, &slot);
+      if (target == NULL || ! _RBT_STRIDE_TEST(target->internal, slot))
+      {
+        return RBT_VALUE_NULL;
+      }
+      return target->values[_RBT_STRIDE_RANK(target->internal, slot)];
+      break;
+
+
+
+    case RBT_QUERY_ACTION_INSERT:
+    case RBT_QUERY_ACTION_RETRIEVE_AND_INSERT:
+    case RBT_QUERY_ACTION_SWAP:
+      target = _RBT_STRIDE_DESCEND(node, key, bits, 1, &slot);
+      if (target == NULL)
+      {
+        return RBT_VALUE_NULL;
+      }
+      target_value = _RBT_STRIDE_SLOT(target, slot, &created);
+      if (target_value == NULL)
+      {
+        return RBT_VALUE_NULL;
+      }
+      if (action == RBT_QUERY_ACTION_SWAP)
+      {
+        old_value = * target_value;
+        * target_value = value;
+        return old_value;
+      }
+      failed = 0;
+      if (action == RBT_QUERY_ACTION_INSERT)
+      {
+        RBT_VALUE_COPY((* target_value), value, failed = 1);
+        old_value = value;
+      }
+      else
+      {
+        old_value = * target_value;
+        * target_value = RBT_VALUE_NULL;
+        RBT_VALUE_COPY((* target_value), value, (* target_value) = old_value; failed = 1);
+      }
+      if (failed)
+      {
+        if (created)
+        {
+          _RBT_STRIDE_UNSLOT(target, slot);
+        }
+        return (action == RBT_QUERY_ACTION_INSERT) ? RBT_VALUE_NULL : value;
+      }
+      return old_value;
+      break;
+  }
+  /*
+    This should be unreachable.
+  */
+  return RBT_VALUE_NULL;
+}
@@ -21,6 +21,32 @@
   In the latter case no further definitions are required before including this
   file and it can be included immediately after each inclusion of node.h.
 
+  # Iterators
+
+  The traversal functions pass each node to a callback along with a `va_list`.
+  The callback cannot be inlined and must extract its arguments again for each
+  node. For tight loops, the same traversal is also available as an iterator
+  that keeps its state in a struct on the caller's stack:
+
+      RBT_NODE_ITERATOR_T iterator;
+      RBT_KEY_DATA_T * key_data;
+
+      for (
+        key_data = RBT_NODE_ITERATOR_BEGIN(&iterator, node, 0);
+        key_data != NULL;
+        key_data = RBT_NODE_ITERATOR_NEXT(&iterator)
+      )
+      {
+        ...
+      }
+      if (RBT_NODE_ITERATOR_END(&iterator))
+      {
+        ...
+      }
+
+  The nodes are visited in the same order as by `RBT_NODE_TRAVERSE_WITH_KEY()`.
+  The tree must not be modified until the iterator is ended.
+
   # Required Headers
 
   - node.h
@@ -57,6 +83,21 @@
 #undef RBT_NODE_FILTER_WITH_KEY
 #define RBT_NODE_FILTER_WITH_KEY RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_filter_with_key)
 
+#undef RBT_NODE_ITERATOR_T
+#define RBT_NODE_ITERATOR_T RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_iterator_t)
+
+#undef RBT_NODE_ITERATOR_BEGIN
+#define RBT_NODE_ITERATOR_BEGIN RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_iterator_begin)
+
+#undef RBT_NODE_ITERATOR_NEXT
+#define RBT_NODE_ITERATOR_NEXT RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_iterator_next)
+
+#undef RBT_NODE_ITERATOR_END
+#define RBT_NODE_ITERATOR_END RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_iterator_end)
+
+#undef _RBT_NODE_ITERATOR_VISIT
+#define _RBT_NODE_ITERATOR_VISIT _RBT_TOKEN_2_W(RBT_TRAVERSE_H_PREFIX_, node_iterator_visit)
+
 /*!
   @endcond
 */
@@ -143,7 +184,11 @@ RBT_NODE_TRAVERSE_WITH_KEY(
 {
   int rc;
   _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack, * stack_tmp, * stack_unused;
-  RBT_KEY_SIZE_T size, pins, bytes, tmp, height;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T)
+  RBT_KEY_SIZE_T pins, bytes, height;
+#ifndef RBT_KEY_SIZE_FIXED
+  RBT_KEY_SIZE_T size, tmp;
+#endif //RBT_KEY_SIZE_FIXED
   RBT_KEY_DATA_T key_data;
 
   va_list func_args;
@@ -169,7 +214,6 @@ RBT_NODE_TRAVERSE_WITH_KEY(
 #ifdef RBT_KEY_SIZE_FIXED
     RBT_PIN_T key[RBT_KEY_SIZE_FIXED/RBT_PIN_SIZE];
     key_data.key = (RBT_PIN_T *) key;
-    size = RBT_KEY_SIZE_FIXED;
 #else
     key_data.key = NULL;
     size = 0;
@@ -184,8 +228,8 @@ RBT_NODE_TRAVERSE_WITH_KEY(
     {
       bytes += RBT_PIN_SIZE;
     }
-    tmp = key_data.bytes + bytes;
 #ifndef RBT_KEY_SIZE_FIXED
+    tmp = key_data.bytes + bytes;
     if (tmp > size)
     {
       RBT_RESIZE_TO_FIT_KEY(size, tmp, errno = EOVERFLOW; break);
@@ -203,7 +247,7 @@ RBT_NODE_TRAVERSE_WITH_KEY(
     {
       key_data.bytes -= RBT_PIN_SIZE;
     }
-    key_data.bits += (key_data.bytes * RBT_PIN_SIZE_BITS);
+    key_data.bits += (key_data.bytes * BITS_PER_BYTE);
 //////////////////////////// END OF COMMON SECTION /////////////////////////////
 
     va_start(func_args, func_v);
@@ -332,8 +376,13 @@ RBT_NODE_FILTER_WITH_KEY(
   int rc, unwanted, is_left, placeholder;
   RBT_NODE_T * tmp_node, * sibling_node;
   RBT_NODE_STACK_T * parent_stack, * parent_stack_tmp, * parent_stack_unused;
-  RBT_KEY_SIZE_T size, pins, bytes, tmp;
+  _RBT_NODE_STACK_DECLARE(parent_stack, RBT_NODE_STACK_T)
+  RBT_KEY_SIZE_T pins, bytes, prefix_bytes, parent_prefix_bytes;
+#ifndef RBT_KEY_SIZE_FIXED
+  RBT_KEY_SIZE_T size, tmp;
+#endif //RBT_KEY_SIZE_FIXED
   _RBT_NODE_FILTER_WITH_KEY_STACK_T * stack, * stack_tmp, * stack_unused;
+  _RBT_NODE_STACK_DECLARE(stack, _RBT_NODE_FILTER_WITH_KEY_STACK_T)
   RBT_KEY_DATA_T key_data;
   va_list func_args;
 
@@ -359,7 +408,6 @@ RBT_NODE_FILTER_WITH_KEY(
 #ifdef RBT_KEY_SIZE_FIXED
     RBT_PIN_T key[RBT_KEY_SIZE_FIXED/RBT_PIN_SIZE];
     key_data.key = (RBT_PIN_T *) key;
-    size = RBT_KEY_SIZE_FIXED;
 #else
     key_data.key = NULL;
     size = 0;
@@ -374,8 +422,8 @@ RBT_NODE_FILTER_WITH_KEY(
     {
       bytes += RBT_PIN_SIZE;
     }
-    tmp = key_data.bytes + bytes;
 #ifndef RBT_KEY_SIZE_FIXED
+    tmp = key_data.bytes + bytes;
     if (tmp > size)
     {
       RBT_RESIZE_TO_FIT_KEY(size, tmp, errno = EOVERFLOW; break);
@@ -393,8 +441,9 @@ RBT_NODE_FILTER_WITH_KEY(
     {
       key_data.bytes -= RBT_PIN_SIZE;
     }
-    key_data.bits += (key_data.bytes * RBT_PIN_SIZE_BITS);
+    key_data.bits += (key_data.bytes * BITS_PER_BYTE);
 //////////////////////////// END OF COMMON SECTION /////////////////////////////
+    prefix_bytes = key_data.bytes - pins * RBT_PIN_SIZE;
 
     if (node != NULL)
     {
@@ -439,6 +488,11 @@ RBT_NODE_FILTER_WITH_KEY(
             {
               sibling_node = parent_stack->node->left;
             }
+            /*
+              The key of the parent changes if the sibling is merged into it,
+              so its prefix is determined beforehand.
+            */
+            parent_prefix_bytes = prefix_bytes - (parent_stack->node->bits / RBT_PIN_SIZE_BITS) * RBT_PIN_SIZE;
             tmp_node = RBT_NODE_REMOVE(node, parent_stack->node);
             if (errno)
             {
@@ -447,86 +501,68 @@ RBT_NODE_FILTER_WITH_KEY(
             }
             /*
               If the node has been completely removed then the sibling may have
-              been merged into the parent. Go back to the parent in that case.
+              been merged into the parent. If the node was the left child then
+              the sibling has not been filtered yet, so go back to the parent
+              to filter the merged node. The sibling's entry on the stack is no
+              longer valid in that case.
             */
             if (tmp_node != node)
             {
-              if (is_left)
+              if (
+                is_left &&
+                sibling_node != NULL &&
+                parent_stack->node->right != sibling_node
+              )
               {
-                /*
-                  Jump directly to the sibling node if it has not changed.
-                */
-                if (parent_stack->node->right == sibling_node)
-                {
-                  node = sibling_node;
-                  key_data.bytes -= bytes;
-                }
-                /*
-                  Otherwise jump to the parent.
-                */
-                else
+                node = parent_stack->node;
+                _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
+                if (stack != NULL && stack->node == sibling_node)
                 {
-                  node = parent_stack->node;
-                  _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
-                  if (stack != NULL && stack->parent_stack->node == node)
-                  {
-                    _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-                  }
-                  if (stack != NULL)
-                  {
-                    key_data.bytes = stack->bytes_in_key_prefix;
-                  }
-                  else
-                  {
-                    // TODO: break instead?
-                    key_data.bytes = 0;
-                  }
+                  _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
                 }
+                key_data.bytes = parent_prefix_bytes;
+                continue;
               }
               /*
-                If the node was the right child, then jump back to the last
-                right child.
+                Otherwise continue with the last right child, which is the
+                sibling if it remains and has not been filtered yet.
               */
-              else
-              {
-                if (stack != NULL)
-                {
-                  node = stack->node;
-                  key_data.bytes = stack->bytes_in_key_prefix;
-                  while (parent_stack != NULL && parent_stack != stack->parent_stack)
-                  {
-                    _RBT_NODE_STACK_POP(parent_stack, parent_stack_tmp, parent_stack_unused);
-                  }
-                  _RBT_NODE_STACK_POP(stack, stack_tmp, stack_unused);
-                }
-                else
-                {
-                  break;
-                }
-              }
-              continue;
+              node = NULL;
             }
             /*
               If the node remains, it is either a placeholder or it has been
               merged with a child. In the latter case, continue to filter the
               new value of the node.
             */
-            if (! placeholder)
+            else if (! placeholder)
             {
+              key_data.bytes = prefix_bytes;
               continue;
             }
           }
           else
           {
+            /*
+              A root with a single child is merged with it.
+            */
+            placeholder = (node->left == NULL) == (node->right == NULL);
             RBT_NODE_REMOVE(node, NULL);
             if (errno)
             {
               rc = errno;
               break;
             }
+            if (! placeholder)
+            {
+              key_data.bytes = prefix_bytes;
+              continue;
+            }
           }
         }
       }
+    }
+    if (node != NULL)
+    {
       if (node->left != NULL)
       {
         _RBT_NODE_STACK_ALLOCATE(parent_stack, parent_stack_tmp, parent_stack_unused, RBT_NODE_STACK_T);
@@ -575,3 +611,362 @@ RBT_NODE_FILTER_WITH_KEY(
   _RBT_NODE_STACK_FREE(stack, stack_tmp, stack_unused);
   errno = rc;
 }
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+/*!
+  @brief
+  Rabbit tree iterator.
+
+  The state of an iteration over a tree. It contains pointers to its own
+  members and must therefore not be copied.
+
+  @see RBT_NODE_ITERATOR_BEGIN()
+*/
+typedef
+struct RBT_NODE_ITERATOR_T
+{
+  /*!
+    @brief
+    The current node and its full associated key. The node is NULL when the
+    iteration is complete.
+  */
+  RBT_KEY_DATA_T key_data;
+
+  /*!
+    @brief
+    The height of the current node above the root node.
+  */
+  RBT_KEY_SIZE_T height;
+
+  /*!
+    @brief
+    If non-zero, empty nodes are also visited.
+  */
+  int include_empty;
+
+  /*!
+    @brief
+    The error that ended the iteration, or 0.
+  */
+  int error;
+
+  /*!
+    @brief
+    The right nodes that remain to be visited.
+  */
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack;
+
+  /*!
+    @brief
+    Previously allocated stack elements for reuse.
+  */
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack_unused;
+
+#ifdef RBT_KEY_SIZE_FIXED
+  /*!
+    @brief
+    The storage of the stack.
+  */
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T stack_array[_RBT_NODE_STACK_SIZE];
+
+  /*!
+    @brief
+    The storage of the key.
+  */
+  RBT_PIN_T key[RBT_KEY_SIZE_FIXED / RBT_PIN_SIZE];
+#else
+  /*!
+    @brief
+    The allocated size of the key, in bytes.
+  */
+  RBT_KEY_SIZE_T size;
+#endif //RBT_KEY_SIZE_FIXED
+}
+RBT_NODE_ITERATOR_T;
+
+
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  @brief
+  Make a node the current node of an iterator.
+
+  The node's key fragment is appended to the key prefix, which must already
+  have been reset to the prefix of the node.
+
+  @param[in,out]
+  iterator The iterator.
+
+  @param[in]
+  node The node.
+
+  @return
+  0, or an error code.
+*/
+static inline int
+_RBT_NODE_ITERATOR_VISIT(
+  RBT_NODE_ITERATOR_T * iterator,
+  RBT_NODE_T * node
+)
+{
+  RBT_KEY_SIZE_T pins, bits, bytes;
+#ifndef RBT_KEY_SIZE_FIXED
+  RBT_KEY_SIZE_T tmp;
+  RBT_PIN_T * key;
+#endif //RBT_KEY_SIZE_FIXED
+
+  iterator->key_data.node = node;
+  RBT_DIVMOD(node->bits, RBT_PIN_SIZE_BITS, pins, bits);
+  bytes = pins * RBT_PIN_SIZE;
+  if (bits)
+  {
+    bytes += RBT_PIN_SIZE;
+  }
+#ifndef RBT_KEY_SIZE_FIXED
+  tmp = iterator->key_data.bytes + bytes;
+  if (tmp > iterator->size)
+  {
+    RBT_RESIZE_TO_FIT_KEY(iterator->size, tmp, return EOVERFLOW);
+    key = realloc(iterator->key_data.key, iterator->size);
+    if (key == NULL)
+    {
+      return errno;
+    }
+    iterator->key_data.key = key;
+  }
+#endif //RBT_KEY_SIZE_FIXED
+  /*
+    The key of an empty root node may be NULL.
+  */
+  if (bytes)
+  {
+    memcpy(((uint8_t *) iterator->key_data.key) + iterator->key_data.bytes, node->key, bytes);
+    iterator->key_data.bytes += bytes;
+  }
+  if (bits)
+  {
+    iterator->key_data.bytes -= RBT_PIN_SIZE;
+  }
+  iterator->key_data.bits = iterator->key_data.bytes * BITS_PER_BYTE + bits;
+  return 0;
+}
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  @brief
+  Advance an iterator to the next node.
+
+  @param[in,out]
+  iterator The iterator.
+
+  @return
+  The next node and its full key, or NULL if there are no more nodes or an
+  error occurred. The returned data is overwritten by the next call.
+
+  @see RBT_NODE_ITERATOR_BEGIN()
+*/
+static inline RBT_KEY_DATA_T *
+RBT_NODE_ITERATOR_NEXT(
+  RBT_NODE_ITERATOR_T * iterator
+)
+{
+  int rc;
+  RBT_NODE_T * node;
+  RBT_KEY_SIZE_T height;
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack, * stack_tmp;
+#ifdef RBT_KEY_SIZE_FIXED
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack_array;
+#endif //RBT_KEY_SIZE_FIXED
+
+  node = iterator->key_data.node;
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  /*
+    Work on local copies so that they can be kept in registers.
+  */
+  height = iterator->height;
+  stack = iterator->stack;
+#ifdef RBT_KEY_SIZE_FIXED
+  stack_array = iterator->stack_array;
+#endif //RBT_KEY_SIZE_FIXED
+  rc = 0;
+  (void) stack_tmp;
+  do
+  {
+    if (node->left != NULL)
+    {
+      if (node->right != NULL)
+      {
+        _RBT_NODE_STACK_ALLOCATE(stack, stack_tmp, iterator->stack_unused, _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T);
+        if (rc)
+        {
+          break;
+        }
+        stack->node = node->right;
+        stack->height = height + 1;
+        stack->bytes_in_key_prefix = iterator->key_data.bytes;
+      }
+      node = node->left;
+      height ++;
+    }
+    else if (node->right != NULL)
+    {
+      node = node->right;
+      height ++;
+    }
+    else if (stack != NULL)
+    {
+      node = stack->node;
+      iterator->key_data.bytes = stack->bytes_in_key_prefix;
+      height = stack->height;
+      _RBT_NODE_STACK_POP(stack, stack_tmp, iterator->stack_unused);
+    }
+    else
+    {
+      node = NULL;
+      break;
+    }
+    rc = _RBT_NODE_ITERATOR_VISIT(iterator, node);
+    if (rc)
+    {
+      break;
+    }
+  }
+  while (! iterator->include_empty && RBT_VALUE_IS_NULL(node->value));
+
+  iterator->height = height;
+  iterator->stack = stack;
+  if (rc)
+  {
+    iterator->error = rc;
+    node = NULL;
+  }
+  if (node == NULL)
+  {
+    iterator->key_data.node = NULL;
+    return NULL;
+  }
+  return &iterator->key_data;
+}
+
+
+
+/*!
+  @brief
+  Begin iterating over a tree.
+
+  Iterators visit the same nodes in the same order as
+  `RBT_NODE_TRAVERSE_WITH_KEY()`, but they are advanced by the caller so that
+  the loop body can be inlined. Each iterator must be ended with
+  `RBT_NODE_ITERATOR_END()` once it has begun, even if the loop is left early.
+
+  @param[out]
+  iterator The iterator.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  include_empty If non-zero, also visit empty nodes.
+
+  @return
+  The first node and its full key, or NULL if there are no nodes or an error
+  occurred.
+
+  @see RBT_NODE_ITERATOR_NEXT() RBT_NODE_ITERATOR_END()
+*/
+static inline RBT_KEY_DATA_T *
+RBT_NODE_ITERATOR_BEGIN(
+  RBT_NODE_ITERATOR_T * iterator,
+  RBT_NODE_T * node,
+  int include_empty
+)
+{
+  int rc;
+
+  iterator->key_data.node = NULL;
+  iterator->key_data.bytes = 0;
+  iterator->height = 0;
+  iterator->include_empty = include_empty;
+  iterator->error = 0;
+  iterator->stack = NULL;
+  iterator->stack_unused = NULL;
+#ifdef RBT_KEY_SIZE_FIXED
+  iterator->key_data.key = iterator->key;
+#else
+  iterator->key_data.key = NULL;
+  iterator->size = 0;
+#endif //RBT_KEY_SIZE_FIXED
+
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  rc = _RBT_NODE_ITERATOR_VISIT(iterator, node);
+  if (rc)
+  {
+    iterator->error = rc;
+    iterator->key_data.node = NULL;
+    return NULL;
+  }
+  if (include_empty || ! RBT_VALUE_IS_NULL(node->value))
+  {
+    return &iterator->key_data;
+  }
+  return RBT_NODE_ITERATOR_NEXT(iterator);
+}
+
+
+
+/*!
+  @brief
+  End an iteration and free its resources.
+
+  @param[in,out]
+  iterator The iterator.
+
+  @return
+  The error that ended the iteration early, or 0. `errno` is also set to this
+  value.
+*/
+static inline int
+RBT_NODE_ITERATOR_END(
+  RBT_NODE_ITERATOR_T * iterator
+)
+{
+  _RBT_NODE_TRAVERSE_WITH_KEY_STACK_T * stack_tmp;
+
+  _RBT_NODE_STACK_FREE(iterator->stack, stack_tmp, iterator->stack_unused);
+#ifndef RBT_KEY_SIZE_FIXED
+  if (iterator->key_data.key != NULL)
+  {
+    free(iterator->key_data.key);
+    iterator->key_data.key = NULL;
+  }
+#endif //RBT_KEY_SIZE_FIXED
+  iterator->key_data.node = NULL;
+  errno = iterator->error;
+  return iterator->error;
+}
@@ -93,6 +93,18 @@ typedef RBT_KEY_T RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, key_t);
 #undef RBT_SWAP
 #define RBT_SWAP     RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, swap)
 
+#undef RBT_RETRIEVE_BATCH
+#define RBT_RETRIEVE_BATCH RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, retrieve_batch)
+
+#undef RBT_BULK_BUILD
+#define RBT_BULK_BUILD RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, bulk_build)
+
+#undef RBT_BULK_MERGE
+#define RBT_BULK_MERGE RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, bulk_merge)
+
+#undef _RBT_BULK_INSERT
+#define _RBT_BULK_INSERT _RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, bulk_insert)
+
 /*
   When a given key type is cast into the internal key type, care must be taken
   to prevent reads past the boundary of allocated memory. This is best
@@ -130,26 +142,26 @@ typedef RBT_KEY_T RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, key_t);
 #define RBT_PINS_FIXED ((RBT_KEY_SIZE_FIXED + (RBT_PIN_SIZE - 1)) / RBT_PIN_SIZE)
 
 /*!
-  Invoke `RBT_NODE_QUERY()` with a key cast to an array of pins.
+  Return the result of a function called with a key cast to an array of pins.
 
   @param[in]
-  node The root node.
+  func The function, e.g. `RBT_NODE_QUERY()`.
 
   @param[in]
-  The uncast key.
+  node The first argument of the function, e.g. the root node.
 
   @param[in]
-  The number of bits in the key.
+  The uncast key.
 
   @param[in]
-  The action to perform.
+  The number of bits in the key.
 
   @param[in]
-  The value with which to perform the action.
+  ... The remaining arguments of the function.
 */
-#undef _RBT_NODE_QUERY_WITH_CAST_KEY
+#undef _RBT_WITH_CAST_KEY
 #ifdef RBT_KEY_SIZE_FIXED
-  #define _RBT_NODE_QUERY_WITH_CAST_KEY(node, key, bits, action, value) \
+  #define _RBT_WITH_CAST_KEY(func, node, key, bits, ...) \
     do \
     { \
       if (RBT_PIN_SIZE != 1) \
@@ -160,22 +172,22 @@ typedef RBT_KEY_T RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, key_t);
           memset(cast_key, 0, sizeof(cast_key)); \
           memcpy(cast_key, RBT_KEY_PTR(key), RBT_KEY_SIZE_FIXED); \
           bits = sizeof(cast_key) * BITS_PER_BYTE; \
-          return RBT_NODE_QUERY(node, cast_key, bits, action, value); \
+          return func(node, cast_key, bits, __VA_ARGS__); \
         } \
         else \
         { \
-          return RBT_NODE_QUERY(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, action, value); \
+          return func(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, __VA_ARGS__); \
         } \
       } \
       else \
       { \
-        return RBT_NODE_QUERY(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, action, value); \
+        return func(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, __VA_ARGS__); \
       } \
     } \
     while (0)
 
 #else
-  #define _RBT_NODE_QUERY_WITH_CAST_KEY(node, key, bits, action, value) \
+  #define _RBT_WITH_CAST_KEY(func, node, key, bits, ...) \
     do \
     { \
       if (RBT_PIN_SIZE != 1) \
@@ -190,16 +202,16 @@ typedef RBT_KEY_T RBT_TOKEN_2_W(RBT_WRAPPER_H_PREFIX_, key_t);
           memset(cast_key, 0, sizeof(cast_key)); \
           memcpy(cast_key, RBT_KEY_PTR(key), (bits + (BITS_PER_BYTE - 1)) / BITS_PER_BYTE); \
           bits = q * RBT_PIN_SIZE_BITS; \
-          return RBT_NODE_QUERY(node, cast_key, bits, action, value); \
+          return func(node, cast_key, bits, __VA_ARGS__); \
         } \
         else \
         { \
-          return RBT_NODE_QUERY(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, action, value); \
+          return func(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, __VA_ARGS__); \
         } \
       } \
       else \
       { \
-        return RBT_NODE_QUERY(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, action, value); \
+        return func(node, (RBT_PIN_T *) RBT_KEY_PTR(key), bits, __VA_ARGS__); \
       } \
     } \
     while (0)
@@ -241,7 +253,7 @@ RBT_NODE_QUERY_WRAPPER(
   bits = RBT_KEY_COUNT_BITS(key);
 //   _RBT_NODE_QUERY_WITH_CAST_KEY(cast_key, key, bits);
 //   return RBT_NODE_QUERY(node, cast_key, bits, action, value);
-  _RBT_NODE_QUERY_WITH_CAST_KEY(node, key, bits, action, value);
+  _RBT_WITH_CAST_KEY(RBT_NODE_QUERY, node, key, bits, action, value);
 }
 
 
@@ -347,6 +359,92 @@ RBT_SWAP(
 
 
 
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  The number of keys that `RBT_RETRIEVE_BATCH()` casts at a time.
+*/
+#undef _RBT_RETRIEVE_BATCH_CHUNK
+#define _RBT_RETRIEVE_BATCH_CHUNK 0x40
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  Retrieve the values of several keys.
+
+  This is equivalent to calling `RBT_RETRIEVE()` for each key. With fixed-size
+  keys, the lookups are interleaved with `RBT_NODE_RETRIEVE_BATCH()`, which is
+  faster for large trees.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  keys The keys.
+
+  @param[out]
+  values The value of each key, or `RBT_VALUE_NULL` if there is none.
+
+  @param[in]
+  n The number of keys.
+*/
+void
+RBT_RETRIEVE_BATCH(
+  RBT_NODE_T * node,
+  RBT_KEY_T * keys,
+  RBT_VALUE_T * values,
+  size_t n
+)
+{
+#ifdef RBT_KEY_SIZE_FIXED
+  RBT_PIN_T cast_keys[_RBT_RETRIEVE_BATCH_CHUNK][RBT_PINS_FIXED];
+  RBT_PIN_T * cast_key_ptrs[_RBT_RETRIEVE_BATCH_CHUNK];
+  RBT_KEY_SIZE_T bits[_RBT_RETRIEVE_BATCH_CHUNK];
+  RBT_NODE_T * nodes[_RBT_RETRIEVE_BATCH_CHUNK];
+  size_t i, j, m;
+
+  for (i=0; i<n; i+=m)
+  {
+    m = MIN(n - i, _RBT_RETRIEVE_BATCH_CHUNK);
+    for (j=0; j<m; j++)
+    {
+      if (RBT_PIN_SIZE != 1 && RBT_KEY_SIZE_FIXED % RBT_PIN_SIZE)
+      {
+        memset(cast_keys[j], 0, sizeof(cast_keys[j]));
+        bits[j] = sizeof(cast_keys[j]) * BITS_PER_BYTE;
+      }
+      else
+      {
+        bits[j] = RBT_KEY_COUNT_BITS(keys[i + j]);
+      }
+      memcpy(cast_keys[j], RBT_KEY_PTR(keys[i + j]), RBT_KEY_SIZE_FIXED);
+      cast_key_ptrs[j] = cast_keys[j];
+    }
+    RBT_NODE_RETRIEVE_BATCH(node, cast_key_ptrs, bits, m, nodes);
+    for (j=0; j<m; j++)
+    {
+      values[i + j] = (nodes[j] == NULL) ? RBT_VALUE_NULL : nodes[j]->value;
+    }
+  }
+#else
+  size_t i;
+
+  for (i=0; i<n; i++)
+  {
+    values[i] = RBT_RETRIEVE(node, keys[i]);
+  }
+#endif // RBT_KEY_SIZE_FIXED
+}
+
+
+
+
 /////////////////////////////////// Has Key ////////////////////////////////////
 
 /*!
@@ -357,4 +455,128 @@ int
 RBT_HAS_KEY(RBT_NODE_T * node, RBT_KEY_T key)
 {
   return !RBT_VALUE_IS_NULL(RBT_RETRIEVE(node, key));
-}
\ No newline at end of file
+}
+
+
+
+
+///////////////////////////////////// Bulk /////////////////////////////////////
+
+/*!
+  @cond INTERNAL
+*/
+
+/*!
+  Invoke `RBT_NODE_BULK_INSERT()` with a key cast to an array of pins.
+*/
+RBT_NODE_T *
+_RBT_BULK_INSERT(
+  RBT_NODE_BULK_T * bulk,
+  RBT_KEY_T key,
+  RBT_VALUE_T value
+)
+{
+  RBT_KEY_SIZE_T bits;
+  bits = RBT_KEY_COUNT_BITS(key);
+  _RBT_WITH_CAST_KEY(RBT_NODE_BULK_INSERT, bulk, key, bits, value);
+}
+
+/*!
+  @endcond
+*/
+
+
+
+/*!
+  Insert arrays of keys and values into a tree.
+
+  This is equivalent to calling `RBT_INSERT()` for each key, in order, but it
+  is done in a single pass if the keys are sorted. See `RBT_NODE_BULK_MERGE()`.
+
+  @attention
+  The value of `errno` should be checked for errors when this function returns.
+
+  @param[in]
+  node The root node.
+
+  @param[in]
+  keys The keys.
+
+  @param[in]
+  values The values. They must not be `RBT_VALUE_NULL`.
+
+  @param[in]
+  n The number of keys and values.
+
+  @return
+  The number of inserted keys.
+*/
+size_t
+RBT_BULK_MERGE(
+  RBT_NODE_T * node,
+  RBT_KEY_T * keys,
+  RBT_VALUE_T * values,
+  size_t n
+)
+{
+  RBT_NODE_BULK_T bulk;
+  size_t i;
+  int rc;
+
+  rc = 0;
+  RBT_NODE_BULK_BEGIN(&bulk, node);
+  for (i=0; i<n; i++)
+  {
+    if (_RBT_BULK_INSERT(&bulk, keys[i], values[i]) == NULL)
+    {
+      rc = errno;
+      break;
+    }
+  }
+  RBT_NODE_BULK_END(&bulk);
+  errno = rc;
+  return i;
+}
+
+
+
+/*!
+  Build a tree from arrays of keys and values.
+
+  @param[in]
+  keys The keys, preferably sorted.
+
+  @param[in]
+  values The values. They must not be `RBT_VALUE_NULL`.
+
+  @param[in]
+  n The number of keys and values.
+
+  @return
+  The root node of the new tree, or NULL on error (check errno).
+*/
+RBT_NODE_T *
+RBT_BULK_BUILD(
+  RBT_KEY_T * keys,
+  RBT_VALUE_T * values,
+  size_t n
+)
+{
+  RBT_NODE_T * node;
+  int rc;
+
+  node = RBT_NODE_NEW();
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  RBT_BULK_MERGE(node, keys, values, n);
+  if (errno)
+  {
+    rc = errno;
+    RBT_NODE_FREE(node);
+    errno = rc;
+    return NULL;
+  }
+  return node;
+}
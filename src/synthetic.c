@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include "common.h"
+#include "synthetic.h"
+
+/*!
+  @brief
+  The length of the padded name field in synthetic events.
+*/
+#define SYNTHETIC_NAME_LEN ((sizeof(SYNTHETIC_NAME) + 15) & ~15)
+
+/*!
+  @brief
+  The state of a synthetic event source.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The number of watch descriptors handed out.
+  */
+  int wds;
+
+  /*!
+    @brief
+    The watch descriptor of the next event.
+  */
+  int next_wd;
+
+  /*!
+    @brief
+    The number of events that remain to be delivered.
+  */
+  unsigned long remaining;
+}
+synthetic_data_t;
+
+
+
+int
+synthetic_source_add_watch(event_source_t * source, const char * path, uint32_t mask)
+{
+  synthetic_data_t * data;
+  data = source->data;
+  return ++ data->wds;
+}
+
+
+
+int
+synthetic_source_rm_watch(event_source_t * source, int wd)
+{
+  return 0;
+}
+
+
+
+ssize_t
+synthetic_source_read(event_source_t * source, char * buffer, size_t len)
+{
+  synthetic_data_t * data;
+  struct inotify_event * event;
+  size_t i;
+
+  data = source->data;
+  if (! data->wds)
+  {
+    return 0;
+  }
+
+  i = 0;
+  while (data->remaining && i + sizeof(struct inotify_event) + SYNTHETIC_NAME_LEN <= len)
+  {
+    event = (struct inotify_event *) (buffer + i);
+    event->wd = data->next_wd;
+    event->mask = IN_CREATE;
+    event->cookie = 0;
+    event->len = SYNTHETIC_NAME_LEN;
+    memset(event->name, 0, SYNTHETIC_NAME_LEN);
+    strcpy(event->name, SYNTHETIC_NAME);
+    i += sizeof(struct inotify_event) + SYNTHETIC_NAME_LEN;
+
+    data->next_wd = (data->next_wd % data->wds) + 1;
+    data->remaining --;
+  }
+  return i;
+}
+
+
+
+int
+synthetic_source_pending(event_source_t * source)
+{
+  synthetic_data_t * data;
+  data = source->data;
+  return data->wds && data->remaining;
+}
+
+
+
+void
+synthetic_source_close(event_source_t * source)
+{
+  free(source->data);
+  free(source);
+}
+
+
+
+event_source_t *
+synthetic_source_new(unsigned long n)
+{
+  event_source_t * source;
+  synthetic_data_t * data;
+
+  source = malloc(sizeof(event_source_t));
+  data = malloc(sizeof(synthetic_data_t));
+  if (source == NULL || data == NULL)
+  {
+    die("error: failed to allocate memory for event source");
+  }
+  data->wds = 0;
+  data->next_wd = 1;
+  data->remaining = n;
+  source->data = data;
+  source->add_watch = synthetic_source_add_watch;
+  source->rm_watch = synthetic_source_rm_watch;
+  source->read = synthetic_source_read;
+  source->pending = synthetic_source_pending;
+  source->close = synthetic_source_close;
+  source->handled = NULL;
+  source->report = NULL;
+  source->interrupt = NULL;
+  return source;
+}
@@ -0,0 +1,33 @@
+#ifndef MAOWN_SYNTHETIC_H
+#define MAOWN_SYNTHETIC_H
+
+#include "event_source.h"
+
+/*!
+  @brief
+  The name given to items in synthetic events.
+*/
+#define SYNTHETIC_NAME ".autochown-synthetic"
+
+/*!
+  @brief
+  Create an in-memory event source that injects synthetic events.
+
+  Watches are not registered with the kernel. Each call to `add_watch` returns
+  the next watch descriptor in sequence. Once watches exist, reads return
+  `IN_CREATE` events for a nonexistent item named `SYNTHETIC_NAME`, cycling
+  through all watch descriptors, until the requested number of events has been
+  delivered. This exercises the watch descriptor lookup, path building and rule
+  evaluation of the event loop without any kernel involvement apart from a
+  failed `lstat`.
+
+  @param
+  n The number of events to inject.
+
+  @return
+  The event source.
+*/
+event_source_t *
+synthetic_source_new(unsigned long n);
+
+#endif //MAOWN_SYNTHETIC_H
@@ -0,0 +1,195 @@
+#ifndef MAOWN_TARGET_INDEX_H
+#define MAOWN_TARGET_INDEX_H
+/*
+  Set up rabbit trees to map target directories to their targets.
+
+  The keys are the bytes of the directory paths, each with a single trailing
+  slash so that only whole path components match. The most specific target of
+  a path is then the value of the longest key that is a prefix of the path,
+  which is found in a single descent along the path instead of comparing the
+  path with every target.
+
+  This must be included after rbt.h if both are used because the macros of the
+  watch descriptor tree are reset here.
+*/
+
+#include <limits.h>
+
+#include <rbt/common.h>
+
+#include "file_parser.h"
+
+#undef RBT_KEY_H_PREFIX_
+#undef RBT_PIN_T
+#undef RBT_KEY_SIZE_T
+#undef RBT_KEY_SIZE_T_FORMAT
+#undef RBT_NODE_H_PREFIX_
+#undef RBT_VALUE_T
+#undef RBT_VALUE_NULL
+#undef RBT_VALUE_IS_EQUAL
+#undef RBT_VALUE_COPY
+#undef RBT_VALUE_FREE
+#undef RBT_VALUE_FPRINT
+#undef RBT_VALUE_HEAP_BYTES
+#undef RBT_NODE_KEY_INLINE_PINS
+#undef RBT_NODE_ARENA
+#undef RBT_KEY_T
+#undef RBT_KEY_SIZE_FIXED
+
+/*
+  Paths are compared byte by byte, so the pins are bytes. Key sizes may exceed
+  PATH_MAX bytes in bits.
+*/
+#define RBT_KEY_H_PREFIX_ path_
+#define RBT_PIN_T unsigned char
+#define RBT_KEY_SIZE_T unsigned int
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_NODE_H_PREFIX_ RBT_KEY_H_PREFIX_
+#define RBT_VALUE_T target_t *
+#define RBT_VALUE_NULL NULL
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) (a) = (b)
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%s", (val)->target)
+/*
+  Short fragments fill the padding after the bits field of the nodes.
+*/
+#define RBT_NODE_KEY_INLINE_PINS 4
+#include <rbt/node.h>
+
+/*!
+  @brief
+  The size of the buffers for index keys: a path, a trailing slash and the
+  terminating null byte.
+*/
+#define TARGET_INDEX_KEY_SIZE (PATH_MAX + 2)
+
+/*!
+  @brief
+  Convert a path to an index key.
+
+  Trailing slashes are replaced by a single slash.
+
+  @param
+  path The path.
+
+  @param
+  key The output buffer of size `TARGET_INDEX_KEY_SIZE`.
+
+  @return
+  The length of the key in bytes.
+*/
+static inline size_t
+target_index_key(const char * path, char * key)
+{
+  size_t l;
+
+  l = strnlen(path, PATH_MAX);
+  while (l > 0 && path[l - 1] == '/')
+  {
+    l --;
+  }
+  memcpy(key, path, l);
+  key[l ++] = '/';
+  key[l] = '\0';
+  return l;
+}
+
+
+
+/*!
+  @brief
+  Map a directory to a target. A previous target of the same directory is
+  replaced.
+
+  @param
+  index The index.
+
+  @param
+  path The directory.
+
+  @param
+  target The target.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+static inline int
+target_index_add(path_node_t * index, const char * path, target_t * target)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  path_node_query(
+    index,
+    (unsigned char *) key,
+    l * BITS_PER_BYTE,
+    RBT_QUERY_ACTION_INSERT,
+    target
+  );
+  return errno ? -1 : 0;
+}
+
+
+
+/*!
+  @brief
+  Check if a path is an indexed directory.
+
+  @param
+  index The index.
+
+  @param
+  path The path. Trailing slashes are ignored.
+
+  @return
+  True if the path is indexed.
+*/
+static inline int
+target_index_contains(path_node_t * index, const char * path)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  return path_node_query(
+    index,
+    (unsigned char *) key,
+    l * BITS_PER_BYTE,
+    RBT_QUERY_ACTION_RETRIEVE,
+    NULL
+  ) != NULL;
+}
+
+
+
+/*!
+  @brief
+  Get the most specific target of a path, i.e. the target of the deepest
+  indexed directory that contains the path or is the path.
+
+  @param
+  index The index.
+
+  @param
+  path The path.
+
+  @return
+  The target, or NULL if no indexed directory contains the path.
+*/
+static inline target_t *
+target_index_lookup(path_node_t * index, const char * path)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+  path_node_t * node;
+
+  l = target_index_key(path, key);
+  node = path_node_longest_prefix(index, (unsigned char *) key, l * BITS_PER_BYTE, NULL);
+  return (node == NULL) ? NULL : node->value;
+}
+
+#endif //MAOWN_TARGET_INDEX_H
@@ -0,0 +1,948 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "inotify.h"
+#include "trace.h"
+
+/*!
+  @brief
+  The number of buckets in the latency histogram. Bucket b counts latencies in
+  the interval [2^b, 2^(b+1)) nanoseconds.
+*/
+#define REPLAY_LATENCY_BUCKETS 64
+
+/*!
+  @brief
+  The initial size of the replay watch table. It must be a power of 2.
+*/
+#define REPLAY_WATCHES_INIT 0x100
+
+
+
+/*!
+  @brief
+  Get the number of nanoseconds elapsed since a given time.
+
+  @param
+  start The start time, from the monotonic clock.
+
+  @return
+  The number of nanoseconds.
+*/
+uint64_t
+trace_elapsed_ns(struct timespec * start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return
+    (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL +
+    now.tv_nsec - start->tv_nsec;
+}
+
+
+
+trace_t *
+trace_open(const char * path)
+{
+  trace_t * trace;
+  uint32_t header[2] = {TRACE_VERSION, TRACE_BYTE_ORDER};
+
+  trace = malloc(sizeof(trace_t));
+  if (trace == NULL)
+  {
+    die("error: failed to allocate memory for trace");
+  }
+  trace->f = fopen(path, "wb");
+  if (trace->f == NULL)
+  {
+    die("error: failed to open trace file \"%s\"", path);
+  }
+  if (
+    fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, trace->f) != 1 ||
+    fwrite(header, sizeof(header), 1, trace->f) != 1
+  )
+  {
+    die("error: failed to write trace header");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &trace->start);
+  return trace;
+}
+
+
+
+void
+trace_record(trace_t * trace, struct inotify_event * event, const char * path)
+{
+  unsigned char record[TRACE_RECORD_SIZE];
+  uint64_t time;
+  int32_t wd;
+  uint32_t mask, cookie;
+  uint16_t path_len, name_len;
+
+  time = trace_elapsed_ns(&trace->start);
+  wd = event->wd;
+  mask = event->mask;
+  cookie = event->cookie;
+  path_len = (path == NULL) ? 0 : strlen(path);
+  if (path_len > 1 && path[path_len - 1] == '/')
+  {
+    path_len --;
+  }
+  name_len = event->len ? strnlen(event->name, event->len) : 0;
+
+  memcpy(record, &time, 8);
+  memcpy(record + 8, &wd, 4);
+  memcpy(record + 12, &mask, 4);
+  memcpy(record + 16, &cookie, 4);
+  memcpy(record + 20, &path_len, 2);
+  memcpy(record + 22, &name_len, 2);
+
+  if (
+    fwrite(record, TRACE_RECORD_SIZE, 1, trace->f) != 1 ||
+    fwrite(path, 1, path_len, trace->f) != path_len ||
+    fwrite(event->name, 1, name_len, trace->f) != name_len
+  )
+  {
+    die("error: failed to write trace record");
+  }
+}
+
+
+
+void
+trace_flush(trace_t * trace)
+{
+  if (fflush(trace->f))
+  {
+    die("error: failed to write trace file");
+  }
+}
+
+
+
+void
+trace_close(trace_t * trace)
+{
+  if (fclose(trace->f))
+  {
+    die("error: failed to close trace file");
+  }
+  free(trace);
+}
+
+
+
+
+
+/*!
+  @brief
+  An entry in the replay watch table.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The watched path, or NULL if the slot is empty.
+  */
+  char * path;
+
+  /*!
+    @brief
+    The watch descriptor, or -1 if the watch has been removed.
+  */
+  int wd;
+}
+replay_watch_t;
+
+/*!
+  @brief
+  The state of a replay event source.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The trace file contents.
+  */
+  unsigned char * trace;
+
+  /*!
+    @brief
+    The size of the trace file.
+  */
+  size_t size;
+
+  /*!
+    @brief
+    The offset of the next record.
+  */
+  size_t offset;
+
+  /*!
+    @brief
+    The directory below which recorded paths are relocated, or NULL.
+  */
+  char * root;
+
+  /*!
+    @brief
+    The factor by which to speed up the recorded timing, or 0 for untimed
+    replays.
+  */
+  double acceleration;
+
+  /*!
+    @brief
+    The time of the first read.
+  */
+  struct timespec start;
+
+  /*!
+    @brief
+    True once the first read has occurred.
+  */
+  int started;
+
+  /*!
+    @brief
+    Open-addressed hash table mapping watched paths to watch descriptors.
+  */
+  replay_watch_t * watches;
+
+  /*!
+    @brief
+    The number of used slots in the watch table.
+  */
+  size_t n_watches;
+
+  /*!
+    @brief
+    The number of slots in the watch table.
+  */
+  size_t size_watches;
+
+  /*!
+    @brief
+    The last watch descriptor handed out.
+  */
+  int last_wd;
+
+  /*!
+    @brief
+    The due times of the events returned by the last read.
+  */
+  uint64_t * due;
+
+  /*!
+    @brief
+    The number of due times.
+  */
+  size_t n_due;
+
+  /*!
+    @brief
+    The allocated size of the due times array.
+  */
+  size_t size_due;
+
+  /*!
+    @brief
+    The number of handled events.
+  */
+  unsigned long handled;
+
+  /*!
+    @brief
+    The number of events that were dropped because their paths were not
+    watched.
+  */
+  unsigned long skipped;
+
+  /*!
+    @brief
+    The sum of all latencies, in nanoseconds.
+  */
+  uint64_t latency_sum;
+
+  /*!
+    @brief
+    The maximum latency, in nanoseconds.
+  */
+  uint64_t latency_max;
+
+  /*!
+    @brief
+    The latency histogram.
+  */
+  unsigned long latency_histogram[REPLAY_LATENCY_BUCKETS];
+}
+replay_data_t;
+
+
+
+/*!
+  @brief
+  Find the slot of a path in the replay watch table.
+
+  @param
+  data The replay data.
+
+  @param
+  path The path.
+
+  @return
+  The slot holding the path, or the empty slot in which it should be inserted.
+*/
+replay_watch_t *
+replay_find_watch(replay_data_t * data, const char * path)
+{
+  size_t i, mask;
+  const unsigned char * c;
+
+  /*
+    FNV-1a
+  */
+  i = 2166136261u;
+  for (c = (const unsigned char *) path; * c; c++)
+  {
+    i = (i ^ * c) * 16777619u;
+  }
+  mask = data->size_watches - 1;
+  i &= mask;
+  while (data->watches[i].path != NULL && strcmp(data->watches[i].path, path))
+  {
+    i = (i + 1) & mask;
+  }
+  return &data->watches[i];
+}
+
+
+
+/*!
+  @brief
+  Double the size of the replay watch table.
+
+  @param
+  data The replay data.
+*/
+void
+replay_grow_watches(replay_data_t * data)
+{
+  replay_watch_t * old, * slot;
+  size_t i, size;
+
+  old = data->watches;
+  size = data->size_watches;
+  data->size_watches *= 2;
+  data->watches = calloc(data->size_watches, sizeof(replay_watch_t));
+  if (data->watches == NULL)
+  {
+    die("error: failed to allocate memory for replay watches");
+  }
+  for (i=0; i<size; i++)
+  {
+    if (old[i].path != NULL)
+    {
+      slot = replay_find_watch(data, old[i].path);
+      * slot = old[i];
+    }
+  }
+  free(old);
+}
+
+
+
+/*!
+  @brief
+  Relocate a recorded path below the replay root.
+
+  @param
+  data The replay data.
+
+  @param
+  path The recorded path. It need not be null-terminated.
+
+  @param
+  len The length of the recorded path.
+
+  @param
+  buffer The output buffer, of size PATH_MAX + 1.
+
+  @return
+  0 on success, -1 if the path is too long.
+*/
+int
+replay_relocate(replay_data_t * data, const unsigned char * path, size_t len, char * buffer)
+{
+  size_t l;
+  l = (data->root == NULL) ? 0 : strlen(data->root);
+  if (l + len > PATH_MAX)
+  {
+    return -1;
+  }
+  if (l)
+  {
+    memcpy(buffer, data->root, l);
+  }
+  memcpy(buffer + l, path, len);
+  buffer[l + len] = '\0';
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Create a directory and all of its missing parents.
+
+  @param
+  path The directory path. It is modified temporarily.
+*/
+void
+replay_mkdirs(char * path)
+{
+  char * c;
+  for (c = path + 1; * c; c++)
+  {
+    if (* c == '/')
+    {
+      * c = '\0';
+      mkdir(path, 0755);
+      * c = '/';
+    }
+  }
+  mkdir(path, 0755);
+}
+
+
+
+/*!
+  @brief
+  Apply the change reported by an event to the file system.
+
+  @param
+  mask The event mask.
+
+  @param
+  path The watched directory.
+
+  @param
+  name The name of the affected item.
+*/
+void
+replay_apply(uint32_t mask, const char * path, const char * name)
+{
+  char full_path[PATH_MAX + 1];
+  int fd;
+
+  if (! * name)
+  {
+    return;
+  }
+  if (snprintf(full_path, sizeof(full_path), "%s/%s", path, name) >= sizeof(full_path))
+  {
+    return;
+  }
+  if (mask & (IN_CREATE | IN_MOVED_TO))
+  {
+    if (mask & IN_ISDIR)
+    {
+      mkdir(full_path, 0755);
+    }
+    else
+    {
+      fd = open(full_path, O_WRONLY | O_CREAT, 0644);
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+  }
+  else if (mask & (IN_DELETE | IN_MOVED_FROM))
+  {
+    if (mask & IN_ISDIR)
+    {
+      rmdir(full_path);
+    }
+    else
+    {
+      unlink(full_path);
+    }
+  }
+}
+
+
+
+int
+replay_source_add_watch(event_source_t * source, const char * path, uint32_t mask)
+{
+  replay_data_t * data;
+  replay_watch_t * slot;
+
+  data = source->data;
+  if ((data->n_watches + 1) * 2 > data->size_watches)
+  {
+    replay_grow_watches(data);
+  }
+  slot = replay_find_watch(data, path);
+  if (slot->path == NULL)
+  {
+    slot->path = strdup(path);
+    if (slot->path == NULL)
+    {
+      die("error: failed to duplicate string");
+    }
+    slot->wd = -1;
+    data->n_watches ++;
+  }
+  if (slot->wd == -1)
+  {
+    slot->wd = ++ data->last_wd;
+  }
+  return slot->wd;
+}
+
+
+
+int
+replay_source_rm_watch(event_source_t * source, int wd)
+{
+  replay_data_t * data;
+  size_t i;
+
+  data = source->data;
+  for (i=0; i<data->size_watches; i++)
+  {
+    if (data->watches[i].path != NULL && data->watches[i].wd == wd)
+    {
+      data->watches[i].wd = -1;
+      return 0;
+    }
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+
+
+/*!
+  @brief
+  Get the due time of the next record.
+
+  @param
+  data The replay data.
+
+  @return
+  The due time, in nanoseconds since the first read.
+*/
+uint64_t
+replay_next_due(replay_data_t * data)
+{
+  uint64_t time;
+  memcpy(&time, data->trace + data->offset, 8);
+  return time / data->acceleration;
+}
+
+
+
+ssize_t
+replay_source_read(event_source_t * source, char * buffer, size_t len)
+{
+  replay_data_t * data;
+  struct inotify_event * event;
+  char path[PATH_MAX + 1], name[NAME_MAX + 1];
+  size_t i, event_len;
+  uint64_t due, now;
+  int32_t wd;
+  uint32_t mask, cookie;
+  uint16_t path_len, name_len;
+  struct timespec delay;
+  replay_watch_t * slot;
+
+  data = source->data;
+  if (! data->started)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &data->start);
+    data->started = 1;
+  }
+
+  if (data->size_due < len / EVENT_SIZE)
+  {
+    data->size_due = len / EVENT_SIZE;
+    free(data->due);
+    data->due = malloc(data->size_due * sizeof(uint64_t));
+    if (data->due == NULL)
+    {
+      die("error: failed to allocate memory for replay");
+    }
+  }
+  data->n_due = 0;
+
+  i = 0;
+  while (data->offset < data->size)
+  {
+    memcpy(&wd, data->trace + data->offset + 8, 4);
+    memcpy(&mask, data->trace + data->offset + 12, 4);
+    memcpy(&cookie, data->trace + data->offset + 16, 4);
+    memcpy(&path_len, data->trace + data->offset + 20, 2);
+    memcpy(&name_len, data->trace + data->offset + 22, 2);
+
+    /*
+      Pad the name to a multiple of 16 bytes with at least one null byte, as
+      inotify does.
+    */
+    event_len = name_len ? ((name_len + 16) & ~15) : 0;
+    if (i + EVENT_SIZE + event_len > len || data->n_due == data->size_due)
+    {
+      break;
+    }
+
+    now = trace_elapsed_ns(&data->start);
+    if (data->acceleration > 0)
+    {
+      due = replay_next_due(data);
+      if (due > now)
+      {
+        /*
+          Return what is ready before waiting for the next event.
+        */
+        if (i)
+        {
+          break;
+        }
+        delay.tv_sec = (due - now) / 1000000000ULL;
+        delay.tv_nsec = (due - now) % 1000000000ULL;
+        nanosleep(&delay, NULL);
+      }
+    }
+    else
+    {
+      due = now;
+    }
+
+    memcpy(name, data->trace + data->offset + TRACE_RECORD_SIZE + path_len, name_len);
+    name[name_len] = '\0';
+
+    if (path_len)
+    {
+      if (replay_relocate(data, data->trace + data->offset + TRACE_RECORD_SIZE, path_len, path))
+      {
+        wd = -1;
+      }
+      else
+      {
+        slot = replay_find_watch(data, path);
+        wd = (slot->path == NULL) ? -1 : slot->wd;
+      }
+      if (wd == -1)
+      {
+        data->offset += TRACE_RECORD_SIZE + path_len + name_len;
+        data->skipped ++;
+        continue;
+      }
+      replay_apply(mask, path, name);
+    }
+    /*
+      Events without a path, e.g. queue overflows, are only meaningful if they
+      do not belong to a watch.
+    */
+    else if (wd != -1)
+    {
+      data->offset += TRACE_RECORD_SIZE + name_len;
+      data->skipped ++;
+      continue;
+    }
+    data->offset += TRACE_RECORD_SIZE + path_len + name_len;
+
+    event = (struct inotify_event *) (buffer + i);
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    event->len = event_len;
+    if (event_len)
+    {
+      memset(event->name, 0, event_len);
+      memcpy(event->name, name, name_len);
+    }
+    i += EVENT_SIZE + event_len;
+    data->due[data->n_due ++] = due;
+  }
+  return i;
+}
+
+
+
+int
+replay_source_pending(event_source_t * source)
+{
+  replay_data_t * data;
+  data = source->data;
+  if (data->offset >= data->size)
+  {
+    return 0;
+  }
+  if (data->acceleration > 0 && data->started)
+  {
+    return replay_next_due(data) <= trace_elapsed_ns(&data->start);
+  }
+  return 1;
+}
+
+
+
+void
+replay_source_close(event_source_t * source)
+{
+  replay_data_t * data;
+  size_t i;
+
+  data = source->data;
+  for (i=0; i<data->size_watches; i++)
+  {
+    free(data->watches[i].path);
+  }
+  free(data->watches);
+  free(data->due);
+  free(data->root);
+  free(data->trace);
+  free(data);
+  free(source);
+}
+
+
+
+/*!
+  @brief
+  Mark all events from the last read as handled.
+
+  This is used to measure the latency between the time at which each event was
+  due and the time at which it was handled. If the replay is not timed, the
+  latency is measured from the time at which the event was read.
+
+  @param
+  source The replay source.
+*/
+void
+replay_source_handled(event_source_t * source)
+{
+  replay_data_t * data;
+  uint64_t now, latency;
+  size_t i;
+  int b;
+
+  data = source->data;
+  now = trace_elapsed_ns(&data->start);
+  for (i=0; i<data->n_due; i++)
+  {
+    latency = (now > data->due[i]) ? (now - data->due[i]) : 0;
+    data->latency_sum += latency;
+    if (latency > data->latency_max)
+    {
+      data->latency_max = latency;
+    }
+    for (b=0; b < REPLAY_LATENCY_BUCKETS - 1 && (latency >> (b + 1)); b++);
+    data->latency_histogram[b] ++;
+  }
+  data->handled += data->n_due;
+  data->n_due = 0;
+}
+
+
+
+/*!
+  @brief
+  Get an upper bound for a latency percentile from the histogram.
+
+  @param
+  data The replay data.
+
+  @param
+  p The percentile, between 0 and 1.
+
+  @return
+  The upper bound in milliseconds.
+*/
+double
+replay_percentile(replay_data_t * data, double p)
+{
+  unsigned long n;
+  int b;
+
+  n = 0;
+  for (b=0; b<REPLAY_LATENCY_BUCKETS - 1; b++)
+  {
+    n += data->latency_histogram[b];
+    if (n >= p * data->handled)
+    {
+      break;
+    }
+  }
+  return (double) (2ULL << b) / 1e6;
+}
+
+
+
+/*!
+  @brief
+  Log the latency statistics and the number of events that could not be
+  replayed.
+
+  @param
+  source The replay source.
+*/
+void
+replay_source_report(event_source_t * source)
+{
+  replay_data_t * data;
+  data = source->data;
+
+  if (data->handled)
+  {
+    msg_log(
+      "replay latency: mean %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms",
+      (double) data->latency_sum / data->handled / 1e6,
+      replay_percentile(data, 0.5),
+      replay_percentile(data, 0.99),
+      (double) data->latency_max / 1e6
+    );
+  }
+  if (data->skipped)
+  {
+    msg_log("replay skipped %lu events of unwatched paths", data->skipped);
+  }
+}
+
+
+
+event_source_t *
+replay_source_new(const char * path, const char * root, double acceleration)
+{
+  event_source_t * source;
+  replay_data_t * data;
+  FILE * f;
+  struct stat st;
+  uint32_t header[2];
+  uint16_t path_len, name_len;
+  size_t offset;
+  char dir_path[PATH_MAX + 1], last_path[PATH_MAX + 1];
+
+  source = malloc(sizeof(event_source_t));
+  data = calloc(1, sizeof(replay_data_t));
+  if (source == NULL || data == NULL)
+  {
+    die("error: failed to allocate memory for event source");
+  }
+
+  f = fopen(path, "rb");
+  if (f == NULL || fstat(fileno(f), &st))
+  {
+    die("error: failed to open trace file \"%s\"", path);
+  }
+  data->size = st.st_size;
+  data->trace = malloc(data->size);
+  if (data->trace == NULL)
+  {
+    die("error: failed to allocate memory for trace");
+  }
+  if (fread(data->trace, 1, data->size, f) != data->size)
+  {
+    die("error: failed to read trace file \"%s\"", path);
+  }
+  fclose(f);
+
+  if (
+    data->size < sizeof(TRACE_MAGIC) + sizeof(header) ||
+    memcmp(data->trace, TRACE_MAGIC, sizeof(TRACE_MAGIC))
+  )
+  {
+    errno = EINVAL;
+    die("error: \"%s\" is not a trace file", path);
+  }
+  memcpy(header, data->trace + sizeof(TRACE_MAGIC), sizeof(header));
+  if (header[0] != TRACE_VERSION || header[1] != TRACE_BYTE_ORDER)
+  {
+    errno = ENOTSUP;
+    die("error: unsupported trace version or byte order (%s)", path);
+  }
+  data->offset = sizeof(TRACE_MAGIC) + sizeof(header);
+
+  if (root != NULL)
+  {
+    data->root = strdup(root);
+    if (data->root == NULL)
+    {
+      die("error: failed to duplicate string");
+    }
+  }
+  data->acceleration = acceleration;
+  data->size_watches = REPLAY_WATCHES_INIT;
+  data->watches = calloc(data->size_watches, sizeof(replay_watch_t));
+  if (data->watches == NULL)
+  {
+    die("error: failed to allocate memory for replay watches");
+  }
+
+  /*
+    Validate the records and create the directories that appear in the trace so
+    that they are found and watched by the initial scan. The trace ends at the
+    last complete record.
+  */
+  last_path[0] = '\0';
+  for (
+    offset = data->offset;
+    offset < data->size;
+    offset += TRACE_RECORD_SIZE + path_len + name_len
+  )
+  {
+    if (offset + TRACE_RECORD_SIZE > data->size)
+    {
+      break;
+    }
+    memcpy(&path_len, data->trace + offset + 20, 2);
+    memcpy(&name_len, data->trace + offset + 22, 2);
+    if (name_len > NAME_MAX)
+    {
+      errno = EINVAL;
+      die("error: invalid trace record at offset %zu (%s)", offset, path);
+    }
+    if (offset + TRACE_RECORD_SIZE + path_len + name_len > data->size)
+    {
+      break;
+    }
+    if (
+      path_len &&
+      ! replay_relocate(data, data->trace + offset + TRACE_RECORD_SIZE, path_len, dir_path) &&
+      strcmp(dir_path, last_path)
+    )
+    {
+      replay_mkdirs(dir_path);
+      strcpy(last_path, dir_path);
+    }
+  }
+  if (offset < data->size)
+  {
+    msg_log(
+      "warning: ignoring truncated trace record at offset %zu (%s)",
+      offset, path
+    );
+    data->size = offset;
+  }
+
+  source->data = data;
+  source->add_watch = replay_source_add_watch;
+  source->rm_watch = replay_source_rm_watch;
+  source->read = replay_source_read;
+  source->pending = replay_source_pending;
+  source->close = replay_source_close;
+  source->handled = replay_source_handled;
+  source->report = replay_source_report;
+  source->interrupt = NULL;
+  return source;
+}
@@ -0,0 +1,165 @@
+#ifndef MAOWN_TRACE_H
+#define MAOWN_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "event_source.h"
+
+/*
+  Trace file format
+
+  All integers are stored in host byte order. The header is the 8-byte magic
+  string (including its terminating null byte), the format version and the
+  value `TRACE_BYTE_ORDER` as 32-bit unsigned integers.
+
+  Each event is then stored as a record:
+
+    uint64_t time       nanoseconds since the trace was opened
+    int32_t  wd         original watch descriptor
+    uint32_t mask       event mask
+    uint32_t cookie     event cookie
+    uint16_t path_len   length of the resolved watch path
+    uint16_t name_len   length of the event name
+    char     path[path_len]
+    char     name[name_len]
+
+  Strings are not null-terminated. Paths are stored without trailing slashes
+  and the name padding of inotify events is dropped.
+*/
+
+/*!
+  @brief
+  The magic string at the start of trace files.
+*/
+#define TRACE_MAGIC "ACTRACE"
+
+/*!
+  @brief
+  The current version of the trace file format.
+*/
+#define TRACE_VERSION 1
+
+/*!
+  @brief
+  Value used to detect traces recorded on hosts with a different byte order.
+*/
+#define TRACE_BYTE_ORDER 0x01020304
+
+/*!
+  @brief
+  The size of a record without the strings.
+*/
+#define TRACE_RECORD_SIZE 24
+
+/*!
+  @brief
+  An open trace file for recording.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The trace file.
+  */
+  FILE * f;
+
+  /*!
+    @brief
+    The time at which the trace was opened.
+  */
+  struct timespec start;
+}
+trace_t;
+
+/*!
+  @brief
+  Open a trace file for recording and write the header.
+
+  @param
+  path The path of the trace file. It will be truncated.
+
+  @return
+  The trace.
+*/
+trace_t *
+trace_open(const char * path);
+
+/*!
+  @brief
+  Record an event.
+
+  @param
+  trace The trace.
+
+  @param
+  event The event.
+
+  @param
+  path The path of the watch to which the event belongs, or NULL if the watch
+  descriptor is unknown.
+*/
+void
+trace_record(trace_t * trace, struct inotify_event * event, const char * path);
+
+/*!
+  @brief
+  Flush buffered records to the trace file.
+
+  @param
+  trace The trace.
+*/
+void
+trace_flush(trace_t * trace);
+
+/*!
+  @brief
+  Flush and close a trace.
+
+  @param
+  trace The trace.
+*/
+void
+trace_close(trace_t * trace);
+
+/*!
+  @brief
+  Create an event source that replays a recorded trace.
+
+  The recorded paths are mapped to the watch descriptors handed out for the
+  same paths during the replay, so the replayed events can be handled by the
+  unmodified event loop. Before each event is delivered, the change that it
+  reports (creation or deletion of the named item) is applied to the file
+  system so that the scans triggered by the event find what they would have
+  found in the recorded tree. All directories that appear in the trace are
+  created when the source is opened.
+
+  A truncated record at the end of the trace, e.g. from a daemon that was
+  killed while recording, is ignored with a warning.
+
+  Replays modify the file system. They should only ever be run against a
+  scratch tree.
+
+  @param
+  path The path of the trace file.
+
+  @param
+  root If not NULL, recorded paths are relocated below this directory, e.g.
+  "/srv/data" becomes "<root>/srv/data". The targets passed to the daemon must
+  refer to the relocated paths.
+
+  @param
+  acceleration The factor by which to speed up the recorded timing. If 0,
+  events are delivered as fast as they are consumed.
+
+  @return
+  The event source. Its `report` function logs the latency between the time at
+  which each event was due and the time at which it was handled.
+*/
+event_source_t *
+replay_source_new(const char * path, const char * root, double acceleration);
+
+#endif //MAOWN_TRACE_H
@@ -0,0 +1,256 @@
+#ifndef MAOWN_WATCH_INDEX_H
+#define MAOWN_WATCH_INDEX_H
+/*
+  Set up rabbit trees to map the paths of watched directories to their watch
+  descriptors.
+
+  The keys are those of target_index.h, i.e. paths with a trailing slash. The
+  trees are ordered by path, so the watches of a directory and of everything
+  below it form a single subtree that is found with one descent. This is used
+  to drop all watches below a directory that is deleted or moved away.
+
+  This must be included after rbt.h if both are used.
+*/
+
+#include "target_index.h"
+
+#undef RBT_KEY_H_PREFIX_
+#undef RBT_PIN_T
+#undef RBT_KEY_SIZE_T
+#undef RBT_KEY_SIZE_T_FORMAT
+#undef RBT_NODE_H_PREFIX_
+#undef RBT_VALUE_T
+#undef RBT_VALUE_NULL
+#undef RBT_VALUE_IS_EQUAL
+#undef RBT_VALUE_COPY
+#undef RBT_VALUE_FREE
+#undef RBT_VALUE_FPRINT
+#undef RBT_NODE_KEY_INLINE_PINS
+
+#define RBT_KEY_H_PREFIX_ watch_path_
+#define RBT_PIN_T unsigned char
+#define RBT_KEY_SIZE_T unsigned int
+#define RBT_KEY_SIZE_T_FORMAT "%u"
+#include <rbt/key.h>
+
+#define RBT_NODE_H_PREFIX_ RBT_KEY_H_PREFIX_
+#define RBT_VALUE_T int
+#define RBT_VALUE_NULL -1
+#define RBT_VALUE_IS_EQUAL(a, b) ((a) == (b))
+#define RBT_VALUE_COPY(a, b, fail) (a) = (b)
+#define RBT_VALUE_FREE(val)
+#define RBT_VALUE_FPRINT(fd, val) fprintf(fd, "%d", val)
+#define RBT_NODE_KEY_INLINE_PINS 4
+#include <rbt/node.h>
+
+/*!
+  @brief
+  A growable list of watch descriptors.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The watch descriptors.
+  */
+  int * wds;
+
+  /*!
+    @brief
+    The number of watch descriptors.
+  */
+  size_t n;
+
+  /*!
+    @brief
+    The number of allocated watch descriptors.
+  */
+  size_t size;
+}
+watch_list_t;
+
+
+
+/*!
+  @brief
+  Map the path of a directory to its watch descriptor. A previous watch
+  descriptor of the same path is replaced.
+
+  @param
+  index The index.
+
+  @param
+  path The path.
+
+  @param
+  wd The watch descriptor.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+static inline int
+watch_index_add(watch_path_node_t * index, const char * path, int wd)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  watch_path_node_query(
+    index,
+    (unsigned char *) key,
+    l * BITS_PER_BYTE,
+    RBT_QUERY_ACTION_INSERT,
+    wd
+  );
+  return errno ? -1 : 0;
+}
+
+
+
+/*!
+  @brief
+  Get the watch descriptor of a directory.
+
+  @param
+  index The index.
+
+  @param
+  path The path.
+
+  @return
+  The watch descriptor, or -1 if the path is not indexed.
+*/
+static inline int
+watch_index_lookup(watch_path_node_t * index, const char * path)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  return watch_path_node_query(
+    index, (unsigned char *) key, l * BITS_PER_BYTE, RBT_QUERY_ACTION_RETRIEVE, -1
+  );
+}
+
+
+
+/*!
+  @brief
+  Remove the path of a directory if it is mapped to the given watch
+  descriptor. The path may have been taken over by another watch descriptor
+  since, e.g. if the directory was replaced.
+
+  @param
+  index The index.
+
+  @param
+  path The path.
+
+  @param
+  wd The watch descriptor.
+*/
+static inline void
+watch_index_delete(watch_path_node_t * index, const char * path, int wd)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  if (
+    watch_path_node_query(
+      index, (unsigned char *) key, l * BITS_PER_BYTE, RBT_QUERY_ACTION_RETRIEVE, -1
+    ) == wd
+  )
+  {
+    watch_path_node_query(
+      index, (unsigned char *) key, l * BITS_PER_BYTE, RBT_QUERY_ACTION_DELETE, -1
+    );
+  }
+}
+
+
+
+/*!
+  @brief
+  `watch_path_node_traverse()` function to collect watch descriptors.
+
+  The list must be passed as the argument.
+*/
+static inline int
+watch_index_collect(watch_path_node_t * node, unsigned int height, va_list args)
+{
+  watch_list_t * list;
+  int * wds;
+
+  if (node->value == -1)
+  {
+    return 0;
+  }
+  list = va_arg(args, watch_list_t *);
+  if (list->n == list->size)
+  {
+    list->size = list->size ? list->size * 2 : 0x10;
+    wds = realloc(list->wds, list->size * sizeof(int));
+    if (wds == NULL)
+    {
+      return 1;
+    }
+    list->wds = wds;
+  }
+  list->wds[list->n ++] = node->value;
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  `watch_path_with_prefix_subtree_do()` function to collect the watch
+  descriptors of a subtree.
+
+  The list must be passed as the argument.
+*/
+static inline void
+watch_index_collect_subtree(watch_path_node_t * subtree, va_list args)
+{
+  watch_path_node_traverse(subtree, watch_index_collect, va_arg(args, watch_list_t *));
+}
+
+
+
+/*!
+  @brief
+  Get the watch descriptors of a directory and of all directories below it.
+
+  @param
+  index The index.
+
+  @param
+  path The path of the directory.
+
+  @param
+  list The list to which the watch descriptors are appended.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+static inline int
+watch_index_subtree(watch_path_node_t * index, const char * path, watch_list_t * list)
+{
+  char key[TARGET_INDEX_KEY_SIZE];
+  size_t l;
+
+  l = target_index_key(path, key);
+  errno = 0;
+  watch_path_with_prefix_subtree_do(
+    index,
+    (unsigned char *) key,
+    l * BITS_PER_BYTE,
+    watch_index_collect_subtree,
+    list
+  );
+  return errno ? -1 : 0;
+}
+
+#endif //MAOWN_WATCH_INDEX_H
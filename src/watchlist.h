@@ -0,0 +1,71 @@
+#ifndef MAOWN_WATCHLIST_H
+#define MAOWN_WATCHLIST_H
+/*
+  Select the map from watch descriptors to watchlist data.
+
+  Both implementations provide `wd_node_t`, `wd_node_new()`, `wd_node_free()`,
+  `wd_insert()`, `wd_retrieve()`, `wd_retrieve_batch()`, `wd_delete()`,
+  `wd_foreach()` and `wd_memory()`.
+*/
+
+#include "file_parser.h"
+
+/*!
+  @brief
+  A function called by `wd_foreach()` for each watch descriptor.
+
+  @param
+  wd The watch descriptor.
+
+  @param
+  data The watchlist data.
+
+  @param
+  arg The argument passed to `wd_foreach()`.
+
+  @return
+  Non-zero to stop iterating.
+*/
+typedef int (* wd_foreach_function_t)(int wd, watchlist_data_t * data, void * arg);
+
+/*!
+  @brief
+  The memory used by a map, as reported by `wd_memory()`.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The number of watch descriptors.
+  */
+  size_t entries;
+
+  /*!
+    @brief
+    The number of bytes allocated for the map's own structure, i.e. the nodes
+    and key fragments of the tree or the array of the table.
+  */
+  size_t map_bytes;
+
+  /*!
+    @brief
+    The number of bytes allocated for the paths.
+  */
+  size_t path_bytes;
+
+  /*!
+    @brief
+    The greatest number of steps needed to look up a watch descriptor.
+  */
+  size_t max_depth;
+}
+wd_memory_t;
+
+#ifdef WD_TABLE_DENSE
+#include "wd_table.h"
+#else
+#include "rbt.h"
+#endif //WD_TABLE_DENSE
+
+#endif //MAOWN_WATCHLIST_H
@@ -0,0 +1,309 @@
+#ifndef MAOWN_WD_TABLE_H
+#define MAOWN_WD_TABLE_H
+/*
+  A dense table mapping watch descriptors to watchlist data.
+
+  This provides the same interface as the rabbit tree set up in rbt.h. The
+  kernel hands out watch descriptors as small, increasing integers, so they can
+  index an array directly instead of walking trie nodes. Descriptors are not
+  reused until they wrap around, so the table grows with the highest descriptor
+  that has been seen rather than with the number of live watches. It is only
+  rebuilt when the watches are rebuilt after a queue overflow. Long-running
+  instances with heavy directory churn should keep the rabbit tree.
+
+  Select it at build time with `WD_TABLE_DENSE`.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_parser.h"
+
+/*!
+  @brief
+  The minimum number of entries allocated by the table.
+*/
+#define WD_TABLE_MIN_SIZE 0x400
+
+static watchlist_data_t wd_empty_value = {.target = NULL, .path = NULL, .dev = 0};
+
+/*!
+  @brief
+  The table. The name matches the rabbit tree type for interchangeability.
+*/
+typedef
+struct
+{
+  /*!
+    @brief
+    The entries, indexed by watch descriptor. Unused entries have a NULL
+    target.
+  */
+  watchlist_data_t * values;
+
+  /*!
+    @brief
+    The number of allocated entries.
+  */
+  size_t size;
+}
+wd_node_t;
+
+
+
+/*!
+  @brief
+  Create an empty table.
+
+  @return
+  The table, or NULL on error (check errno).
+*/
+static inline wd_node_t *
+wd_node_new(void)
+{
+  return calloc(1, sizeof(wd_node_t));
+}
+
+
+
+/*!
+  @brief
+  Free a table along with all of its values.
+
+  @param
+  table The table.
+*/
+static inline void
+wd_node_free(wd_node_t * table)
+{
+  size_t i;
+  for (i=0; i<table->size; i++)
+  {
+    path_entry_unref(table->values[i].path);
+  }
+  free(table->values);
+  free(table);
+}
+
+
+
+/*!
+  @brief
+  Grow the table to hold a given watch descriptor.
+
+  @param
+  table The table.
+
+  @param
+  wd The watch descriptor.
+
+  @return
+  0 on success, -1 on error (check errno).
+*/
+static inline int
+wd_table_reserve(wd_node_t * table, int wd)
+{
+  size_t size;
+  watchlist_data_t * values;
+
+  size = table->size ? table->size : WD_TABLE_MIN_SIZE;
+  while (size <= (size_t) wd)
+  {
+    size *= 2;
+  }
+  values = realloc(table->values, size * sizeof(watchlist_data_t));
+  if (values == NULL)
+  {
+    return -1;
+  }
+  memset(values + table->size, 0, (size - table->size) * sizeof(watchlist_data_t));
+  table->values = values;
+  table->size = size;
+  return 0;
+}
+
+
+
+/*!
+  @brief
+  Delete a watch descriptor.
+
+  @param
+  table The table.
+
+  @param
+  wd The watch descriptor.
+
+  @return
+  The empty value.
+*/
+static inline watchlist_data_t
+wd_delete(wd_node_t * table, int wd)
+{
+  if (wd >= 0 && (size_t) wd < table->size)
+  {
+    path_entry_unref(table->values[wd].path);
+    table->values[wd] = wd_empty_value;
+  }
+  return wd_empty_value;
+}
+
+
+
+/*!
+  @brief
+  Insert or replace the value of a watch descriptor. The table takes a
+  reference to the path entry.
+
+  @param
+  table The table.
+
+  @param
+  wd The watch descriptor.
+
+  @param
+  value The value. Inserting the empty value deletes the descriptor.
+
+  @return
+  The value, or the empty value on error (check errno).
+*/
+static inline watchlist_data_t
+wd_insert(wd_node_t * table, int wd, watchlist_data_t value)
+{
+  if (value.target == NULL)
+  {
+    return wd_delete(table, wd);
+  }
+  if (wd < 0)
+  {
+    errno = EINVAL;
+    return wd_empty_value;
+  }
+  if ((size_t) wd >= table->size && wd_table_reserve(table, wd))
+  {
+    return wd_empty_value;
+  }
+  path_entry_ref(value.path);
+  path_entry_unref(table->values[wd].path);
+  table->values[wd] = value;
+  return value;
+}
+
+
+
+/*!
+  @brief
+  Retrieve the value of a watch descriptor.
+
+  @param
+  table The table.
+
+  @param
+  wd The watch descriptor.
+
+  @return
+  The value, or the empty value if the descriptor is not in the table. The path
+  belongs to the table.
+*/
+static inline watchlist_data_t
+wd_retrieve(wd_node_t * table, int wd)
+{
+  if (wd >= 0 && (size_t) wd < table->size)
+  {
+    return table->values[wd];
+  }
+  return wd_empty_value;
+}
+
+
+
+/*!
+  @brief
+  Retrieve the values of several watch descriptors.
+
+  @param
+  table The table.
+
+  @param
+  wds The watch descriptors.
+
+  @param
+  values The output array for the values, as returned by `wd_retrieve()`.
+
+  @param
+  n The number of watch descriptors.
+*/
+static inline void
+wd_retrieve_batch(wd_node_t * table, int * wds, watchlist_data_t * values, size_t n)
+{
+  size_t i;
+  for (i=0; i<n; i++)
+  {
+    values[i] = wd_retrieve(table, wds[i]);
+  }
+}
+
+
+
+/*!
+  @brief
+  Pass each watch descriptor and its value to a function.
+
+  @param
+  table The table.
+
+  @param
+  func The function. Iteration stops if it returns non-zero.
+
+  @param
+  arg An argument to pass to the function.
+*/
+static inline void
+wd_foreach(wd_node_t * table, wd_foreach_function_t func, void * arg)
+{
+  size_t i;
+  for (i=0; i<table->size; i++)
+  {
+    if (table->values[i].target != NULL && func(i, &table->values[i], arg))
+    {
+      break;
+    }
+  }
+}
+
+
+
+/*!
+  @brief
+  Get the memory used by the table.
+
+  @param
+  table The table.
+
+  @param
+  memory The output memory statistics.
+*/
+static inline void
+wd_memory(wd_node_t * table, wd_memory_t * memory)
+{
+  size_t i;
+
+  memory->entries = 0;
+  memory->map_bytes = sizeof(wd_node_t) + table->size * sizeof(watchlist_data_t);
+  memory->path_bytes = 0;
+  memory->max_depth = 0;
+  for (i=0; i<table->size; i++)
+  {
+    if (table->values[i].target != NULL)
+    {
+      memory->entries ++;
+      if (table->values[i].path != NULL)
+      {
+        memory->path_bytes += path_entry_bytes(table->values[i].path);
+      }
+    }
+  }
+}
+
+#endif //MAOWN_WD_TABLE_H